@@ -0,0 +1,183 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * admission.c - Chain edit admission control
+ *
+ * Predicts how many cycles per sample the chain will take from each filter's
+ * cost model (see Filter_t::nCost) and checks edits from the UI against a
+ * percentage of the sample period before they're published.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "dbg.h"
+#include "fixed.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "filters.h"
+#include "profile.h"
+#include "packets.h"
+#include "admission.h"
+
+
+// What to do with over budget edits (AdmissionMode_e)
+uint8_t g_iAdmissionMode = ADMISSION_MODE_REFUSE;
+
+// Percentage of the sample period the chain is allowed to use
+uint8_t g_nAdmissionBudgetPerc = ADMISSION_BUDGET_PERC;
+
+const char *g_ppszAdmissionModes[ADMISSION_MODE_COUNT] =
+{
+	"off",
+	"warn",
+	"refuse",
+};
+
+
+/*
+ * admission_branch_cost
+ *
+ * Predicts cycles per sample spent running an enabled branch from the compiled
+ * plan, including mixing it (see op_init in chainplan.c).
+ */
+uint32_t admission_branch_cost(const ChainStageHeader_t *pStageHdr, const StageBranch_t *pBranch)
+{
+	uint32_t ulCost = PLAN_COST_OP + filter_cost(pBranch->pFilter, pBranch->pUnknown);
+
+	// Only single branch stages honour BRANCHFLAG_FULL_MIX
+	if(pStageHdr->nBranches == 1 && (pBranch->flags & BRANCHFLAG_FULL_MIX))
+		return ulCost;
+
+#ifdef FLOAT_DSP
+	if(pBranch->flMixPerc != 1.0f)
+#else
+	if(qgain_from_float(pBranch->flMixPerc) != Q15_ONE)
+#endif
+		ulCost += PLAN_COST_MIX;
+
+	return ulCost;
+}
+
+
+/*
+ * admission_chain_cost
+ *
+ * Predicts cycles per sample spent in the sampling path with the chain as it
+ * currently is in `pContext` (which may not have been compiled yet).
+ */
+uint32_t admission_chain_cost(const AudioContext_t *pContext)
+{
+	// Sample input/output doesn't depend on the chain, so use the real figure
+	// once there is one
+	ProfileSummary_t tick;
+	profile_summarise(&g_ProfileTick, &tick);
+
+	uint32_t ulCost = (tick.nAvg ? tick.nAvg : ADMISSION_COST_SAMPLE_IO) + ADMISSION_COST_CHAIN_IO;
+
+	for(const ChainStageHeader_t *pStageHdr = pContext->pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext)
+	{
+		for(const StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext)
+		{
+			if(pBranch->flags & BRANCHFLAG_ENABLED)
+				ulCost += admission_branch_cost(pStageHdr, pBranch);
+		}
+	}
+
+	return ulCost;
+}
+
+
+/*
+ * admission_budget
+ *
+ * @returns cycles per sample the sampling path is allowed to take
+ */
+uint32_t admission_budget(void)
+{
+	return g_ulPeriodCycles * g_nAdmissionBudgetPerc / 100;
+}
+
+
+/*
+ * admission_check
+ *
+ * Checks a chain edit that has been made to the chain of `pContext`, but not
+ * yet compiled, against the budget and reports the result to the UI.
+ * `ulPreviousCost` is admission_chain_cost from before the edit: edits that
+ * don't add cycles are always allowed, so an over budget chain can still be
+ * trimmed. The result is sent even in ADMISSION_MODE_OFF, as the UI waits for
+ * it to settle parameter changes.
+ *
+ * @returns ADMISSION_REFUSED if the caller must undo the edit
+ */
+AdmissionResult_e admission_check(const AudioContext_t *pContext, uint8_t type, uint8_t nStage, uint8_t nBranch, uint32_t ulPreviousCost)
+{
+	uint32_t ulCost = admission_chain_cost(pContext);
+	const uint32_t ulBudget = admission_budget();
+
+	AdmissionResult_e result = ADMISSION_OK;
+
+	if(g_iAdmissionMode != ADMISSION_MODE_OFF && ulCost > ulBudget && ulCost > ulPreviousCost)
+	{
+		if(g_iAdmissionMode == ADMISSION_MODE_REFUSE)
+		{
+			result = ADMISSION_REFUSED;
+			dbg_warning("refused edit to branch %u:%u, predicted %lu cycles/sample (budget %lu)\r\n", nStage, nBranch, ulCost, ulBudget);
+		}
+		else
+		{
+			result = ADMISSION_WARNED;
+			dbg_warning("branch %u:%u over budget, predicted %lu cycles/sample (budget %lu)\r\n", nStage, nBranch, ulCost, ulBudget);
+		}
+	}
+
+	// Report what the chain will cost after undoing a refused edit
+	if(result == ADMISSION_REFUSED)
+		ulCost = ulPreviousCost;
+
+	packet_admission_send(type, nStage, nBranch, result, ulCost, ulBudget);
+	return result;
+}
+
+
+/*
+ * admission_debug
+ *
+ * Prints the predicted cost of each enabled branch of `pContext`, and compares
+ * the predicted cost of the chain with what has been measured.
+ */
+void admission_debug(const AudioContext_t *pContext)
+{
+	ProfileSummary_t tick, chain;
+	profile_summarise(&g_ProfileTick, &tick);
+	profile_summarise(&g_ProfileChain, &chain);
+
+	const uint32_t ulCost = admission_chain_cost(pContext);
+	const uint32_t ulBudget = admission_budget();
+
+	dbg_printf(" === admission_debug ===\r\n");
+	dbg_printf("mode: %s, budget: %u%% (%lu cycles/sample)\r\n", g_ppszAdmissionModes[g_iAdmissionMode], g_nAdmissionBudgetPerc, ulBudget);
+	dbg_printf("predicted: %lu cycles/sample (%lu%%)\r\n", ulCost, ulCost * 100 / g_ulPeriodCycles);
+
+	if(chain.nAvg)
+		dbg_printf("measured:  %u cycles/sample avg, %u peak\r\n", tick.nAvg + chain.nAvg, tick.nMax + chain.nMax);
+
+	uint8_t nStage = 0;
+	for(const ChainStageHeader_t *pStageHdr = pContext->pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext, nStage++)
+	{
+		uint8_t nBranch = 0;
+		for(const StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext, nBranch++)
+		{
+			if(pBranch->flags & BRANCHFLAG_ENABLED)
+				dbg_printf("  - branch %u:%u (%s): %lu cycles/sample\r\n", nStage, nBranch, pBranch->pFilter->pszName, admission_branch_cost(pStageHdr, pBranch));
+		}
+	}
+
+	dbg_printf("\r\n");
+}
@@ -0,0 +1,68 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * admission.c - Chain edit admission control
+ *
+ * Predicts how many cycles per sample the chain will take from each filter's
+ * cost model (see Filter_t::nCost) and checks edits from the UI against a
+ * percentage of the sample period before they're published. Over budget edits
+ * are warned about or refused, and the result is reported with B2U_ADMISSION.
+ */
+
+#ifndef _ADMISSION_H_
+#define _ADMISSION_H_
+
+#include <stdint.h>
+#include "chain.h"
+
+
+// Cycles per sample spent outside the filters
+#define ADMISSION_COST_SAMPLE_IO	200	///< audio_tick, used until it has been measured
+#define ADMISSION_COST_CHAIN_IO		80	///< chain_process history, volume, clip detection
+
+
+/*
+ * AdmissionMode_e
+ *
+ * What to do with edits predicted to go over budget.
+ */
+typedef enum
+{
+	ADMISSION_MODE_OFF = 0,	///< don't check edits, report them all as ADMISSION_OK
+	ADMISSION_MODE_WARN,	///< apply the edit, but warn the UI
+	ADMISSION_MODE_REFUSE,	///< undo the edit
+
+	ADMISSION_MODE_COUNT
+} AdmissionMode_e;
+
+
+/*
+ * AdmissionResult_e
+ *
+ * Result of checking an edit, sent in AdmissionPacket_t::result.
+ */
+typedef enum
+{
+	ADMISSION_OK = 0,		///< edit fits in the budget
+	ADMISSION_WARNED,		///< edit is over budget but was applied
+	ADMISSION_REFUSED,		///< edit is over budget and was undone
+} AdmissionResult_e;
+
+
+extern uint8_t g_iAdmissionMode;
+extern uint8_t g_nAdmissionBudgetPerc;
+extern const char *g_ppszAdmissionModes[ADMISSION_MODE_COUNT];
+
+
+uint32_t admission_branch_cost(const ChainStageHeader_t *pStageHdr, const StageBranch_t *pBranch);
+uint32_t admission_chain_cost(const AudioContext_t *pContext);
+uint32_t admission_budget(void);
+AdmissionResult_e admission_check(const AudioContext_t *pContext, uint8_t type, uint8_t nStage, uint8_t nBranch, uint32_t ulPreviousCost);
+void admission_debug(const AudioContext_t *pContext);
+
+#endif
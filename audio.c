@@ -0,0 +1,278 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	TB & SR
+ *	File debugged by:	TB & SR
+ *
+ * audio.c - Sampling path
+ *
+ * Reads input samples, runs them through the compiled filter chain of
+ * g_AudioContext and writes them out, through the HAL (see hal.h), so the same
+ * code runs on the board and on the host.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal.h"
+#include "dbg.h"
+#include "config.h"
+#include "fixed.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "profile.h"
+#include "governor.h"
+#include "pool.h"
+#include "lfo.h"
+#include "envelope.h"
+#include "samples.h"
+#include "context.h"
+#include "packets.h"
+#include "audio.h"
+
+
+// The audio stream from the ADC to the DAC
+AudioContext_t g_AudioContext;
+
+// Is the * key held down on the keypad?
+volatile bool g_bPassThru = false;
+
+// Sample multiplier (i.e., volume)
+volatile float g_flChainVolume = 1.0;
+volatile qgain_t g_qChainVolume = Q15_ONE;
+
+// Last tick where the filter chain took longer than 1msec to process
+volatile uint32_t g_ulLastLongTick = 0;
+
+#if BLOCK_SAMPLES > 1
+// Double buffered sample blocks. audio_tick plays back and refills
+// s_ppBlocks[s_iIOBlock] while audio_block_process filters the other block.
+static int16_t s_ppBlocks[2][BLOCK_SAMPLES];
+static volatile uint8_t s_iIOBlock = 0;
+static volatile uint16_t s_iIOSample = 0;
+static volatile bool s_bBlockPending = false;
+#endif
+
+#ifdef INDIVIDUAL_BUILD_TOM
+volatile uint32_t iAnalogAverage = 0;
+volatile bool bDoSendAverage = false;
+volatile uint16_t iNumMeasurements = 0;
+volatile uint16_t iPreviousAverage = 1;
+#endif
+
+
+/*
+ * chain_process
+ *
+ * Passes a block of input samples through g_AudioContext (see
+ * context_process) and converts them to DAC values (in place).
+ *
+ * Also sets pass thru, clip and slow LEDs.
+ *
+ * @returns cycles spent, excluding any audio_tick preempting it
+ */
+static uint32_t chain_process(int16_t *pSamples, uint16_t nSamples)
+{
+	static uint32_t s_ulLastClipTick = 0;
+
+	uint32_t ulStartCycles = PROFILE_CYCLES();
+	uint32_t ulStartTickCycles = g_ulTickCycles;
+
+	// Is the * key held down? Just passthru.
+	const bool bPassThru = g_bPassThru;
+	hal_led_set(LED_PASS_THRU, bPassThru);
+
+	context_process(&g_AudioContext, pSamples, nSamples, bPassThru);
+
+	bool bClipped = false;
+
+	for(uint16_t i = 0; i < nSamples; ++i)
+	{
+		// Output to DAC
+#ifdef FLOAT_DSP
+		int16_t iScaledOut = pSamples[i] * g_flChainVolume;
+#else
+		int16_t iScaledOut = sat_sample(q15_mul(pSamples[i], g_qChainVolume));
+#endif
+		iScaledOut += ADC_MID_POINT;
+
+		// Shouldn't *really* be less than 0 (unless DC bias in hardware is wrong)
+		// ...clamp to 0 anyway so we don't shift the sign bit
+		if(iScaledOut < 0)
+			iScaledOut = 0;
+		else
+			iScaledOut = iScaledOut >> 2;
+
+		if(iScaledOut == DAC_MAX_VALUE || iScaledOut == 0)
+			bClipped = true;
+
+		pSamples[i] = iScaledOut;
+	}
+
+	uint32_t ulElapsedCycles = PROFILE_CYCLES() - ulStartCycles;
+	uint32_t ulCycles = ulElapsedCycles - (g_ulTickCycles - ulStartTickCycles);
+	profile_stat_add(&g_ProfileChain, ulCycles / nSamples);
+
+	uint32_t ulEndTick = hal_tickcount();
+
+	// Is output clipped? If so, enable the clip LED
+	if(bClipped)
+	{
+		s_ulLastClipTick = ulEndTick;
+		hal_led_set(LED_CLIP, true);
+	}
+
+	// If we haven't clipped in 100 ticks, turn off the clip LED
+	else if(s_ulLastClipTick + 100 < ulEndTick)
+		hal_led_set(LED_CLIP, false);
+
+	// If we took longer than the samples last for, let the overload governor
+	// know (it warns and sheds branches from the main loop)
+	const bool bMissed = ulElapsedCycles >= nSamples * g_ulPeriodCycles;
+	governor_deadline(bMissed, ulElapsedCycles / nSamples);
+
+	if(bMissed)
+	{
+		g_ulLastLongTick = ulEndTick;
+		hal_led_set(LED_SLOW, true);
+	}
+
+	// If we haven't had been slow in 100 ticks, turn off the slow LED
+	else if(g_ulLastLongTick + 100 < ulEndTick)
+		hal_led_set(LED_SLOW, false);
+
+	return ulCycles;
+}
+
+
+/*
+ * audio_init
+ *
+ * Sets up the DSP core and g_AudioContext with an empty filter chain. Call
+ * before starting the sampling timer.
+ */
+void audio_init(void)
+{
+#if BLOCK_SAMPLES > 1
+	// The first two blocks are played back before anything has been filtered
+	// into them, so start them at the DAC's mid-point rather than full scale low
+	for(uint16_t i = 0; i < BLOCK_SAMPLES; ++i)
+		s_ppBlocks[0][i] = s_ppBlocks[1][i] = (DAC_MAX_VALUE + 1) / 2;
+#endif
+
+	// Generate an empty filter chain
+	pool_check_filters();
+	lfo_init();
+	envelope_init();
+
+	if(!context_init(&g_AudioContext))
+		dbg_error("unable to allocate chain root or plan");
+}
+
+
+/*
+ * audio_block_process
+ *
+ * Filters the block audio_tick isn't using. Runs at the lowest priority
+ * whenever audio_tick pends it (see hal_block_pend), so only one block is
+ * ever being filtered.
+ */
+void audio_block_process(void)
+{
+#if BLOCK_SAMPLES > 1
+	chain_process(s_ppBlocks[s_iIOBlock ^ 1], BLOCK_SAMPLES);
+	s_bBlockPending = false;
+#endif
+}
+
+
+/*
+ * audio_tick
+ *
+ * Called SAMPLE_RATE times per second by the sampling timer (see
+ * hal_sample_timer_start)
+ *
+ * Reads input from ADC and writes output to the DAC. If BLOCK_SAMPLES > 1 the
+ * samples are buffered and filtered a block at a time in audio_block_process,
+ * otherwise each sample is filtered here.
+ */
+void audio_tick(void)
+{
+	uint32_t ulStartCycles = PROFILE_CYCLES();
+	uint32_t ulChainCycles = 0;
+
+#if BLOCK_SAMPLES > 1
+	int16_t *pBlock = s_ppBlocks[s_iIOBlock];
+
+	// Output the processed sample before anything else so the output doesn't
+	// jitter, then replace it with the new input sample
+	hal_dac_write(pBlock[s_iIOSample]);
+
+	// Subtract ADC_MID_POINT so we are working with 0 as the mid-point
+	pBlock[s_iIOSample] = hal_adc_read() - ADC_MID_POINT;
+
+	// Have we filled the block? Swap blocks and filter the full one
+	if(++s_iIOSample == BLOCK_SAMPLES)
+	{
+		// If the last block still hasn't been filtered, we are about to play
+		// it back half-processed
+		if(s_bBlockPending)
+		{
+			g_ulLastLongTick = hal_tickcount();
+			hal_led_set(LED_SLOW, true);
+		}
+
+		s_iIOSample = 0;
+		s_iIOBlock ^= 1;
+		s_bBlockPending = true;
+
+		hal_block_pend();
+	}
+#else
+	// Subtract ADC_MID_POINT so we are working with 0 as the mid-point
+	int16_t iSample = hal_adc_read() - ADC_MID_POINT;
+
+	ulChainCycles = chain_process(&iSample, 1);
+	hal_dac_write(iSample);
+#endif
+
+#ifdef INDIVIDUAL_BUILD_TOM
+	/*
+	 *	Takes the value of an analog in pin connected via a variable
+	 *	resistor to the 3V3 output of the board.
+	 *	Takes a number of measurements, and then averages them out.
+	 *	If the average is significantly different from the average
+	 *	previously calculated, a serial packet is sent to the board
+	 *	with the new value.
+	 *	If not, the values are reset.
+	 */
+	if(iNumMeasurements == SAMPLE_RATE/5)
+	{
+		uint16_t average = (uint16_t)(iAnalogAverage/iNumMeasurements);
+		if(average < 100)
+			average = 0;
+		// If significantly different
+		if(average - iPreviousAverage > 50 || iPreviousAverage - average > 50)
+		{
+			// Send across the new average to the UI
+			packet_analog_control_send(average);
+			iPreviousAverage = average;
+		}
+		iAnalogAverage = 0;
+		iNumMeasurements = 0;
+	}
+	else
+	{
+		// Get the analog data from ADC channel 1
+		iAnalogAverage += hal_adc_read_channel(1);
+		iNumMeasurements++;
+	}
+#endif
+
+	// Profile sample input/output (the chain is profiled separately)
+	uint32_t ulCycles = PROFILE_CYCLES() - ulStartCycles;
+	g_ulTickCycles += ulCycles;
+	profile_stat_add(&g_ProfileTick, ulCycles - ulChainCycles);
+}
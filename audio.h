@@ -0,0 +1,33 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * audio.c - Sampling path
+ *
+ * Reads input samples, runs them through the compiled filter chain and writes
+ * them out, through the HAL (see hal.h), so the same code runs on the board
+ * and on the host.
+ */
+
+#ifndef _AUDIO_H_
+#define _AUDIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "context.h"
+
+
+extern AudioContext_t g_AudioContext;		///< the stream from the ADC to the DAC
+extern volatile bool g_bPassThru;			///< is the * key held down on the keypad?
+extern volatile uint32_t g_ulLastLongTick;	///< last tick the filter chain missed its deadline
+
+
+void audio_init(void);
+void audio_tick(void);
+void audio_block_process(void);
+
+#endif
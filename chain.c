@@ -12,30 +12,28 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
+#include "config.h"
 #include "dbg.h"
 #include "chain.h"
+#include "chainplan.h"
+#include "pool.h"
 #include "samples.h"
-
-
-// Root stage in the filter chain linked list
-ChainStageHeader_t *g_pChainRoot = NULL;
+#include "context.h"
 
 
 /*
  * stage_alloc
  *
- * Allocates a chain stage header.
+ * Allocates a chain stage header from g_StagePool.
  *
- * @returns pointer to the header for this chain stage
+ * @returns pointer to the header for this chain stage, or NULL if the pool is
+ * full
  */
 ChainStageHeader_t *stage_alloc(void)
 {
-	// Allocate chain stage header
-	ChainStageHeader_t *pHdr = (ChainStageHeader_t *)calloc(1, sizeof(ChainStageHeader_t));
-	dbg_assert(pHdr, "unable to allocate chain stage");
-
-	return pHdr;
+	return (ChainStageHeader_t *)pool_alloc(&g_StagePool);
 }
 
 
@@ -59,71 +57,26 @@ void stage_free(ChainStageHeader_t *pStageHdr)
 	}
 
 	// Free the entire stage
-	free(pStageHdr);
+	pool_free(&g_StagePool, pStageHdr);
+}
+
+
+// RetireCallback_t for stage_retire
+static void stage_free_unknown(void *pUnknown)
+{
+	stage_free((ChainStageHeader_t *)pUnknown);
 }
 
 
 /*
- * stage_apply
- *
- * Applies each branch in a chain stage to a sample `iSample`.
+ * stage_retire
  *
- * Note `iSample` should be a 12-bit signed sample i.e., in the range))
- *
- * @returns filtered 12-bit sample
+ * Deallocates a stage that has been unlinked from the chain of `pContext` once
+ * the sampling interrupt is no longer using it (see chainplan_retire).
  */
-int16_t stage_apply(const ChainStageHeader_t *pStageHdr, int16_t iSample)
+void stage_retire(AudioContext_t *pContext, ChainStageHeader_t *pStageHdr)
 {
-	dbg_assert(pStageHdr->nBranches > 0, "stage has no branches");
-
-	const StageBranch_t *pBranch = pStageHdr->pFirst;
-	dbg_assert(pBranch, "stage has no branches (NULL pFirst)");
-
-	int16_t iResult = 0;
-
-	// Is this a simple one stage branch?
-	if(pStageHdr->nBranches == 1)
-	{
-		// Is this branch enabled?
-		if(!(pBranch->flags & BRANCHFLAG_ENABLED))
-			return iSample;
-
-		// If we are using BRANCHFLAG_FULL_MIX, skip the floating point
-		// multiplication to save some clock cycles
-		if(pBranch->flags & BRANCHFLAG_FULL_MIX)
-			iResult = pBranch->pFilter->pfnApply(iSample, pBranch->pUnknown);
-		else
-			iResult =  pBranch->pFilter->pfnApply(iSample, pBranch->pUnknown) * pBranch->flMixPerc;
-
-		return iResult;
-	}
-
-	// Does this stage have multiple parallel branches that must be mixed?
-	else
-	{
-		bool bAnyEnabled = false;
-
-		while(pBranch)
-		{
-			// Is this branch enabled?
-			if(!(pBranch->flags & BRANCHFLAG_ENABLED))
-			{
-				pBranch = pBranch->pNext;
-				continue;
-			}
-
-			// Add the result of this filter to the total for this stage
-			bAnyEnabled = true;
-			iResult += pBranch->pFilter->pfnApply(iSample, pBranch->pUnknown) * pBranch->flMixPerc;
-
-			pBranch = pBranch->pNext;
-		}
-
-		if(!bAnyEnabled)
-			return iSample;
-
-		return iResult;
-	}
+	chainplan_retire(pContext, stage_free_unknown, pStageHdr);
 }
 
 
@@ -197,17 +150,20 @@ StageBranch_t *stage_get_branch(const ChainStageHeader_t *pStageHdr, uint8_t nBr
 /*
  * branch_alloc
  *
- * Allocates a stage branch.
+ * Allocates a stage branch and its filter data from g_BranchPool and
+ * g_FilterDataPool.
  *
- * @returns pointer to the header for this chain stage
+ * @returns pointer to the header for this chain stage, or NULL if a pool is
+ * full
  */
  StageBranch_t *branch_alloc(Filter_e iFilterType, uint8_t flags, float flMixPerc, void **ppUnknown)
 {
 	dbg_assert(iFilterType < NUM_FILTERS, "invalid filter type");
 
 	// Allocate branch
-	StageBranch_t *pBranch = (StageBranch_t *)calloc(1, sizeof(StageBranch_t));
-	dbg_assert(pBranch, "unable to allocate branch");
+	StageBranch_t *pBranch = (StageBranch_t *)pool_alloc(&g_BranchPool);
+	if(!pBranch)
+		return NULL;
 
 	// Initialise the branch
 	pBranch->pFilter = &g_pFilters[iFilterType];
@@ -215,8 +171,12 @@ StageBranch_t *stage_get_branch(const ChainStageHeader_t *pStageHdr, uint8_t nBr
 	pBranch->flMixPerc = flMixPerc;
 
 	// Allocate filter data
-	pBranch->pUnknown = calloc(1, pBranch->pFilter->nFilterDataSize);
-	dbg_assert(pBranch->pUnknown, "unable to allocate data for filter %s", pBranch->pFilter->pszName);
+	pBranch->pUnknown = pool_alloc(&g_FilterDataPool);
+	if(!pBranch->pUnknown)
+	{
+		pool_free(&g_BranchPool, pBranch);
+		return NULL;
+	}
 
 	if(ppUnknown)
 		*ppUnknown = pBranch->pUnknown;
@@ -234,52 +194,79 @@ void branch_free(StageBranch_t *pBranch)
 {
 	dbg_assert(pBranch, "cannot free NULL branch");
 
-	// Free the filter data associated with this branch
-	free(pBranch->pUnknown);
+	// Free memory owned by the filter data, then the filter data itself
+	if(pBranch->pFilter->pfnFreeCallback)
+		pBranch->pFilter->pfnFreeCallback(pBranch->pUnknown);
+
+	pool_free(&g_FilterDataPool, pBranch->pUnknown);
 
 	// Free the branch
-	free(pBranch);
+	pool_free(&g_BranchPool, pBranch);
+}
+
+
+// RetireCallback_t for branch_retire
+static void branch_free_unknown(void *pUnknown)
+{
+	branch_free((StageBranch_t *)pUnknown);
 }
 
 
 /*
- * chain_apply
+ * branch_retire
  *
- * Applies each stage in an entire filter chain.
+ * Deallocates a branch that has been unlinked from the chain of `pContext`
+ * once the sampling interrupt is no longer using it (see chainplan_retire).
+ */
+void branch_retire(AudioContext_t *pContext, StageBranch_t *pBranch)
+{
+	chainplan_retire(pContext, branch_free_unknown, pBranch);
+}
+
+
+/*
+ * branch_clone
  *
- * Note `iSample` should be a 12-bit sample from the ADC.
+ * Allocates a copy of a branch and its filter data, so the copy can be
+ * modified while the sampling interrupt is still using the original.
  *
- * @returns filtered 12-bit sample
+ * Memory owned by the filter data is shared until the filter's mod callback
+ * replaces it (see Filter_t::pfnModCallback).
+ *
+ * @returns pointer to the new branch, or NULL if a pool is full
  */
-int16_t chain_apply(int16_t iSample)
+StageBranch_t *branch_clone(const StageBranch_t *pBranch)
 {
-	const ChainStageHeader_t *pStageHdr = g_pChainRoot;
+	StageBranch_t *pClone = (StageBranch_t *)pool_alloc(&g_BranchPool);
+	if(!pClone)
+		return NULL;
 
-	// Iterate through the chain
-	while(pStageHdr)
-	{
-		// If this stage isn't empty, apply all filters to the sample
-		if(pStageHdr->nBranches > 0)
-			iSample = stage_apply(pStageHdr, iSample);
+	memcpy(pClone, pBranch, sizeof(StageBranch_t));
 
-		pStageHdr = pStageHdr->pNext;
+	pClone->pUnknown = pool_alloc(&g_FilterDataPool);
+	if(!pClone->pUnknown)
+	{
+		pool_free(&g_BranchPool, pClone);
+		return NULL;
 	}
 
-	return iSample;
+	memcpy(pClone->pUnknown, pBranch->pUnknown, pBranch->pFilter->nFilterDataSize);
+
+	return pClone;
 }
 
 
 /*
  * chain_debug
  *
- * Prints debug information for each stage in an entire chain.
+ * Prints debug information for each stage in the entire chain of `pContext`.
  */
-void chain_debug(void)
+void chain_debug(const AudioContext_t *pContext)
 {
-	dbg_printf(" === chain_debug(%p) ===\r\n", (void *)g_pChainRoot);
+	dbg_printf(" === chain_debug(%p) ===\r\n", (void *)pContext->pChainRoot);
 
-	uint i = 0;
-	const ChainStageHeader_t *pStageHdr = g_pChainRoot;
+	uint8_t i = 0;
+	const ChainStageHeader_t *pStageHdr = pContext->pChainRoot;
 
 	// Iterate through the chain
 	while(pStageHdr)
@@ -298,12 +285,12 @@ void chain_debug(void)
 /*
  * chain_get_stage
  *
- * @returns stage of index `nStage` of chain
+ * @returns stage of index `nStage` of the chain of `pContext`
  */
-ChainStageHeader_t *chain_get_stage(uint8_t nStage)
+ChainStageHeader_t *chain_get_stage(const AudioContext_t *pContext, uint8_t nStage)
 {
 	uint8_t i = 0;
-	const ChainStageHeader_t *pStageHdr = g_pChainRoot;
+	const ChainStageHeader_t *pStageHdr = pContext->pChainRoot;
 
 	while(pStageHdr && i < nStage)
 	{
@@ -324,12 +311,10 @@ ChainStageHeader_t *chain_get_stage(uint8_t nStage)
 /*
  * chain_free
  *
- * Deallocates entire chain
+ * Deallocates an entire chain starting at `pStageHdr`
  */
-void chain_free(void)
+void chain_free(ChainStageHeader_t *pStageHdr)
 {
-	ChainStageHeader_t *pStageHdr = g_pChainRoot;
-
 	// Iterate all stages in the chain
 	while(pStageHdr)
 	{
@@ -340,3 +325,22 @@ void chain_free(void)
 		pStageHdr = pNextStage;
 	}
 }
+
+
+// RetireCallback_t for chain_retire
+static void chain_free_unknown(void *pUnknown)
+{
+	chain_free((ChainStageHeader_t *)pUnknown);
+}
+
+
+/*
+ * chain_retire
+ *
+ * Deallocates an entire chain that has been replaced in `pContext` once the
+ * sampling interrupt is no longer using it (see chainplan_retire).
+ */
+void chain_retire(AudioContext_t *pContext, ChainStageHeader_t *pStageHdr)
+{
+	chainplan_retire(pContext, chain_free_unknown, pStageHdr);
+}
@@ -17,6 +17,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "filters.h"
+#include "fixed.h"
+#include "context.h"
 
 
 /*
@@ -30,7 +32,7 @@ typedef enum
 	BRANCHFLAG_NONE = 0,
 	BRANCHFLAG_ENABLED = (1<<0),
 	BRANCHFLAG_FULL_MIX = (1<<1),	///< ignore flMixPerc, implied 1.0 -- only valid on single branch stages
-	//STAGEFLAG_UNUSED2 = (1<<2),
+	BRANCHFLAG_SHED = (1<<2),		///< bypassed by the overload governor until there is headroom (see governor.h) -- not saved
 	//STAGEFLAG_UNUSED3 = (1<<3),
 	//STAGEFLAG_UNUSED4 = (1<<4),
 	//STAGEFLAG_UNUSED5 = (1<<5),
@@ -73,26 +75,38 @@ typedef struct ChainStageHeader_t
 #pragma pack(pop)
 
 
-extern ChainStageHeader_t *g_pChainRoot;
-extern volatile bool g_bChainLock;		///< is chain locked for modification?
+/*
+ * branch_is_active
+ *
+ * @returns true if the branch is enabled and hasn't been shed by the overload
+ * governor
+ */
+static inline bool branch_is_active(const StageBranch_t *pBranch)
+{
+	return (pBranch->flags & (BRANCHFLAG_ENABLED | BRANCHFLAG_SHED)) == BRANCHFLAG_ENABLED;
+}
+
+
 extern volatile float g_flChainVolume;	///< current chain volume
+extern volatile qgain_t g_qChainVolume;	///< g_flChainVolume in Q15
 
 
 ChainStageHeader_t *stage_alloc();
 void stage_free(ChainStageHeader_t *pStageHdr);
-int16_t stage_apply(const ChainStageHeader_t *pStageHdr, int16_t iSample);
+void stage_retire(AudioContext_t *pContext, ChainStageHeader_t *pStageHdr);
 void stage_debug(const ChainStageHeader_t *pStageHdr);
 StageBranch_t *stage_get_branch(const ChainStageHeader_t *pStageHdr, uint8_t nBranch);
 
 
 StageBranch_t *branch_alloc(Filter_e iFilterType, uint8_t flags, float flMixPerc, void **ppUnknown);
 void branch_free(StageBranch_t *pBranch);
+void branch_retire(AudioContext_t *pContext, StageBranch_t *pBranch);
+StageBranch_t *branch_clone(const StageBranch_t *pBranch);
 
 
-void chain_free(void);
-int16_t chain_apply(int16_t iSample);
-void chain_debug();
-StageBranch_t *chain_get_branch(uint8_t nStage, uint8_t nBranch);
-ChainStageHeader_t *chain_get_stage(uint8_t nStage);
+void chain_free(ChainStageHeader_t *pStageHdr);
+void chain_retire(AudioContext_t *pContext, ChainStageHeader_t *pStageHdr);
+void chain_debug(const AudioContext_t *pContext);
+ChainStageHeader_t *chain_get_stage(const AudioContext_t *pContext, uint8_t nStage);
 
 #endif
@@ -0,0 +1,607 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * chainplan.c - Compiled filter chain
+ *
+ * Flattens the filter chain linked list into a contiguous array of operations
+ * that can be run without chasing pointers or re-checking branch flags.
+ *
+ * The sampling interrupt only ever sees the chain through the pChainPlan of its
+ * audio context (see context.h), so the linked list can be edited freely from
+ * the main loop. Edits are published by recompiling, which swaps pChainPlan in
+ * one store. Memory the old plan may still reference is handed to
+ * chainplan_retire and freed by chainplan_reclaim once the sampling path has
+ * moved onto the new plan.
+ *
+ * Plans and retired block records come from fixed pools (see pool.h) rather
+ * than the heap. chainplan_reserve checks there is room for an edit before it
+ * is made, so an edit is either published or refused outright.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "dbg.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "profile.h"
+#include "pool.h"
+
+
+// Names of each PlanOpType_e for chainplan_debug
+static const char *s_ppszOpTypes[] = {
+	"apply",
+	"mix_begin",
+	"mix",
+	"mix_end",
+};
+
+
+/*
+ * op_init
+ *
+ * Fills in a plan op for branch `pBranch` (branch `nBranch` of stage
+ * `nStage`). If `bMixGain` is true the mix percentage is always applied (as in
+ * a multiple branch stage), otherwise BRANCHFLAG_FULL_MIX is honoured.
+ */
+static void op_init(PlanOp_t *pOp, PlanOpType_e type, const StageBranch_t *pBranch, bool bMixGain, uint8_t nStage, uint8_t nBranch)
+{
+	pOp->type = type;
+	pOp->nStage = nStage;
+	pOp->nBranch = nBranch;
+	pOp->flags = PLANOPFLAG_NONE;
+	pOp->pfnApply = pBranch->pFilter->pfnApply;
+	pOp->pFilter = pBranch->pFilter;
+	pOp->pUnknown = pBranch->pUnknown;
+	pOp->flGain = 1.0f;
+	pOp->qGain = Q15_ONE;
+
+	if(!bMixGain && (pBranch->flags & BRANCHFLAG_FULL_MIX))
+		return;
+
+	// Multiplying by 1.0 doesn't change the sample, skip it
+	pOp->flGain = pBranch->flMixPerc;
+	pOp->qGain = qgain_from_float(pBranch->flMixPerc);
+
+#ifdef FLOAT_DSP
+	if(pOp->flGain != 1.0f)
+#else
+	if(pOp->qGain != Q15_ONE)
+#endif
+		pOp->flags |= PLANOPFLAG_GAIN;
+}
+
+
+/*
+ * plan_free
+ *
+ * Returns a plan retired by chainplan_compile to g_PlanPool.
+ */
+static void plan_free(void *pUnknown)
+{
+	pool_free(&g_PlanPool, pUnknown);
+}
+
+
+/*
+ * chainplan_reserve
+ *
+ * Frees what the sampling path has finished with, then checks a chain edit of
+ * `pContext` can be published: a plan block must be free for the new plan,
+ * and enough retired block records for everything the edit drops (see
+ * CHAINPLAN_EDIT_RETIRES). Call before editing the chain, and refuse the edit
+ * if it fails, so nothing is left half done.
+ *
+ * @returns false if a pool is full (reported by packet_out_of_memory_send)
+ */
+bool chainplan_reserve(AudioContext_t *pContext)
+{
+	chainplan_reclaim(pContext);
+
+	return pool_reserve(&g_PlanPool, 1) && pool_reserve(&g_RetiredPool, CHAINPLAN_EDIT_RETIRES);
+}
+
+
+/*
+ * chainplan_compile
+ *
+ * Compiles the chain of `pContext` into a new plan and publishes it in its
+ * pChainPlan. Disabled branches and empty stages are left out.
+ *
+ * Must be called whenever the chain is edited, after chainplan_reserve.
+ *
+ * @returns false if the plan pool is full, in which case the old plan keeps
+ * running
+ */
+bool chainplan_compile(AudioContext_t *pContext)
+{
+	// Count enabled branches (and the stages they are in) to size the plan
+	uint16_t nOps = 0;
+	uint16_t nPlanStages = 0;
+
+	for(const ChainStageHeader_t *pStageHdr = pContext->pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext)
+	{
+		uint16_t nStageOps = nOps;
+
+		for(const StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext)
+		{
+			if(branch_is_active(pBranch))
+				nOps++;
+		}
+
+		if(nOps != nStageOps)
+			nPlanStages++;
+	}
+
+	// Branches and stages come from pools no larger than the plan is sized for
+	ChainPlan_t *pPlan = (ChainPlan_t *)pool_alloc(&g_PlanPool);
+	if(!pPlan)
+		return false;
+
+	pPlan->nPlanStages = nPlanStages;
+	pPlan->pStageStats = (ProfileStat_t *)(pPlan->pOps + nOps);
+
+	PlanOp_t *pOp = pPlan->pOps;
+
+	for(const ChainStageHeader_t *pStageHdr = pContext->pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext)
+	{
+		const uint8_t nStage = pPlan->nStages++;
+		pPlan->nWalkCost += PLAN_COST_WALK_STAGE;
+
+		// Count enabled branches in this stage
+		uint8_t nEnabled = 0;
+		for(const StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext)
+		{
+			pPlan->nBranches++;
+			pPlan->nWalkCost += PLAN_COST_WALK_BRANCH;
+
+			if(!branch_is_active(pBranch))
+				continue;
+
+			nEnabled++;
+
+			// Walking the list only skips the mix multiplication for
+			// single branch stages with BRANCHFLAG_FULL_MIX
+			if(pStageHdr->nBranches > 1 || !(pBranch->flags & BRANCHFLAG_FULL_MIX))
+				pPlan->nWalkCost += PLAN_COST_FLOAT_MIX;
+		}
+
+		// Empty stage (or all branches disabled) passes samples straight thru
+		if(nEnabled == 0)
+			continue;
+
+		// Single branch stages respect BRANCHFLAG_FULL_MIX
+		if(pStageHdr->nBranches == 1)
+		{
+			op_init(pOp++, PLANOP_APPLY, pStageHdr->pFirst, false, nStage, 0);
+			continue;
+		}
+
+		// Only one enabled branch: mixing it is just a scale
+		if(nEnabled == 1)
+		{
+			uint8_t nBranch = 0;
+			const StageBranch_t *pBranch = pStageHdr->pFirst;
+
+			for(; !branch_is_active(pBranch); nBranch++)
+				pBranch = pBranch->pNext;
+
+			op_init(pOp++, PLANOP_APPLY, pBranch, true, nStage, nBranch);
+			continue;
+		}
+
+		// Mix the enabled branches
+		uint8_t i = 0;
+		uint8_t nBranch = 0;
+		for(const StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext, nBranch++)
+		{
+			if(!branch_is_active(pBranch))
+				continue;
+
+			PlanOpType_e type = PLANOP_MIX;
+			if(i == 0)
+				type = PLANOP_MIX_BEGIN;
+			else if(i == nEnabled - 1)
+				type = PLANOP_MIX_END;
+
+			op_init(pOp++, type, pBranch, true, nStage, nBranch);
+			i++;
+		}
+	}
+
+	pPlan->nOps = pOp - pPlan->pOps;
+
+	// Estimate the overhead of running the plan
+	for(uint8_t i = 0; i < pPlan->nOps; ++i)
+	{
+		pPlan->nPlanCost += PLAN_COST_OP;
+
+		if(pPlan->pOps[i].flags & PLANOPFLAG_GAIN)
+			pPlan->nPlanCost += PLAN_COST_MIX;
+	}
+
+	// Publish the new plan. The sampling path picks it up on its next block.
+	ChainPlan_t *pOldPlan = pContext->pChainPlan;
+	pContext->pChainPlan = pPlan;
+
+	if(pOldPlan)
+		chainplan_retire(pContext, plan_free, pOldPlan);
+
+	// Everything retired so far is unreachable from the new plan
+	const uint32_t ulGeneration = pContext->ulPlanGeneration;
+
+	for(RetiredBlock_t *pRetired = pContext->pRetired; pRetired; pRetired = pRetired->pNext)
+	{
+		if(pRetired->bPublished)
+			continue;
+
+		pRetired->bPublished = true;
+		pRetired->ulGeneration = ulGeneration;
+	}
+
+	return true;
+}
+
+
+/*
+ * chainplan_retire
+ *
+ * Queues memory that is no longer part of the chain of `pContext` to be freed
+ * with `pfnFree` after the next plan is published and the sampling path has
+ * stopped using the current one.
+ *
+ * The edit doing the retiring must have called chainplan_reserve first, which
+ * guarantees there is a record free.
+ */
+void chainplan_retire(AudioContext_t *pContext, RetireCallback_t pfnFree, void *pUnknown)
+{
+	RetiredBlock_t *pRetired = (RetiredBlock_t *)pool_alloc(&g_RetiredPool);
+	dbg_assert(pRetired, "chain edited without chainplan_reserve");
+
+	pRetired->pfnFree = pfnFree;
+	pRetired->pUnknown = pUnknown;
+	pRetired->pNext = pContext->pRetired;
+	pContext->pRetired = pRetired;
+}
+
+
+/*
+ * chainplan_reclaim
+ *
+ * Called by the main loop. Frees memory retired from `pContext` that the
+ * sampling path can no longer be using.
+ */
+void chainplan_reclaim(AudioContext_t *pContext)
+{
+	const uint32_t ulGeneration = pContext->ulPlanGeneration;
+	RetiredBlock_t **ppRetired = &pContext->pRetired;
+
+	while(*ppRetired)
+	{
+		RetiredBlock_t *pRetired = *ppRetired;
+
+		// Has the sampling path finished a block since the plan that dropped
+		// this memory was published?
+		if(!pRetired->bPublished || pRetired->ulGeneration == ulGeneration)
+		{
+			ppRetired = &pRetired->pNext;
+			continue;
+		}
+
+		*ppRetired = pRetired->pNext;
+		pRetired->pfnFree(pRetired->pUnknown);
+		pool_free(&g_RetiredPool, pRetired);
+	}
+}
+
+
+/*
+ * chainplan_flush
+ *
+ * Frees everything retired from `pContext` without waiting for the next block,
+ * for edits that need the memory back before they can carry on. Call straight
+ * after chainplan_compile: once the sampling path has finished any block it is
+ * in the middle of, it can only be running the plan just published.
+ */
+void chainplan_flush(AudioContext_t *pContext)
+{
+	while(pContext->bProcessing)
+		;
+
+	while(pContext->pRetired)
+	{
+		RetiredBlock_t *pRetired = pContext->pRetired;
+		dbg_assert(pRetired->bPublished, "chainplan_flush called before chainplan_compile");
+
+		pContext->pRetired = pRetired->pNext;
+
+		pRetired->pfnFree(pRetired->pUnknown);
+		pool_free(&g_RetiredPool, pRetired);
+	}
+}
+
+
+/*
+ * chainplan_free
+ *
+ * Frees the plan of `pContext` and everything retired from it, whether or not
+ * a plan has been published since. The sampling path must have stopped
+ * running it (see context_free).
+ */
+void chainplan_free(AudioContext_t *pContext)
+{
+	pool_free(&g_PlanPool, pContext->pChainPlan);
+	pContext->pChainPlan = NULL;
+
+	while(pContext->pRetired)
+	{
+		RetiredBlock_t *pRetired = pContext->pRetired;
+		pContext->pRetired = pRetired->pNext;
+
+		pRetired->pfnFree(pRetired->pUnknown);
+		pool_free(&g_RetiredPool, pRetired);
+	}
+}
+
+
+#if PROFILE_CHAIN
+/*
+ * op_cycles
+ *
+ * @returns the cycle counter less the cycles spent in audio_tick, which can
+ * preempt a block, so the difference of two readings is the chain's own work
+ * (as in chain_process)
+ */
+static inline uint32_t op_cycles(void)
+{
+	return PROFILE_CYCLES() - g_ulTickCycles;
+}
+
+
+/*
+ * op_profile
+ *
+ * Records the cycles per sample since `*pulOpStart` against `pOp`, and since
+ * `ulStageStart` against the stage if `pOp` is the last op in it. Restarts the
+ * count afterwards so the profiling itself isn't counted against the next op.
+ * Both starts are readings of op_cycles.
+ */
+static inline void op_profile(PlanOp_t *pOp, ProfileStat_t **ppStageStat, uint32_t *pulOpStart, uint32_t ulStageStart, uint16_t nSamples)
+{
+	uint32_t ulNow = op_cycles();
+	profile_stat_add(&pOp->stat, (ulNow - *pulOpStart) / nSamples);
+
+	if(pOp->type == PLANOP_APPLY || pOp->type == PLANOP_MIX_END)
+		profile_stat_add((*ppStageStat)++, (ulNow - ulStageStart) / nSamples);
+
+	*pulOpStart = op_cycles();
+}
+#endif
+
+
+/*
+ * chainplan_apply
+ *
+ * Runs a compiled chain on a single sample of `pContext`.
+ *
+ * @returns filtered 12-bit sample
+ */
+int16_t chainplan_apply(AudioContext_t *pContext, ChainPlan_t *pPlan, int16_t iSample)
+{
+	int16_t iInput = 0;
+#ifdef FLOAT_DSP
+	int16_t iMix = 0;
+#else
+	q31_t iMix = 0;
+#endif
+
+	PlanOp_t *pOp = pPlan->pOps;
+	const PlanOp_t *pEnd = pOp + pPlan->nOps;
+
+#if PROFILE_CHAIN
+	ProfileStat_t *pStageStat = pPlan->pStageStats;
+	uint32_t ulOpStart = op_cycles();
+	uint32_t ulStageStart = ulOpStart;
+#endif
+
+	for(; pOp < pEnd; ++pOp)
+	{
+#if PROFILE_CHAIN
+		if(pOp->type == PLANOP_APPLY || pOp->type == PLANOP_MIX_BEGIN)
+			ulStageStart = ulOpStart;
+#endif
+
+		pContext->nStage = pOp->nStage;
+
+		if(pOp->type == PLANOP_APPLY)
+		{
+			iSample = pOp->pfnApply(pContext, iSample, pOp->pUnknown);
+
+			if(pOp->flags & PLANOPFLAG_GAIN)
+#ifdef FLOAT_DSP
+				iSample = iSample * pOp->flGain;
+#else
+				iSample = sat16(q15_mul(iSample, pOp->qGain));
+#endif
+
+#if PROFILE_CHAIN
+			op_profile(pOp, &pStageStat, &ulOpStart, ulStageStart, 1);
+#endif
+			continue;
+		}
+
+		// Start of a stage with multiple branches
+		if(pOp->type == PLANOP_MIX_BEGIN)
+		{
+			iInput = iSample;
+			iMix = 0;
+		}
+
+		if(pOp->flags & PLANOPFLAG_GAIN)
+#ifdef FLOAT_DSP
+			iMix += pOp->pfnApply(pContext, iInput, pOp->pUnknown) * pOp->flGain;
+#else
+			iMix += q15_mul(pOp->pfnApply(pContext, iInput, pOp->pUnknown), pOp->qGain);
+#endif
+		else
+			iMix += pOp->pfnApply(pContext, iInput, pOp->pUnknown);
+
+		if(pOp->type == PLANOP_MIX_END)
+#ifdef FLOAT_DSP
+			iSample = iMix;
+#else
+			iSample = sat16(iMix);
+#endif
+
+#if PROFILE_CHAIN
+		op_profile(pOp, &pStageStat, &ulOpStart, ulStageStart, 1);
+#endif
+	}
+
+	return iSample;
+}
+
+
+/*
+ * op_apply_block
+ *
+ * Runs a single op's filter on a block in place.
+ */
+static void op_apply_block(AudioContext_t *pContext, const PlanOp_t *pOp, int16_t *pSamples, uint16_t nSamples)
+{
+	if(pOp->pFilter->pfnApplyBlock)
+		pOp->pFilter->pfnApplyBlock(pContext, pSamples, nSamples, pOp->pUnknown);
+	else
+		filter_apply_block_fallback(pContext, pOp->pFilter, pSamples, nSamples, pOp->pUnknown);
+}
+
+
+/*
+ * chainplan_apply_block
+ *
+ * Block version of chainplan_apply. Filters `nSamples` samples in place, which
+ * must already have been written to the history of `pContext` with
+ * `pSamples[0]` at its cursor. `nSamples` must be no larger than BLOCK_SAMPLES.
+ */
+void chainplan_apply_block(AudioContext_t *pContext, ChainPlan_t *pPlan, int16_t *pSamples, uint16_t nSamples)
+{
+	int16_t *pInputBlock = pContext->pInputBlock;
+	int16_t *pBranchBlock = pContext->pBranchBlock;
+#ifdef FLOAT_DSP
+	int16_t *pMixBlock = pContext->pMixBlock;
+#else
+	q31_t *pMixBlock = pContext->pMixBlock;
+#endif
+
+	dbg_assert(nSamples <= BLOCK_SAMPLES, "block too large (%u samples, max=%d)", nSamples, BLOCK_SAMPLES);
+
+	PlanOp_t *pOp = pPlan->pOps;
+	const PlanOp_t *pEnd = pOp + pPlan->nOps;
+
+#if PROFILE_CHAIN
+	ProfileStat_t *pStageStat = pPlan->pStageStats;
+	uint32_t ulOpStart = op_cycles();
+	uint32_t ulStageStart = ulOpStart;
+#endif
+
+	for(; pOp < pEnd; ++pOp)
+	{
+#if PROFILE_CHAIN
+		if(pOp->type == PLANOP_APPLY || pOp->type == PLANOP_MIX_BEGIN)
+			ulStageStart = ulOpStart;
+#endif
+
+		pContext->nStage = pOp->nStage;
+
+		if(pOp->type == PLANOP_APPLY)
+		{
+			op_apply_block(pContext, pOp, pSamples, nSamples);
+
+			if(pOp->flags & PLANOPFLAG_GAIN)
+			{
+				for(uint16_t i = 0; i < nSamples; ++i)
+#ifdef FLOAT_DSP
+					pSamples[i] = pSamples[i] * pOp->flGain;
+#else
+					pSamples[i] = sat16(q15_mul(pSamples[i], pOp->qGain));
+#endif
+			}
+
+#if PROFILE_CHAIN
+			op_profile(pOp, &pStageStat, &ulOpStart, ulStageStart, nSamples);
+#endif
+			continue;
+		}
+
+		// Start of a stage with multiple branches
+		if(pOp->type == PLANOP_MIX_BEGIN)
+		{
+			memcpy(pInputBlock, pSamples, nSamples * sizeof(int16_t));
+			memset(pMixBlock, 0, nSamples * sizeof(pMixBlock[0]));
+		}
+
+		memcpy(pBranchBlock, pInputBlock, nSamples * sizeof(int16_t));
+		op_apply_block(pContext, pOp, pBranchBlock, nSamples);
+
+		if(pOp->flags & PLANOPFLAG_GAIN)
+		{
+			for(uint16_t i = 0; i < nSamples; ++i)
+#ifdef FLOAT_DSP
+				pMixBlock[i] += pBranchBlock[i] * pOp->flGain;
+#else
+				pMixBlock[i] += q15_mul(pBranchBlock[i], pOp->qGain);
+#endif
+		}
+		else
+		{
+			for(uint16_t i = 0; i < nSamples; ++i)
+				pMixBlock[i] += pBranchBlock[i];
+		}
+
+		if(pOp->type == PLANOP_MIX_END)
+		{
+#ifdef FLOAT_DSP
+			memcpy(pSamples, pMixBlock, nSamples * sizeof(int16_t));
+#else
+			for(uint16_t i = 0; i < nSamples; ++i)
+				pSamples[i] = sat16(pMixBlock[i]);
+#endif
+		}
+
+#if PROFILE_CHAIN
+		op_profile(pOp, &pStageStat, &ulOpStart, ulStageStart, nSamples);
+#endif
+	}
+}
+
+
+/*
+ * chainplan_debug
+ *
+ * Prints each op in a compiled chain, and the estimated overhead compared to
+ * walking the linked list.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdouble-promotion"
+void chainplan_debug(const ChainPlan_t *pPlan)
+{
+	dbg_printf(" === chainplan_debug(%p) ===\r\n", (const void *)pPlan);
+
+	if(!pPlan)
+		return;
+
+	for(uint8_t i = 0; i < pPlan->nOps; ++i)
+	{
+		const PlanOp_t *pOp = &pPlan->pOps[i];
+		dbg_printf("  - #%u: %s filter=%s, gain=%.3f%s, data=%p\r\n", i, s_ppszOpTypes[pOp->type], pOp->pFilter->pszName, pOp->flGain, (pOp->flags & PLANOPFLAG_GAIN) ? "" : " (skipped)", pOp->pUnknown);
+	}
+
+	dbg_printf("\r\n%u ops from %u stages/%u branches\r\n", pPlan->nOps, pPlan->nStages, pPlan->nBranches);
+	dbg_printf("estimated overhead: plan=%lu cycles, linked list=%lu cycles per sample\r\n\r\n", pPlan->nPlanCost, pPlan->nWalkCost);
+}
+#pragma GCC diagnostic pop
@@ -0,0 +1,161 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * chainplan.c - Compiled filter chain
+ *
+ * Flattens the filter chain linked list into a contiguous array of operations
+ * that can be run without chasing pointers or re-checking branch flags.
+ *
+ * The sampling interrupt only ever sees the chain through the pChainPlan of its
+ * audio context (see context.h), so the linked list can be edited freely from
+ * the main loop. Edits are published by recompiling, which swaps pChainPlan in
+ * one store. Memory the old plan may still reference is handed to
+ * chainplan_retire and freed by chainplan_reclaim once the sampling path has
+ * moved onto the new plan.
+ *
+ * Plans and retired block records come from fixed pools (see pool.h) rather
+ * than the heap. chainplan_reserve checks there is room for an edit before it
+ * is made, so an edit is either published or refused outright.
+ */
+
+#ifndef _CHAINPLAN_H_
+#define _CHAINPLAN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "filters.h"
+#include "fixed.h"
+#include "profile.h"
+#include "context.h"
+
+
+// Rough Cortex-M3 cycle estimates for the overhead of running the chain (not
+// including the filters themselves). Used to compare the compiled plan with
+// walking the linked list.
+#define PLAN_COST_WALK_STAGE	12	///< stage pointer chase, nBranches test
+#define PLAN_COST_WALK_BRANCH	14	///< branch pointer chase, flag test, indirect call
+#define PLAN_COST_OP			8	///< op dispatch, indirect call
+#define PLAN_COST_FLOAT_MIX		60	///< soft-float int -> float, multiply, float -> int
+#define PLAN_COST_FIXED_MIX		6	///< Q15 multiply, round, saturate
+
+#ifdef FLOAT_DSP
+#	define PLAN_COST_MIX	PLAN_COST_FLOAT_MIX
+#else
+#	define PLAN_COST_MIX	PLAN_COST_FIXED_MIX
+#endif
+
+
+/*
+ * PlanOpType_e
+ *
+ * What an op does with the running sample.
+ */
+typedef enum
+{
+	PLANOP_APPLY = 0,	///< sample = filter(sample) * gain
+	PLANOP_MIX_BEGIN,	///< input = sample, mix = filter(input) * gain
+	PLANOP_MIX,			///< mix += filter(input) * gain
+	PLANOP_MIX_END,		///< mix += filter(input) * gain, sample = mix
+} PlanOpType_e;
+
+
+/*
+ * PlanOpFlag_e
+ *
+ * Flags for PlanOp_t::flags.
+ */
+typedef enum
+{
+	PLANOPFLAG_NONE = 0,
+	PLANOPFLAG_GAIN = (1<<0),	///< multiply by flGain (not set for unity gain/BRANCHFLAG_FULL_MIX)
+} PlanOpFlag_e;
+
+
+/*
+ * PlanOp_t
+ *
+ * A single enabled branch of the chain.
+ */
+typedef struct
+{
+	uint8_t type;					///< `PlanOpType_e`
+	uint8_t flags;					///< `PlanOpFlag_e`s OR'd together
+	FilterApply_t pfnApply;			///< copied from pFilter
+	const Filter_t *pFilter;		///< filter type
+	void *pUnknown;					///< filter data (owned by the branch)
+	float flGain;					///< resolved mix percentage
+	qgain_t qGain;					///< flGain in Q15
+	uint8_t nStage;					///< index of the branch's stage in the linked list
+	uint8_t nBranch;				///< index of the branch in its stage
+	ProfileStat_t stat;				///< cycles per sample spent in this op (see PROFILE_CHAIN)
+} PlanOp_t;
+
+
+/*
+ * ChainPlan_t
+ *
+ * Compiled filter chain. Allocated as one block with `nOps` ops following the
+ * header, then `nPlanStages` stage statistics.
+ */
+typedef struct ChainPlan_t
+{
+	uint8_t nOps;				///< number of ops in pOps
+	uint8_t nStages;			///< number of stages in the linked list
+	uint8_t nBranches;			///< number of branches in the linked list (including disabled)
+	uint8_t nPlanStages;		///< number of stages with enabled branches (one per APPLY/MIX_BEGIN op)
+	uint32_t nPlanCost;			///< estimated overhead cycles per sample running the plan
+	uint32_t nWalkCost;			///< estimated overhead cycles per sample walking the linked list
+	ProfileStat_t *pStageStats;	///< cycles per sample spent in each planned stage (see PROFILE_CHAIN)
+	PlanOp_t pOps[];
+} ChainPlan_t;
+
+
+// Size of a g_PlanPool block, enough for every branch in the branch pool to be
+// enabled, each in a stage of its own
+#define CHAINPLAN_MAX_SIZE		(sizeof(ChainPlan_t) + POOL_BRANCHES * sizeof(PlanOp_t) + POOL_STAGES * sizeof(ProfileStat_t))
+
+// Most blocks a single chain edit retires: a branch, a stage and the old plan
+// (see chainplan_reserve)
+#define CHAINPLAN_EDIT_RETIRES	3
+
+
+/*
+ * RetireCallback_t
+ *
+ * Frees memory passed to chainplan_retire.
+ */
+typedef void (*RetireCallback_t)(void *pUnknown);
+
+
+/*
+ * RetiredBlock_t
+ *
+ * Memory waiting to be freed once the sampling path is done with it.
+ * Allocated from g_RetiredPool.
+ */
+typedef struct RetiredBlock_t
+{
+	RetireCallback_t pfnFree;		///< function that frees pUnknown
+	void *pUnknown;					///< memory to free
+	bool bPublished;				///< has a plan without pUnknown been published?
+	uint32_t ulGeneration;			///< ulPlanGeneration of the context when that plan was published
+	struct RetiredBlock_t *pNext;	///< next retired block
+} RetiredBlock_t;
+
+
+bool chainplan_reserve(AudioContext_t *pContext);
+bool chainplan_compile(AudioContext_t *pContext);
+void chainplan_retire(AudioContext_t *pContext, RetireCallback_t pfnFree, void *pUnknown);
+void chainplan_reclaim(AudioContext_t *pContext);
+void chainplan_flush(AudioContext_t *pContext);
+void chainplan_free(AudioContext_t *pContext);
+int16_t chainplan_apply(AudioContext_t *pContext, ChainPlan_t *pPlan, int16_t iSample);
+void chainplan_apply_block(AudioContext_t *pContext, ChainPlan_t *pPlan, int16_t *pSamples, uint16_t nSamples);
+void chainplan_debug(const ChainPlan_t *pPlan);
+
+#endif
@@ -16,54 +16,17 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "dbg.h"
 #include "fatfs/ff.h"
 #include "sd.h"
 #include "filters.h"
 #include "chain.h"
+#include "chainplan.h"
 #include "chainstore.h"
 
 
-/*
- * param_type_size
- *
- * Calculates the number of bytes a parameter format character represents.
- * See http://docs.python.org/2/library/struct.html#format-characters
- */
-static uint8_t param_type_size(char ch)
-{
-	switch(ch)
-	{
-	case 'c':
-	case 'b':
-	case 'B':
-	case '?':
-		return 1;
-
-	case 'h':
-	case 'H':
-		return 2;
-
-	case 'i':
-	case 'I':
-	case 'l':
-	case 'L':
-	case 'f':
-		return 4;
-
-	case 'q':
-	case 'Q':
-	case 'd':
-		return 8;
-
-	default:
-		dbg_warning("unknown parameter type (%c)\r\n", ch);
-		return 0;
-	}
-}
-
-
 /*
  * chainstore_save_branch
  *
@@ -128,13 +91,15 @@ static void chainstore_save_branch(FIL *pFile, const StageBranch_t *pBranch)
 		if(!bFoundOffset || !format)
 			dbg_error("parameter (%.*s) for filter (%s) is missing offset or format KV\r\n", nParamNameLen, pParam, pBranch->pFilter->pszName);
 
-		// Shift the offset past the private filter data
-		offset += pBranch->pFilter->nNonPublicDataSize;
-
-		// Write param header
+		// Write param header. The offset is stored as it is in the parameter
+		// string, relative to the public filter data, so it doesn't depend on
+		// the size of the private pointers in front of it.
 		ChainStoreParam_t param;
 		param.iOffset = offset;
-		param.nSize = param_type_size(format);
+		param.nSize = filter_param_size(format);
+
+		// Shift the offset past the private filter data
+		offset += pBranch->pFilter->nNonPublicDataSize;
 
 		if((res = f_write(pFile, &param, sizeof(param), &nWrote)))
 		{
@@ -157,7 +122,7 @@ static void chainstore_save_branch(FIL *pFile, const StageBranch_t *pBranch)
 	// Populate branch header data
 	ChainStoreBranchHeader_t branchHdr;
 	branchHdr.filter = iFilterIndex;
-	branchHdr.flags = pBranch->flags;
+	branchHdr.flags = pBranch->flags & ~BRANCHFLAG_SHED;
 	branchHdr.flMixPerc = pBranch->flMixPerc;
 	branchHdr.nParams = nParams;
 
@@ -179,15 +144,15 @@ static void chainstore_save_branch(FIL *pFile, const StageBranch_t *pBranch)
 /*
  * chainstore_save
  *
- * Save the current filter change to `pszPath` on the SD card.
+ * Save the filter chain of `pContext` to `pszPath` on the SD card.
  */
-void chainstore_save(const char *pszPath)
+void chainstore_save(const AudioContext_t *pContext, const char *pszPath)
 {
 	FRESULT res;
 	UINT nWrote;
 
 	// Do we have a filter chain to save?
-	if(!g_pChainRoot || !g_pChainRoot->pNext)
+	if(!pContext->pChainRoot || !pContext->pChainRoot->pNext)
 	{
 		dbg_warning("cannot save empty chain!\r\n");
 		return;
@@ -204,7 +169,7 @@ void chainstore_save(const char *pszPath)
 	// Reserve space for header
 	f_lseek(&fh, sizeof(ChainStoreHeader_t));
 
-	const ChainStageHeader_t *pStageHdr = g_pChainRoot;
+	const ChainStageHeader_t *pStageHdr = pContext->pChainRoot;
 	uint8_t nStages = 0;
 
 	// Iterate through the filter chain
@@ -267,6 +232,14 @@ bool chainstore_header_validate(const ChainStoreHeader_t *pHdr)
 		return false;
 	}
 
+	// Saved before a filter data layout changed? The parameters would land in
+	// the wrong fields, so the chain has to be made again.
+	if(pHdr->iVersion < STORE_VERSION)
+	{
+		dbg_warning("chain was saved by older firmware (version %d, expected %d), filters have changed since so it must be recreated\r\n", pHdr->iVersion, STORE_VERSION);
+		return false;
+	}
+
 	// Version mismatch?
 	if(pHdr->iVersion != STORE_VERSION)
 	{
@@ -279,50 +252,27 @@ bool chainstore_header_validate(const ChainStoreHeader_t *pHdr)
 
 
 /*
- * chainstore_restore
+ * chainstore_decode_stages
+ *
+ * Decodes `nStages` stored stages, read through `pfnRead` from `pReader`, into
+ * the empty chain `pRoot`.
  *
- * Reads and decodes the stored chain at `pszPath` on the SD card.
+ * @returns false if a stage is invalid or doesn't fit in memory (as much of it
+ * as was decoded is left in `pRoot`)
  */
-void chainstore_restore(const char *pszPath)
+static bool chainstore_decode_stages(ChainStageHeader_t *pRoot, uint8_t nStages, ChainStoreRead_t pfnRead, void *pReader)
 {
-	FRESULT res;
-	UINT nRead;
-
-	// Try to open the file
-	FIL fh;
-	if((res = f_open(&fh, pszPath, FA_READ)))
-	{
-		dbg_warning("f_open(%s) failed %d\r\n", pszPath, res);
-		return;
-	}
-
-	// Read store header
-	ChainStoreHeader_t hdr;
-	if((res = f_read(&fh, &hdr, sizeof(hdr), &nRead)) || nRead != sizeof(hdr))
-	{
-		dbg_warning("header read failed %d\r\n", res);
-		return;
-	}
-
-	// Check the header is valid
-	if(!chainstore_header_validate(&hdr))
-		return;
-
-	// Deallocate current chain
-	chain_free();
-	g_pChainRoot = stage_alloc();
-
-	ChainStageHeader_t *pStageHdr = g_pChainRoot;
+	ChainStageHeader_t *pStageHdr = pRoot;
 
 	// Decode all stages from the file
-	for(uint8_t i = 0; i < hdr.nStages; ++i)
+	for(uint8_t i = 0; i < nStages; ++i)
 	{
 		// Read stage header
 		ChainStoreStageHeader_t storeStageHdr;
-		if((res = f_read(&fh, &storeStageHdr, sizeof(storeStageHdr), &nRead)) || nRead != sizeof(storeStageHdr))
+		if(!pfnRead(pReader, &storeStageHdr, sizeof(storeStageHdr)))
 		{
-			dbg_warning("stage header read failed %d\r\n", res);
-			return;
+			dbg_warning("stage header read failed\r\n");
+			return false;
 		}
 
 		pStageHdr->nBranches = storeStageHdr.nBranches;
@@ -333,45 +283,72 @@ void chainstore_restore(const char *pszPath)
 		{
 			// Read branch header
 			ChainStoreBranchHeader_t storeBranchHdr;
-			if((res = f_read(&fh, &storeBranchHdr, sizeof(storeBranchHdr), &nRead)) || nRead != sizeof(storeBranchHdr))
+			if(!pfnRead(pReader, &storeBranchHdr, sizeof(storeBranchHdr)))
+			{
+				dbg_warning("branch header read failed\r\n");
+				pStageHdr->nBranches = j;
+				return false;
+			}
+
+			if(storeBranchHdr.filter >= NUM_FILTERS)
 			{
-				dbg_warning("branch header read failed %d\r\n", res);
-				return;
+				dbg_warning("invalid filter (%u)\r\n", storeBranchHdr.filter);
+				pStageHdr->nBranches = j;
+				return false;
 			}
 
 			// Allocate a new branch in memory
 			uint8_t *pUnknown;
-			StageBranch_t *pBranch = branch_alloc(storeBranchHdr.filter, storeBranchHdr.flags, storeBranchHdr.flMixPerc, (void **)&pUnknown);
+			StageBranch_t *pBranch = branch_alloc(storeBranchHdr.filter, storeBranchHdr.flags & ~BRANCHFLAG_SHED, storeBranchHdr.flMixPerc, (void **)&pUnknown);
+
+			// Out of memory
+			if(!pBranch)
+			{
+				pStageHdr->nBranches = j;
+				return false;
+			}
 
 			// Iterate all parameters in file
 			for(uint8_t k = 0; k < storeBranchHdr.nParams; ++k)
 			{
 				// Read parameter data
 				ChainStoreParam_t storeParam;
-				if((res = f_read(&fh, &storeParam, sizeof(storeParam), &nRead)) || nRead != sizeof(storeParam))
+				if(!pfnRead(pReader, &storeParam, sizeof(storeParam)))
 				{
-					dbg_warning("parameter header read failed %d\r\n", res);
-					return;
+					dbg_warning("parameter header read failed\r\n");
+					branch_free(pBranch);
+					pStageHdr->nBranches = j;
+					return false;
 				}
 
-				// Check offset is not out of range
-				if(storeParam.iOffset < pBranch->pFilter->nNonPublicDataSize || storeParam.iOffset + storeParam.nSize > pBranch->pFilter->nFilterDataSize)
+				// Check offset is not out of range of the public filter data
+				const uint8_t nNonPublicDataSize = pBranch->pFilter->nNonPublicDataSize;
+
+				if(storeParam.iOffset + storeParam.nSize > pBranch->pFilter->nFilterDataSize - nNonPublicDataSize)
 				{
 					dbg_warning("invalid offset/size for parameter data\r\n");
-					return;
+					branch_free(pBranch);
+					pStageHdr->nBranches = j;
+					return false;
 				}
 
 				// Read parameter data into memory
-				if((res = f_read(&fh, &pUnknown[storeParam.iOffset], storeParam.nSize, &nRead)) || nRead != storeParam.nSize)
+				if(!pfnRead(pReader, &pUnknown[nNonPublicDataSize + storeParam.iOffset], storeParam.nSize))
 				{
-					dbg_warning("parameter data read failed %d\r\n", res);
-					return;
+					dbg_warning("parameter data read failed\r\n");
+					branch_free(pBranch);
+					pStageHdr->nBranches = j;
+					return false;
 				}
 			}
 
 			// Trigger filter modified
-			if(pBranch->pFilter->pfnModCallback)
-				pBranch->pFilter->pfnModCallback(pBranch->pUnknown);
+			if(pBranch->pFilter->pfnModCallback && !pBranch->pFilter->pfnModCallback(pBranch->pUnknown))
+			{
+				branch_free(pBranch);
+				pStageHdr->nBranches = j;
+				return false;
+			}
 
 			// Add this branch to the stage linked list
 			if(pLastBranch)
@@ -389,9 +366,125 @@ void chainstore_restore(const char *pszPath)
 		// Allocate the next stage and add to linked list
 		pStageHdr->pNext = stage_alloc();
 		pStageHdr = pStageHdr->pNext;
+
+		if(!pStageHdr)
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * chainstore_decode
+ *
+ * Decodes a stored chain, read through `pfnRead` from `pReader`, and replaces
+ * the chain of `pContext` with it. The caller publishes it (see
+ * chainplan_compile).
+ *
+ * The current chain is freed first, so the stored chain only has to fit in
+ * memory on its own (a chain can be loaded over itself). Until the stored
+ * chain is published an empty one runs in its place.
+ *
+ * @returns false if the chain is invalid or doesn't fit in memory. If the
+ * current chain had already been freed by then, the chain of `pContext` is left
+ * as a new empty one.
+ */
+bool chainstore_decode(AudioContext_t *pContext, ChainStoreRead_t pfnRead, void *pReader)
+{
+	// Read store header
+	ChainStoreHeader_t hdr;
+	if(!pfnRead(pReader, &hdr, sizeof(hdr)))
+	{
+		dbg_warning("header read failed\r\n");
+		return false;
+	}
+
+	// Check the header is valid
+	if(!chainstore_header_validate(&hdr))
+		return false;
+
+	// Make sure the empty chain can be published
+	if(!chainplan_reserve(pContext))
+		return false;
+
+	ChainStageHeader_t *pRoot = stage_alloc();
+	if(!pRoot)
+		return false;
+
+	// Publish the empty chain, and free the current one as soon as the
+	// sampling path has moved onto it
+	chain_retire(pContext, pContext->pChainRoot);
+	pContext->pChainRoot = pRoot;
+
+	chainplan_compile(pContext);
+	chainplan_flush(pContext);
+
+	if(chainstore_decode_stages(pRoot, hdr.nStages, pfnRead, pReader))
+		return true;
+
+	// None of the stored chain has been published, so it can be freed
+	// straight away, leaving the empty root
+	chain_free(pRoot->pNext);
+
+	StageBranch_t *pBranch = pRoot->pFirst;
+	while(pBranch)
+	{
+		StageBranch_t *pNextBranch = pBranch->pNext;
+		branch_free(pBranch);
+		pBranch = pNextBranch;
+	}
+
+	memset(pRoot, 0, sizeof(ChainStageHeader_t));
+	return false;
+}
+
+
+/*
+ * chainstore_read_file
+ *
+ * ChainStoreRead_t for a file on the SD card.
+ */
+static bool chainstore_read_file(void *pReader, void *pBuf, uint16_t nBytes)
+{
+	FRESULT res;
+	UINT nRead;
+
+	if((res = f_read((FIL *)pReader, pBuf, nBytes, &nRead)) || nRead != nBytes)
+	{
+		dbg_warning("f_read failed %d (%u of %u bytes)\r\n", res, nRead, nBytes);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * chainstore_restore
+ *
+ * Reads and decodes the stored chain at `pszPath` on the SD card into
+ * `pContext` (see chainstore_decode).
+ *
+ * @returns false if it can't be restored
+ */
+bool chainstore_restore(AudioContext_t *pContext, const char *pszPath)
+{
+	FRESULT res;
+
+	// Try to open the file
+	FIL fh;
+	if((res = f_open(&fh, pszPath, FA_READ)))
+	{
+		dbg_warning("f_open(%s) failed %d\r\n", pszPath, res);
+		return false;
 	}
 
+	const bool bRestored = chainstore_decode(pContext, chainstore_read_file, &fh);
 	f_close(&fh);
 
-	dbg_printf(ANSI_COLOR_GREEN "Restored chain from \"%s\"\r\n" ANSI_COLOR_RESET, pszPath);
+	if(bRestored)
+		dbg_printf(ANSI_COLOR_GREEN "Restored chain from \"%s\"\r\n" ANSI_COLOR_RESET, pszPath);
+
+	return bRestored;
 }
@@ -16,14 +16,25 @@
 #ifndef _CHAINSTORE_H_
 #define _CHAINSTORE_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "context.h"
+
 // Directory where the chains are stored on SD card
 #define STORE_DIRECTORY "chains"
 
 // Identifier for the ChainStore format
 #define STORE_IDENT ('C' | ('H' << 8) | ('S' << 16) | ('T' << 24))
 
-// Current version for the ChainStore format
-#define STORE_VERSION 1
+// Current version for the ChainStore format. Parameters are stored by offset
+// into the filter data, so this must be bumped whenever a filter's data layout
+// changes. Older chains are refused rather than restored with the wrong values.
+//   1 - original filters
+//   2 - Delay encoding, Vibrato/Flange fine frequency and interpolation,
+//       Tremolo depth moved, dynamics filters and Reverb rewritten
+//   3 - parameter offsets relative to the public filter data (as in the
+//       parameter strings), rather than including the private pointers
+#define STORE_VERSION 3
 
 
 /*
@@ -78,14 +89,24 @@ typedef struct
 #pragma pack(push, 1)
 typedef struct
 {
-	uint8_t iOffset;	///< Offset into filter data that the proceeding value should be copied
+	uint8_t iOffset;	///< Offset into the public filter data (after Filter_t::nNonPublicDataSize) that the proceeding value should be copied
 	uint8_t nSize;		///< Size of the parameter value that follows this struct
 } ChainStoreParam_t;
 #pragma pack(pop)
 
 
-void chainstore_save(const char *pszPath);
+/*
+ * ChainStoreRead_t
+ *
+ * Reads exactly `nBytes` of a stored chain from `pReader` into `pBuf`. Returns
+ * false on error or end of file.
+ */
+typedef bool (*ChainStoreRead_t)(void *pReader, void *pBuf, uint16_t nBytes);
+
+
+void chainstore_save(const AudioContext_t *pContext, const char *pszPath);
 bool chainstore_header_validate(const ChainStoreHeader_t *pHdr);
-void chainstore_restore(const char *pszPath);
+bool chainstore_decode(AudioContext_t *pContext, ChainStoreRead_t pfnRead, void *pReader);
+bool chainstore_restore(AudioContext_t *pContext, const char *pszPath);
 
 #endif
@@ -17,8 +17,75 @@
 // Sample rate
 #define SAMPLE_RATE		10000
 
-// Number of samples to hold in memory
-#define BUFFER_SAMPLES	10000
+// Number of input samples to hold in memory, as a power of two so indices wrap
+// with BUFFER_MASK. Filters that delay keep their own lines (see
+// DELAY_BUDGET_SAMPLES), so this only needs to be long enough for the sample
+// benchmarks and to wrap the sample cursor.
+#define BUFFER_SAMPLES_LOG2	10
+#define BUFFER_SAMPLES		(1 << BUFFER_SAMPLES_LOG2)
+#define BUFFER_MASK			(BUFFER_SAMPLES - 1)
+
+// Samples shared out between the delay lines of every branch (see delayline.h).
+// 7680 samples (15 KB) is 0.77 seconds of delay in total. A Delay filter's line
+// can take at most half, so it always has room to change length (see
+// DELAY_MAX_SAMPLES).
+#define DELAY_BUDGET_SAMPLES	7680
+
+// Store the history as packed 12 bit pairs (3 bytes per 2 samples) rather
+// than int16_t. Saves BUFFER_SAMPLES/2 bytes of RAM, costs a few cycles per
+// read (see the `sample_bench` command). Build with PACKED=1 to enable.
+#ifndef SAMPLE_HISTORY_PACKED
+#	define SAMPLE_HISTORY_PACKED	0
+#endif
+
+// Number of samples passed through the filter chain at once. Blocks are double
+// buffered, so output is delayed by 2 * BLOCK_SAMPLES samples.
+// Set to 1 to filter each sample inside the sampling interrupt.
+#define BLOCK_SAMPLES	16
+
+// Record cycles spent in each stage and branch of the chain (see profile.h)
+#define PROFILE_CHAIN	1
+
+// Default interval between B2U_PROFILE packets (msec, 0 = disabled)
+#define PROFILE_TELEMETRY_MSEC	1000
+
+// Chain edits predicted to take more than this percentage of the sample period
+// are refused (see admission.h). Change at runtime with the `admission` command.
+#define ADMISSION_BUDGET_PERC	90
+
+// Overload governor (see governor.h). Sheds the most expensive branch after
+// this many consecutive blocks miss their deadline...
+#define GOVERNOR_MISS_LIMIT		3
+
+// ...and restores shed branches once the sampling path has had this much
+// headroom (percentage of the sample period) for GOVERNOR_RESTORE_MSEC
+#define GOVERNOR_RESTORE_PERC	70
+#define GOVERNOR_RESTORE_MSEC	2000
+
+// Capacity of the chain memory pools (see pool.h). Edits keep the old copy of
+// whatever they change until the sampling path has moved on, so leave room
+// for both.
+#define POOL_STAGES				16
+#define POOL_BRANCHES			32	///< also the number of filter data blocks
+#define POOL_FILTER_DATA_SIZE	(16 + sizeof(void *))	///< bytes, must fit the largest filter data struct (20 on the board)
+#define POOL_FIR_KERNELS		8	///< FIR kernels, their history is a delay line (see FIRKernel_t)
+#define POOL_FIR_DESIGNS		12	///< cached FIR coefficients, should be more than POOL_FIR_KERNELS (see FIRDesign_t)
+#define POOL_LFOS				8	///< oscillators shared by modulated filters (see lfo.h)
+#define POOL_ENVELOPES			8	///< detectors, one for each dynamics filter (see envelope.h)
+#define POOL_DYNAMICS			8	///< dynamics filter gain curves (see DynamicsState_t)
+#define POOL_BIQUADS			8	///< biquad coefficients and state (see BiquadCascade_t)
+#define POOL_DELAY_LINES		16	///< delay lines in DELAY_BUDGET_SAMPLES (see DelayLine_t)
+#define POOL_SHAPER_TABLES		3	///< waveshaper curves, 8 KB each, kept in AHB SRAM (see ShaperTable_t)
+#define POOL_REVERBS			1	///< reverb delay lines, 5.7 KB each, kept in AHB SRAM after the waveshaper tables (see ReverbLines_t). Enough for one Reverb: modified copies share its lines, and restoring a chain frees the current one first (see chainstore_decode)
+#define POOL_PLANS				3	///< compiled chains of the largest size, about 2 KB each: the running plan, the one it replaced and the next (see chainplan.h)
+#define POOL_RETIRED			16	///< chain memory waiting for the sampling path to move on (see RetiredBlock_t)
+
+// The two AHB SRAM banks (contiguous, 32 KB) aren't used by the peripherals
+// this project drives, so large tables live there instead of the 32 KB of
+// local SRAM. The delay budget (DELAY_BUDGET_SAMPLES) already takes half of
+// that, and the chain pools, sample history and stack most of the rest.
+#define AHB_SRAM_BASE	0x2007C000
+#define AHB_SRAM_SIZE	(32 * 1024)
 
 // Peripheral extreme values
 #define ADC_MAX_VALUE	((1<<12)-1)
@@ -0,0 +1,116 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * context.c - Audio contexts
+ *
+ * Everything the DSP core keeps between samples for one audio stream: the
+ * filter chain and its compiled plan, the input history, the LFO time base and
+ * the envelope detector levels. Every filter is applied with the context it is
+ * filtering, so any number of streams can be processed side by side in one
+ * program, each by its own interrupt or thread.
+ *
+ * Filter data, LFO settings and envelope settings are allocated from the
+ * shared pools (see pool.h) by the main loop, so only context_process may run
+ * for different contexts at once.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "config.h"
+#include "dbg.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "envelope.h"
+#include "samples.h"
+#include "context.h"
+
+
+/*
+ * context_init
+ *
+ * Clears the history of `pContext` and gives it an empty filter chain. The
+ * wave and level tables must already be filled (see lfo_init and
+ * envelope_init).
+ *
+ * @returns false if the stage or plan pool is full
+ */
+bool context_init(AudioContext_t *pContext)
+{
+	memset(pContext, 0, sizeof(AudioContext_t));
+
+	pContext->pChainRoot = stage_alloc();
+	if(!pContext->pChainRoot)
+		return false;
+
+	if(!chainplan_compile(pContext))
+	{
+		stage_free(pContext->pChainRoot);
+		pContext->pChainRoot = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * context_free
+ *
+ * Frees the chain and plan of `pContext`, including anything still waiting to
+ * be reclaimed. context_process must not be running for it.
+ */
+void context_free(AudioContext_t *pContext)
+{
+	chain_free(pContext->pChainRoot);
+	pContext->pChainRoot = NULL;
+
+	chainplan_free(pContext);
+}
+
+
+/*
+ * context_process
+ *
+ * Writes a block of `nSamples` input samples to the history of `pContext` and
+ * passes them through its filter chain (in place), unless `bPassThru` is set.
+ * `nSamples` must be no larger than BLOCK_SAMPLES.
+ */
+void context_process(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, bool bPassThru)
+{
+	SampleHistory_t *pHistory = &pContext->history;
+	const uint16_t iCursor = pHistory->iCursor;
+
+	// Edits are published by swapping pChainPlan, so read it exactly once,
+	// after saying we're using it (see chainplan_flush)
+	pContext->bProcessing = true;
+	struct ChainPlan_t *pPlan = pContext->pChainPlan;
+
+	// Add input to the history. pSamples[0] is at the cursor.
+	for(uint16_t i = 0; i < nSamples; ++i)
+		sample_write(pHistory, iCursor + i, pSamples[i]);
+
+	pContext->iBlockCursor = iCursor;
+
+	if(!bPassThru && pPlan)
+	{
+		if(nSamples == 1)
+			pSamples[0] = chainplan_apply(pContext, pPlan, pSamples[0]);
+		else
+			chainplan_apply_block(pContext, pPlan, pSamples, nSamples);
+	}
+
+	// Let the main loop free anything the previous plan was using
+	pContext->ulPlanGeneration++;
+	pContext->bProcessing = false;
+
+	// Move on to the next block
+	pHistory->iCursor = (iCursor + nSamples) & BUFFER_MASK;
+	pContext->ulSamples += nSamples;
+}
@@ -0,0 +1,72 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * context.c - Audio contexts
+ *
+ * Everything the DSP core keeps between samples for one audio stream: the
+ * filter chain and its compiled plan, the input history, the LFO time base and
+ * the envelope detector levels. Every filter is applied with the context it is
+ * filtering, so any number of streams can be processed side by side in one
+ * program, each by its own interrupt or thread.
+ *
+ * Filter data, LFO settings and envelope settings are allocated from the
+ * shared pools (see pool.h) by the main loop, so only context_process may run
+ * for different contexts at once.
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "fixed.h"
+#include "samples.h"
+#include "envelope.h"
+
+
+struct ChainStageHeader_t;
+struct ChainPlan_t;
+struct RetiredBlock_t;
+
+
+/*
+ * AudioContext_t
+ *
+ * State of one audio stream. Set up with context_init, then run a block at a
+ * time by context_process.
+ */
+typedef struct AudioContext_t
+{
+	SampleHistory_t history;					///< input samples, history.iCursor is the sample being filtered
+	struct ChainStageHeader_t *pChainRoot;		///< root stage of the filter chain, edited by the main loop
+	struct ChainPlan_t * volatile pChainPlan;	///< compiled pChainRoot, run by context_process (see chainplan.h)
+	volatile uint32_t ulPlanGeneration;			///< incremented each time context_process finishes with pChainPlan
+	volatile bool bProcessing;					///< set while context_process is running a block
+	struct RetiredBlock_t *pRetired;			///< memory waiting for context_process to finish with it
+	volatile uint32_t ulSamples;				///< samples processed before the current block, the LFO time base
+	volatile uint16_t iBlockCursor;				///< history.iCursor at the start of the current block
+	uint8_t nStage;								///< stage being applied by the chain plan, see envelope_follow
+	EnvelopeState_t pEnvelopes[POOL_ENVELOPES];	///< detector levels, one for each block of g_EnvelopePool
+
+	// Scratch blocks used to mix stages with parallel branches
+	int16_t pInputBlock[BLOCK_SAMPLES];
+	int16_t pBranchBlock[BLOCK_SAMPLES];
+#ifdef FLOAT_DSP
+	int16_t pMixBlock[BLOCK_SAMPLES];
+#else
+	q31_t pMixBlock[BLOCK_SAMPLES];				///< saturated when the stage ends
+#endif
+} AudioContext_t;
+
+
+bool context_init(AudioContext_t *pContext);
+void context_free(AudioContext_t *pContext);
+void context_process(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, bool bPassThru);
+
+#endif
@@ -14,9 +14,8 @@
 #include <string.h>
 
 #include "dbg.h"
-#include "led.h"
+#include "hal.h"
 #include "packets.h"
-#include "microtimer.h"
 
 
 /*
@@ -24,7 +23,8 @@
  *
  * Prints an error in red to the console and halts program execution.
  *
- * If the LED subsystem has been setup, the LEDs will blink indefinitely.
+ * On the board, the LEDs will blink indefinitely if they have been setup (see
+ * hal_halt).
  */
 void _dbg_error(const char *file, int line, const char *func, const char *format, ...)
 {
@@ -44,16 +44,8 @@ void _dbg_error(const char *file, int line, const char *func, const char *format
 	dbg_printn(buf, -1);
 	dbg_printn(ANSI_COLOR_RESET "\r\n", -1);
 
-	// Disable all microtimers
-	for(uint8_t i = 0; i < UTIM_NUM_TIMERS; ++i)
-		microtimer_disable(i);
-
-	// Blink LEDs infinitely if LEDs are setup
-	if(led_setup())
-		led_blink(200, LED_BLINK_INDEFINITE);
-
-	// Halt program
-	while(1);
+	// Stop sampling and halt program
+	hal_halt();
 }
 
 
@@ -0,0 +1,737 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * delayline.c - Per-branch delay lines
+ *
+ * Filters that need past samples (Delay, Flange, Vibrato, FIR) keep their own
+ * delay line of their own input, rather than reading the shared sample history
+ * of the chain input. Each line is exactly as long as the filter asks for, and
+ * is carved out of a fixed budget of DELAY_BUDGET_SAMPLES samples. Line
+ * descriptors are allocated from g_DelayLinePool.
+ *
+ * Lines can optionally be stored compressed, for long delays: 8 bit mu-law
+ * (2 samples per budget sample) or 4 bit IMA ADPCM (4 samples per budget
+ * sample). Compressed lines are only read through delayline_shift.
+ *
+ * Lines are allocated and released from the main loop (in mod and free
+ * callbacks), and only read and written by the sampling path.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "config.h"
+#include "dbg.h"
+#include "pool.h"
+#include "profile.h"
+#include "delayline.h"
+
+
+// Samples are 12 bit, the codecs work on 16 bit samples
+#define DELAYLINE_CODEC_SHIFT	4
+
+// G.711 mu-law bias and largest (16 bit) magnitude before biasing
+#define MULAW_BIAS				0x84
+#define MULAW_CLIP				32635
+
+// Highest IMA ADPCM step size index
+#define ADPCM_MAX_STEP			88
+
+
+// Samples shared out between the lines
+static int16_t s_pBudget[DELAY_BUDGET_SAMPLES];
+
+// Names of the encodings, for delayline_debug and delayline_benchmark
+static const char *s_ppszEncodings[DELAYLINE_ENCODINGS] = { "linear", "mu-law", "ADPCM" };
+
+// IMA ADPCM step sizes
+static const uint16_t s_pAdpcmSteps[ADPCM_MAX_STEP + 1] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+	11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+	32767
+};
+
+// IMA ADPCM step size index change for each code magnitude
+static const int8_t s_pAdpcmStepChange[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Interpolation coefficients (see delayline.h), rounded from
+// c(f) = (-f^3 + 2f^2 - f) / 2 and (3f^3 - 5f^2 + 2) / 2, f = i / DELAYLINE_FRAC_STEPS
+const int16_t g_pHermiteCoefficients[DELAYLINE_FRAC_STEPS + 1][2] =
+{
+	{ 0, 16384 }, { -32, 16383 }, { -63, 16382 }, { -94, 16378 }, { -124, 16374 }, { -154, 16369 },
+	{ -183, 16362 }, { -212, 16354 }, { -240, 16345 }, { -268, 16334 }, { -295, 16323 }, { -322, 16310 },
+	{ -349, 16297 }, { -375, 16282 }, { -400, 16266 }, { -425, 16248 }, { -450, 16230 }, { -474, 16211 },
+	{ -498, 16190 }, { -521, 16168 }, { -544, 16146 }, { -566, 16122 }, { -588, 16097 }, { -610, 16071 },
+	{ -631, 16044 }, { -651, 16016 }, { -672, 15987 }, { -691, 15957 }, { -711, 15926 }, { -730, 15894 },
+	{ -748, 15861 }, { -766, 15827 }, { -784, 15792 }, { -801, 15756 }, { -818, 15719 }, { -835, 15681 },
+	{ -851, 15642 }, { -866, 15603 }, { -882, 15562 }, { -897, 15520 }, { -911, 15478 }, { -925, 15434 },
+	{ -939, 15390 }, { -953, 15345 }, { -966, 15299 }, { -978, 15252 }, { -991, 15204 }, { -1002, 15155 },
+	{ -1014, 15106 }, { -1025, 15056 }, { -1036, 15005 }, { -1047, 14953 }, { -1057, 14900 }, { -1066, 14846 },
+	{ -1076, 14792 }, { -1085, 14737 }, { -1094, 14681 }, { -1102, 14625 }, { -1110, 14567 }, { -1118, 14509 },
+	{ -1125, 14450 }, { -1133, 14391 }, { -1139, 14331 }, { -1146, 14270 }, { -1152, 14208 }, { -1158, 14146 },
+	{ -1163, 14083 }, { -1169, 14019 }, { -1174, 13955 }, { -1178, 13890 }, { -1182, 13824 }, { -1187, 13758 },
+	{ -1190, 13691 }, { -1194, 13623 }, { -1197, 13555 }, { -1200, 13486 }, { -1202, 13417 }, { -1205, 13347 },
+	{ -1207, 13277 }, { -1208, 13206 }, { -1210, 13134 }, { -1211, 13062 }, { -1212, 12989 }, { -1213, 12916 },
+	{ -1213, 12842 }, { -1214, 12768 }, { -1214, 12693 }, { -1213, 12618 }, { -1213, 12542 }, { -1212, 12466 },
+	{ -1211, 12389 }, { -1210, 12312 }, { -1208, 12235 }, { -1207, 12157 }, { -1205, 12078 }, { -1202, 11999 },
+	{ -1200, 11920 }, { -1197, 11840 }, { -1195, 11760 }, { -1192, 11680 }, { -1188, 11599 }, { -1185, 11518 },
+	{ -1181, 11436 }, { -1177, 11354 }, { -1173, 11272 }, { -1169, 11189 }, { -1165, 11106 }, { -1160, 11023 },
+	{ -1155, 10939 }, { -1150, 10855 }, { -1145, 10771 }, { -1140, 10687 }, { -1134, 10602 }, { -1128, 10517 },
+	{ -1122, 10432 }, { -1116, 10346 }, { -1110, 10260 }, { -1104, 10174 }, { -1097, 10088 }, { -1091, 10002 },
+	{ -1084, 9915 }, { -1077, 9828 }, { -1070, 9741 }, { -1062, 9654 }, { -1055, 9567 }, { -1047, 9479 },
+	{ -1040, 9392 }, { -1032, 9304 }, { -1024, 9216 }, { -1016, 9128 }, { -1008, 9040 }, { -999, 8951 },
+	{ -991, 8863 }, { -982, 8775 }, { -974, 8686 }, { -965, 8597 }, { -956, 8509 }, { -947, 8420 },
+	{ -938, 8331 }, { -929, 8242 }, { -920, 8154 }, { -911, 8065 }, { -901, 7976 }, { -892, 7887 },
+	{ -882, 7798 }, { -872, 7709 }, { -863, 7620 }, { -853, 7531 }, { -843, 7443 }, { -833, 7354 },
+	{ -823, 7265 }, { -813, 7177 }, { -803, 7088 }, { -793, 7000 }, { -782, 6911 }, { -772, 6823 },
+	{ -762, 6735 }, { -751, 6647 }, { -741, 6559 }, { -730, 6472 }, { -720, 6384 }, { -709, 6297 },
+	{ -699, 6209 }, { -688, 6122 }, { -678, 6035 }, { -667, 5949 }, { -657, 5862 }, { -646, 5776 },
+	{ -635, 5690 }, { -625, 5604 }, { -614, 5518 }, { -603, 5433 }, { -593, 5348 }, { -582, 5263 },
+	{ -571, 5178 }, { -561, 5094 }, { -550, 5010 }, { -539, 4926 }, { -529, 4843 }, { -518, 4760 },
+	{ -508, 4677 }, { -497, 4595 }, { -487, 4512 }, { -476, 4431 }, { -466, 4349 }, { -455, 4268 },
+	{ -445, 4188 }, { -435, 4107 }, { -424, 4027 }, { -414, 3948 }, { -404, 3869 }, { -394, 3790 },
+	{ -384, 3712 }, { -374, 3634 }, { -364, 3557 }, { -354, 3480 }, { -345, 3404 }, { -335, 3328 },
+	{ -325, 3252 }, { -316, 3177 }, { -306, 3103 }, { -297, 3029 }, { -288, 2955 }, { -278, 2882 },
+	{ -269, 2810 }, { -260, 2738 }, { -251, 2667 }, { -243, 2596 }, { -234, 2526 }, { -225, 2456 },
+	{ -217, 2387 }, { -209, 2319 }, { -200, 2251 }, { -192, 2184 }, { -184, 2117 }, { -176, 2052 },
+	{ -169, 1986 }, { -161, 1922 }, { -154, 1858 }, { -146, 1794 }, { -139, 1732 }, { -132, 1670 },
+	{ -125, 1608 }, { -119, 1548 }, { -112, 1488 }, { -106, 1429 }, { -99, 1370 }, { -93, 1313 },
+	{ -87, 1256 }, { -82, 1200 }, { -76, 1144 }, { -70, 1090 }, { -65, 1036 }, { -60, 983 },
+	{ -55, 930 }, { -51, 879 }, { -46, 828 }, { -42, 778 }, { -38, 729 }, { -34, 681 },
+	{ -30, 634 }, { -26, 588 }, { -23, 542 }, { -20, 497 }, { -17, 453 }, { -14, 411 },
+	{ -12, 369 }, { -10, 327 }, { -8, 287 }, { -6, 248 }, { -4, 210 }, { -3, 172 },
+	{ -2, 136 }, { -1, 100 }, { 0, 66 }, { 0, 32 }, { 0, 0 }
+};
+
+// Rounded from (1 - d) / (1 + d), d = 0.5 + i / DELAYLINE_FRAC_STEPS
+const int16_t g_pAllpassCoefficients[DELAYLINE_FRAC_STEPS] =
+{
+	10923, 10809, 10696, 10584, 10472, 10361, 10251, 10140, 10031, 9922, 9814, 9706,
+	9599, 9492, 9386, 9280, 9175, 9070, 8966, 8863, 8760, 8657, 8555, 8454,
+	8353, 8252, 8152, 8052, 7953, 7855, 7757, 7659, 7562, 7465, 7369, 7273,
+	7178, 7083, 6988, 6894, 6801, 6708, 6615, 6523, 6431, 6340, 6249, 6158,
+	6068, 5978, 5889, 5800, 5712, 5624, 5536, 5449, 5362, 5276, 5190, 5104,
+	5019, 4934, 4849, 4765, 4681, 4598, 4515, 4432, 4350, 4268, 4186, 4105,
+	4024, 3944, 3863, 3784, 3704, 3625, 3546, 3468, 3390, 3312, 3235, 3158,
+	3081, 3004, 2928, 2852, 2777, 2702, 2627, 2552, 2478, 2404, 2331, 2258,
+	2185, 2112, 2040, 1967, 1896, 1824, 1753, 1682, 1612, 1541, 1471, 1401,
+	1332, 1263, 1194, 1125, 1057, 989, 921, 854, 786, 719, 653, 586,
+	520, 454, 389, 323, 258, 193, 129, 64, 0, -64, -128, -191,
+	-254, -317, -380, -442, -504, -566, -628, -689, -750, -811, -872, -933,
+	-993, -1053, -1113, -1172, -1232, -1291, -1350, -1409, -1467, -1526, -1584, -1641,
+	-1699, -1757, -1814, -1871, -1928, -1984, -2040, -2097, -2153, -2208, -2264, -2319,
+	-2374, -2429, -2484, -2539, -2593, -2647, -2701, -2755, -2809, -2862, -2915, -2968,
+	-3021, -3074, -3126, -3179, -3231, -3283, -3334, -3386, -3437, -3488, -3539, -3590,
+	-3641, -3691, -3742, -3792, -3842, -3892, -3941, -3991, -4040, -4089, -4138, -4187,
+	-4235, -4284, -4332, -4380, -4428, -4476, -4524, -4571, -4618, -4665, -4712, -4759,
+	-4806, -4852, -4899, -4945, -4991, -5037, -5083, -5128, -5174, -5219, -5264, -5309,
+	-5354, -5399, -5444, -5488, -5532, -5576, -5620, -5664, -5708, -5752, -5795, -5838,
+	-5881, -5924, -5967, -6010, -6053, -6095, -6137, -6180, -6222, -6264, -6306, -6347,
+	-6389, -6430, -6471, -6513
+};
+
+
+/*
+ * delayline_get_block
+ *
+ * @returns line `i` (block `i` of g_DelayLinePool)
+ */
+static inline DelayLine_t *delayline_get_block(uint16_t i)
+{
+	return (DelayLine_t *)(g_DelayLinePool.pStorage + i * g_DelayLinePool.nBlockSize);
+}
+
+
+/*
+ * delayline_gap
+ *
+ * @returns free samples in the budget from `iStart` up to the next line in
+ * use, or 0 if a line covers `iStart`
+ */
+static uint16_t delayline_gap(uint16_t iStart)
+{
+	uint16_t iNext = DELAY_BUDGET_SAMPLES;
+
+	for(uint16_t i = 0; i < g_DelayLinePool.nCarved; ++i)
+	{
+		const DelayLine_t *pLine = delayline_get_block(i);
+
+		if(!pLine->nUsers)
+			continue;
+
+		const uint16_t iBegin = pLine->pSamples - s_pBudget;
+
+		if(iBegin <= iStart && iStart < iBegin + pLine->nSlots)
+			return 0;
+
+		if(iBegin > iStart && iBegin < iNext)
+			iNext = iBegin;
+	}
+
+	return iNext - iStart;
+}
+
+
+/*
+ * delayline_find_space
+ *
+ * Finds the lowest position in the budget with `nSlots` free samples, or with
+ * `bFromTop` the highest, at the top of its gap. Free space can only start at
+ * 0 or at the end of a line.
+ *
+ * @returns the position, or -1 if no gap is big enough
+ */
+static int32_t delayline_find_space(uint16_t nSlots, bool bFromTop)
+{
+	int32_t iBest = -1;
+
+	// Starting at -1 for the gap at the start of the budget
+	for(int32_t i = -1; i < g_DelayLinePool.nCarved; ++i)
+	{
+		uint16_t iGap = 0;
+
+		if(i >= 0)
+		{
+			const DelayLine_t *pLine = delayline_get_block(i);
+
+			if(!pLine->nUsers)
+				continue;
+
+			iGap = pLine->pSamples - s_pBudget + pLine->nSlots;
+		}
+
+		const uint16_t nGap = delayline_gap(iGap);
+		if(nGap < nSlots)
+			continue;
+
+		const int32_t iStart = bFromTop ? iGap + nGap - nSlots : iGap;
+
+		if(iBest < 0 || (bFromTop ? iStart > iBest : iStart < iBest))
+			iBest = iStart;
+	}
+
+	return iBest;
+}
+
+
+/*
+ * delayline_largest_free
+ *
+ * @returns the longest DELAYLINE_LINEAR line that could be allocated now
+ */
+static uint16_t delayline_largest_free(void)
+{
+	uint16_t nLargest = delayline_gap(0);
+
+	for(uint16_t i = 0; i < g_DelayLinePool.nCarved; ++i)
+	{
+		const DelayLine_t *pLine = delayline_get_block(i);
+
+		if(!pLine->nUsers)
+			continue;
+
+		const uint16_t nGap = delayline_gap(pLine->pSamples - s_pBudget + pLine->nSlots);
+
+		if(nGap > nLargest)
+			nLargest = nGap;
+	}
+
+	return nLargest;
+}
+
+
+/*
+ * mulaw_encode
+ *
+ * @returns the G.711 mu-law code of a 16 bit sample: a sign, 3 bit exponent
+ * and 4 bit mantissa, inverted
+ */
+static inline uint8_t mulaw_encode(int16_t sample)
+{
+	int32_t iMagnitude = sample;
+	uint8_t iSign = 0;
+
+	if(iMagnitude < 0)
+	{
+		iMagnitude = -iMagnitude;
+		iSign = 0x80;
+	}
+
+	if(iMagnitude > MULAW_CLIP)
+		iMagnitude = MULAW_CLIP;
+
+	// Biased magnitudes have their top bit between bits 7 and 14
+	iMagnitude += MULAW_BIAS;
+	const uint8_t iExponent = 24 - __builtin_clz(iMagnitude);
+	const uint8_t iMantissa = (iMagnitude >> (iExponent + 3)) & 0x0F;
+
+	return ~(iSign | (iExponent << 4) | iMantissa);
+}
+
+
+/*
+ * mulaw_decode
+ *
+ * @returns the 16 bit sample of a mu-law code
+ */
+static inline int16_t mulaw_decode(uint8_t code)
+{
+	code = ~code;
+	const int32_t iMagnitude = ((((code & 0x0F) << 3) + MULAW_BIAS) << ((code >> 4) & 0x07)) - MULAW_BIAS;
+
+	return (code & 0x80) ? -iMagnitude : iMagnitude;
+}
+
+
+/*
+ * adpcm_update
+ *
+ * Steps an IMA ADPCM predictor by a 4 bit code. The encoder and decoder both
+ * use this, so they stay in step.
+ *
+ * @returns the new 16 bit sample
+ */
+static inline int16_t adpcm_update(AdpcmState_t *pState, uint8_t code)
+{
+	const uint16_t nStep = s_pAdpcmSteps[pState->iStep];
+	int32_t iDelta = nStep >> 3;
+
+	if(code & 4)
+		iDelta += nStep;
+	if(code & 2)
+		iDelta += nStep >> 1;
+	if(code & 1)
+		iDelta += nStep >> 2;
+
+	pState->iPredictor = sat16(pState->iPredictor + ((code & 8) ? -iDelta : iDelta));
+
+	int16_t iStep = pState->iStep + s_pAdpcmStepChange[code & 7];
+
+	if(iStep < 0)
+		iStep = 0;
+	else if(iStep > ADPCM_MAX_STEP)
+		iStep = ADPCM_MAX_STEP;
+
+	pState->iStep = iStep;
+	return pState->iPredictor;
+}
+
+
+/*
+ * adpcm_encode
+ *
+ * @returns the 4 bit IMA ADPCM code (sign and 3 bit magnitude) of a 16 bit
+ * sample, the difference from the predictor in steps
+ */
+static inline uint8_t adpcm_encode(AdpcmState_t *pState, int16_t sample)
+{
+	uint16_t nStep = s_pAdpcmSteps[pState->iStep];
+	int32_t iDiff = sample - pState->iPredictor;
+	uint8_t code = 0;
+
+	if(iDiff < 0)
+	{
+		code = 8;
+		iDiff = -iDiff;
+	}
+
+	for(uint8_t iBit = 4; iBit; iBit >>= 1, nStep >>= 1)
+	{
+		if(iDiff >= nStep)
+		{
+			code |= iBit;
+			iDiff -= nStep;
+		}
+	}
+
+	adpcm_update(pState, code);
+	return code;
+}
+
+
+/*
+ * delayline_encode
+ *
+ * Stores `value` as sample `i` of the line, in its encoding. ADPCM samples
+ * must be encoded in order.
+ */
+static inline void delayline_encode(DelayLine_t *pLine, uint16_t i, int16_t value)
+{
+	uint8_t *pBytes = (uint8_t *)pLine->pSamples;
+
+	switch(pLine->iEncoding)
+	{
+	case DELAYLINE_LINEAR:
+		pLine->pSamples[i] = value;
+		break;
+
+	case DELAYLINE_MULAW:
+		pBytes[i] = mulaw_encode(sat16(value << DELAYLINE_CODEC_SHIFT));
+		break;
+
+	case DELAYLINE_ADPCM:
+	{
+		const uint8_t code = adpcm_encode(&pLine->encoder, sat16(value << DELAYLINE_CODEC_SHIFT));
+
+		// Two codes per byte, the even sample in the low nibble
+		if(i & 1)
+			pBytes[i >> 1] = (pBytes[i >> 1] & 0x0F) | (code << 4);
+		else
+			pBytes[i >> 1] = (pBytes[i >> 1] & 0xF0) | code;
+		break;
+	}
+	}
+}
+
+
+/*
+ * delayline_decode
+ *
+ * @returns sample `i` of the line. ADPCM samples must be decoded in the order
+ * they were encoded.
+ */
+static inline int16_t delayline_decode(DelayLine_t *pLine, uint16_t i)
+{
+	const uint8_t *pBytes = (const uint8_t *)pLine->pSamples;
+	const int32_t iRound = 1 << (DELAYLINE_CODEC_SHIFT - 1);
+
+	switch(pLine->iEncoding)
+	{
+	case DELAYLINE_MULAW:
+		return (mulaw_decode(pBytes[i]) + iRound) >> DELAYLINE_CODEC_SHIFT;
+
+	case DELAYLINE_ADPCM:
+	{
+		const uint8_t code = (i & 1) ? pBytes[i >> 1] >> 4 : pBytes[i >> 1] & 0x0F;
+		return (adpcm_update(&pLine->decoder, code) + iRound) >> DELAYLINE_CODEC_SHIFT;
+	}
+
+	default:
+		return pLine->pSamples[i];
+	}
+}
+
+
+/*
+ * delayline_acquire
+ *
+ * Gets a delay line of `nLength` samples, stored as `iEncoding`
+ * (DelayLineEncoding_e), for a filter's mod callback. `pPrevious` is the line
+ * the filter data had before (copied from the original filter data, or NULL).
+ * If it is already the right length and encoding it is shared, otherwise a
+ * new line is allocated from the budget. If both lines are DELAYLINE_LINEAR
+ * the newest samples of `pPrevious` are copied into it, so the output carries
+ * on; compressed lines start out silent. `pPrevious` isn't released here. Each
+ * call must be paired with delayline_release.
+ *
+ * Both lines are in use until the original filter data is freed, so changing
+ * a line's length needs room in the budget for both (see DELAY_MAX_SAMPLES).
+ *
+ * @returns the line, or NULL if there isn't a big enough gap in the budget or
+ * g_DelayLinePool is full
+ */
+DelayLine_t *delayline_acquire(DelayLine_t *pPrevious, uint16_t nLength, uint8_t iEncoding)
+{
+	dbg_assert(nLength > 0, "delay line must be at least 1 sample");
+	dbg_assert(iEncoding < DELAYLINE_ENCODINGS, "unknown delay line encoding %u", iEncoding);
+
+	if(pPrevious && pPrevious->nLength == nLength && pPrevious->iEncoding == iEncoding)
+	{
+		pPrevious->nUsers++;
+		return pPrevious;
+	}
+
+	const uint8_t nPerSlot = DELAYLINE_SAMPLES_PER_SLOT(iEncoding);
+	const uint16_t nSlots = ((uint32_t) nLength + nPerSlot - 1) / nPerSlot;
+
+	// The previous line stays allocated until the original filter data is
+	// freed, so put the new one at the other end of the budget. A single line
+	// then always sits against one end, leaving room for another half the
+	// budget long.
+	const bool bFromTop = pPrevious && pPrevious->pSamples - s_pBudget < DELAY_BUDGET_SAMPLES / 2;
+	const int32_t iStart = delayline_find_space(nSlots, bFromTop);
+
+	if(iStart < 0)
+	{
+		pool_report_full(&g_DelayLinePool);
+		dbg_warning("delay line budget full (%u budget samples requested, largest gap %u)\r\n", nSlots, delayline_largest_free());
+		return NULL;
+	}
+
+	DelayLine_t *pLine = pool_alloc(&g_DelayLinePool);
+	if(!pLine)
+		return NULL;
+
+	pLine->pSamples = s_pBudget + iStart;
+	pLine->nLength = nLength;
+	pLine->nSlots = nSlots;
+	pLine->iEncoding = iEncoding;
+	memset(pLine->pSamples, 0, nSlots * sizeof(int16_t));
+
+	// Oldest first, so the newest sample ends up newest
+	if(pPrevious && pPrevious->iEncoding == DELAYLINE_LINEAR && iEncoding == DELAYLINE_LINEAR)
+	{
+		uint16_t nCopy = pPrevious->nLength < nLength ? pPrevious->nLength : nLength;
+
+		while(nCopy--)
+			delayline_write(pLine, delayline_read(pPrevious, nCopy));
+	}
+
+	pLine->nUsers = 1;
+	return pLine;
+}
+
+
+/*
+ * delayline_release
+ *
+ * Releases a reference from delayline_acquire, freeing its samples once
+ * nothing uses the line. Releasing NULL does nothing.
+ */
+void delayline_release(DelayLine_t *pLine)
+{
+	if(!pLine)
+		return;
+
+	dbg_assert(pLine->nUsers > 0, "delay line %p is not in use", (void *)pLine);
+
+	if(--pLine->nUsers == 0)
+		pool_free(&g_DelayLinePool, pLine);
+}
+
+
+/*
+ * delayline_interp_cost
+ *
+ * @returns estimated cycles per sample to read with `iInterp`
+ * (DelayLineInterp_e), on top of linear interpolation
+ */
+uint16_t delayline_interp_cost(uint8_t iInterp)
+{
+	switch(iInterp)
+	{
+	case DELAYLINE_INTERP_HERMITE:
+		return 35;
+
+	case DELAYLINE_INTERP_ALLPASS:
+		return 15;
+
+	default:
+		return 0;
+	}
+}
+
+
+/*
+ * delayline_shift_encoded
+ *
+ * delayline_shift for compressed lines. The ADPCM decoder follows the
+ * encoder nLength - 1 samples behind, starting once the first sample
+ * written is the oldest.
+ */
+int16_t delayline_shift_encoded(DelayLine_t *pLine, int16_t value)
+{
+	uint16_t iCursor = pLine->iCursor;
+	delayline_encode(pLine, iCursor, value);
+
+	if(++iCursor >= pLine->nLength)
+		iCursor = 0;
+
+	pLine->iCursor = iCursor;
+
+	if(pLine->nFilled < pLine->nLength && ++pLine->nFilled < pLine->nLength)
+		return 0;
+
+	return delayline_decode(pLine, iCursor);
+}
+
+
+/*
+ * delayline_debug
+ *
+ * Prints every line in use and how much of the budget is left.
+ */
+void delayline_debug(void)
+{
+	uint32_t nUsed = 0;
+
+	dbg_printf(" === delayline_debug ===\r\n");
+
+	for(uint16_t i = 0; i < g_DelayLinePool.nCarved; ++i)
+	{
+		const DelayLine_t *pLine = delayline_get_block(i);
+
+		if(pLine->nUsers)
+		{
+			const uint16_t iBegin = pLine->pSamples - s_pBudget;
+
+			dbg_printf("#%u: samples %u-%u (%u, %s), %u user(s)\r\n", i, iBegin, iBegin + pLine->nSlots - 1, pLine->nLength,
+				s_ppszEncodings[pLine->iEncoding], pLine->nUsers);
+			nUsed += pLine->nSlots;
+		}
+	}
+
+	dbg_printf("budget: %lu/%u samples used, largest gap %u\r\n", nUsed, DELAY_BUDGET_SAMPLES, delayline_largest_free());
+	dbg_printf("\r\n");
+}
+
+
+// Samples encoded and decoded per run of delayline_benchmark, and runs per
+// encoding. Only the fastest run counts, so runs interrupted by the sampling
+// path are ignored.
+#define DELAYLINE_BENCH_SAMPLES	BLOCK_SAMPLES
+#define DELAYLINE_BENCH_RUNS	8
+
+// Length of the line, and samples shifted through it, to measure the SNR of
+// each encoding
+#define DELAYLINE_BENCH_LENGTH	100
+#define DELAYLINE_BENCH_SNR_SAMPLES	4000
+
+static volatile int32_t s_iBenchSink;	///< keeps the compiler from dropping the output
+
+
+/*
+ * delayline_bench_signal
+ *
+ * @returns sample `n` of the SNR test signal: two tones (440 Hz and 1.25 kHz)
+ * peaking at `flPeak`
+ */
+static int16_t delayline_bench_signal(uint16_t n, float flPeak)
+{
+	const float flTime = 2 * PI_F * n / SAMPLE_RATE;
+	return flPeak * (0.7f * sinf(440 * flTime) + 0.3f * sinf(1250 * flTime));
+}
+
+
+/*
+ * delayline_bench_snr
+ *
+ * Shifts the test signal through a new line stored as `iEncoding`, and
+ * compares what comes out with what went in.
+ *
+ * @returns the signal to noise ratio in tenths of a dB, INT32_MAX if lossless,
+ * or INT32_MIN if the line couldn't be allocated
+ */
+static int32_t delayline_bench_snr(uint8_t iEncoding, float flPeak)
+{
+	DelayLine_t *pLine = delayline_acquire(NULL, DELAYLINE_BENCH_LENGTH, iEncoding);
+	if(!pLine)
+		return INT32_MIN;
+
+	const uint16_t nDelay = DELAYLINE_BENCH_LENGTH - 1;
+	uint64_t ullSignal = 0;
+	uint64_t ullNoise = 0;
+
+	for(uint16_t n = 0; n < DELAYLINE_BENCH_SNR_SAMPLES; ++n)
+	{
+		const int32_t iOutput = delayline_shift(pLine, delayline_bench_signal(n, flPeak));
+
+		if(n < nDelay)
+			continue;
+
+		const int32_t iExpected = delayline_bench_signal(n - nDelay, flPeak);
+		ullSignal += iExpected * iExpected;
+		ullNoise += (iOutput - iExpected) * (iOutput - iExpected);
+	}
+
+	delayline_release(pLine);
+
+	if(!ullNoise)
+		return INT32_MAX;
+
+	return 100 * log10f((float) ullSignal / ullNoise);
+}
+
+
+// Prints a delay line SNR, from delayline_bench_snr
+static void delayline_bench_print_snr(const char *pszLevel, int32_t iSNR)
+{
+	if(iSNR == INT32_MIN)
+		dbg_printf(", no line for SNR at %s", pszLevel);
+	else if(iSNR == INT32_MAX)
+		dbg_printf(", lossless at %s", pszLevel);
+	else
+		dbg_printf(", SNR %ld.%ld dB at %s", iSNR / 10, (iSNR < 0 ? -iSNR : iSNR) % 10, pszLevel);
+}
+
+
+/*
+ * delayline_benchmark
+ *
+ * Times encoding and decoding DELAYLINE_BENCH_SAMPLES samples with each
+ * encoding, and measures its SNR on a loud (-6 dBFS) and a quiet (-30 dBFS)
+ * test signal. Uses a spare block of g_DelayLinePool and
+ * DELAYLINE_BENCH_LENGTH samples of the budget.
+ */
+void delayline_benchmark(void)
+{
+	int16_t pInput[DELAYLINE_BENCH_SAMPLES];
+
+	for(uint16_t n = 0; n < DELAYLINE_BENCH_SAMPLES; ++n)
+		pInput[n] = delayline_bench_signal(n, ADC_MID_POINT / 2);
+
+	dbg_printf(" === delayline_benchmark ===\r\n");
+	dbg_printf("best of %u runs of %u samples, SNR over %u samples:\r\n", DELAYLINE_BENCH_RUNS, DELAYLINE_BENCH_SAMPLES, DELAYLINE_BENCH_SNR_SAMPLES);
+
+	for(uint8_t iEncoding = 0; iEncoding < DELAYLINE_ENCODINGS; ++iEncoding)
+	{
+		DelayLine_t *pLine = delayline_acquire(NULL, DELAYLINE_BENCH_LENGTH, iEncoding);
+		if(!pLine)
+			return;
+
+		uint32_t ulEncode = UINT32_MAX;
+		uint32_t ulDecode = UINT32_MAX;
+
+		for(uint8_t iRun = 0; iRun < DELAYLINE_BENCH_RUNS; ++iRun)
+		{
+			const AdpcmState_t start = pLine->encoder;
+			int32_t sum = 0;
+
+			uint32_t ulStartCycles = PROFILE_CYCLES();
+
+			for(uint16_t n = 0; n < DELAYLINE_BENCH_SAMPLES; ++n)
+				delayline_encode(pLine, n, pInput[n]);
+
+			const uint32_t ulEncodeCycles = PROFILE_CYCLES() - ulStartCycles;
+
+			// Decode from where the encoder started
+			pLine->decoder = start;
+			ulStartCycles = PROFILE_CYCLES();
+
+			for(uint16_t n = 0; n < DELAYLINE_BENCH_SAMPLES; ++n)
+				sum += delayline_decode(pLine, n);
+
+			const uint32_t ulDecodeCycles = PROFILE_CYCLES() - ulStartCycles;
+			s_iBenchSink = sum;
+
+			if(ulEncodeCycles < ulEncode)
+				ulEncode = ulEncodeCycles;
+			if(ulDecodeCycles < ulDecode)
+				ulDecode = ulDecodeCycles;
+		}
+
+		delayline_release(pLine);
+
+		const int32_t iLoudSNR = delayline_bench_snr(iEncoding, ADC_MID_POINT / 2);
+		const int32_t iQuietSNR = delayline_bench_snr(iEncoding, ADC_MID_POINT / 32);
+		const uint32_t ulMaxDelayMs = (uint32_t) DELAY_BUDGET_SAMPLES * DELAYLINE_SAMPLES_PER_SLOT(iEncoding) * 1000 / SAMPLE_RATE;
+
+		dbg_printf("  - %s: %u bits/sample, up to %lu ms, encode %lu cycles/sample, decode %lu cycles/sample", s_ppszEncodings[iEncoding],
+			16 / DELAYLINE_SAMPLES_PER_SLOT(iEncoding), ulMaxDelayMs, ulEncode / DELAYLINE_BENCH_SAMPLES, ulDecode / DELAYLINE_BENCH_SAMPLES);
+		delayline_bench_print_snr("-6 dBFS", iLoudSNR);
+		delayline_bench_print_snr("-30 dBFS", iQuietSNR);
+		dbg_printf("\r\n");
+	}
+
+	dbg_printf("\r\n");
+}
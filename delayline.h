@@ -0,0 +1,279 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * delayline.c - Per-branch delay lines
+ *
+ * Filters that need past samples (Delay, Flange, Vibrato, FIR) keep their own
+ * delay line of their own input, rather than reading the shared sample history
+ * of the chain input. Each line is exactly as long as the filter asks for, and
+ * is carved out of a fixed budget of DELAY_BUDGET_SAMPLES samples. Line
+ * descriptors are allocated from g_DelayLinePool.
+ *
+ * Lines can optionally be stored compressed, for long delays: 8 bit mu-law
+ * (2 samples per budget sample) or 4 bit IMA ADPCM (4 samples per budget
+ * sample). Compressed lines are only read through delayline_shift.
+ *
+ * Lines are allocated and released from the main loop (in mod and free
+ * callbacks), and only read and written by the sampling path.
+ */
+
+#ifndef _DELAYLINE_H_
+#define _DELAYLINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "fixed.h"
+
+
+/*
+ * DelayLineEncoding_e
+ *
+ * How a line stores its samples, in order of density (and of the "Encoding"
+ * filter parameter)
+ */
+typedef enum
+{
+	DELAYLINE_LINEAR = 0,	///< int16_t
+	DELAYLINE_MULAW,		///< 8 bit G.711 mu-law, random access
+	DELAYLINE_ADPCM,		///< 4 bit IMA ADPCM, decoded in order
+	DELAYLINE_ENCODINGS
+} DelayLineEncoding_e;
+
+// Samples of a line stored in each sample of the budget
+#define DELAYLINE_SAMPLES_PER_SLOT(iEncoding)	(1 << (iEncoding))
+
+
+/*
+ * DelayLineInterp_e
+ *
+ * How a fractional delay is read from a line (the "Interpolation" filter
+ * parameter)
+ */
+typedef enum
+{
+	DELAYLINE_INTERP_LINEAR = 0,	///< 2 taps, delayline_read_q16
+	DELAYLINE_INTERP_HERMITE,		///< 4 taps, cubic, delayline_read_hermite
+	DELAYLINE_INTERP_ALLPASS,		///< 2 taps and feedback, flat magnitude, delayline_read_allpass
+	DELAYLINE_INTERPS
+} DelayLineInterp_e;
+
+// Fractional delays are rounded to 1/DELAYLINE_FRAC_STEPS of a sample to look
+// up the interpolation coefficients
+#define DELAYLINE_FRAC_BITS		8
+#define DELAYLINE_FRAC_STEPS	(1 << DELAYLINE_FRAC_BITS)
+
+// Samples a line needs beyond the whole part of the longest delay read from
+// it, with any interpolation
+#define DELAYLINE_INTERP_TAPS	3
+
+
+/*
+ * AdpcmState_t
+ *
+ * Predictor of an IMA ADPCM encoder or decoder. A decoder reproduces the
+ * samples if it starts from the same state as the encoder did.
+ */
+typedef struct
+{
+	int16_t iPredictor;		///< last sample (16 bit)
+	uint8_t iStep;			///< index into the step size table [0-88]
+} AdpcmState_t;
+
+
+/*
+ * DelayLine_t
+ *
+ * A circular buffer of nLength samples in the budget. pSamples overlaps the
+ * pool free list pointer, so it is only valid while nUsers > 0.
+ */
+typedef struct
+{
+	int16_t *pSamples;		///< nSlots samples in the budget, holding nLength encoded samples
+	uint16_t nLength;		///< samples in the line
+	uint16_t nSlots;		///< budget samples taken by the line
+	uint16_t iCursor;		///< where the next sample will be written [0-(nLength-1)]
+	uint16_t nFilled;		///< samples written since allocation, up to nLength
+	uint8_t iEncoding;		///< DelayLineEncoding_e
+	uint8_t nUsers;			///< filter data referencing this line, 0 when free
+	AdpcmState_t encoder;	///< DELAYLINE_ADPCM state of the newest sample
+	AdpcmState_t decoder;	///< DELAYLINE_ADPCM state of the oldest sample
+	int16_t iAllpassOutput;	///< last output of delayline_read_allpass
+} DelayLine_t;
+
+
+// Catmull-Rom (Hermite) coefficients of the nearer outer and inner taps, in
+// Q14, for each fraction [0-DELAYLINE_FRAC_STEPS]. The other two taps use
+// the coefficients of 1 - fraction.
+extern const int16_t g_pHermiteCoefficients[DELAYLINE_FRAC_STEPS + 1][2];
+
+// First order all-pass coefficients (1 - d) / (1 + d) in Q15, for delays d
+// of 0.5 + fraction
+extern const int16_t g_pAllpassCoefficients[DELAYLINE_FRAC_STEPS];
+
+
+int16_t delayline_shift_encoded(DelayLine_t *pLine, int16_t value);
+
+
+/*
+ * delayline_write
+ *
+ * Adds `value` to the line as the newest sample.
+ */
+static inline void delayline_write(DelayLine_t *pLine, int16_t value)
+{
+	uint16_t iCursor = pLine->iCursor;
+	pLine->pSamples[iCursor] = value;
+
+	if(++iCursor >= pLine->nLength)
+		iCursor = 0;
+
+	pLine->iCursor = iCursor;
+}
+
+
+/*
+ * delayline_read
+ *
+ * Returns the sample written `nDelay` samples before the newest one, so 0 is
+ * the newest. `nDelay` must be less than the line length. Only for
+ * DELAYLINE_LINEAR lines.
+ */
+static inline int16_t delayline_read(const DelayLine_t *pLine, uint16_t nDelay)
+{
+	int32_t i = (int32_t) pLine->iCursor - 1 - nDelay;
+
+	if(i < 0)
+		i += pLine->nLength;
+
+	return pLine->pSamples[i];
+}
+
+
+/*
+ * delayline_read_q16
+ *
+ * Returns the sample `qDelay` (Q16.16) samples before the newest one, linearly
+ * interpolated. The whole part of `qDelay` must be at least 2 less than the
+ * line length. Only for DELAYLINE_LINEAR lines.
+ */
+static inline int16_t delayline_read_q16(const DelayLine_t *pLine, uint32_t qDelay)
+{
+	const uint16_t nDelay = qDelay >> Q16_SHIFT;
+	const int32_t qFrac = qDelay & (Q16_ONE - 1);
+
+	const int32_t si = delayline_read(pLine, nDelay);
+	const int32_t sj = delayline_read(pLine, nDelay + 1);
+
+	return si + (((sj - si) * qFrac) >> Q16_SHIFT);
+}
+
+
+/*
+ * delayline_read_hermite
+ *
+ * Returns the sample `qDelay` (Q16.16) samples before the newest one, cubic
+ * (Catmull-Rom) interpolated from the two samples either side. Smoother than
+ * linear interpolation, which dulls high frequencies at half-sample delays.
+ * The whole part of `qDelay` must be at least DELAYLINE_INTERP_TAPS less than
+ * the line length. Only for DELAYLINE_LINEAR lines.
+ */
+static inline int16_t delayline_read_hermite(const DelayLine_t *pLine, uint32_t qDelay)
+{
+	const uint16_t nDelay = qDelay >> Q16_SHIFT;
+	const uint16_t iFrac = (qDelay & (Q16_ONE - 1)) >> (Q16_SHIFT - DELAYLINE_FRAC_BITS);
+
+	const int16_t *pNear = g_pHermiteCoefficients[iFrac];
+	const int16_t *pFar = g_pHermiteCoefficients[DELAYLINE_FRAC_STEPS - iFrac];
+
+	// There's nothing newer than the newest sample to interpolate from
+	const int32_t sh = delayline_read(pLine, nDelay ? nDelay - 1 : 0);
+	const int32_t si = delayline_read(pLine, nDelay);
+	const int32_t sj = delayline_read(pLine, nDelay + 1);
+	const int32_t sk = delayline_read(pLine, nDelay + 2);
+
+	const int32_t iSum = sh * pNear[0] + si * pNear[1] + sj * pFar[1] + sk * pFar[0];
+	return sat16((iSum + (1 << 13)) >> 14);
+}
+
+
+/*
+ * delayline_read_allpass
+ *
+ * Returns the sample `qDelay` (Q16.16) samples before the newest one, through
+ * a first order all-pass filter with a delay of 0.5-1.5 samples. Unlike
+ * linear interpolation this doesn't dull high frequencies, but the filter
+ * rings briefly when the delay jumps, so it suits slowly swept delays. Must
+ * be called once per sample written. Delays under half a sample are read as
+ * half a sample. The whole part of `qDelay` must be at least 2 less than the
+ * line length. Only for DELAYLINE_LINEAR lines.
+ */
+static inline int16_t delayline_read_allpass(DelayLine_t *pLine, uint32_t qDelay)
+{
+	const uint32_t qBase = qDelay > Q16_ONE / 2 ? qDelay - Q16_ONE / 2 : 0;
+	const uint16_t nDelay = qBase >> Q16_SHIFT;
+	const uint16_t iFrac = (qBase & (Q16_ONE - 1)) >> (Q16_SHIFT - DELAYLINE_FRAC_BITS);
+
+	// y[n] = x[n - 1] + coeff * (x[n] - y[n - 1])
+	const int32_t si = delayline_read(pLine, nDelay);
+	const int32_t sj = delayline_read(pLine, nDelay + 1);
+	const int16_t output = sat16(sj + q15_mul(si - pLine->iAllpassOutput, g_pAllpassCoefficients[iFrac]));
+
+	pLine->iAllpassOutput = output;
+	return output;
+}
+
+
+/*
+ * delayline_read_interp
+ *
+ * Returns the sample `qDelay` (Q16.16) samples before the newest one,
+ * interpolated as `iInterp` (DelayLineInterp_e). See the delayline_read_*
+ * functions for the limits on `qDelay`; a line DELAYLINE_INTERP_TAPS longer
+ * than the whole part of the longest delay suits them all.
+ */
+static inline int16_t delayline_read_interp(DelayLine_t *pLine, uint32_t qDelay, uint8_t iInterp)
+{
+	switch(iInterp)
+	{
+	case DELAYLINE_INTERP_HERMITE:
+		return delayline_read_hermite(pLine, qDelay);
+
+	case DELAYLINE_INTERP_ALLPASS:
+		return delayline_read_allpass(pLine, qDelay);
+
+	default:
+		return delayline_read_q16(pLine, qDelay);
+	}
+}
+
+
+/*
+ * delayline_shift
+ *
+ * Adds `value` to the line as the newest sample, and returns the oldest
+ * sample, the one written nLength - 1 samples before it (0 until the line has
+ * filled). Works with any encoding.
+ */
+static inline int16_t delayline_shift(DelayLine_t *pLine, int16_t value)
+{
+	if(pLine->iEncoding != DELAYLINE_LINEAR)
+		return delayline_shift_encoded(pLine, value);
+
+	delayline_write(pLine, value);
+	return pLine->pSamples[pLine->iCursor];
+}
+
+
+DelayLine_t *delayline_acquire(DelayLine_t *pPrevious, uint16_t nLength, uint8_t iEncoding);
+void delayline_release(DelayLine_t *pLine);
+uint16_t delayline_interp_cost(uint8_t iInterp);
+void delayline_debug(void);
+void delayline_benchmark(void);
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * envelope.c - Shared envelope followers
+ *
+ * The dynamics filters (Noise Gate, Compressor, Expander) read the level of
+ * their input from a bank of one-pole attack/release detectors, allocated from
+ * g_EnvelopePool. The bank holds each detector's settings, and each audio
+ * context (see context.h) keeps its own state of them, which each filter moves
+ * along with the samples it is given (see envelope_follow).
+ * Each filter has its own detector, as filters at different points in the chain
+ * see different signals. Branches of the same stage are given the same input,
+ * so a branch only copies the levels of an earlier one with the same attack,
+ * release and mode. Levels are in dBFS, so gain curves can be applied in the
+ * log domain.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "config.h"
+#include "dbg.h"
+#include "fixed.h"
+#include "pool.h"
+#include "samples.h"
+#include "context.h"
+#include "envelope.h"
+
+
+// log2(1 + i/ENVELOPE_TABLE_SIZE) and 2^(i/ENVELOPE_TABLE_SIZE), both in Q16.
+// The extra entry is the value at the end of the octave, so the last step can
+// be interpolated.
+static uint32_t s_pLog2Table[ENVELOPE_TABLE_SIZE + 1];
+static uint32_t s_pExp2Table[ENVELOPE_TABLE_SIZE + 1];
+
+// Names of each EnvelopeMode_e, for envelope_debug
+static const char *s_ppszModes[ENVELOPE_MODES] = {"peak", "RMS"};
+
+// Coefficient of the ENVELOPE_RMS mean square, set by envelope_init
+static uint32_t s_ulMeanSquareCoefficient = 0;
+
+// Serial of the last detector started (0 is never used, see EnvelopeState_t)
+static uint32_t s_ulSerial = 0;
+
+
+/*
+ * envelope_get_block
+ *
+ * @returns detector `iEnvelope` (block `iEnvelope` of g_EnvelopePool)
+ */
+static inline Envelope_t *envelope_get_block(uint8_t iEnvelope)
+{
+	return (Envelope_t *)(g_EnvelopePool.pStorage + iEnvelope * g_EnvelopePool.nBlockSize);
+}
+
+
+/*
+ * envelope_one_pole
+ *
+ * Moves `ulEnvelope` towards `ulTarget` by Q31 coefficient `ulCoefficient`,
+ * rounding to nearest. Both must be < 2^31.
+ */
+static inline uint32_t envelope_one_pole(uint32_t ulEnvelope, uint32_t ulTarget, uint32_t ulCoefficient)
+{
+	return ulEnvelope + (((int64_t)((int32_t) ulTarget - (int32_t) ulEnvelope) * ulCoefficient + (1U << 30)) >> 31);
+}
+
+
+// One-pole coefficient (Q31) that moves 1-1/e of the way in `nMsec`
+static uint32_t envelope_coefficient(uint16_t nMsec)
+{
+	if(!nMsec)
+		return INT32_MAX;
+
+	return (1 - expf(-1000.0f / ((float) nMsec * SAMPLE_RATE))) * INT32_MAX;
+}
+
+
+/*
+ * envelope_init
+ *
+ * Fills the log2/exp2 tables. Called once at boot.
+ */
+void envelope_init(void)
+{
+	s_ulMeanSquareCoefficient = envelope_coefficient(ENVELOPE_RMS_MSEC);
+
+	for(uint16_t i = 0; i <= ENVELOPE_TABLE_SIZE; ++i)
+	{
+		s_pLog2Table[i] = log2f(1 + (float) i / ENVELOPE_TABLE_SIZE) * Q16_ONE + 0.5f;
+		s_pExp2Table[i] = exp2f((float) i / ENVELOPE_TABLE_SIZE) * Q16_ONE + 0.5f;
+	}
+}
+
+
+/*
+ * envelope_log2
+ *
+ * @returns log2(`ul`) in Q16, `ul` must be > 0
+ */
+static inline int32_t envelope_log2(uint32_t ul)
+{
+	const uint8_t nExponent = 31 - __builtin_clz(ul);
+
+	// Normalise so the leading 1 is bit 31, the bits below it are the fraction
+	const uint32_t ulMantissa = ul << (31 - nExponent);
+	const uint32_t i = (ulMantissa >> (31 - ENVELOPE_TABLE_LOG2)) & (ENVELOPE_TABLE_SIZE - 1);
+	const uint32_t ulFrac = (ulMantissa >> (31 - ENVELOPE_TABLE_LOG2 - Q16_SHIFT)) & (Q16_ONE - 1);
+
+	return (nExponent << Q16_SHIFT) + s_pLog2Table[i] + (((s_pLog2Table[i + 1] - s_pLog2Table[i]) * ulFrac) >> Q16_SHIFT);
+}
+
+
+/*
+ * envelope_db_to_gain
+ *
+ * Converts `qDb` dB (Q8) to a gain (Q15), e.g. 0 dB is Q15_ONE and -6 dB is
+ * about Q15_HALF.
+ */
+qgain_t envelope_db_to_gain(int32_t qDb)
+{
+	// dB / 20log10(2) is log2 of the gain, in Q16
+	const int32_t qLog2 = (qDb * 10885) >> DB_SHIFT;
+	const int32_t nExponent = qLog2 >> Q16_SHIFT;
+
+	if(nExponent < -Q15_SHIFT - 1)
+		return 0;
+
+	const uint32_t i = (qLog2 >> (Q16_SHIFT - ENVELOPE_TABLE_LOG2)) & (ENVELOPE_TABLE_SIZE - 1);
+	const uint32_t ulFrac = ((uint32_t) qLog2 << ENVELOPE_TABLE_LOG2) & (Q16_ONE - 1);
+	const uint32_t ulMantissa = s_pExp2Table[i] + (((s_pExp2Table[i + 1] - s_pExp2Table[i]) * ulFrac) >> Q16_SHIFT);
+
+	// Mantissa is Q16 in [1-2)
+	const int32_t nShift = Q16_SHIFT - Q15_SHIFT - nExponent;
+
+	if(nShift < 0)
+		return ulMantissa << -nShift;
+
+	return (ulMantissa + ((1 << nShift) >> 1)) >> nShift;
+}
+
+
+/*
+ * envelope_matches
+ *
+ * @returns true if `pEnvelope` has the given settings
+ */
+static inline bool envelope_matches(const Envelope_t *pEnvelope, uint8_t nAttackMsec, uint16_t nReleaseMsec, uint8_t iMode)
+{
+	return pEnvelope->nAttackMsec == nAttackMsec && pEnvelope->nReleaseMsec == nReleaseMsec && pEnvelope->iMode == iMode;
+}
+
+
+/*
+ * envelope_follow
+ *
+ * Called by the dynamics filters with each block of `nSamples` samples they
+ * are given (pSamples[0] is at the history cursor of `pContext`), the input of
+ * stage pContext->nStage. Moves the context's state of detector `iEnvelope`
+ * along the block and converts its envelope to dBFS.
+ *
+ * @returns the level of each sample in the block (dBFS, Q8)
+ */
+const int16_t *envelope_follow(AudioContext_t *pContext, uint8_t iEnvelope, const int16_t *pSamples, uint16_t nSamples)
+{
+	dbg_assert(nSamples <= BLOCK_SAMPLES, "block of %u samples is too long", nSamples);
+
+	const Envelope_t *pEnvelope = envelope_get_block(iEnvelope);
+	EnvelopeState_t *pState = &pContext->pEnvelopes[iEnvelope];
+
+	// Samples since the context started, up to pSamples[0], which may be part
+	// way through the block
+	const uint32_t ulSample = pContext->ulSamples + ((pContext->history.iCursor - pContext->iBlockCursor) & BUFFER_MASK);
+
+	// New detector, start from silence
+	if(pState->ulSerial != pEnvelope->ulSerial)
+	{
+		pState->ulSerial = pEnvelope->ulSerial;
+		pState->ulEnvelope = 0;
+		pState->ulMeanSquare = 0;
+		pState->nLevels = 0;
+	}
+
+	pState->nStage = pContext->nStage;
+
+	// Copy an earlier branch of this stage with the same settings, as it has
+	// already followed the same samples
+	for(uint16_t i = 0; i < g_EnvelopePool.nCarved; ++i)
+	{
+		const Envelope_t *pOther = envelope_get_block(i);
+		const EnvelopeState_t *pOtherState = &pContext->pEnvelopes[i];
+
+		if(i == iEnvelope || !pOther->nUsers || pOtherState->ulSerial != pOther->ulSerial)
+			continue;
+
+		if(pOtherState->nStage == pState->nStage && pOtherState->ulFirstSample == ulSample && pOtherState->nLevels == nSamples
+			&& envelope_matches(pOther, pEnvelope->nAttackMsec, pEnvelope->nReleaseMsec, pEnvelope->iMode))
+		{
+			pState->ulEnvelope = pOtherState->ulEnvelope;
+			pState->ulMeanSquare = pOtherState->ulMeanSquare;
+			pState->ulFirstSample = ulSample;
+			pState->nLevels = nSamples;
+			memcpy(pState->pLevels, pOtherState->pLevels, nSamples * sizeof(int16_t));
+
+			return pState->pLevels;
+		}
+	}
+
+	const bool bRMS = pEnvelope->iMode == ENVELOPE_RMS;
+	uint32_t ulEnvelope = pState->ulEnvelope;
+	uint32_t ulMeanSquare = pState->ulMeanSquare;
+
+	for(uint16_t n = 0; n < nSamples; ++n)
+	{
+		uint32_t ulInput = pSamples[n] < 0 ? -pSamples[n] : pSamples[n];
+		if(ulInput > ADC_MID_POINT - 1)
+			ulInput = ADC_MID_POINT - 1;
+
+		// Full scale is 2^27 or 2^31, so both stay inside 32 bits. Attack and
+		// release on x^2 itself would follow the peaks, so RMS detectors
+		// average it first.
+		uint32_t ulTarget;
+
+		if(bRMS)
+		{
+			ulMeanSquare = envelope_one_pole(ulMeanSquare, (ulInput * ulInput) << 9, s_ulMeanSquareCoefficient);
+			ulTarget = ulMeanSquare;
+		}
+		else
+			ulTarget = ulInput << Q16_SHIFT;
+
+		ulEnvelope = envelope_one_pole(ulEnvelope, ulTarget, ulTarget > ulEnvelope ? pEnvelope->ulAttack : pEnvelope->ulRelease);
+
+		// Convert to dBFS: 20log10(|x|/2048) or 10log10(x^2/2048^2)
+		int32_t qLevel = ENVELOPE_MIN_DB * DB_ONE;
+
+		if(ulEnvelope)
+		{
+			const int32_t qLog2 = envelope_log2(ulEnvelope) - ((bRMS ? 31 : 27) << Q16_SHIFT);
+			qLevel = ((int64_t) qLog2 * (bRMS ? 771 : 1541)) >> Q16_SHIFT;
+
+			if(qLevel < ENVELOPE_MIN_DB * DB_ONE)
+				qLevel = ENVELOPE_MIN_DB * DB_ONE;
+		}
+
+		pState->pLevels[n] = qLevel;
+	}
+
+	pState->ulEnvelope = ulEnvelope;
+	pState->ulMeanSquare = ulMeanSquare;
+	pState->ulFirstSample = ulSample;
+	pState->nLevels = nSamples;
+
+	return pState->pLevels;
+}
+
+
+/*
+ * envelope_acquire
+ *
+ * Starts a detector following in mode `iMode` with the given attack and
+ * release times. If detector `iPrevious` (which may be ENVELOPE_NONE) has the
+ * same settings it is shared instead, so a copy of a filter made to edit it
+ * carries on from the original's level. Each call must be paired with
+ * envelope_release.
+ *
+ * @returns index of the detector, or ENVELOPE_NONE if the bank is full
+ */
+uint8_t envelope_acquire(uint8_t nAttackMsec, uint16_t nReleaseMsec, uint8_t iMode, uint8_t iPrevious)
+{
+	if(iMode >= ENVELOPE_MODES)
+	{
+		dbg_warning("invalid detector mode %u\r\n", iMode);
+		iMode = ENVELOPE_PEAK;
+	}
+
+	if(iPrevious != ENVELOPE_NONE)
+	{
+		Envelope_t *pEnvelope = envelope_get_block(iPrevious);
+		dbg_assert(iPrevious < g_EnvelopePool.nCarved && pEnvelope->nUsers > 0, "envelope %u is not in use", iPrevious);
+
+		if(envelope_matches(pEnvelope, nAttackMsec, nReleaseMsec, iMode))
+		{
+			pEnvelope->nUsers++;
+			return iPrevious;
+		}
+	}
+
+	Envelope_t *pEnvelope = (Envelope_t *)pool_alloc(&g_EnvelopePool);
+	if(!pEnvelope)
+		return ENVELOPE_NONE;
+
+	pEnvelope->nAttackMsec = nAttackMsec;
+	pEnvelope->nReleaseMsec = nReleaseMsec;
+	pEnvelope->iMode = iMode;
+	pEnvelope->ulAttack = envelope_coefficient(nAttackMsec);
+	pEnvelope->ulRelease = envelope_coefficient(nReleaseMsec);
+
+	// Every context's state for this block belongs to the last detector in it
+	if(++s_ulSerial == 0)
+		s_ulSerial = 1;
+
+	pEnvelope->ulSerial = s_ulSerial;
+
+	// envelope_follow skips detectors with no users, so set this last
+	pEnvelope->nUsers = 1;
+
+	return ((uint8_t *)pEnvelope - g_EnvelopePool.pStorage) / g_EnvelopePool.nBlockSize;
+}
+
+
+/*
+ * envelope_release
+ *
+ * Releases a reference from envelope_acquire. Releasing ENVELOPE_NONE does
+ * nothing.
+ */
+void envelope_release(uint8_t iEnvelope)
+{
+	if(iEnvelope == ENVELOPE_NONE)
+		return;
+
+	Envelope_t *pEnvelope = envelope_get_block(iEnvelope);
+	dbg_assert(iEnvelope < g_EnvelopePool.nCarved && pEnvelope->nUsers > 0, "envelope %u is not in use", iEnvelope);
+
+	if(--pEnvelope->nUsers == 0)
+		pool_free(&g_EnvelopePool, pEnvelope);
+}
+
+
+/*
+ * envelope_debug
+ *
+ * Prints every running detector and its latest level in `pContext`.
+ */
+void envelope_debug(const AudioContext_t *pContext)
+{
+	dbg_printf(" === envelope_debug ===\r\n");
+
+	for(uint16_t i = 0; i < g_EnvelopePool.nCarved; ++i)
+	{
+		const Envelope_t *pEnvelope = envelope_get_block(i);
+
+		if(pEnvelope->nUsers)
+		{
+			const EnvelopeState_t *pState = &pContext->pEnvelopes[i];
+			const int16_t qLevel = pState->ulSerial == pEnvelope->ulSerial && pState->nLevels ? pState->pLevels[pState->nLevels - 1] : ENVELOPE_MIN_DB * DB_ONE;
+			const uint16_t nLevel = qLevel < 0 ? -qLevel : qLevel;
+
+			dbg_printf("#%u: %s, attack %u msec, release %u msec, level %s%u.%u dBFS, %u user(s)\r\n", i, s_ppszModes[pEnvelope->iMode], pEnvelope->nAttackMsec, pEnvelope->nReleaseMsec,
+				qLevel < 0 ? "-" : "", nLevel >> DB_SHIFT, ((nLevel & (DB_ONE - 1)) * 10) >> DB_SHIFT, pEnvelope->nUsers);
+		}
+	}
+
+	dbg_printf("\r\n");
+}
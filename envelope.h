@@ -0,0 +1,115 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * envelope.c - Shared envelope followers
+ *
+ * The dynamics filters (Noise Gate, Compressor, Expander) read the level of
+ * their input from a bank of one-pole attack/release detectors, allocated from
+ * g_EnvelopePool. The bank holds each detector's settings, and each audio
+ * context (see context.h) keeps its own state of them, which each filter moves
+ * along with the samples it is given (see envelope_follow).
+ * Each filter has its own detector, as filters at different points in the chain
+ * see different signals. Branches of the same stage are given the same input,
+ * so a branch only copies the levels of an earlier one with the same attack,
+ * release and mode. Levels are in dBFS, so gain curves can be applied in the
+ * log domain.
+ */
+
+#ifndef _ENVELOPE_H_
+#define _ENVELOPE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "fixed.h"
+
+
+// Fraction bits of levels and gains in dB
+#define DB_SHIFT		8
+#define DB_ONE			(1 << DB_SHIFT)	///< 1 dB
+
+// Quietest level reported, in dBFS. A 12 bit sample only covers ~72 dB.
+#define ENVELOPE_MIN_DB		(-96)
+
+// Entries in the log2/exp2 tables (as a power of two). Values between entries
+// are linearly interpolated.
+#define ENVELOPE_TABLE_LOG2	6
+#define ENVELOPE_TABLE_SIZE	(1 << ENVELOPE_TABLE_LOG2)
+
+// Index returned by envelope_acquire when the bank is full
+#define ENVELOPE_NONE		0xFF
+
+// Window of the mean square taken before the attack/release stage of an
+// ENVELOPE_RMS detector (msec)
+#define ENVELOPE_RMS_MSEC	10
+
+// Estimated cycles per sample to update a detector
+#define ENVELOPE_COST		55
+
+
+/*
+ * EnvelopeMode_e
+ *
+ * What each detector follows, in the order of the "Detector" filter parameter
+ */
+typedef enum
+{
+	ENVELOPE_PEAK = 0,	///< |x|, reacts to transients
+	ENVELOPE_RMS,		///< mean x^2, closer to perceived loudness
+	ENVELOPE_MODES
+} EnvelopeMode_e;
+
+
+struct AudioContext_t;
+
+
+/*
+ * Envelope_t
+ *
+ * A detector in the bank. ulAttack overlaps the pool free list pointer, so it
+ * is only valid while nUsers > 0.
+ */
+typedef struct
+{
+	uint32_t ulAttack;		///< Q31 coefficient used while the input is above the envelope
+	uint32_t ulRelease;		///< Q31 coefficient used while the input is below the envelope
+	uint32_t ulSerial;		///< different for every detector started, see EnvelopeState_t
+	uint16_t nReleaseMsec;	///< release time (msec)
+	uint8_t nAttackMsec;	///< attack time (msec)
+	uint8_t iMode;			///< EnvelopeMode_e
+	uint8_t nUsers;			///< filter data referencing this detector, 0 when free
+} Envelope_t;
+
+
+/*
+ * EnvelopeState_t
+ *
+ * A detector's state in one audio context. Each context has one for each
+ * block of g_EnvelopePool, which starts again from silence when ulSerial
+ * doesn't match the detector's (i.e. the block has been reused).
+ */
+typedef struct
+{
+	uint32_t ulSerial;		///< Envelope_t ulSerial this state follows, 0 for none
+	uint32_t ulEnvelope;	///< |x| in Q16, or x^2 in Q9 for ENVELOPE_RMS
+	uint32_t ulMeanSquare;	///< x^2 in Q9 averaged over ENVELOPE_RMS_MSEC, for ENVELOPE_RMS
+	uint32_t ulFirstSample;	///< samples processed by the context before pLevels[0]
+	uint8_t nStage;			///< stage whose input was last followed
+	uint16_t nLevels;		///< samples in pLevels, 0 until the detector is first followed
+	int16_t pLevels[BLOCK_SAMPLES];	///< level of each sample last followed (dBFS, Q8)
+} EnvelopeState_t;
+
+
+void envelope_init(void);
+const int16_t *envelope_follow(struct AudioContext_t *pContext, uint8_t iEnvelope, const int16_t *pSamples, uint16_t nSamples);
+qgain_t envelope_db_to_gain(int32_t qDb);
+uint8_t envelope_acquire(uint8_t nAttackMsec, uint16_t nReleaseMsec, uint8_t iMode, uint8_t iPrevious);
+void envelope_release(uint8_t iEnvelope);
+void envelope_debug(const struct AudioContext_t *pContext);
+
+#endif
@@ -10,9 +10,13 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "config.h"
 #include "dbg.h"
+#include "samples.h"
 #include "filters.h"
 #include "filters/delay.h"
 #include "filters/dynamic.h"
@@ -21,6 +25,8 @@
 #include "filters/fir.h"
 #include "filters/distortion.h"
 #include "filters/flange.h"
+#include "filters/biquad.h"
+#include "filters/reverb.h"
 
 /*
  * g_pFilters
@@ -33,74 +39,106 @@
  * - o: offset into filter data struct
  * - t: widget type ("range" or "choice")
  */
-#define WAVE_TYPE_KV ";f=B;t=choice;c=Square;c=Sawtooth;c=Inverse Sawtooth;c=Triangle"
+#define WAVE_TYPE_KV ";f=B;t=choice;c=Square;c=Sawtooth;c=Inverse Sawtooth;c=Triangle;c=Sine"
+
+/*
+ * Detector parameter key/values (see EnvelopeMode_e)
+ */
+#define DETECTOR_KV ";f=B;t=choice;c=Peak;c=RMS"
+
+/*
+ * Swept delay interpolation parameter key/values (see DelayLineInterp_e)
+ */
+#define INTERP_KV ";f=B;t=choice;c=Linear;c=Hermite;c=All-pass"
 
 Filter_t g_pFilters[] = {
 	{
 		"Delay",
-		"Delay;f=H;o=0;t=range;min=0;max=9999;step=1;val=5000" PARAM_SEP
-		"Mix level;f=f;o=2;t=range;min=0;max=1;step=0.05;val=0.5",
-		filter_delay_apply, filter_delay_debug, filter_delay_create, NULL,
-		sizeof(FilterDelayData_t), 0
+		"Delay;f=H;o=0;t=range;min=0;max=15359;step=1;val=3000" PARAM_SEP
+		"Mix level;f=f;o=2;t=range;min=0;max=1;step=0.05;val=0.5" PARAM_SEP
+		"Encoding;f=B;o=10;t=choice;c=Linear;c=Mu-law (2x);c=ADPCM (4x)",
+		filter_delay_apply, filter_delay_apply_block, filter_delay_debug, filter_delay_create, filter_delay_mod, filter_delay_free,
+		sizeof(FilterDelayData_t), offsetof(FilterDelayData_t, nDelay),
+		45, NULL
 	},
 
 	{
 		"Reverb",
-		"Delay;f=H;o=0;t=range;min=0;max=9999;step=1;val=5000" PARAM_SEP
-		"Mix level;f=f;o=2;t=range;min=0;max=1;step=0.05;val=0.5",
-		filter_delay_feedback_apply, filter_delay_debug, filter_delay_create, NULL, // Using delay as they share data structure
-		sizeof(FilterDelayData_t), 0
+		"Size;f=B;o=0;t=range;min=0;max=100;step=1;val=50" PARAM_SEP
+		"Damping;f=B;o=1;t=range;min=0;max=100;step=1;val=50" PARAM_SEP
+		"Mix level;f=B;o=2;t=range;min=0;max=100;step=1;val=30",
+		filter_reverb_apply, filter_reverb_apply_block, filter_reverb_debug, filter_reverb_create, filter_reverb_mod, filter_reverb_free,
+		sizeof(FilterReverbData_t), offsetof(FilterReverbData_t, size),
+		170, NULL
 	},
 
 	{
 		"Noise Gate",
-		"Sensitivity;f=H;o=0;t=range;min=1;max=100;step=1;val=25" PARAM_SEP
-		"Threshold;f=H;o=2;t=range;min=0;max=350;step=1;val=50",
-		filter_noisegate_apply, filter_noisegate_debug, filter_noisegate_create, NULL,
-		sizeof(FilterNoiseGateData_t), 0
+		"Threshold;f=b;o=0;t=range;min=-72;max=0;step=1;val=-40" PARAM_SEP
+		"Hysteresis;f=B;o=1;t=range;min=0;max=24;step=1;val=6" PARAM_SEP
+		"Attack;f=B;o=2;t=range;min=1;max=100;step=1;val=1" PARAM_SEP
+		"Release;f=H;o=4;t=range;min=5;max=2000;step=5;val=100" PARAM_SEP
+		"Detector;o=3" DETECTOR_KV,
+		filter_noisegate_apply, filter_noisegate_apply_block, filter_dynamics_debug, filter_noisegate_create, filter_noisegate_mod, filter_dynamics_free,
+		sizeof(FilterDynamicsData_t), offsetof(FilterDynamicsData_t, threshold),
+		15 + ENVELOPE_COST, NULL
 	},
 
 	{
 		"Compressor",
-		"Sensitivity;f=H;o=0;t=range;min=1;max=100;step=1;val=25" PARAM_SEP
-		"Threshold;f=H;o=2;t=range;min=0;max=350;step=1;val=65" PARAM_SEP
-		"Scalar;f=f;o=4;t=range;min=0;max=1;step=0.05;val=0.8",
-		filter_compressor_apply, filter_compressor_debug, filter_compressor_create, NULL,
-		sizeof(FilterCompressorData_t), 0
+		"Threshold;f=b;o=0;t=range;min=-72;max=0;step=1;val=-20" PARAM_SEP
+		"Ratio;f=f;o=6;t=range;min=1;max=20;step=0.5;val=4" PARAM_SEP
+		"Knee;f=B;o=1;t=range;min=0;max=24;step=1;val=6" PARAM_SEP
+		"Attack;f=B;o=2;t=range;min=1;max=100;step=1;val=5" PARAM_SEP
+		"Release;f=H;o=4;t=range;min=5;max=2000;step=5;val=100" PARAM_SEP
+		"Detector;o=3" DETECTOR_KV,
+		filter_dynamics_apply, filter_dynamics_apply_block, filter_dynamics_debug, filter_compressor_create, filter_compressor_mod, filter_dynamics_free,
+		sizeof(FilterDynamicsData_t), offsetof(FilterDynamicsData_t, threshold),
+		35 + ENVELOPE_COST, NULL
 	},
 
 	{
 		"Expander",
-		"Sensitivity;f=H;o=0;t=range;min=1;max=100;step=1;val=25" PARAM_SEP
-		"Threshold;f=H;o=2;t=range;min=0;max=350;step=1;val=65" PARAM_SEP
-		"Scalar;f=f;o=4;t=range;min=1;max=2;step=0.05;val=1.5",
-		filter_expander_apply, filter_compressor_debug, filter_expander_create, NULL,
-		sizeof(FilterCompressorData_t), 0
+		"Threshold;f=b;o=0;t=range;min=-72;max=0;step=1;val=-40" PARAM_SEP
+		"Ratio;f=f;o=6;t=range;min=1;max=10;step=0.5;val=2" PARAM_SEP
+		"Knee;f=B;o=1;t=range;min=0;max=24;step=1;val=6" PARAM_SEP
+		"Attack;f=B;o=2;t=range;min=1;max=100;step=1;val=5" PARAM_SEP
+		"Release;f=H;o=4;t=range;min=5;max=2000;step=5;val=100" PARAM_SEP
+		"Detector;o=3" DETECTOR_KV,
+		filter_dynamics_apply, filter_dynamics_apply_block, filter_dynamics_debug, filter_expander_create, filter_expander_mod, filter_dynamics_free,
+		sizeof(FilterDynamicsData_t), offsetof(FilterDynamicsData_t, threshold),
+		35 + ENVELOPE_COST, NULL
 	},
 
 	{
 		"Bitcrusher",
 		"Bit loss;f=B;o=0;t=range;min=0;max=10;step=1;val=1",
-		filter_bitcrusher_apply, filter_bitcrusher_debug, filter_bitcrusher_create, NULL,
-		sizeof(FilterBitcrusherData_t), 0
+		filter_bitcrusher_apply, filter_bitcrusher_apply_block, filter_bitcrusher_debug, filter_bitcrusher_create, NULL, NULL,
+		sizeof(FilterBitcrusherData_t), 0,
+		15, NULL
 	},
 
 	{
 		"Vibrato",
 		"Delay;f=H;o=0;t=range;min=1;max=500;step=1;val=10" PARAM_SEP
-		"Frequency;f=B;o=2;t=range;min=1;max=10;step=1;val=1" PARAM_SEP
-		"Wave Type;o=3" WAVE_TYPE_KV,
-		filter_vibrato_apply, filter_vibrato_debug, filter_vibrato_create, NULL,
-		sizeof(FilterVibratoData_t), 0
+		"Frequency;f=B;o=2;t=range;min=0;max=10;step=1;val=1" PARAM_SEP
+		"Fine frequency;f=B;o=4;t=range;min=0;max=99;step=1;val=0" PARAM_SEP
+		"Wave Type;o=3" WAVE_TYPE_KV PARAM_SEP
+		"Interpolation;o=6" INTERP_KV,
+		filter_vibrato_apply, NULL, filter_vibrato_debug, filter_vibrato_create, filter_vibrato_mod, filter_vibrato_free,
+		sizeof(FilterVibratoData_t), offsetof(FilterVibratoData_t, nDelay),
+		60, filter_vibrato_cost
 	},
 
 	{
 		"Tremolo",
-		"Frequency;f=B;o=0;t=range;min=1;max=10;step=1;val=1" PARAM_SEP
+		"Frequency;f=B;o=0;t=range;min=0;max=10;step=1;val=1" PARAM_SEP
+		"Fine frequency;f=B;o=2;t=range;min=0;max=99;step=1;val=0" PARAM_SEP
 		"Wave Type;o=1" WAVE_TYPE_KV PARAM_SEP
-		"Depth;f=f;o=2;t=range;min=0;max=1;step=0.05;val=0.5",
-		filter_tremolo_apply, filter_tremolo_debug, filter_tremolo_create, NULL,
-		sizeof(FilterTremoloData_t), 0
+		"Depth;f=f;o=4;t=range;min=0;max=1;step=0.05;val=0.5",
+		filter_tremolo_apply, NULL, filter_tremolo_debug, filter_tremolo_create, filter_tremolo_mod, filter_tremolo_free,
+		sizeof(FilterTremoloData_t), 0,
+		55, NULL
 	},
 
 	{
@@ -108,18 +146,49 @@ Filter_t g_pFilters[] = {
 		"Co-efficients;f=B;o=0;t=range;min=1;max=50;step=1;val=15" PARAM_SEP
 		"Centre frequency;f=H;o=1;t=range;min=20;max=2500;step=1;val=1000" PARAM_SEP
 		"Width;f=H;o=3;t=range;min=20;max=5000;step=2;val=500",
-		filter_fir_apply, filter_bandpass_debug, filter_bandpass_create, filter_bandpass_mod,
-		sizeof(FilterBandPassData_t), offsetof(FilterFIRBaseData_t, nCoefficients)
+		filter_fir_apply, filter_fir_apply_block, filter_bandpass_debug, filter_bandpass_create, filter_bandpass_mod, filter_fir_free,
+		sizeof(FilterBandPassData_t), offsetof(FilterFIRBaseData_t, nCoefficients),
+		20, filter_fir_cost
 	},
 
 	{
 		"Flange",
-		"Delay;f=H;o=0;t=range;min=1;max=4999;step=1;val=10" PARAM_SEP
-		"Frequency;f=B;o=2;t=range;min=1;max=10;step=1;val=1" PARAM_SEP
+		"Delay;f=H;o=0;t=range;min=1;max=4095;step=1;val=10" PARAM_SEP
+		"Frequency;f=B;o=2;t=range;min=0;max=10;step=1;val=1" PARAM_SEP
+		"Fine frequency;f=B;o=10;t=range;min=0;max=99;step=1;val=0" PARAM_SEP
 		"Wave Type;o=3" WAVE_TYPE_KV PARAM_SEP
-		"Flanged mix;f=f;o=4;t=range;min=0;max=1;step=0.05;val=0.5",
-		filter_flange_apply, filter_flange_debug, filter_flange_create, NULL,
-		sizeof(FilterFlangeData_t), 0
+		"Flanged mix;f=f;o=4;t=range;min=0;max=1;step=0.05;val=0.5" PARAM_SEP
+		"Interpolation;o=12" INTERP_KV,
+		filter_flange_apply, NULL, filter_flange_debug, filter_flange_create, filter_flange_mod, filter_flange_free,
+		sizeof(FilterFlangeData_t), offsetof(FilterFlangeData_t, nDelay),
+		120, filter_flange_cost
+	},
+
+	{
+		"Biquad",
+		"Type;f=B;o=0;t=choice;c=Low-Pass;c=High-Pass;c=Band-Pass;c=Notch;c=Peak;c=Low Shelf;c=High Shelf" PARAM_SEP
+		"Sections;f=B;o=1;t=range;min=1;max=4;step=1;val=1" PARAM_SEP
+		"Frequency;f=H;o=2;t=range;min=20;max=4900;step=1;val=1000" PARAM_SEP
+		"Q;f=f;o=4;t=range;min=0.1;max=10;step=0.1;val=0.7" PARAM_SEP
+		"Gain;f=f;o=8;t=range;min=-12;max=12;step=0.5;val=6",
+		filter_biquad_apply, filter_biquad_apply_block, filter_biquad_debug, filter_biquad_create, filter_biquad_mod, filter_biquad_free,
+		sizeof(FilterBiquadData_t), offsetof(FilterBiquadData_t, iType),
+		20, filter_biquad_cost
+	},
+
+	{
+		"Waveshaper",
+		"Curve;f=B;o=0;t=choice;c=Soft Clip;c=Hard Clip;c=Tube;c=Foldback;c=Custom" PARAM_SEP
+		"Drive;f=B;o=1;t=range;min=1;max=20;step=1;val=4" PARAM_SEP
+		"Shape;f=B;o=2;t=range;min=0;max=100;step=1;val=30" PARAM_SEP
+		"Level;f=B;o=3;t=range;min=0;max=100;step=1;val=80" PARAM_SEP
+		"Custom 1/4;f=B;o=4;t=range;min=0;max=100;step=1;val=40" PARAM_SEP
+		"Custom 1/2;f=B;o=5;t=range;min=0;max=100;step=1;val=70" PARAM_SEP
+		"Custom 3/4;f=B;o=6;t=range;min=0;max=100;step=1;val=90" PARAM_SEP
+		"Custom full;f=B;o=7;t=range;min=0;max=100;step=1;val=100",
+		filter_waveshaper_apply, filter_waveshaper_apply_block, filter_waveshaper_debug, filter_waveshaper_create, filter_waveshaper_mod, filter_waveshaper_free,
+		sizeof(FilterWaveshaperData_t), offsetof(FilterWaveshaperData_t, params),
+		12, NULL
 	}
 };
 
@@ -127,6 +196,108 @@ Filter_t g_pFilters[] = {
 const size_t NUM_FILTERS = sizeof(g_pFilters)/sizeof(g_pFilters[0]);
 
 
+/*
+ * filter_cost
+ *
+ * Estimates the cycles per sample filter data `pUnknown` will take to apply on
+ * the fixed point path.
+ */
+uint32_t filter_cost(const Filter_t *pFilter, const void *pUnknown)
+{
+	uint32_t ulCost = pFilter->nCost;
+
+	if(pFilter->pfnCost)
+		ulCost += pFilter->pfnCost(pUnknown);
+
+	return ulCost;
+}
+
+
+/*
+ * filter_param_size
+ *
+ * Calculates the number of bytes a parameter format character represents.
+ * See http://docs.python.org/2/library/struct.html#format-characters
+ */
+uint8_t filter_param_size(char ch)
+{
+	switch(ch)
+	{
+	case 'c':
+	case 'b':
+	case 'B':
+	case '?':
+		return 1;
+
+	case 'h':
+	case 'H':
+		return 2;
+
+	case 'i':
+	case 'I':
+	case 'l':
+	case 'L':
+	case 'f':
+		return 4;
+
+	case 'q':
+	case 'Q':
+	case 'd':
+		return 8;
+
+	default:
+		dbg_warning("unknown parameter type (%c)\r\n", ch);
+		return 0;
+	}
+}
+
+
+/*
+ * filter_params_equal
+ *
+ * Compares the parameters listed in pFilter->pszParamFormat between two copies
+ * of the public filter data. Anything else in the public data, such as values
+ * the mod callback derives from the parameters, is ignored.
+ */
+bool filter_params_equal(const Filter_t *pFilter, const void *pPublic1, const void *pPublic2)
+{
+	const char *pParam = pFilter->pszParamFormat;
+
+	while(pParam)
+	{
+		// Skip past parameter separator
+		if(*pParam == *PARAM_SEP) pParam++;
+
+		const char *pszNextParam = strstr(pParam, PARAM_SEP);
+
+		uint8_t offset = 0;
+		char format = 0;
+
+		// Pick the format and offset out of the KeyValue pairs
+		const char *pKVPair = strstr(pParam, ";");
+
+		while(pKVPair && (pszNextParam == NULL || pKVPair < pszNextParam))
+		{
+			pKVPair++;
+
+			if(!strncmp(pKVPair, "f=", 2))
+				format = pKVPair[2];
+			else if(!strncmp(pKVPair, "o=", 2))
+				offset = atoi(pKVPair + 2);
+
+			pKVPair = strstr(pKVPair, ";");
+		}
+
+		if(memcmp((const uint8_t *)pPublic1 + offset, (const uint8_t *)pPublic2 + offset, filter_param_size(format)))
+			return false;
+
+		pParam = pszNextParam;
+	}
+
+	return true;
+}
+
+
 /*
  * filter_debug
  *
@@ -142,9 +313,33 @@ void filter_debug(void)
 	{
 		const Filter_t *pFilter = &g_pFilters[i];
 
-		dbg_printf("#%u: %s, apply=%p, debug=%p, create=%p, mod=%p, datasize=%u(%u private)\r\n", i, pFilter->pszName, (void *)pFilter->pfnApply, (void *)pFilter->pfnDebug, (void *)pFilter->pfnCreateCallback, (void *)pFilter->pfnModCallback, pFilter->nFilterDataSize, pFilter->nNonPublicDataSize);
+		dbg_printf("#%u: %s, apply=%p, applyblock=%p, debug=%p, create=%p, mod=%p, free=%p, datasize=%u(%u private), cost=%u\r\n", i, pFilter->pszName, (void *)pFilter->pfnApply, (void *)pFilter->pfnApplyBlock, (void *)pFilter->pfnDebug, (void *)pFilter->pfnCreateCallback, (void *)pFilter->pfnModCallback, (void *)pFilter->pfnFreeCallback, pFilter->nFilterDataSize, pFilter->nNonPublicDataSize, pFilter->nCost);
 	}
 
 	dbg_printn("\r\n", -1);
 }
 #pragma GCC diagnostic pop
+
+
+/*
+ * filter_apply_block_fallback
+ *
+ * Applies a filter that has no FilterApplyBlock_t to a block of samples by
+ * calling its per-sample FilterApply_t. The history cursor of `pContext` is
+ * moved along with each sample so history based filters, LFOs and envelopes
+ * see the same state as they would when called once per tick.
+ */
+void filter_apply_block_fallback(AudioContext_t *pContext, const Filter_t *pFilter, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	SampleHistory_t *pHistory = &pContext->history;
+	const uint16_t iSampleCursor = pHistory->iCursor;
+
+	for(uint16_t i = 0; i < nSamples; ++i)
+	{
+		pHistory->iCursor = (iSampleCursor + i) & BUFFER_MASK;
+
+		pSamples[i] = pFilter->pfnApply(pContext, pSamples[i], pUnknown);
+	}
+
+	pHistory->iCursor = iSampleCursor;
+}
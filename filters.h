@@ -12,6 +12,9 @@
 #ifndef _FILTERS_H_
 #define _FILTERS_H_
 
+#include <stdbool.h>
+#include "context.h"
+
 // Character that separates parameter info in Filter_t::pszParamFormat
 #define PARAM_SEP "|"
 
@@ -31,27 +34,67 @@ typedef enum
 /*
  * FilterApply_t
  *
- * Receives a 32-bit sample value (`input`) and filter data `pUnknown`.
- * `pUnknown` should be cast to the struct that holds the parameters for this
- * filter.
+ * Receives a 32-bit sample value (`input`) of audio context `pContext` and
+ * filter data `pUnknown`. `pUnknown` should be cast to the struct that holds
+ * the parameters for this filter. Anything kept between samples belongs in
+ * one of the two.
+ */
+typedef int16_t (*FilterApply_t)(AudioContext_t *pContext, int16_t input, void *pUnknown);
+
+
+/*
+ * FilterApplyBlock_t
+ *
+ * Receives a block of `nSamples` samples (`pSamples`) which should be filtered
+ * in place, and filter data `pUnknown`. `pSamples[0]` is the sample at the
+ * history cursor of `pContext`, the rest follow it in time.
+ *
+ * Filters that don't provide one of these are run through
+ * `filter_apply_block_fallback`.
  */
-typedef int16_t (*FilterApply_t)(int16_t input, void *pUnknown);
+typedef void (*FilterApplyBlock_t)(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
 
 
 /*
  * FilterCallback_t
  *
- * Passes filter data as `pUnknown`. Used for parameter debugging,
- * creation callback and filter data mod callback.
+ * Passes filter data as `pUnknown`. Used for parameter debugging and freeing
+ * filter data.
  */
 typedef void (*FilterCallback_t)(void *pUnknown);
 
 
+/*
+ * FilterSetupCallback_t
+ *
+ * Passes filter data as `pUnknown`. Used for the creation callback and filter
+ * data mod callback, which may allocate memory.
+ *
+ * @returns false if a memory pool is full (see pool.h)
+ */
+typedef bool (*FilterSetupCallback_t)(void *pUnknown);
+
+
+/*
+ * FilterCost_t
+ *
+ * Returns the parameter dependent part of the estimated cycles per sample for
+ * filter data `pUnknown` (see Filter_t::nCost).
+ */
+typedef uint16_t (*FilterCost_t)(const void *pUnknown);
+
+
 /*
  * Filter_t
  *
  * Holds all information about a filter type (NOT a filter instance, see
  * `ChainStage_t` in chain.h)
+ *
+ * Filter data is modified on a copy (see `branch_clone` in chain.c) while the
+ * original is still in use. If the filter data owns memory, pfnModCallback
+ * must replace it rather than free it; the original's pfnFreeCallback
+ * releases it once it is no longer in use. If pfnModCallback fails it must not
+ * leave the copy pointing at the original's memory, as the copy is freed.
  */
 #pragma pack(push, 1)
 typedef struct
@@ -59,16 +102,24 @@ typedef struct
 	const char *pszName;
 	const char *pszParamFormat; ///< defines what parameters can be modified by the UI and which ones are saved to disk
 	FilterApply_t pfnApply; ///< called to apply the filter to a sample
+	FilterApplyBlock_t pfnApplyBlock; ///< called to apply the filter to a block of samples (may be NULL)
 	FilterCallback_t pfnDebug;
-	FilterCallback_t pfnCreateCallback; ///< called when a filter is created
-	FilterCallback_t pfnModCallback; ///< called when filter data is modified
+	FilterSetupCallback_t pfnCreateCallback; ///< called when a filter is created
+	FilterSetupCallback_t pfnModCallback; ///< called when filter data is modified (see above)
+	FilterCallback_t pfnFreeCallback; ///< called before filter data is freed, releases memory owned by the filter data
 	uint8_t nFilterDataSize; ///< size of filter data struct
 	uint8_t nNonPublicDataSize; ///< size of non-public data at start of filter data struct
+	uint16_t nCost; ///< estimated cycles per sample on the fixed point path (used for admission control)
+	FilterCost_t pfnCost; ///< returns estimated cycles per sample on top of nCost that depend on the filter data (may be NULL)
 } Filter_t;
 #pragma pack(pop)
 
 
 void filter_debug(void);
+uint32_t filter_cost(const Filter_t *pFilter, const void *pUnknown);
+uint8_t filter_param_size(char ch);
+bool filter_params_equal(const Filter_t *pFilter, const void *pPublic1, const void *pPublic2);
+void filter_apply_block_fallback(AudioContext_t *pContext, const Filter_t *pFilter, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
 
 
 extern Filter_t g_pFilters[];
@@ -0,0 +1,344 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ *	biquad.c
+ *
+ *	Defines functions to apply second order IIR (biquad) filters
+ *	to a sample.
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "dbg.h"
+#include "config.h"
+#include "pool.h"
+#include "biquad.h"
+
+
+// Range of the design parameters, so the poles stay inside the unit circle
+#define BIQUAD_MIN_FREQUENCY	20
+#define BIQUAD_MAX_FREQUENCY	(SAMPLE_RATE / 2 - 100)
+#define BIQUAD_MIN_Q			0.1f
+
+
+/*
+ * biquad_section_apply
+ *
+ * Runs `input` through one section and returns its output. On the fixed point
+ * path the fraction bits dropped from the last two outputs are fed back,
+ * weighted by the denominator rounded to integers (error spectrum shaping),
+ * otherwise the rounding error is amplified by the poles at low and high
+ * cutoff frequencies. The float path rounds the output of each section.
+ *
+ * Either way the response is within 0.05 dB (fixed point) or 0.08 dB (float)
+ * of the design formulas wherever they give more than -24 dB, for every type
+ * and number of sections (checked by `make test`, see hal/test.c).
+ */
+static inline int16_t biquad_section_apply(BiquadSection_t *pSection, int16_t input)
+{
+	BiquadAccumulator_t acc = (BiquadAccumulator_t) pSection->b0 * input;
+	acc += (BiquadAccumulator_t) pSection->b1 * pSection->x1;
+	acc += (BiquadAccumulator_t) pSection->b2 * pSection->x2;
+	acc -= (BiquadAccumulator_t) pSection->a1 * pSection->y1;
+	acc -= (BiquadAccumulator_t) pSection->a2 * pSection->y2;
+
+#ifdef FLOAT_DSP
+	const BiquadState_t output = acc;
+#else
+	acc += pSection->iShape1 * pSection->iError1 + pSection->iShape2 * pSection->iError2;
+	pSection->iError2 = pSection->iError1;
+	pSection->iError1 = acc & ((1 << BIQUAD_SHIFT) - 1);
+
+	const int32_t iOutput = acc >> BIQUAD_SHIFT;
+	const BiquadState_t output = sat16(iOutput);
+#endif
+
+	pSection->x2 = pSection->x1;
+	pSection->x1 = input;
+	pSection->y2 = pSection->y1;
+	pSection->y1 = output;
+
+#ifdef FLOAT_DSP
+	return sat16(output + (output < 0 ? -0.5f : 0.5f));
+#else
+	return output;
+#endif
+}
+
+
+/*
+ *	Biquad apply runs the input through each second order
+ *	section of the cascade in turn. Each section needs five
+ *	multiplies, where the FIR band-pass needs up to 50 taps
+ *	for a similar slope.
+ *
+ *	inputs:
+ *		pContext	audio context being filtered
+ *		input		signed 12 bit sample
+ *		pUnknown	null pointer to FilterBiquadData_t data
+ *
+ *	output:
+ *		signed 12 bit sample
+ */
+int16_t filter_biquad_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
+{
+	const FilterBiquadData_t *pData = (const FilterBiquadData_t *)pUnknown;
+	BiquadCascade_t *pCascade = pData->pCascade;
+
+	for(uint8_t i = 0; i < pCascade->nSections; ++i)
+		input = biquad_section_apply(&pCascade->pSections[i], input);
+
+	return input;
+}
+
+
+// Block version of filter_biquad_apply. Runs the whole block through one
+// section before the next.
+void filter_biquad_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterBiquadData_t *pData = (const FilterBiquadData_t *)pUnknown;
+	BiquadCascade_t *pCascade = pData->pCascade;
+
+	for(uint8_t i = 0; i < pCascade->nSections; ++i)
+	{
+		BiquadSection_t *pSection = &pCascade->pSections[i];
+
+		for(uint16_t n = 0; n < nSamples; ++n)
+			pSamples[n] = biquad_section_apply(pSection, pSamples[n]);
+	}
+}
+
+
+// Print biquad parameter values to UI console
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdouble-promotion"
+void filter_biquad_debug(void *pUnknown)
+{
+	const FilterBiquadData_t *pData = (const FilterBiquadData_t *)pUnknown;
+	dbg_printf("cascade=%p, type=%u, sections=%u, frequency=%u, q=%f, gain=%f", (void *)pData->pCascade, pData->iType, pData->nSections, pData->iFrequency, pData->flQ, pData->flGain);
+}
+#pragma GCC diagnostic pop
+
+
+/*
+ *	Calculates the coefficients of one section from the
+ *	"Audio EQ Cookbook" (R. Bristow-Johnson) formulae, and
+ *	normalises them by a0.
+ */
+static void biquad_design(BiquadSection_t *pSection, uint8_t iType, float flFrequency, float flQ, float flGain)
+{
+	const float w0 = 2 * PI_F * flFrequency / SAMPLE_RATE;
+	const float flCos = cosf(w0);
+	const float flAlpha = sinf(w0) / (2 * flQ);
+	const float A = powf(10, flGain / 40);
+	const float flSqrtA = sqrtf(A);
+
+	float b0, b1, b2, a0, a1, a2;
+
+	switch(iType)
+	{
+		default:
+		case BIQUAD_LOWPASS:
+			b0 = (1 - flCos) / 2;
+			b1 = 1 - flCos;
+			b2 = b0;
+			a0 = 1 + flAlpha;
+			a1 = -2 * flCos;
+			a2 = 1 - flAlpha;
+			break;
+
+		case BIQUAD_HIGHPASS:
+			b0 = (1 + flCos) / 2;
+			b1 = -(1 + flCos);
+			b2 = b0;
+			a0 = 1 + flAlpha;
+			a1 = -2 * flCos;
+			a2 = 1 - flAlpha;
+			break;
+
+		case BIQUAD_BANDPASS:
+			b0 = flAlpha;
+			b1 = 0;
+			b2 = -flAlpha;
+			a0 = 1 + flAlpha;
+			a1 = -2 * flCos;
+			a2 = 1 - flAlpha;
+			break;
+
+		case BIQUAD_NOTCH:
+			b0 = 1;
+			b1 = -2 * flCos;
+			b2 = 1;
+			a0 = 1 + flAlpha;
+			a1 = -2 * flCos;
+			a2 = 1 - flAlpha;
+			break;
+
+		case BIQUAD_PEAK:
+			b0 = 1 + flAlpha * A;
+			b1 = -2 * flCos;
+			b2 = 1 - flAlpha * A;
+			a0 = 1 + flAlpha / A;
+			a1 = -2 * flCos;
+			a2 = 1 - flAlpha / A;
+			break;
+
+		case BIQUAD_LOWSHELF:
+			b0 = A * ((A + 1) - (A - 1) * flCos + 2 * flSqrtA * flAlpha);
+			b1 = 2 * A * ((A - 1) - (A + 1) * flCos);
+			b2 = A * ((A + 1) - (A - 1) * flCos - 2 * flSqrtA * flAlpha);
+			a0 = (A + 1) + (A - 1) * flCos + 2 * flSqrtA * flAlpha;
+			a1 = -2 * ((A - 1) + (A + 1) * flCos);
+			a2 = (A + 1) + (A - 1) * flCos - 2 * flSqrtA * flAlpha;
+			break;
+
+		case BIQUAD_HIGHSHELF:
+			b0 = A * ((A + 1) + (A - 1) * flCos + 2 * flSqrtA * flAlpha);
+			b1 = -2 * A * ((A - 1) + (A + 1) * flCos);
+			b2 = A * ((A + 1) + (A - 1) * flCos - 2 * flSqrtA * flAlpha);
+			a0 = (A + 1) - (A - 1) * flCos + 2 * flSqrtA * flAlpha;
+			a1 = 2 * ((A - 1) - (A + 1) * flCos);
+			a2 = (A + 1) - (A - 1) * flCos - 2 * flSqrtA * flAlpha;
+			break;
+	}
+
+#ifdef FLOAT_DSP
+	pSection->b0 = b0 / a0;
+	pSection->b1 = b1 / a0;
+	pSection->b2 = b2 / a0;
+	pSection->a1 = a1 / a0;
+	pSection->a2 = a2 / a0;
+#else
+	const float flScale = (float)(1 << BIQUAD_SHIFT) / a0;
+
+	pSection->b0 = lrintf(b0 * flScale);
+	pSection->b1 = lrintf(b1 * flScale);
+	pSection->b2 = lrintf(b2 * flScale);
+	pSection->a1 = lrintf(a1 * flScale);
+	pSection->a2 = lrintf(a2 * flScale);
+
+	pSection->iShape1 = -lrintf(a1 / a0);
+	pSection->iShape2 = -lrintf(a2 / a0);
+#endif
+}
+
+
+/*
+ *	Designs the sections once per parameter change, so the
+ *	sampling path only has to run them.
+ *	Parameters are clamped to a range where the design is
+ *	stable, then a new cascade is allocated and every
+ *	section is given the same response. Peak and shelf gain
+ *	is split between the sections, so Gain is the total
+ *	boost/cut.
+ *
+ *	The previous cascade is not freed here, it may still be
+ *	in use by the original copy of this filter data (see
+ *	filter_biquad_free). Its state is copied so the output
+ *	doesn't jump when a parameter changes.
+ */
+bool filter_biquad_mod(void *pUnknown)
+{
+	FilterBiquadData_t *pData = (FilterBiquadData_t *)pUnknown;
+
+	if(pData->iType >= BIQUAD_TYPES)
+	{
+		dbg_warning("invalid biquad type %u\r\n", pData->iType);
+		pData->iType = BIQUAD_LOWPASS;
+	}
+
+	if(pData->nSections < 1 || pData->nSections > BIQUAD_MAX_SECTIONS)
+	{
+		dbg_warning("%u sections requested, clamping to [1-%u]\r\n", pData->nSections, BIQUAD_MAX_SECTIONS);
+		pData->nSections = pData->nSections < 1 ? 1 : BIQUAD_MAX_SECTIONS;
+	}
+
+	if(pData->iFrequency < BIQUAD_MIN_FREQUENCY)
+		pData->iFrequency = BIQUAD_MIN_FREQUENCY;
+	else if(pData->iFrequency > BIQUAD_MAX_FREQUENCY)
+		pData->iFrequency = BIQUAD_MAX_FREQUENCY;
+
+	// Also catches NaN
+	if(!(pData->flQ >= BIQUAD_MIN_Q))
+		pData->flQ = BIQUAD_MIN_Q;
+
+	// Gain is the total, so each section is within BIQUAD_MAX_GAIN too
+	if(isnan(pData->flGain))
+		pData->flGain = 0;
+	else if(pData->flGain < -BIQUAD_MAX_GAIN)
+		pData->flGain = -BIQUAD_MAX_GAIN;
+	else if(pData->flGain > BIQUAD_MAX_GAIN)
+		pData->flGain = BIQUAD_MAX_GAIN;
+
+	// Allocate the new cascade. If the pool is full the original's cascade is
+	// forgotten, so freeing this copy is safe.
+	const BiquadCascade_t *pPrevious = pData->pCascade;
+	BiquadCascade_t *pCascade = pool_alloc(&g_BiquadPool);
+	pData->pCascade = pCascade;
+
+	if(!pCascade)
+		return false;
+
+	const uint8_t nSections = pData->nSections;
+	pCascade->nSections = nSections;
+
+	for(uint8_t i = 0; i < nSections; ++i)
+	{
+		BiquadSection_t *pSection = &pCascade->pSections[i];
+
+		biquad_design(pSection, pData->iType, pData->iFrequency, pData->flQ, pData->flGain / nSections);
+
+		// Carry on from the original's state
+		if(pPrevious && i < pPrevious->nSections)
+		{
+			const BiquadSection_t *pPreviousSection = &pPrevious->pSections[i];
+
+			pSection->x1 = pPreviousSection->x1;
+			pSection->x2 = pPreviousSection->x2;
+			pSection->y1 = pPreviousSection->y1;
+			pSection->y2 = pPreviousSection->y2;
+		}
+	}
+
+	return true;
+}
+
+
+// Free biquad cascade
+void filter_biquad_free(void *pUnknown)
+{
+	FilterBiquadData_t *pData = (FilterBiquadData_t *)pUnknown;
+	pool_free(&g_BiquadPool, pData->pCascade);
+}
+
+
+// Estimate cycles spent on the sections (five 64 bit multiply-accumulates and
+// the error feedback each)
+uint16_t filter_biquad_cost(const void *pUnknown)
+{
+	const FilterBiquadData_t *pData = (const FilterBiquadData_t *)pUnknown;
+	return 34 * pData->nSections;
+}
+
+
+// Set initial biquad creation parameters
+bool filter_biquad_create(void *pUnknown)
+{
+	FilterBiquadData_t *pData = (FilterBiquadData_t *)pUnknown;
+	pData->iType = BIQUAD_LOWPASS;
+	pData->nSections = 1;
+	pData->iFrequency = 1000;
+	pData->flQ = 0.707f;
+	pData->flGain = 6;
+
+	// Generate coefficients
+	return filter_biquad_mod(pUnknown);
+}
@@ -0,0 +1,123 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ *	biquad.c
+ *
+ *	Defines functions to apply second order IIR (biquad) filters
+ *	to a sample.
+*/
+
+
+#ifndef _FILTER_BIQUAD_H_
+#define _FILTER_BIQUAD_H_
+
+#include <stdbool.h>
+#include "fixed.h"
+#include "context.h"
+
+
+// Most sections a biquad filter can cascade (see the Biquad parameters in
+// filters.c)
+#define BIQUAD_MAX_SECTIONS	4
+
+// Fraction bits of fixed point coefficients. Low cutoffs put the poles very
+// close to z = 1, so Q15 isn't enough; this leaves room for coefficients up to
+// 32.
+#define BIQUAD_SHIFT		26
+
+// Most boost or cut of the peak and shelf types (dB). A high shelf at the
+// lowest cutoff has b1 of twice its linear gain, just under 32 at 24 dB.
+#define BIQUAD_MAX_GAIN		24
+
+
+// Coefficients are Q(BIQUAD_SHIFT), summed in a 64 bit accumulator, unless
+// building the float path
+#ifdef FLOAT_DSP
+typedef float BiquadCoefficient_t;
+typedef float BiquadAccumulator_t;
+typedef float BiquadState_t;
+#else
+typedef int32_t BiquadCoefficient_t;
+typedef int64_t BiquadAccumulator_t;
+typedef int16_t BiquadState_t;
+#endif
+
+
+/*
+ * BiquadType_e
+ *
+ * Responses, in the order of the "Type" filter parameter
+ */
+typedef enum
+{
+	BIQUAD_LOWPASS = 0,
+	BIQUAD_HIGHPASS,
+	BIQUAD_BANDPASS,
+	BIQUAD_NOTCH,
+	BIQUAD_PEAK,
+	BIQUAD_LOWSHELF,
+	BIQUAD_HIGHSHELF,
+	BIQUAD_TYPES
+} BiquadType_e;
+
+
+/*
+ * BiquadSection_t
+ *
+ * Coefficients (normalised so a0 = 1) and Direct Form I state of one second
+ * order section:
+ * y[n] = b0.x[n] + b1.x[n-1] + b2.x[n-2] - a1.y[n-1] - a2.y[n-2]
+ */
+typedef struct
+{
+	BiquadCoefficient_t b0, b1, b2, a1, a2;
+	BiquadState_t x1, x2;	///< previous two inputs
+	BiquadState_t y1, y2;	///< previous two outputs
+#ifndef FLOAT_DSP
+	int32_t iError1;		///< fraction bits dropped from the last output
+	int32_t iError2;		///< fraction bits dropped from the output before that
+	int8_t iShape1, iShape2;	///< weights iError1 and iError2 are fed back with, -a1 and -a2 rounded to integers
+#endif
+} BiquadSection_t;
+
+
+/*
+ * BiquadCascade_t
+ *
+ * Sections of a biquad filter, allocated from g_BiquadPool. Each sample goes
+ * through every section in turn.
+ */
+typedef struct
+{
+	uint8_t nSections;	///< number of sections in use
+	BiquadSection_t pSections[BIQUAD_MAX_SECTIONS];
+} BiquadCascade_t;
+
+
+#pragma pack(push, 1)
+typedef struct
+{
+	BiquadCascade_t *pCascade;	///< Pointer to the coefficients and state
+	uint8_t iType;				///< BiquadType_e
+	uint8_t nSections;			///< Number of identical sections to cascade [1-BIQUAD_MAX_SECTIONS]
+	uint16_t iFrequency;		///< Cutoff/centre frequency (Hz)
+	float flQ;					///< Quality factor, higher is narrower/more resonant
+	float flGain;				///< Boost/cut of peak and shelf types (dB), split between the sections (at most BIQUAD_MAX_GAIN either way)
+} FilterBiquadData_t;
+#pragma pack(pop)
+
+
+int16_t filter_biquad_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_biquad_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
+void filter_biquad_debug(void *pUnknown);
+bool filter_biquad_create(void *pUnknown);
+bool filter_biquad_mod(void *pUnknown);
+void filter_biquad_free(void *pUnknown);
+uint16_t filter_biquad_cost(const void *pUnknown);
+
+#endif
@@ -14,31 +14,66 @@
 
 #include <stdint.h>
 
+#include "config.h"
 #include "dbg.h"
-#include "samples.h"
 #include "delay.h"
 
 
 /*
- *	Delay filter adds together the current 'input' with a sample
- *	'pData->nDelay' in the past, at a ratio of
+ *	Delay filter adds together the current 'input' with the
+ *	input 'pData->nDelay' samples in the past, at a ratio of
  *	1 - 'pData->flDelayMixPerc' : 'pData->flDelayMixPerc'.
+ *	The past input is read from the filter's own delay line,
+ *	so it is what this filter was given rather than the raw
+ *	chain input. The line can be compressed (see
+ *	delayline.c), for delays longer than the budget holds.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit audio sample
  *		pUnknown	null pointer to a FilterDelayData_t data structure
  *
  *	output:
  *		signed 12 bit audio sample
  */
-int16_t filter_delay_apply(int16_t input, void *pUnknown)
+int16_t filter_delay_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
 	const FilterDelayData_t *pData = (const FilterDelayData_t *)pUnknown;
 
-	if(pData->nDelay == 0)
-		return (sample_get(g_iSampleCursor) * pData->flDelayMixPerc) + (input * (1-pData->flDelayMixPerc));
+	const int16_t iDelayed = delayline_shift(pData->pLine, input);
 
-	return (sample_get(-pData->nDelay) * pData->flDelayMixPerc) + (input * (1-pData->flDelayMixPerc));
+#ifdef FLOAT_DSP
+	return (iDelayed * pData->flDelayMixPerc) + (input * (1-pData->flDelayMixPerc));
+#else
+	return q15_round(iDelayed * pData->qDelayMix + input * (Q15_ONE - pData->qDelayMix));
+#endif
+}
+
+
+// Block version of filter_delay_apply
+void filter_delay_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterDelayData_t *pData = (const FilterDelayData_t *)pUnknown;
+	DelayLine_t *pLine = pData->pLine;
+
+#ifdef FLOAT_DSP
+	const float flWet = pData->flDelayMixPerc;
+	const float flDry = 1 - pData->flDelayMixPerc;
+#else
+	const qgain_t qWet = pData->qDelayMix;
+	const qgain_t qDry = Q15_ONE - pData->qDelayMix;
+#endif
+
+	for(uint16_t i = 0; i < nSamples; ++i)
+	{
+		const int16_t iDelayed = delayline_shift(pLine, pSamples[i]);
+
+#ifdef FLOAT_DSP
+		pSamples[i] = (iDelayed * flWet) + (pSamples[i] * flDry);
+#else
+		pSamples[i] = q15_round(iDelayed * qWet + pSamples[i] * qDry);
+#endif
+	}
 }
 
 
@@ -46,26 +81,51 @@ int16_t filter_delay_apply(int16_t input, void *pUnknown)
 void filter_delay_debug(void *pUnknown)
 {
 	const FilterDelayData_t *pData = (const FilterDelayData_t *)pUnknown;
-	dbg_printf("delay=%u", pData->nDelay);
+	dbg_printf("line=%p, delay=%u, encoding=%u", (void *)pData->pLine, pData->nDelay, pData->encoding);
 }
 
 
 // Set delay filter initial creation values
-void filter_delay_create(void *pUnknown)
+bool filter_delay_create(void *pUnknown)
 {
 	FilterDelayData_t *pData = (FilterDelayData_t *)pUnknown;
-	pData->nDelay = 5000;
+	pData->nDelay = 3000;
 	pData->flDelayMixPerc = 0.5;
+	pData->encoding = DELAYLINE_LINEAR;
+
+	return filter_delay_mod(pUnknown);
 }
 
 
 /*
- *	Delay with feedback applies writeback facility.
- *	The current sample will be overwritten with the two mixed samples
-*/
-int16_t filter_delay_feedback_apply(int16_t input, void *pUnknown)
+ *	Derives the fixed point mix level after the parameters
+ *	change, and gets a delay line of the new length. The
+ *	previous line is not released here, it may still be in
+ *	use by the original copy of this filter data (see
+ *	filter_delay_free).
+ */
+bool filter_delay_mod(void *pUnknown)
 {
-	int16_t result = filter_delay_apply(input, pUnknown);
-	sample_set(g_iSampleCursor, result);
-	return result;
+	FilterDelayData_t *pData = (FilterDelayData_t *)pUnknown;
+
+	if(pData->encoding >= DELAYLINE_ENCODINGS)
+		pData->encoding = DELAYLINE_LINEAR;
+
+	// The range of the delay parameter is for the densest encoding, the UI is
+	// told about the clamp (see PACKETERROR_PARAM_CLAMPED)
+	if(pData->nDelay > DELAY_MAX_SAMPLES(pData->encoding) - 1)
+		pData->nDelay = DELAY_MAX_SAMPLES(pData->encoding) - 1;
+
+	pData->qDelayMix = qgain_from_float(pData->flDelayMixPerc);
+	pData->pLine = delayline_acquire(pData->pLine, pData->nDelay + 1, pData->encoding);
+
+	return pData->pLine != NULL;
+}
+
+
+// Release the delay line
+void filter_delay_free(void *pUnknown)
+{
+	FilterDelayData_t *pData = (FilterDelayData_t *)pUnknown;
+	delayline_release(pData->pLine);
 }
@@ -15,18 +15,36 @@
 #ifndef _FILTER_DELAY_H_
 #define _FILTER_DELAY_H_
 
+#include <stdbool.h>
+#include "fixed.h"
+#include "delayline.h"
+#include "context.h"
+
+
+// Longest delay line with `encoding`. Changing the delay or encoding needs the
+// old and new lines in the budget at once (see delayline_acquire), so a line
+// can only take half of it.
+#define DELAY_MAX_SAMPLES(encoding)	((uint32_t) (DELAY_BUDGET_SAMPLES / 2) * DELAYLINE_SAMPLES_PER_SLOT(encoding))
+
 
 // Structure used to hold delay data
+#pragma pack(push, 1)
 typedef struct
 {
-	uint16_t nDelay;		///< Length of delay (in samples [0-9999])
+	DelayLine_t *pLine;		///< nDelay + 1 samples of input, set by filter_delay_mod
+	uint16_t nDelay;		///< Length of delay (in samples [0-(DELAY_MAX_SAMPLES(encoding)-1)])
 	float flDelayMixPerc;	///< Mix level of the delayed sample float [0-1]
+	qgain_t qDelayMix;		///< flDelayMixPerc in Q15, set by filter_delay_mod
+	uint8_t encoding;		///< How the delay line is stored (DelayLineEncoding_e)
 } FilterDelayData_t;
+#pragma pack(pop)
 
 
-int16_t filter_delay_apply(int16_t input, void *pUnknown);
+int16_t filter_delay_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_delay_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
 void filter_delay_debug(void *pUnknown);
-void filter_delay_create(void *pUnknown);
-int16_t filter_delay_feedback_apply(int16_t input, void *pUnknown);
+bool filter_delay_create(void *pUnknown);
+bool filter_delay_mod(void *pUnknown);
+void filter_delay_free(void *pUnknown);
 
 #endif
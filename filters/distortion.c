@@ -3,7 +3,7 @@
  *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
  *
  *	File created by:	TB
- *	File modified by:	TB
+ *	File modified by:	TB & SR
  *	File debugged by:	TB
  *
  *	distortion.c
@@ -12,8 +12,13 @@
 */
 
 
+#include <string.h>
+#include <math.h>
+
 #include "config.h"
 #include "dbg.h"
+#include "fixed.h"
+#include "pool.h"
 #include "samples.h"
 #include "distortion.h"
 
@@ -26,13 +31,14 @@
  *	the distortion.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit sample
  *		pUnknown	null pointer to FilterBitcrusherData_t data
  *
  *	output:
  *		signed 12 bit sample
  */
-int16_t filter_bitcrusher_apply(int16_t input, void *pUnknown)
+int16_t filter_bitcrusher_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
 	const FilterBitcrusherData_t *pData = (const FilterBitcrusherData_t *)pUnknown;
 
@@ -40,6 +46,17 @@ int16_t filter_bitcrusher_apply(int16_t input, void *pUnknown)
 }
 
 
+// Block version of filter_bitcrusher_apply
+void filter_bitcrusher_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterBitcrusherData_t *pData = (const FilterBitcrusherData_t *)pUnknown;
+	const uint8_t bitLoss = pData->bitLoss;
+
+	for(uint16_t i = 0; i < nSamples; ++i)
+		pSamples[i] = (pSamples[i] >> bitLoss) << bitLoss;
+}
+
+
 // Print bitcrusher parameter information to UI console
 void filter_bitcrusher_debug(void *pUnknown)
 {
@@ -49,8 +66,225 @@ void filter_bitcrusher_debug(void *pUnknown)
 
 
 // Set initial creation bitcrusher parameter values
-void filter_bitcrusher_create(void *pUnknown)
+bool filter_bitcrusher_create(void *pUnknown)
 {
 	FilterBitcrusherData_t *pData = (FilterBitcrusherData_t *)pUnknown;
 	pData->bitLoss = 1;
+	return true;
+}
+
+
+/*
+ *	Waveshaper passes each sample through a static curve.
+ *	The curve is rendered for every 12 bit sample value by
+ *	filter_waveshaper_mod, so applying it is a clamp and a
+ *	single table load however complex the curve is.
+ *
+ *	inputs:
+ *		pContext	audio context being filtered
+ *		input		signed 12 bit sample
+ *		pUnknown	null pointer to FilterWaveshaperData_t data
+ *
+ *	output:
+ *		signed 12 bit sample
+ */
+int16_t filter_waveshaper_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
+{
+	const FilterWaveshaperData_t *pData = (const FilterWaveshaperData_t *)pUnknown;
+
+	return pData->pTable->pTable[sat_sample(input) + ADC_MID_POINT];
+}
+
+
+// Block version of filter_waveshaper_apply
+void filter_waveshaper_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterWaveshaperData_t *pData = (const FilterWaveshaperData_t *)pUnknown;
+	const int16_t *pTable = pData->pTable->pTable;
+
+	for(uint16_t i = 0; i < nSamples; ++i)
+		pSamples[i] = pTable[sat_sample(pSamples[i]) + ADC_MID_POINT];
+}
+
+
+// Print waveshaper parameter information to UI console
+void filter_waveshaper_debug(void *pUnknown)
+{
+	const FilterWaveshaperData_t *pData = (const FilterWaveshaperData_t *)pUnknown;
+	const ShaperParams_t *pParams = &pData->params;
+
+	dbg_printf("table=%p, curve=%u, drive=%u, shape=%u, level=%u, points=%u/%u/%u/%u", (void *)pData->pTable, pParams->curve, pParams->drive, pParams->shape, pParams->level,
+		pParams->pPoints[0], pParams->pPoints[1], pParams->pPoints[2], pParams->pPoints[3]);
+}
+
+
+/*
+ *	Evaluates waveshaper curve 'pParams' at 'flInput'
+ *	[-1-1]. Each curve is scaled so full scale input gives
+ *	at most full scale output, before the output level is
+ *	applied.
+ */
+static float waveshaper_curve(const ShaperParams_t *pParams, float flInput)
+{
+	const float flDrive = pParams->drive;
+	const float flShape = pParams->shape / 100.0f;
+	const float x = flInput * flDrive;
+
+	switch(pParams->curve)
+	{
+		default:
+		case SHAPER_SOFT_CLIP:
+			return tanhf(x) / tanhf(flDrive);
+
+		case SHAPER_HARD_CLIP:
+			return x > 1 ? 1 : (x < -1 ? -1 : x);
+
+		case SHAPER_TUBE:
+		{
+			// Bias moves the operating point up the curve, so negative
+			// peaks clip harder than positive ones
+			const float flBias = flShape;
+			return (tanhf(x + flBias) - tanhf(flBias)) / (1 + tanhf(flBias));
+		}
+
+		case SHAPER_FOLDBACK:
+		{
+			// Fold the input into [-1, 1] relative to the threshold, as a
+			// triangle wave of it
+			const float flThreshold = 1 - 0.9f * flShape;
+			float u = fmodf(x / flThreshold + 1, 4);
+			if(u < 0)
+				u += 4;
+
+			return u < 2 ? u - 1 : 3 - u;
+		}
+
+		case SHAPER_CUSTOM:
+		{
+			// Straight lines between (0, 0) and the points, mirrored for
+			// negative input
+			float flMagnitude = fabsf(x);
+			if(flMagnitude > 1)
+				flMagnitude = 1;
+
+			const float flPosition = flMagnitude * SHAPER_CUSTOM_POINTS;
+			uint8_t i = flPosition;
+			if(i >= SHAPER_CUSTOM_POINTS)
+				i = SHAPER_CUSTOM_POINTS - 1;
+
+			const float flFrom = i ? pParams->pPoints[i - 1] / 100.0f : 0;
+			const float flTo = pParams->pPoints[i] / 100.0f;
+			const float flOutput = flFrom + (flTo - flFrom) * (flPosition - i);
+
+			return x < 0 ? -flOutput : flOutput;
+		}
+	}
+}
+
+
+/*
+ *	Renders the waveshaper curve into a table, or shares the
+ *	table of another waveshaper with the same parameters.
+ *	Rendering calls the curve once per sample value in
+ *	soft-float, which takes a while, but only happens when
+ *	the parameters change.
+ *
+ *	The previous table is not released here, it may still be
+ *	in use by the original copy of this filter data (see
+ *	filter_waveshaper_free).
+ */
+bool filter_waveshaper_mod(void *pUnknown)
+{
+	FilterWaveshaperData_t *pData = (FilterWaveshaperData_t *)pUnknown;
+	ShaperParams_t *pParams = &pData->params;
+
+	if(pParams->curve >= SHAPER_CURVES)
+	{
+		dbg_warning("invalid waveshaper curve %u\r\n", pParams->curve);
+		pParams->curve = SHAPER_SOFT_CLIP;
+	}
+
+	if(pParams->drive < 1)
+		pParams->drive = 1;
+	if(pParams->shape > 100)
+		pParams->shape = 100;
+	if(pParams->level > 100)
+		pParams->level = 100;
+
+	for(uint8_t i = 0; i < SHAPER_CUSTOM_POINTS; ++i)
+	{
+		if(pParams->pPoints[i] > 100)
+			pParams->pPoints[i] = 100;
+	}
+
+	// Share a table that has already been rendered
+	for(uint16_t i = 0; i < g_ShaperPool.nCarved; ++i)
+	{
+		ShaperTable_t *pTable = (ShaperTable_t *)(g_ShaperPool.pStorage + i * g_ShaperPool.nBlockSize);
+
+		if(pTable->nUsers && !memcmp(&pTable->params, pParams, sizeof(ShaperParams_t)))
+		{
+			pTable->nUsers++;
+			pData->pTable = pTable;
+			return true;
+		}
+	}
+
+	// If the pool is full the original's table is forgotten, so freeing this
+	// copy is safe
+	ShaperTable_t *pTable = pool_alloc(&g_ShaperPool);
+	pData->pTable = pTable;
+
+	if(!pTable)
+		return false;
+
+	const float flLevel = pParams->level / 100.0f;
+
+	for(uint16_t i = 0; i < SHAPER_TABLE_SIZE; ++i)
+	{
+		const float flInput = (float)(i - ADC_MID_POINT) / ADC_MID_POINT;
+		const float flOutput = waveshaper_curve(pParams, flInput) * flLevel * ADC_MID_POINT;
+
+		pTable->pTable[i] = sat_sample(flOutput + (flOutput < 0 ? -0.5f : 0.5f));
+	}
+
+	pTable->params = *pParams;
+	pTable->nUsers = 1;
+
+	return true;
+}
+
+
+// Release waveshaper table
+void filter_waveshaper_free(void *pUnknown)
+{
+	FilterWaveshaperData_t *pData = (FilterWaveshaperData_t *)pUnknown;
+	ShaperTable_t *pTable = pData->pTable;
+
+	if(!pTable)
+		return;
+
+	dbg_assert(pTable->nUsers > 0, "waveshaper table %p is not in use", (void *)pTable);
+
+	if(--pTable->nUsers == 0)
+		pool_free(&g_ShaperPool, pTable);
+}
+
+
+// Set initial creation waveshaper parameter values
+bool filter_waveshaper_create(void *pUnknown)
+{
+	FilterWaveshaperData_t *pData = (FilterWaveshaperData_t *)pUnknown;
+	ShaperParams_t *pParams = &pData->params;
+
+	pParams->curve = SHAPER_SOFT_CLIP;
+	pParams->drive = 4;
+	pParams->shape = 30;
+	pParams->level = 80;
+	pParams->pPoints[0] = 40;
+	pParams->pPoints[1] = 70;
+	pParams->pPoints[2] = 90;
+	pParams->pPoints[3] = 100;
+
+	return filter_waveshaper_mod(pUnknown);
 }
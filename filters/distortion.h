@@ -3,7 +3,7 @@
  *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
  *
  *	File created by:	TB
- *	File modified by:	TB
+ *	File modified by:	TB & SR
  *	File debugged by:	TB
  *
  *	distortion.c
@@ -15,6 +15,10 @@
 #ifndef _FILTER_DISTORTION_H_
 #define _FILTER_DISTORTION_H_
 
+#include <stdbool.h>
+#include "config.h"
+#include "context.h"
+
 
 // Structure to hold bitcrusher parameter information
 typedef struct
@@ -23,8 +27,75 @@ typedef struct
 } FilterBitcrusherData_t;
 
 
-int16_t filter_bitcrusher_apply(int16_t input, void *pUnknown);
+// Entries in a waveshaper table, one for every 12 bit sample value
+#define SHAPER_TABLE_SIZE	(ADC_MAX_VALUE + 1)
+
+// Points of the "Custom" waveshaper curve
+#define SHAPER_CUSTOM_POINTS	4
+
+
+/*
+ * ShaperCurve_e
+ *
+ * Waveshaper curves, in the order of the "Curve" filter parameter
+ */
+typedef enum
+{
+	SHAPER_SOFT_CLIP = 0,	///< tanh
+	SHAPER_HARD_CLIP,
+	SHAPER_TUBE,			///< tanh with a bias, so the halves clip differently
+	SHAPER_FOLDBACK,		///< reflects peaks back down past a threshold
+	SHAPER_CUSTOM,			///< odd-symmetric, through SHAPER_CUSTOM_POINTS points
+	SHAPER_CURVES
+} ShaperCurve_e;
+
+
+// Waveshaper parameters, which the table is rendered from
+#pragma pack(push, 1)
+typedef struct
+{
+	uint8_t curve;			///< ShaperCurve_e
+	uint8_t drive;			///< Input gain [1-20]
+	uint8_t shape;			///< Tube bias or foldback threshold (%) [0-100]
+	uint8_t level;			///< Output level (%) [0-100]
+	uint8_t pPoints[SHAPER_CUSTOM_POINTS];	///< Custom curve output (%) at 1/4, 1/2, 3/4 and full scale input
+} ShaperParams_t;
+#pragma pack(pop)
+
+
+/*
+ * ShaperTable_t
+ *
+ * Output for every input sample of a waveshaper curve, allocated from
+ * g_ShaperPool and shared by every waveshaper with the same parameters.
+ */
+typedef struct
+{
+	ShaperParams_t params;	///< parameters rendered into pTable
+	uint8_t nUsers;			///< filter data using the table
+	int16_t pTable[SHAPER_TABLE_SIZE];	///< indexed by sample + ADC_MID_POINT
+} ShaperTable_t;
+
+
+// Structure to hold waveshaper parameter information
+#pragma pack(push, 1)
+typedef struct
+{
+	ShaperTable_t *pTable;	///< Rendered curve, set by filter_waveshaper_mod
+	ShaperParams_t params;
+} FilterWaveshaperData_t;
+#pragma pack(pop)
+
+
+int16_t filter_bitcrusher_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_bitcrusher_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
 void filter_bitcrusher_debug(void *pUnknown);
-void filter_bitcrusher_create(void *pUnknown);
+bool filter_bitcrusher_create(void *pUnknown);
+int16_t filter_waveshaper_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_waveshaper_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
+void filter_waveshaper_debug(void *pUnknown);
+bool filter_waveshaper_create(void *pUnknown);
+bool filter_waveshaper_mod(void *pUnknown);
+void filter_waveshaper_free(void *pUnknown);
 
 #endif
@@ -3,7 +3,7 @@
  *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
  *
  *	File created by:	TB
- *	File modified by:	TB
+ *	File modified by:	TB & SR
  *	File debugged by:	TB
  *
  *	dynamic.c
@@ -13,144 +13,319 @@
 
 
 #include "dbg.h"
+#include "pool.h"
 #include "samples.h"
+#include "envelope.h"
 #include "dynamic.h"
 #include "config.h"
 
 
+// Kinds of gain curve filter_dynamics_mod can build
+typedef enum
+{
+	DYNAMICS_GATE = 0,
+	DYNAMICS_COMPRESSOR,
+	DYNAMICS_EXPANDER
+} DynamicsType_e;
+
+
+/*
+ *	Looks the gain for level 'qLevel' (dBFS, Q8) up in the
+ *	filter's gain curve, and converts it to a Q15 scalar.
+ */
+static inline qgain_t dynamics_gain(const DynamicsState_t *pState, int16_t qLevel)
+{
+	const int32_t qPosition = qLevel - ENVELOPE_MIN_DB * DB_ONE;
+	const int32_t i = qPosition / (DYNAMICS_CURVE_STEP * DB_ONE);
+
+	if(i >= DYNAMICS_CURVE_SIZE - 1)
+		return envelope_db_to_gain(pState->pGainDb[DYNAMICS_CURVE_SIZE - 1]);
+
+	const int32_t qFrac = qPosition % (DYNAMICS_CURVE_STEP * DB_ONE);
+	const int32_t qGainDb = pState->pGainDb[i] + ((pState->pGainDb[i + 1] - pState->pGainDb[i]) * qFrac) / (DYNAMICS_CURVE_STEP * DB_ONE);
+
+	return envelope_db_to_gain(qGainDb);
+}
+
+
+// Applies a Q15 gain from dynamics_gain to 'input'
+static inline int16_t dynamics_scale(int16_t input, qgain_t qGain)
+{
+#ifdef FLOAT_DSP
+	return input * (qGain * (1.0f / Q15_ONE));
+#else
+	return q15_mul(input, qGain);
+#endif
+}
+
+
+/*
+ *	Noise gate opens while the detected level is above
+ *	'pData->threshold', and closes once it drops below the
+ *	threshold by more than 'pData->knee' (the hysteresis),
+ *	so a level hovering around the threshold doesn't make
+ *	it chatter. Silence is returned while it is closed.
+ */
+static inline int16_t noisegate_apply(DynamicsState_t *pState, int8_t threshold, uint8_t hysteresis, int16_t input, int16_t qLevel)
+{
+	if(qLevel >= threshold * DB_ONE)
+		pState->bGateOpen = true;
+	else if(qLevel < (threshold - hysteresis) * DB_ONE)
+		pState->bGateOpen = false;
+
+	return pState->bGateOpen ? input : 0;
+}
+
+
 /*
- *	Noisegate filter takes an average of the amplitude over the last
- *	'pData->sensitivity' samples. If the average is lower than
- *	'pData->threshold', silence is returned. Otherwise, 'input' is
- *	returned.
+ *	Noisegate filter silences the input while the level from
+ *	its envelope detector, following the input, is below
+ *	'pData->threshold'.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit audio sample
- *		pUnknown	null pointer to a FilterNoiseGateData_t data structure
+ *		pUnknown	null pointer to a FilterDynamicsData_t data structure
  *
  *	output:
  *		signed 12 bit audio sample
  */
-int16_t filter_noisegate_apply(int16_t input, void *pUnknown)
+int16_t filter_noisegate_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
-	const FilterNoiseGateData_t *pData = (const FilterNoiseGateData_t *)pUnknown;
+	const FilterDynamicsData_t *pData = (const FilterDynamicsData_t *)pUnknown;
+	DynamicsState_t *pState = pData->pState;
 
-	uint16_t average = sample_get_average(pData->sensitivity);
-	if(average < pData->threshold)
-		return 0;
-	else
-		return input;
+	return noisegate_apply(pState, pData->threshold, pData->knee, input, envelope_follow(pContext, pState->iEnvelope, &input, 1)[0]);
 }
 
 
-// Prints noise gate parameter information to UI console
-void filter_noisegate_debug(void *pUnknown)
+// Block version of filter_noisegate_apply
+void filter_noisegate_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
 {
-	const FilterNoiseGateData_t *pData = (const FilterNoiseGateData_t *)pUnknown;
-	dbg_printf("sensitivity=%u, threshold=%u", pData->sensitivity, pData->threshold);
-}
-
+	const FilterDynamicsData_t *pData = (const FilterDynamicsData_t *)pUnknown;
+	DynamicsState_t *pState = pData->pState;
+	const int16_t *pLevels = envelope_follow(pContext, pState->iEnvelope, pSamples, nSamples);
 
-// Set noise gate initial creation values
-void filter_noisegate_create(void *pUnknown)
-{
-	FilterNoiseGateData_t *pData = (FilterNoiseGateData_t *)pUnknown;
-	pData->sensitivity = 25;
-	pData->threshold = 50;
+	for(uint16_t n = 0; n < nSamples; ++n)
+		pSamples[n] = noisegate_apply(pState, pData->threshold, pData->knee, pSamples[n], pLevels[n]);
 }
 
 
 /*
- *	Compressor takes an average of the amplitude over the last
- *	'pData->sensitivity' samples. If the average is lower than
- *	'pData->threshold', the input is returned. Otherwise, the input
- *	is scaled using 'pData->scalar'.
+ *	Compressor and expander scale the input by a gain that
+ *	depends on the level of the input from their envelope
+ *	detector. The gain is read from a curve in the log
+ *	domain calculated by filter_dynamics_mod, so the
+ *	filters only differ in the curve.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit audio sample
- *		pUnknown	null pointer to a FilterCompressorData_t data structure
+ *		pUnknown	null pointer to a FilterDynamicsData_t data structure
  *
  *	output:
  *		signed 12 bit audio sample
  */
-int16_t filter_compressor_apply(int16_t input, void *pUnknown)
+int16_t filter_dynamics_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
-	const FilterCompressorData_t *pData = (const FilterCompressorData_t *)pUnknown;
-	input = input;
+	const FilterDynamicsData_t *pData = (const FilterDynamicsData_t *)pUnknown;
+	const DynamicsState_t *pState = pData->pState;
 
-	uint16_t average = sample_get_average(pData->sensitivity);
-	if(average < pData->threshold)
-		return input;
+	return dynamics_scale(input, dynamics_gain(pState, envelope_follow(pContext, pState->iEnvelope, &input, 1)[0]));
+}
 
-	input = input * pData->scalar;
 
-	if(input < -ADC_MID_POINT)
-		return  -ADC_MID_POINT;
-	if(input > ADC_MID_POINT-1)
-		return ADC_MID_POINT-1;
-	return input;
+// Block version of filter_dynamics_apply
+void filter_dynamics_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterDynamicsData_t *pData = (const FilterDynamicsData_t *)pUnknown;
+	const DynamicsState_t *pState = pData->pState;
+	const int16_t *pLevels = envelope_follow(pContext, pState->iEnvelope, pSamples, nSamples);
+
+	for(uint16_t n = 0; n < nSamples; ++n)
+		pSamples[n] = dynamics_scale(pSamples[n], dynamics_gain(pState, pLevels[n]));
 }
 
 
-// Prints compressor parameter information to UI console
+// Prints dynamics parameter information to UI console
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdouble-promotion"
-void filter_compressor_debug(void *pUnknown)
+void filter_dynamics_debug(void *pUnknown)
 {
-	const FilterCompressorData_t *pData = (const FilterCompressorData_t *)pUnknown;
-	dbg_printf("sensitivity=%u, threshold=%u, scalar=%f", pData->sensitivity, pData->threshold, pData->scalar);
+	const FilterDynamicsData_t *pData = (const FilterDynamicsData_t *)pUnknown;
+	const DynamicsState_t *pState = pData->pState;
+
+	dbg_printf("threshold=%d, knee=%u, attack=%u, release=%u, detector=%u, ratio=%f, envelope=%u, open=%u", pData->threshold, pData->knee, pData->attack, pData->release, pData->detector, pData->ratio,
+		pState ? pState->iEnvelope : ENVELOPE_NONE, pState ? pState->bGateOpen : 0);
 }
 #pragma GCC diagnostic pop
 
 
-// Set compressor initial creation values
-void filter_compressor_create(void *pUnknown)
+/*
+ *	Static gain (dB) of each filter type at level 'flLevel'
+ *	(dBFS). Compressor reduces the level above the threshold
+ *	by 'flRatio', expander pushes the level below it down by
+ *	'flRatio'. Both use a quadratic soft knee 'flKnee' dB wide
+ *	centred on the threshold.
+ */
+static float dynamics_curve(uint8_t iType, float flLevel, float flThreshold, float flKnee, float flRatio)
 {
-	FilterCompressorData_t *pData = (FilterCompressorData_t *)pUnknown;
-	pData->sensitivity = 25;
-	pData->threshold = 65;
-	pData->scalar = 0.8;
+	const float flOver = flLevel - flThreshold;
+
+	switch(iType)
+	{
+		case DYNAMICS_COMPRESSOR:
+			if(2 * flOver <= -flKnee)
+				return 0;
+			if(2 * flOver < flKnee)
+				return (1 / flRatio - 1) * (flOver + flKnee / 2) * (flOver + flKnee / 2) / (2 * flKnee);
+			return (1 / flRatio - 1) * flOver;
+
+		case DYNAMICS_EXPANDER:
+			if(2 * flOver >= flKnee)
+				return 0;
+			if(2 * flOver > -flKnee)
+				return -(flRatio - 1) * (flOver - flKnee / 2) * (flOver - flKnee / 2) / (2 * flKnee);
+			return (flRatio - 1) * flOver;
+	}
+
+	return 0;
 }
 
 
 /*
- * 	Expander takes an average of the amplitude over the last
- * 	'pData->sensitivity' samples. If the average is higher than
- * 	'pData->threshold', the input is returned. Otherwise, the input
- * 	is scaled using 'pData->scalar'.
- *
- *  inputs:
- * 	input		signed 12 bit audio sample
- * 	pUnknown	null pointer to a FilterCompressorData_t data structure.
- * 				FilterCompressorData_t structure used as the parameters
- * 				needed for expander are shared with those for compressor
- *
- *	output:
- *	signed 12 bit audio sample
+ *	Clamps the parameters, finds or starts an envelope
+ *	detector and tabulates the gain curve for filter type
+ *	'iType'. A new DynamicsState_t is allocated: the previous
+ *	one and its detector are not freed here, they may still
+ *	be in use by the original copy of this filter data (see
+ *	filter_dynamics_free).
  */
-int16_t filter_expander_apply(int16_t input, void *pUnknown)
+static bool filter_dynamics_mod(void *pUnknown, uint8_t iType)
 {
-	const FilterCompressorData_t *pData = (const FilterCompressorData_t *)pUnknown;
+	FilterDynamicsData_t *pData = (FilterDynamicsData_t *)pUnknown;
 
-	uint16_t average = sample_get_average(pData->sensitivity);
-	if(average > pData->threshold)
-		return input;
+	if(pData->threshold > 0)
+		pData->threshold = 0;
+	if(pData->threshold < ENVELOPE_MIN_DB)
+		pData->threshold = ENVELOPE_MIN_DB;
 
-	input = input * pData->scalar;
+	// Also catches NaN
+	if(!(pData->ratio >= 1))
+		pData->ratio = 1;
 
-	if(input < -ADC_MID_POINT)
-		return -ADC_MID_POINT;
-	if(input > ADC_MID_POINT-1)
-		return ADC_MID_POINT-1;
-	return (input);
+	if(pData->detector >= ENVELOPE_MODES)
+		pData->detector = ENVELOPE_PEAK;
+
+	// Allocate the new state. If the pool is full the original's state is
+	// forgotten, so freeing this copy is safe.
+	const DynamicsState_t *pPrevious = pData->pState;
+	DynamicsState_t *pState = pool_alloc(&g_DynamicsPool);
+	pData->pState = pState;
+
+	if(!pState)
+		return false;
+
+	pState->iEnvelope = envelope_acquire(pData->attack, pData->release, pData->detector, pPrevious ? pPrevious->iEnvelope : ENVELOPE_NONE);
+	if(pState->iEnvelope == ENVELOPE_NONE)
+	{
+		pool_free(&g_DynamicsPool, pState);
+		pData->pState = NULL;
+		return false;
+	}
+
+	// Carry on from the original's gate state, so it doesn't click shut
+	pState->bGateOpen = pPrevious ? pPrevious->bGateOpen : false;
+
+	for(uint8_t i = 0; i < DYNAMICS_CURVE_SIZE; ++i)
+	{
+		const float flLevel = ENVELOPE_MIN_DB + i * DYNAMICS_CURVE_STEP;
+		float flGain = dynamics_curve(iType, flLevel, pData->threshold, pData->knee, pData->ratio);
+
+		if(flGain < ENVELOPE_MIN_DB)
+			flGain = ENVELOPE_MIN_DB;
+
+		pState->pGainDb[i] = flGain * DB_ONE + (flGain < 0 ? -0.5f : 0.5f);
+	}
+
+	return true;
+}
+
+
+// Free the detector and gain curve
+void filter_dynamics_free(void *pUnknown)
+{
+	FilterDynamicsData_t *pData = (FilterDynamicsData_t *)pUnknown;
+
+	if(!pData->pState)
+		return;
+
+	envelope_release(pData->pState->iEnvelope);
+	pool_free(&g_DynamicsPool, pData->pState);
+}
+
+
+// Derives the detector after the noise gate parameters change
+bool filter_noisegate_mod(void *pUnknown)
+{
+	return filter_dynamics_mod(pUnknown, DYNAMICS_GATE);
+}
+
+
+// Set noise gate initial creation values
+bool filter_noisegate_create(void *pUnknown)
+{
+	FilterDynamicsData_t *pData = (FilterDynamicsData_t *)pUnknown;
+	pData->threshold = -40;
+	pData->knee = 6;
+	pData->attack = 1;
+	pData->release = 100;
+	pData->detector = ENVELOPE_PEAK;
+	pData->ratio = 1;
+
+	return filter_noisegate_mod(pUnknown);
+}
+
+
+// Derives the detector and gain curve after the compressor parameters change
+bool filter_compressor_mod(void *pUnknown)
+{
+	return filter_dynamics_mod(pUnknown, DYNAMICS_COMPRESSOR);
+}
+
+
+// Set compressor initial creation values
+bool filter_compressor_create(void *pUnknown)
+{
+	FilterDynamicsData_t *pData = (FilterDynamicsData_t *)pUnknown;
+	pData->threshold = -20;
+	pData->knee = 6;
+	pData->attack = 5;
+	pData->release = 100;
+	pData->detector = ENVELOPE_RMS;
+	pData->ratio = 4;
+
+	return filter_compressor_mod(pUnknown);
+}
+
+
+// Derives the detector and gain curve after the expander parameters change
+bool filter_expander_mod(void *pUnknown)
+{
+	return filter_dynamics_mod(pUnknown, DYNAMICS_EXPANDER);
 }
 
 
 // Set expander initial creation values
-void filter_expander_create(void *pUnknown)
+bool filter_expander_create(void *pUnknown)
 {
-	FilterCompressorData_t *pData = (FilterCompressorData_t *)pUnknown;
-	pData->sensitivity = 25;
-	pData->threshold = 65;
-	pData->scalar = 1.5;
+	FilterDynamicsData_t *pData = (FilterDynamicsData_t *)pUnknown;
+	pData->threshold = -40;
+	pData->knee = 6;
+	pData->attack = 5;
+	pData->release = 100;
+	pData->detector = ENVELOPE_RMS;
+	pData->ratio = 2;
+
+	return filter_expander_mod(pUnknown);
 }
@@ -3,7 +3,7 @@
  *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
  *
  *	File created by:	TB
- *	File modified by:	TB
+ *	File modified by:	TB & SR
  *	File debugged by:	TB
  *
  *	dynamic.c
@@ -15,31 +15,58 @@
 #ifndef _FILTER_DYNAMIC_H_
 #define _FILTER_DYNAMIC_H_
 
+#include <stdbool.h>
+#include "fixed.h"
+#include "envelope.h"
+#include "context.h"
 
-// Structure used to hold noisegate data
+
+// Gain curves are tabulated from ENVELOPE_MIN_DB to 0 dBFS, every
+// DYNAMICS_CURVE_STEP dB. Levels between entries are linearly interpolated.
+#define DYNAMICS_CURVE_STEP		2
+#define DYNAMICS_CURVE_SIZE		(-ENVELOPE_MIN_DB / DYNAMICS_CURVE_STEP + 1)
+
+
+/*
+ * DynamicsState_t
+ *
+ * Detector and static gain curve of a dynamics filter, allocated from
+ * g_DynamicsPool.
+ */
 typedef struct
 {
-	uint16_t sensitivity;	///< number of samples over which to take an average
-	uint16_t threshold;		///< Threshold, Peak amplitude of range [0-2047]
-} FilterNoiseGateData_t;
+	uint8_t iEnvelope;		///< Detector, see envelope_acquire
+	bool bGateOpen;			///< Noise gate state, kept for hysteresis
+	int16_t pGainDb[DYNAMICS_CURVE_SIZE];	///< gain at each level (dB, Q8)
+} DynamicsState_t;
 
 
-// Structure used to hold compressor (and expander) data
+// Structure used to hold noisegate, compressor and expander data
+#pragma pack(push, 1)
 typedef struct
 {
-	uint16_t sensitivity;	///< number of samples over which to take an average
-	uint16_t threshold;		///< Threshold, Peak amplitude of range [0-2047]
-	float scalar;			///< float [0-1] scalar value to compress/expand by
-} FilterCompressorData_t;
-
-
-int16_t filter_noisegate_apply(int16_t input, void *pUnknown);
-void filter_noisegate_debug(void *pUnknown);
-void filter_noisegate_create(void *pUnknown);
-int16_t filter_compressor_apply(int16_t input, void *pUnknown);
-void filter_compressor_debug(void *pUnknown);
-void filter_compressor_create(void *pUnknown);
-int16_t filter_expander_apply(int16_t input, void *pUnknown);
-void filter_expander_create(void *pUnknown);
+	DynamicsState_t *pState;	///< Detector and gain curve, set by the mod callbacks
+	int8_t threshold;		///< Threshold (dBFS) [-72-0]
+	uint8_t knee;			///< Knee width, or hysteresis for the noise gate (dB) [0-24]
+	uint8_t attack;			///< Detector attack time (msec)
+	uint8_t detector;		///< EnvelopeMode_e, 0 = Peak, 1 = RMS
+	uint16_t release;		///< Detector release time (msec)
+	float ratio;			///< Compression/expansion ratio [1-20]
+} FilterDynamicsData_t;
+#pragma pack(pop)
+
+
+int16_t filter_noisegate_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_noisegate_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
+bool filter_noisegate_create(void *pUnknown);
+bool filter_noisegate_mod(void *pUnknown);
+int16_t filter_dynamics_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_dynamics_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
+void filter_dynamics_debug(void *pUnknown);
+void filter_dynamics_free(void *pUnknown);
+bool filter_compressor_create(void *pUnknown);
+bool filter_compressor_mod(void *pUnknown);
+bool filter_expander_create(void *pUnknown);
+bool filter_expander_mod(void *pUnknown);
 
 #endif
@@ -19,38 +19,118 @@
 #include "dbg.h"
 #include "samples.h"
 #include "fir.h"
+#include "pool.h"
+#include "profile.h"
 #include "config.h"
 
 
 #define FREQ_TO_PI_FRAC(hz) (2 * hz / ((float)SAMPLE_RATE))
 
 
+// Incremented on every fir_design_acquire, to find the least recently used
+// design
+static uint32_t s_ulDesignClock = 0;
+
+// Design cache statistics, see fir_cache_debug
+static uint32_t s_ulDesignHits = 0;
+static uint32_t s_ulDesignMisses = 0;
+static uint32_t s_ulDesignEvictions = 0;
+
+
+/*
+ * fir_kernel_apply
+ *
+ * Adds `input` to the kernel's delay line and returns the filtered sample.
+ * Symmetric kernels add the two samples sharing a coefficient first, so need
+ * half the multiplies. MAC loops are unrolled four taps at a time.
+ */
+static inline int16_t fir_kernel_apply(FIRKernel_t *pKernel, int16_t input)
+{
+	const uint8_t nTaps = pKernel->nTaps;
+
+	// Store the newest sample before the previous one, twice
+	const uint8_t iHistory = pKernel->iHistory ? pKernel->iHistory - 1 : nTaps - 1;
+	pKernel->iHistory = iHistory;
+	pKernel->pHistory[iHistory] = input;
+	pKernel->pHistory[iHistory + nTaps] = input;
+
+	const int16_t *pWindow = &pKernel->pHistory[iHistory];
+	const FIRCoefficient_t *pCoefficients = pKernel->pDesign->pCoefficients;
+	FIRAccumulator_t acc = 0;
+	uint8_t k = 0;
+
+	if(pKernel->bSymmetric)
+	{
+		// pWindow[k] and pOldest[-k] share coefficient k
+		const int16_t *pOldest = pWindow + nTaps - 1;
+		const uint8_t nPairs = nTaps / 2;
+
+		for(; k + 4 <= nPairs; k += 4)
+		{
+			acc += pCoefficients[k] * (pWindow[k] + pOldest[-k]);
+			acc += pCoefficients[k+1] * (pWindow[k+1] + pOldest[-k-1]);
+			acc += pCoefficients[k+2] * (pWindow[k+2] + pOldest[-k-2]);
+			acc += pCoefficients[k+3] * (pWindow[k+3] + pOldest[-k-3]);
+		}
+
+		for(; k < nPairs; ++k)
+			acc += pCoefficients[k] * (pWindow[k] + pOldest[-k]);
+
+		// Middle tap of an odd length kernel has no pair
+		if(nTaps & 1)
+			acc += pCoefficients[nPairs] * pWindow[nPairs];
+	}
+	else
+	{
+		for(; k + 4 <= nTaps; k += 4)
+		{
+			acc += pCoefficients[k] * pWindow[k];
+			acc += pCoefficients[k+1] * pWindow[k+1];
+			acc += pCoefficients[k+2] * pWindow[k+2];
+			acc += pCoefficients[k+3] * pWindow[k+3];
+		}
+
+		for(; k < nTaps; ++k)
+			acc += pCoefficients[k] * pWindow[k];
+	}
+
+#ifdef FLOAT_DSP
+	return sat16(acc);
+#else
+	return sat16(q15_round(acc));
+#endif
+}
+
+
 /*
  *	FIR apply uses the calculated coefficients to sum together
- *	the previous 'pData->nCoefficients' samples, each independently
- *	scaled by their corresponding coefficient.
+ *	the previous 'pData->nCoefficients' input samples, each
+ *	independently scaled by their corresponding coefficient.
  *	This creates a bandpass effect.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit sample
  *		pUnknown	null pointer to FilterFIRBaseData_t data
  *
  *	output:
  *		signed 12 bit sample
  */
-int16_t filter_fir_apply(int16_t input, void *pUnknown)
+int16_t filter_fir_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
 	const FilterFIRBaseData_t *pData = (const FilterFIRBaseData_t *)pUnknown;
+	return fir_kernel_apply(pData->pKernel, input);
+}
 
-	int16_t output = 0;
 
-	for(uint8_t i = 0; i < pData->nCoefficients; ++i)
-	{
-		int16_t iSample = i == 0 ? input : sample_get(-i);
-		output += iSample * pData->pflCoefficients[i];
-	}
+// Block version of filter_fir_apply
+void filter_fir_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterFIRBaseData_t *pData = (const FilterFIRBaseData_t *)pUnknown;
+	FIRKernel_t *pKernel = pData->pKernel;
 
-	return output;
+	for(uint16_t n = 0; n < nSamples; ++n)
+		pSamples[n] = fir_kernel_apply(pKernel, pSamples[n]);
 }
 
 
@@ -58,41 +138,42 @@ int16_t filter_fir_apply(int16_t input, void *pUnknown)
 void filter_bandpass_debug(void *pUnknown)
 {
 	const FilterBandPassData_t *pData = (const FilterBandPassData_t *)pUnknown;
-	dbg_printf("base.coeffs=%p, base.coeffs=%u, centre=%u, width=%u", (void *)pData->base.pflCoefficients, pData->base.nCoefficients, pData->iCentreFreq, pData->iWidth);
+	dbg_printf("base.kernel=%p, base.coeffs=%u, centre=%u, width=%u", (void *)pData->base.pKernel, pData->base.nCoefficients, pData->iCentreFreq, pData->iWidth);
 }
 
 
 /*
- *	As recalculation of coefficients takes a long time,
- *	filter_bandpass_mod function is used to allow the
- *	coefficients to be calculated only once per parameter
- *	change.
- *	First, it is ensured that their is enough space to store
- *	the parameters by allocating them in memory before
- *	calculating.
- *	Then, each coefficient is calculated and stored in the
- *	array.
+ * fir_design_get_block
+ *
+ * @returns design `i` (block `i` of g_FIRDesignPool)
  */
-void filter_bandpass_mod(void *pUnknown)
+static inline FIRDesign_t *fir_design_get_block(uint16_t i)
 {
-	FilterBandPassData_t *pData = (FilterBandPassData_t *)pUnknown;
+	return (FIRDesign_t *)(g_FIRDesignPool.pStorage + i * g_FIRDesignPool.nBlockSize);
+}
 
-	dbg_assert(pData->base.nCoefficients > 0, "coefficient number must be > 0");
 
-	// Free current coefficients and allocate space for the new ones
-	free(pData->base.pflCoefficients);
-	pData->base.pflCoefficients = malloc(sizeof(float) * pData->base.nCoefficients);
-	dbg_assert(pData->base.pflCoefficients, "unable to allocate memory for %d FIR coefficients", pData->base.nCoefficients);
+/*
+ *	Calculates band-pass coefficients into pDesign for its
+ *	parameters. This is the slow part (a sinf per tap in
+ *	soft-float), which is why designs are cached.
+ *
+ *	The coefficients are symmetric, so only the first half
+ *	are calculated and the kernel folds the taps.
+ */
+static void fir_design_calculate(FIRDesign_t *pDesign)
+{
+	const uint8_t nTaps = pDesign->nTaps;
 
-	int32_t iLowerFreq = fmaxf(pData->iCentreFreq - (pData->iWidth / 2), 0);
-	int32_t iUpperFreq = fminf(pData->iCentreFreq + (pData->iWidth / 2), 20000);
+	int32_t iLowerFreq = fmaxf(pDesign->iCentreFreq - (pDesign->iWidth / 2), 0);
+	int32_t iUpperFreq = fminf(pDesign->iCentreFreq + (pDesign->iWidth / 2), 20000);
 
-	float d1 = (pData->base.nCoefficients - 1) / 2.0f;
+	float d1 = (nTaps - 1) / 2.0f;
 	float fc1 = FREQ_TO_PI_FRAC(iLowerFreq);
 	float fc2 = FREQ_TO_PI_FRAC(iUpperFreq);
 
-	// Calculate new coefficients
-	for(uint8_t i = 0; i < pData->base.nCoefficients; ++i)
+	// Calculate the first half of the new coefficients and mirror them
+	for(uint8_t i = 0; i < (nTaps + 1) / 2; ++i)
 	{
 		float d2 = i - d1;
 		float flCoeff;
@@ -102,13 +183,195 @@ void filter_bandpass_mod(void *pUnknown)
 		else
 			flCoeff = (sinf(fc2 * d2) - sinf(fc1 * d2)) / (PI_F * d2);
 
-		pData->base.pflCoefficients[i] = flCoeff;
+#ifdef FLOAT_DSP
+		pDesign->pCoefficients[i] = flCoeff;
+#else
+		pDesign->pCoefficients[i] = q15_from_float(flCoeff);
+#endif
+		pDesign->pCoefficients[nTaps - 1 - i] = pDesign->pCoefficients[i];
+	}
+}
+
+
+/*
+ * fir_design_acquire
+ *
+ * Finds cached band-pass coefficients for `nTaps` taps, `iCentreFreq` and
+ * `iWidth`, or designs them. If the cache is full the least recently used
+ * design that nothing is using is replaced. Each call must be paired with
+ * fir_design_release.
+ *
+ * @returns the design, or NULL if every cached design is in use
+ */
+static const FIRDesign_t *fir_design_acquire(uint8_t nTaps, uint16_t iCentreFreq, uint16_t iWidth)
+{
+	FIRDesign_t *pOldest = NULL;
+
+	for(uint16_t i = 0; i < g_FIRDesignPool.nCarved; ++i)
+	{
+		FIRDesign_t *pDesign = fir_design_get_block(i);
+
+		if(!pDesign->nTaps)
+			continue;
+
+		if(pDesign->nTaps == nTaps && pDesign->iCentreFreq == iCentreFreq && pDesign->iWidth == iWidth)
+		{
+			s_ulDesignHits++;
+			pDesign->nUsers++;
+			pDesign->ulLastUsed = ++s_ulDesignClock;
+			return pDesign;
+		}
+
+		if(!pDesign->nUsers && (!pOldest || pDesign->ulLastUsed < pOldest->ulLastUsed))
+			pOldest = pDesign;
+	}
+
+	s_ulDesignMisses++;
+
+	// Make room by dropping the least recently used design
+	if(g_FIRDesignPool.nUsed == g_FIRDesignPool.nBlocks && pOldest)
+	{
+		s_ulDesignEvictions++;
+		pOldest->nTaps = 0;
+		pool_free(&g_FIRDesignPool, pOldest);
+	}
+
+	FIRDesign_t *pDesign = pool_alloc(&g_FIRDesignPool);
+	if(!pDesign)
+		return NULL;
+
+	pDesign->nTaps = nTaps;
+	pDesign->iCentreFreq = iCentreFreq;
+	pDesign->iWidth = iWidth;
+	fir_design_calculate(pDesign);
+
+	pDesign->nUsers = 1;
+	pDesign->ulLastUsed = ++s_ulDesignClock;
+
+	return pDesign;
+}
+
+
+/*
+ * fir_design_release
+ *
+ * Releases a reference from fir_design_acquire. The design stays cached.
+ * Releasing NULL does nothing.
+ */
+static void fir_design_release(const FIRDesign_t *pConstDesign)
+{
+	if(!pConstDesign)
+		return;
+
+	FIRDesign_t *pDesign = (FIRDesign_t *)pConstDesign;
+	dbg_assert(pDesign->nUsers > 0, "FIR design %p is not in use", (void *)pDesign);
+
+	pDesign->nUsers--;
+}
+
+
+/*
+ *	As recalculation of coefficients takes a long time,
+ *	filter_bandpass_mod function is used to allow the
+ *	coefficients to be calculated only once per parameter
+ *	change.
+ *	First, it is ensured that their is enough space to store
+ *	the delay line by allocating it from the budget.
+ *	Then, the coefficients are looked up in the design cache,
+ *	so settings that have been used recently (or are in use
+ *	by another branch) don't have to be calculated again.
+ *
+ *	The previous kernel is not freed here, it may still be in
+ *	use by the original copy of this filter data (see
+ *	filter_fir_free). Its delay line is copied so the output
+ *	doesn't jump when a parameter changes.
+ */
+bool filter_bandpass_mod(void *pUnknown)
+{
+	FilterBandPassData_t *pData = (FilterBandPassData_t *)pUnknown;
+
+	dbg_assert(pData->base.nCoefficients > 0, "coefficient number must be > 0");
+
+	if(pData->base.nCoefficients > FIR_MAX_COEFFICIENTS)
+	{
+		dbg_warning("%u coefficients requested, clamping to %u\r\n", pData->base.nCoefficients, FIR_MAX_COEFFICIENTS);
+		pData->base.nCoefficients = FIR_MAX_COEFFICIENTS;
+	}
+
+	// Allocate the new kernel. If the pool is full the original's kernel is
+	// forgotten, so freeing this copy is safe.
+	const FIRKernel_t *pPrevious = pData->base.pKernel;
+	FIRKernel_t *pKernel = pool_alloc(&g_FIRKernelPool);
+	pData->base.pKernel = pKernel;
+
+	if(!pKernel)
+		return false;
+
+	const uint8_t nTaps = pData->base.nCoefficients;
+	pKernel->pDesign = fir_design_acquire(nTaps, pData->iCentreFreq, pData->iWidth);
+
+	if(!pKernel->pDesign)
+	{
+		pool_free(&g_FIRKernelPool, pKernel);
+		pData->base.pKernel = NULL;
+		return false;
+	}
+
+	pKernel->pLine = delayline_acquire(NULL, 2 * nTaps, DELAYLINE_LINEAR);
+
+	if(!pKernel->pLine)
+	{
+		fir_design_release(pKernel->pDesign);
+		pool_free(&g_FIRKernelPool, pKernel);
+		pData->base.pKernel = NULL;
+		return false;
 	}
+
+	pKernel->pHistory = pKernel->pLine->pSamples;
+
+	pKernel->nTaps = nTaps;
+	pKernel->bSymmetric = true;
+
+	// Carry on from the original's delay line, newest samples first
+	if(pPrevious)
+	{
+		const uint8_t nCopy = pPrevious->nTaps < nTaps ? pPrevious->nTaps : nTaps;
+
+		for(uint8_t i = 0; i < nCopy; ++i)
+		{
+			pKernel->pHistory[i] = pPrevious->pHistory[pPrevious->iHistory + i];
+			pKernel->pHistory[i + nTaps] = pKernel->pHistory[i];
+		}
+	}
+
+	return true;
+}
+
+
+// Free FIR kernel and release its coefficients and delay line
+void filter_fir_free(void *pUnknown)
+{
+	FilterFIRBaseData_t *pData = (FilterFIRBaseData_t *)pUnknown;
+
+	if(!pData->pKernel)
+		return;
+
+	fir_design_release(pData->pKernel->pDesign);
+	delayline_release(pData->pKernel->pLine);
+	pool_free(&g_FIRKernelPool, pData->pKernel);
+}
+
+
+// Estimate cycles spent on the taps (a multiply-accumulate per folded pair)
+uint16_t filter_fir_cost(const void *pUnknown)
+{
+	const FilterFIRBaseData_t *pData = (const FilterFIRBaseData_t *)pUnknown;
+	return 40 + 4 * pData->nCoefficients;
 }
 
 
 // Set initial bandpass creation parameters
-void filter_bandpass_create(void *pUnknown)
+bool filter_bandpass_create(void *pUnknown)
 {
 	FilterBandPassData_t *pData = (FilterBandPassData_t *)pUnknown;
 	pData->base.nCoefficients = 15;
@@ -116,5 +379,144 @@ void filter_bandpass_create(void *pUnknown)
 	pData->iWidth = 500;
 
 	// Generate coefficients
-	filter_bandpass_mod(pUnknown);
+	return filter_bandpass_mod(pUnknown);
+}
+
+
+// Samples filtered per run of each fir_benchmark variant, and runs per
+// variant. Only the fastest run counts, so runs interrupted by the sampling
+// path are ignored.
+#define FIR_BENCH_SAMPLES	BLOCK_SAMPLES
+#define FIR_BENCH_RUNS		8
+
+static volatile int32_t s_iBenchSink;	///< keeps the compiler from dropping the output
+
+
+/*
+ * fir_bench_previous
+ *
+ * The filter_fir_apply this replaced: each tap read from the sample history
+ * with sample_get, no folding.
+ */
+static int16_t __attribute__((noinline)) fir_bench_previous(const SampleHistory_t *pHistory, const FIRKernel_t *pKernel, int16_t input)
+{
+	FIRAccumulator_t output = 0;
+
+	for(uint8_t i = 0; i < pKernel->nTaps; ++i)
+	{
+		int16_t iSample = i == 0 ? input : sample_get(pHistory, -i);
+		output += iSample * pKernel->pDesign->pCoefficients[i];
+	}
+
+#ifdef FLOAT_DSP
+	return output;
+#else
+	return sat16(q15_round(output));
+#endif
+}
+
+
+// Cycles to filter FIR_BENCH_SAMPLES samples from `pHistory` with `pKernel`,
+// the previous way or with the kernel
+static uint32_t fir_bench_run(const SampleHistory_t *pHistory, FIRKernel_t *pKernel, bool bPrevious)
+{
+	uint32_t ulBest = UINT32_MAX;
+
+	for(uint8_t i = 0; i < FIR_BENCH_RUNS; ++i)
+	{
+		int32_t sum = 0;
+		const uint32_t ulStartCycles = PROFILE_CYCLES();
+
+		for(uint16_t n = 0; n < FIR_BENCH_SAMPLES; ++n)
+		{
+			const int16_t input = sample_read(pHistory, pHistory->iCursor - n);
+			sum += bPrevious ? fir_bench_previous(pHistory, pKernel, input) : fir_kernel_apply(pKernel, input);
+		}
+
+		const uint32_t ulCycles = PROFILE_CYCLES() - ulStartCycles;
+		s_iBenchSink = sum;
+
+		if(ulCycles < ulBest)
+			ulBest = ulCycles;
+	}
+
+	return ulBest;
+}
+
+
+// Prints a fir_benchmark result
+static void fir_bench_print(const char *pszName, uint8_t nTaps, uint32_t ulCycles)
+{
+	const uint32_t ulTaps = (uint32_t) nTaps * FIR_BENCH_SAMPLES;
+	const uint32_t ulTapsPerUsec = ulTaps * 100 * (hal_core_clock() / 1000000) / ulCycles;
+
+	dbg_printf("  - %s: %lu cycles/sample, %lu.%02lu taps/usec\r\n", pszName, ulCycles / FIR_BENCH_SAMPLES, ulTapsPerUsec / 100, ulTapsPerUsec % 100);
+}
+
+
+/*
+ * fir_benchmark
+ *
+ * Times a FIR_MAX_COEFFICIENTS tap band-pass the way filter_fir_apply used to
+ * (taps read from the history of `pContext`), and with the kernel with and
+ * without folding. Uses a spare block of g_FIRKernelPool and
+ * 2 * FIR_MAX_COEFFICIENTS samples of the delay line budget.
+ */
+void fir_benchmark(const AudioContext_t *pContext)
+{
+	FilterBandPassData_t data = {{NULL, FIR_MAX_COEFFICIENTS}, 1000, 500};
+
+	if(!filter_bandpass_mod(&data))
+		return;
+
+	FIRKernel_t *pKernel = data.base.pKernel;
+
+	const SampleHistory_t *pHistory = &pContext->history;
+	const uint32_t ulPrevious = fir_bench_run(pHistory, pKernel, true);
+	const uint32_t ulFolded = fir_bench_run(pHistory, pKernel, false);
+	pKernel->bSymmetric = false;
+	const uint32_t ulUnfolded = fir_bench_run(pHistory, pKernel, false);
+
+	dbg_printf(" === fir_benchmark ===\r\n");
+	dbg_printf("%u taps, best of %u runs of %u samples:\r\n", pKernel->nTaps, FIR_BENCH_RUNS, FIR_BENCH_SAMPLES);
+	fir_bench_print("previous (sample_get per tap)", pKernel->nTaps, ulPrevious);
+	fir_bench_print("kernel", pKernel->nTaps, ulUnfolded);
+	fir_bench_print("kernel, folded", pKernel->nTaps, ulFolded);
+	dbg_printf("\r\n");
+
+	filter_fir_free(&data.base);
+}
+
+
+/*
+ * fir_cache_debug
+ *
+ * Prints design cache hits/misses and every cached design.
+ */
+void fir_cache_debug(void)
+{
+	const uint32_t ulLookups = s_ulDesignHits + s_ulDesignMisses;
+	const uint32_t ulHitPerc = ulLookups ? s_ulDesignHits * 100 / ulLookups : 0;
+
+	dbg_printf(" === fir_cache_debug ===\r\n");
+	dbg_printf("hits: %lu, misses: %lu (%lu%% hit), evictions: %lu\r\n", s_ulDesignHits, s_ulDesignMisses, ulHitPerc, s_ulDesignEvictions);
+
+	for(uint16_t i = 0; i < g_FIRDesignPool.nCarved; ++i)
+	{
+		const FIRDesign_t *pDesign = fir_design_get_block(i);
+
+		if(pDesign->nTaps)
+			dbg_printf("#%u: %u taps, centre=%u, width=%u, %u user(s), last used %lu lookup(s) ago\r\n", i, pDesign->nTaps, pDesign->iCentreFreq, pDesign->iWidth, pDesign->nUsers, s_ulDesignClock - pDesign->ulLastUsed);
+	}
+
+	dbg_printf("\r\n");
+}
+
+
+// Zeroes the design cache statistics
+void fir_cache_reset(void)
+{
+	s_ulDesignHits = 0;
+	s_ulDesignMisses = 0;
+	s_ulDesignEvictions = 0;
 }
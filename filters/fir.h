@@ -15,10 +15,72 @@
 #ifndef _FILTER_FIR_H_
 #define _FILTER_FIR_H_
 
+#include <stdbool.h>
+#include "fixed.h"
+#include "delayline.h"
+#include "context.h"
+
+
+// Coefficients are Q15 (summed in a Q31 accumulator) unless building the
+// float path
+#ifdef FLOAT_DSP
+typedef float FIRCoefficient_t;
+typedef float FIRAccumulator_t;
+#else
+typedef q15_t FIRCoefficient_t;
+typedef q31_t FIRAccumulator_t;
+#endif
+
+
+// Most coefficients a FIR filter can have (see the Band-Pass parameters in
+// filters.c)
+#define FIR_MAX_COEFFICIENTS	50
+
+
+/*
+ * FIRDesign_t
+ *
+ * Band-pass coefficients for one set of parameters, allocated from
+ * g_FIRDesignPool and shared by every kernel with the same parameters. Designs
+ * nothing uses any more stay cached until the pool is needed for another one,
+ * least recently used first. ulLastUsed overlaps the pool free list pointer,
+ * as do the frequencies on a 64 bit host, but nTaps and nUsers never do.
+ */
+typedef struct
+{
+	uint32_t ulLastUsed;		///< value of the design clock when last acquired
+	uint16_t iCentreFreq;		///< Centre frequency designed for (Hz)
+	uint16_t iWidth;			///< Width designed for (Hz)
+	uint8_t nTaps;				///< number of coefficients, 0 when the block is free
+	uint8_t nUsers;				///< kernels using these coefficients
+	FIRCoefficient_t pCoefficients[FIR_MAX_COEFFICIENTS];
+} FIRDesign_t;
+
+
+/*
+ * FIRKernel_t
+ *
+ * Delay line of a FIR filter and the coefficients it uses, allocated from
+ * g_FIRKernelPool. The history is a 2 * nTaps sample line from the delay line
+ * budget. Each input sample is stored twice, nTaps apart, so the last nTaps
+ * samples are always contiguous: pHistory[iHistory + k] is the sample k
+ * samples ago. The line's own cursor isn't used.
+ */
+typedef struct
+{
+	uint8_t nTaps;		///< number of coefficients in use
+	bool bSymmetric;	///< pCoefficients[k] == pCoefficients[nTaps-1-k], taps are folded to halve the multiplies
+	uint8_t iHistory;	///< position of the newest sample in pHistory [0-(nTaps-1)]
+	const FIRDesign_t *pDesign;	///< coefficients, see fir_design_acquire
+	DelayLine_t *pLine;	///< history, see delayline_acquire
+	int16_t *pHistory;	///< pLine->pSamples
+} FIRKernel_t;
+
+
 #pragma pack(push, 1)
 typedef struct
 {
-	float *pflCoefficients;	///< Pointer to the coefficients array
+	FIRKernel_t *pKernel;	///< Pointer to the coefficients and delay line
 	uint8_t nCoefficients;	///< Number of coefficients to be calculated/used
 } FilterFIRBaseData_t;
 #pragma pack(pop)
@@ -34,9 +96,15 @@ typedef struct
 #pragma pack(pop)
 
 
-int16_t filter_fir_apply(int16_t input, void *pUnknown);
+int16_t filter_fir_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_fir_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
 void filter_bandpass_debug(void *pUnknown);
-void filter_bandpass_mod(void *pUnknown);
-void filter_bandpass_create(void *pUnknown);
+bool filter_bandpass_mod(void *pUnknown);
+bool filter_bandpass_create(void *pUnknown);
+void filter_fir_free(void *pUnknown);
+uint16_t filter_fir_cost(const void *pUnknown);
+void fir_benchmark(const AudioContext_t *pContext);
+void fir_cache_debug(void);
+void fir_cache_reset(void);
 
 #endif
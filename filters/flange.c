@@ -3,7 +3,7 @@
  *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
  *
  *	File created by:	TB
- *	File modified by:	TB
+ *	File modified by:	TB & SR
  *	File debugged by:	TB
  *
  *	flange.c
@@ -16,9 +16,8 @@
 
 #include "dbg.h"
 #include "config.h"
-#include "samples.h"
 #include "flange.h"
-#include "waves.h"
+#include "lfo.h"
 
 
 /*
@@ -26,46 +25,33 @@
  *	a sample a varying amount in the past.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit sample
  *		pUnknown	null pointer to FilterFlangeData_t data
  *
  *	output:
  *		signed 12 bit sample
  */
-int16_t filter_flange_apply(int16_t input, void *pUnknown)
+int16_t filter_flange_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
 	const FilterFlangeData_t *pData = (const FilterFlangeData_t *)pUnknown;
 
-	dbg_assert(pData->nDelay < BUFFER_SAMPLES / 2, "invalid flange parameter (nDelay)");
+	dbg_assert(pData->nDelay <= FLANGE_MAX_DELAY, "invalid flange parameter (nDelay)");
 
+	delayline_write(pData->pLine, input);
+
+#ifdef FLOAT_DSP
 	int16_t output = (1 - pData->flangedMix) * input;
 
-	float index;
-	switch (pData->waveType)
-	{
-		case 0:
-			if(get_square(pData->frequency))
-				index = g_iSampleCursor;
-			else
-				index = g_iSampleCursor - pData->nDelay;
-			break;
-		case 1:
-			index = g_iSampleCursor - get_sawtooth(pData->frequency) * pData->nDelay;
-			break;
-		case 2:
-			index = g_iSampleCursor - get_inverse_sawtooth(pData->frequency) * pData->nDelay;
-			break;
-		case 3:
-			index = g_iSampleCursor - get_triangle(pData->frequency) * pData->nDelay;
-			break;
-		default:
-			index = g_iSampleCursor;
-	}
-	if(index <= 0)
-	{
-		index += g_iSampleCursor;
-	}
-	return output + pData->flangedMix * sample_get_interpolated(index);
+	const uint32_t qDelay = lfo_get(pContext, pData->iLFO) * pData->nDelay * Q16_ONE;
+
+	return output + pData->flangedMix * delayline_read_interp(pData->pLine, qDelay, pData->interpolation);
+#else
+	// Q16.16 delay of the flanged sample, Q15 wave * nDelay is shifted once more to make it Q16
+	const uint32_t qDelay = ((uint32_t) pData->nDelay * lfo_get_q15(pContext, pData->iLFO)) << 1;
+
+	return q15_round(input * (Q15_ONE - pData->qFlangedMix) + delayline_read_interp(pData->pLine, qDelay, pData->interpolation) * pData->qFlangedMix);
+#endif
 }
 
 
@@ -75,17 +61,72 @@ int16_t filter_flange_apply(int16_t input, void *pUnknown)
 void filter_flange_debug(void *pUnknown)
 {
 	const FilterFlangeData_t *pData = (const FilterFlangeData_t *)pUnknown;
-	dbg_printf("delay=%u, frequency=%u, waveType=%u, flangedMix=%f", pData->nDelay, pData->frequency, pData->waveType, pData->flangedMix);
+	dbg_printf("line=%p, delay=%u, frequency=%u.%02u, waveType=%u, flangedMix=%f, lfo=%u, interpolation=%u", (void *)pData->pLine, pData->nDelay, pData->frequency,
+		pData->frequencyFine, pData->waveType, pData->flangedMix, pData->iLFO, pData->interpolation);
 }
 #pragma GCC diagnostic pop
 
 
 // Set initial creation flange parameter values
-void filter_flange_create(void *pUnknown)
+bool filter_flange_create(void *pUnknown)
 {
 	FilterFlangeData_t *pData = (FilterFlangeData_t *)pUnknown;
 	pData->nDelay = 10;
 	pData->frequency = 1;
 	pData->waveType = 0;
 	pData->flangedMix = 0.5;
+
+	return filter_flange_mod(pUnknown);
+}
+
+
+/*
+ *	Derives the fixed point mix level after the parameters
+ *	change, finds or starts an oscillator for the current
+ *	frequency and wave type, and gets a delay line long
+ *	enough for the deepest sweep. The previous oscillator and
+ *	line are not released here, they may still be in use by
+ *	the original copy of this filter data (see
+ *	filter_flange_free).
+ */
+bool filter_flange_mod(void *pUnknown)
+{
+	FilterFlangeData_t *pData = (FilterFlangeData_t *)pUnknown;
+
+	// Chains saved before the limit changed may delay further than allowed
+	if(pData->nDelay > FLANGE_MAX_DELAY)
+		pData->nDelay = FLANGE_MAX_DELAY;
+
+	pData->qFlangedMix = qgain_from_float(pData->flangedMix);
+	pData->iLFO = lfo_acquire(pData->frequency, pData->frequencyFine, pData->waveType);
+
+	if(pData->iLFO == LFO_NONE)
+	{
+		pData->pLine = NULL;
+		return false;
+	}
+
+	if(pData->interpolation >= DELAYLINE_INTERPS)
+		pData->interpolation = DELAYLINE_INTERP_LINEAR;
+
+	// Room for the taps either side of the deepest delay, with any interpolation
+	pData->pLine = delayline_acquire(pData->pLine, pData->nDelay + DELAYLINE_INTERP_TAPS, DELAYLINE_LINEAR);
+	return pData->pLine != NULL;
+}
+
+
+// Releases the oscillator and delay line used by this filter data
+void filter_flange_free(void *pUnknown)
+{
+	FilterFlangeData_t *pData = (FilterFlangeData_t *)pUnknown;
+	lfo_release(pData->iLFO);
+	delayline_release(pData->pLine);
+}
+
+
+// Extra cycles per sample of the interpolation over linear
+uint16_t filter_flange_cost(const void *pUnknown)
+{
+	const FilterFlangeData_t *pData = (const FilterFlangeData_t *)pUnknown;
+	return delayline_interp_cost(pData->interpolation);
 }
@@ -15,19 +15,38 @@
 #ifndef _FILTER_FLANGE_H_
 #define _FILTER_FLANGE_H_
 
+#include <stdbool.h>
+#include "fixed.h"
+#include "delayline.h"
+#include "context.h"
+
+
+// Longest flange delay (samples)
+#define FLANGE_MAX_DELAY	4095
+
 
 // Structure for Flange data
+#pragma pack(push, 1)
 typedef struct
 {
-	uint16_t nDelay;	///< The maximum sample in the past to go to [0-9999]
+	DelayLine_t *pLine;	///< nDelay + DELAYLINE_INTERP_TAPS samples of input, set by filter_flange_mod
+	uint16_t nDelay;	///< The maximum sample in the past to go to [1-FLANGE_MAX_DELAY]
 	uint8_t frequency;	///< The frequency of the LFO (Hz)
-	uint8_t waveType;	///< 0 = Square, 1 = Sawtooth, 2 = Inverse Sawtooth, 3 = Triangle
+	uint8_t waveType;	///< LFOWave_e, 0 = Square, 1 = Sawtooth, 2 = Inverse Sawtooth, 3 = Triangle, 4 = Sine
 	float flangedMix;	///< The mix amount of the flanged part [0-1]
+	uint16_t qFlangedMix;	///< flangedMix in Q15, set by filter_flange_mod
+	uint8_t frequencyFine;	///< Added to frequency, in 1/100 Hz [0-99]
+	uint8_t iLFO;		///< Shared oscillator, set by filter_flange_mod
+	uint8_t interpolation;	///< How the swept delay is read (DelayLineInterp_e)
 } FilterFlangeData_t;
+#pragma pack(pop)
 
 
-int16_t filter_flange_apply(int16_t input, void *pUnknown);
+int16_t filter_flange_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
 void filter_flange_debug(void *pUnknown);
-void filter_flange_create(void *pUnknown);
+bool filter_flange_create(void *pUnknown);
+bool filter_flange_mod(void *pUnknown);
+void filter_flange_free(void *pUnknown);
+uint16_t filter_flange_cost(const void *pUnknown);
 
 #endif
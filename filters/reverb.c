@@ -0,0 +1,224 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ *	reverb.c
+ *
+ *	Defines functions to apply a Schroeder/Freeverb style
+ *	reverb to a sample.
+*/
+
+
+#include <stdint.h>
+
+#include "config.h"
+#include "dbg.h"
+#include "pool.h"
+#include "reverb.h"
+
+
+// Freeverb's parameter scaling: the room size maps onto a comb feedback of
+// [0.7-0.98] and the damping onto a low-pass coefficient of [0-0.4]
+#define REVERB_FEEDBACK_OFFSET	0.7f
+#define REVERB_FEEDBACK_SCALE	0.28f
+#define REVERB_DAMP_SCALE		0.4f
+
+// Gain into the combs, and of the reverb at full mix. The combs are summed and
+// divided by REVERB_COMBS before the all-pass filters.
+#define REVERB_INPUT_GAIN		((qgain_t)(0.015f * REVERB_HEADROOM * Q15_ONE))
+#define REVERB_WET_SCALE		(3.0f * REVERB_COMBS / REVERB_HEADROOM)
+
+
+// Length of each delay line (samples)
+static const uint16_t s_pCombLengths[REVERB_COMBS] =
+{
+	REVERB_LENGTH(1116), REVERB_LENGTH(1188), REVERB_LENGTH(1277), REVERB_LENGTH(1356),
+	REVERB_LENGTH(1422), REVERB_LENGTH(1491), REVERB_LENGTH(1557), REVERB_LENGTH(1617)
+};
+
+static const uint16_t s_pAllpassLengths[REVERB_ALLPASSES] =
+{
+	REVERB_LENGTH(556), REVERB_LENGTH(441), REVERB_LENGTH(341), REVERB_LENGTH(225)
+};
+
+
+/*
+ *	Runs 'input' through the comb filters and then the
+ *	all-pass filters, and returns the reverb alone.
+ *
+ *	Each comb feeds its delayed output back through a one
+ *	pole low-pass, so high frequencies die away first. The
+ *	all-pass filters then smear the echoes of the combs out
+ *	into a dense tail. The arithmetic is all Q15.
+ */
+static inline int32_t reverb_process(ReverbLines_t *pLines, const FilterReverbData_t *pData, int16_t input)
+{
+	const int32_t iInput = q15_mul(input, REVERB_INPUT_GAIN);
+	int16_t *pLine = pLines->pSamples;
+	int32_t iSum = 0;
+
+	for(uint8_t i = 0; i < REVERB_COMBS; ++i)
+	{
+		uint16_t iCursor = pLines->pCombCursor[i];
+		const int32_t iDelayed = pLine[iCursor];
+
+		// store = delayed * (1 - damping) + store * damping
+		int32_t iStore = pLines->pCombStore[i];
+		iStore += q15_mul(iDelayed - iStore, pData->qDamp);
+		pLines->pCombStore[i] = iStore;
+
+		// Truncated towards zero, rounding would let the tail settle into a
+		// limit cycle of a few LSBs rather than dying away
+		pLine[iCursor] = sat16(iInput + iStore * pData->qFeedback / Q15_ONE);
+
+		if(++iCursor >= s_pCombLengths[i])
+			iCursor = 0;
+
+		pLines->pCombCursor[i] = iCursor;
+		pLine += s_pCombLengths[i];
+		iSum += iDelayed;
+	}
+
+	int32_t iOutput = iSum / REVERB_COMBS;
+
+	for(uint8_t i = 0; i < REVERB_ALLPASSES; ++i)
+	{
+		uint16_t iCursor = pLines->pAllpassCursor[i];
+		const int32_t iDelayed = pLine[iCursor];
+
+		// Freeverb's all-pass, with a fixed gain of 0.5 (also truncated
+		// towards zero)
+		pLine[iCursor] = sat16(iOutput + iDelayed / 2);
+		iOutput = iDelayed - iOutput;
+
+		if(++iCursor >= s_pAllpassLengths[i])
+			iCursor = 0;
+
+		pLines->pAllpassCursor[i] = iCursor;
+		pLine += s_pAllpassLengths[i];
+	}
+
+	return iOutput;
+}
+
+
+/*
+ *	Reverb filter mixes the input with a reverberated copy
+ *	of itself, at a ratio of 'pData->mix'. The reverb keeps
+ *	its own delay lines, so unlike the sample history they
+ *	hold this filter's input rather than the raw input, and
+ *	writing to them doesn't affect other filters.
+ *
+ *	inputs:
+ *		pContext	audio context being filtered
+ *		input		signed 12 bit audio sample
+ *		pUnknown	null pointer to a FilterReverbData_t data structure
+ *
+ *	output:
+ *		signed 12 bit audio sample
+ */
+int16_t filter_reverb_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
+{
+	const FilterReverbData_t *pData = (const FilterReverbData_t *)pUnknown;
+	const int32_t iReverb = reverb_process(pData->pLines, pData, input);
+
+	return sat_sample(q15_round(iReverb * pData->qWet + input * pData->qDry));
+}
+
+
+// Block version of filter_reverb_apply
+void filter_reverb_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown)
+{
+	const FilterReverbData_t *pData = (const FilterReverbData_t *)pUnknown;
+	ReverbLines_t *pLines = pData->pLines;
+
+	const qgain_t qWet = pData->qWet;
+	const qgain_t qDry = pData->qDry;
+
+	for(uint16_t n = 0; n < nSamples; ++n)
+	{
+		const int32_t iReverb = reverb_process(pLines, pData, pSamples[n]);
+		pSamples[n] = sat_sample(q15_round(iReverb * qWet + pSamples[n] * qDry));
+	}
+}
+
+
+// Prints reverb parameter information to UI console
+void filter_reverb_debug(void *pUnknown)
+{
+	const FilterReverbData_t *pData = (const FilterReverbData_t *)pUnknown;
+	dbg_printf("lines=%p, size=%u, damping=%u, mix=%u, feedback=%u, damp=%u, wet=%u, dry=%u", (void *)pData->pLines, pData->size, pData->damping, pData->mix,
+		pData->qFeedback, pData->qDamp, pData->qWet, pData->qDry);
+}
+
+
+/*
+ *	Derives the Q15 gains after the parameters change, and
+ *	allocates the delay lines the first time. The copy of
+ *	the filter data being modified shares the original's
+ *	lines, so the tail isn't cut off by a parameter change
+ *	(see filter_reverb_free).
+ */
+bool filter_reverb_mod(void *pUnknown)
+{
+	FilterReverbData_t *pData = (FilterReverbData_t *)pUnknown;
+
+	if(pData->size > 100)
+		pData->size = 100;
+	if(pData->damping > 100)
+		pData->damping = 100;
+	if(pData->mix > 100)
+		pData->mix = 100;
+
+	pData->qFeedback = qgain_from_float(REVERB_FEEDBACK_OFFSET + REVERB_FEEDBACK_SCALE * pData->size / 100);
+	pData->qDamp = qgain_from_float(1 - REVERB_DAMP_SCALE * pData->damping / 100);
+	pData->qWet = qgain_from_float(REVERB_WET_SCALE * pData->mix / 100);
+	pData->qDry = qgain_from_float(1 - pData->mix / 100.0f);
+
+	if(pData->pLines)
+	{
+		pData->pLines->nUsers++;
+		return true;
+	}
+
+	ReverbLines_t *pLines = pool_alloc(&g_ReverbPool);
+	pData->pLines = pLines;
+
+	if(!pLines)
+		return false;
+
+	pLines->nUsers = 1;
+	return true;
+}
+
+
+// Release the delay lines
+void filter_reverb_free(void *pUnknown)
+{
+	FilterReverbData_t *pData = (FilterReverbData_t *)pUnknown;
+	ReverbLines_t *pLines = pData->pLines;
+
+	if(!pLines)
+		return;
+
+	dbg_assert(pLines->nUsers > 0, "reverb lines %p are not in use", (void *)pLines);
+
+	if(--pLines->nUsers == 0)
+		pool_free(&g_ReverbPool, pLines);
+}
+
+
+// Set reverb initial creation values
+bool filter_reverb_create(void *pUnknown)
+{
+	FilterReverbData_t *pData = (FilterReverbData_t *)pUnknown;
+	pData->size = 50;
+	pData->damping = 50;
+	pData->mix = 30;
+
+	return filter_reverb_mod(pUnknown);
+}
@@ -0,0 +1,82 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ *	reverb.c
+ *
+ *	Defines functions to apply a Schroeder/Freeverb style
+ *	reverb to a sample.
+*/
+
+
+#ifndef _FILTER_REVERB_H_
+#define _FILTER_REVERB_H_
+
+#include <stdbool.h>
+#include "config.h"
+#include "fixed.h"
+#include "context.h"
+
+
+// Parallel low-pass feedback comb filters, and all-pass filters in series
+// after them
+#define REVERB_COMBS		8
+#define REVERB_ALLPASSES	4
+
+// Freeverb's delay lengths are tuned for 44.1 kHz
+#define REVERB_LENGTH(n)	((n) * SAMPLE_RATE / 44100)
+
+// Samples in every comb and all-pass delay line together
+#define REVERB_SAMPLES		(REVERB_LENGTH(1116 + 1188 + 1277 + 1356 + 1422 + 1491 + 1557 + 1617) + \
+							 REVERB_LENGTH(556 + 441 + 341 + 225))
+
+// Delay lines hold the input scaled up by this much, so the quiet end of the
+// tail isn't lost to rounding
+#define REVERB_HEADROOM		16
+
+
+/*
+ * ReverbLines_t
+ *
+ * Delay lines of a reverb, allocated from g_ReverbPool. They're shared by the
+ * copies of a reverb's filter data, so the tail carries on when a parameter
+ * changes. pCombStore overlaps the pool free list pointer, nUsers doesn't.
+ */
+typedef struct
+{
+	int32_t pCombStore[REVERB_COMBS];		///< output of each comb's damping low-pass
+	uint16_t pCombCursor[REVERB_COMBS];		///< position in each comb's line
+	uint16_t pAllpassCursor[REVERB_ALLPASSES];	///< position in each all-pass's line
+	uint8_t nUsers;							///< filter data using the lines
+	int16_t pSamples[REVERB_SAMPLES];		///< the comb lines followed by the all-pass lines
+} ReverbLines_t;
+
+
+// Structure used to hold reverb data
+#pragma pack(push, 1)
+typedef struct
+{
+	ReverbLines_t *pLines;	///< Delay lines, set by filter_reverb_mod
+	uint8_t size;			///< Room size, sets the comb feedback (%) [0-100]
+	uint8_t damping;		///< High frequency damping of the tail (%) [0-100]
+	uint8_t mix;			///< Mix level of the reverb (%) [0-100]
+	uint16_t qFeedback;		///< Comb feedback in Q15, set by filter_reverb_mod
+	uint16_t qDamp;			///< 1 - damping coefficient in Q15, set by filter_reverb_mod
+	uint16_t qWet;			///< Q15 gain of the reverb, set by filter_reverb_mod
+	uint16_t qDry;			///< Q15 gain of the input, set by filter_reverb_mod
+} FilterReverbData_t;
+#pragma pack(pop)
+
+
+int16_t filter_reverb_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
+void filter_reverb_apply_block(AudioContext_t *pContext, int16_t *pSamples, uint16_t nSamples, void *pUnknown);
+void filter_reverb_debug(void *pUnknown);
+bool filter_reverb_create(void *pUnknown);
+bool filter_reverb_mod(void *pUnknown);
+void filter_reverb_free(void *pUnknown);
+
+#endif
@@ -17,7 +17,7 @@
 #include "dbg.h"
 #include "config.h"
 #include "samples.h"
-#include "waves.h"
+#include "lfo.h"
 #include "tremolo.h"
 
 
@@ -29,32 +29,24 @@
  *	are applied to the input value.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit sample
  		pUnknown	null pointer to FilterTremoloData_t data
  *
  *	output
  *		signed 12 bit sample
  */
-int16_t filter_tremolo_apply(int16_t input, void *pUnknown)
+int16_t filter_tremolo_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
 	const FilterTremoloData_t *pData = (const FilterTremoloData_t *)pUnknown;
 
-	switch (pData->waveType)
-	{
-		case 0:
-			if(get_square(pData->frequency))
-				return input;
-			else
-				return input * (1 - pData->depth);
-		case 1:
-			return input * ((1 - pData->depth) + (get_sawtooth(pData->frequency) * pData->depth));
-		case 2:
-			return input * ((1 - pData->depth) + (get_inverse_sawtooth(pData->frequency) * pData->depth));
-		case 3:
-			return input * ((1 - pData->depth) + (get_triangle(pData->frequency) * pData->depth));
-		default:
-			return input;
-	}
+#ifdef FLOAT_DSP
+	return input * ((1 - pData->depth) + (lfo_get(pContext, pData->iLFO) * pData->depth));
+#else
+	const uint16_t qWave = lfo_get_q15(pContext, pData->iLFO);
+
+	return q15_mul(input, (Q15_ONE - pData->qDepth) + ((qWave * pData->qDepth) >> Q15_SHIFT));
+#endif
 }
 
 
@@ -64,16 +56,42 @@ int16_t filter_tremolo_apply(int16_t input, void *pUnknown)
 void filter_tremolo_debug(void *pUnknown)
 {
 	const FilterTremoloData_t *pData = (const FilterTremoloData_t *)pUnknown;
-	dbg_printf("frequency=%u, waveType=%u, depth=%f", pData->frequency, pData->waveType, pData->depth);
+	dbg_printf("frequency=%u.%02u, waveType=%u, depth=%f, lfo=%u", pData->frequency, pData->frequencyFine, pData->waveType, pData->depth, pData->iLFO);
 }
 #pragma GCC diagnostic pop
 
 
 // Set initial creation values of tremolo parameters
-void filter_tremolo_create(void *pUnknown)
+bool filter_tremolo_create(void *pUnknown)
 {
 	FilterTremoloData_t *pData = (FilterTremoloData_t *)pUnknown;
 	pData->frequency = 1;
 	pData->waveType = 0;
 	pData->depth = 0.5;
+
+	return filter_tremolo_mod(pUnknown);
+}
+
+
+/*
+ *	Derives the fixed point depth after the parameters change,
+ *	and finds or starts an oscillator for the current frequency
+ *	and wave type. The previous oscillator is not released
+ *	here, it may still be in use by the original copy of
+ *	this filter data (see filter_tremolo_free).
+ */
+bool filter_tremolo_mod(void *pUnknown)
+{
+	FilterTremoloData_t *pData = (FilterTremoloData_t *)pUnknown;
+	pData->qDepth = qgain_from_float(pData->depth);
+	pData->iLFO = lfo_acquire(pData->frequency, pData->frequencyFine, pData->waveType);
+	return pData->iLFO != LFO_NONE;
+}
+
+
+// Releases the oscillator used by this filter data
+void filter_tremolo_free(void *pUnknown)
+{
+	FilterTremoloData_t *pData = (FilterTremoloData_t *)pUnknown;
+	lfo_release(pData->iLFO);
 }
@@ -15,17 +15,26 @@
 #ifndef _FILTER_TREMOLO_H_
 #define _FILTER_TREMOLO_H_
 
+#include <stdbool.h>
+#include "fixed.h"
+#include "context.h"
+
 
 // Tremolo paramter data structure
 typedef struct
 {
-	uint8_t frequency;	///< Frequency of the LFO (Hz) (Divisor of SAMPLE_RATE/4)
-	uint8_t waveType;	///< 0 = Square, 1 = Sawtooth, 2 = Inverse Sawtooth, 3 = Triangle
+	uint8_t frequency;	///< Frequency of the LFO (Hz)
+	uint8_t waveType;	///< LFOWave_e, 0 = Square, 1 = Sawtooth, 2 = Inverse Sawtooth, 3 = Triangle, 4 = Sine
+	uint8_t frequencyFine;	///< Added to frequency, in 1/100 Hz [0-99]
+	uint8_t iLFO;		///< Shared oscillator, set by filter_tremolo_mod
 	float depth;		///< Minimum amplitude scalar [0-1]
+	qgain_t qDepth;		///< depth in Q15, set by filter_tremolo_mod
 } FilterTremoloData_t;
 
-int16_t filter_tremolo_apply(int16_t input, void *pUnknown);
+int16_t filter_tremolo_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
 void filter_tremolo_debug(void *pUnknown);
-void filter_tremolo_create(void *pUnknown);
+bool filter_tremolo_create(void *pUnknown);
+bool filter_tremolo_mod(void *pUnknown);
+void filter_tremolo_free(void *pUnknown);
 
 #endif
@@ -3,7 +3,7 @@
  *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
  *
  *	File created by:	TB
- *	File modified by:	TB
+ *	File modified by:	TB & SR
  *	File debugged by:	TB
  *
  *	vibrato.c
@@ -13,70 +13,39 @@
 
 
 #include "dbg.h"
-#include "samples.h"
 #include "vibrato.h"
-#include "waves.h"
+#include "lfo.h"
 #include "config.h"
-
-
-volatile bool g_bVibratoActive = false;
-
-/*
- *	Returns the current cursor for the currently applied vibrato.
- *	Calculated by using the vibrato's FilterVibratoData_t data.
- */
-float vibrato_get_cursor(void *pUnknown)
-{
-	const FilterVibratoData_t *pData = (const FilterVibratoData_t *)pUnknown;
-
-	float vib_cursor;
-
-	switch (pData->waveType)
-	{
-		case 0:
-			if(get_square(pData->frequency))
-				vib_cursor = g_iSampleCursor;
-			else
-				vib_cursor = g_iSampleCursor - (pData->nDelay);
-			break;
-		case 1:
-			vib_cursor = g_iSampleCursor - (pData->nDelay * get_sawtooth(pData->frequency));
-			break;
-		case 2:
-			vib_cursor = g_iSampleCursor - (pData->nDelay * get_inverse_sawtooth(pData->frequency));
-			break;
-		case 3:
-			vib_cursor = g_iSampleCursor - (pData->nDelay * get_triangle(pData->frequency));
-			break;
-		default:
-			vib_cursor = g_iSampleCursor;
-	}
-
-	if(vib_cursor < 0)
-		vib_cursor += BUFFER_SAMPLES;
-
-	return vib_cursor;
-}
+#include "fixed.h"
 
 
 /*
- *	Set the global vibrato boolean to true and
- *	calculate the current cursor value, before
- *	returning the sample in the delay line at
- *	the calculated cursor value.
+ *	Vibrato reads the input back from its delay line at a
+ *	delay swept by the LFO, which bends the pitch up and
+ *	down as the delay shrinks and grows.
  *
  *	inputs:
+ *		pContext	audio context being filtered
  *		input		signed 12 bit sample
  *		pUnknown	null pointer to FilterVibratoData_t data
  *
  *	output:
  *		signed 12 bit sample
  */
-int16_t filter_vibrato_apply(int16_t input, void *pUnknown)
+int16_t filter_vibrato_apply(AudioContext_t *pContext, int16_t input, void *pUnknown)
 {
-	g_bVibratoActive = true;
-	g_flVibratoSampleCursor = vibrato_get_cursor(pUnknown);
-	return sample_get(g_iSampleCursor);
+	const FilterVibratoData_t *pData = (const FilterVibratoData_t *)pUnknown;
+
+	delayline_write(pData->pLine, input);
+
+#ifdef FLOAT_DSP
+	const uint32_t qDelay = lfo_get(pContext, pData->iLFO) * pData->nDelay * Q16_ONE;
+#else
+	// Q15 wave * nDelay is shifted once more to make it Q16
+	const uint32_t qDelay = ((uint32_t) pData->nDelay * lfo_get_q15(pContext, pData->iLFO)) << 1;
+#endif
+
+	return delayline_read_interp(pData->pLine, qDelay, pData->interpolation);
 }
 
 
@@ -84,15 +53,66 @@ int16_t filter_vibrato_apply(int16_t input, void *pUnknown)
 void filter_vibrato_debug(void *pUnknown)
 {
 	const FilterVibratoData_t *pData = (const FilterVibratoData_t *)pUnknown;
-	dbg_printf("delay=%u, frequency=%u, waveType=%u", pData->nDelay, pData->frequency, pData->waveType);
+	dbg_printf("line=%p, delay=%u, frequency=%u.%02u, waveType=%u, lfo=%u, interpolation=%u", (void *)pData->pLine, pData->nDelay, pData->frequency, pData->frequencyFine,
+		pData->waveType, pData->iLFO, pData->interpolation);
 }
 
 
 // Set initial creation vibrato parameter values
-void filter_vibrato_create(void *pUnknown)
+bool filter_vibrato_create(void *pUnknown)
 {
 	FilterVibratoData_t *pData = (FilterVibratoData_t *)pUnknown;
 	pData->nDelay = 10;
 	pData->frequency = 1;
 	pData->waveType = 0;
+
+	return filter_vibrato_mod(pUnknown);
+}
+
+
+/*
+ *	Finds or starts an oscillator for the current frequency
+ *	and wave type, and gets a delay line long enough for the
+ *	deepest sweep. The previous oscillator and line are not
+ *	released here, they may still be in use by the original
+ *	copy of this filter data (see filter_vibrato_free).
+ */
+bool filter_vibrato_mod(void *pUnknown)
+{
+	FilterVibratoData_t *pData = (FilterVibratoData_t *)pUnknown;
+
+	if(pData->nDelay > VIBRATO_MAX_DELAY)
+		pData->nDelay = VIBRATO_MAX_DELAY;
+
+	pData->iLFO = lfo_acquire(pData->frequency, pData->frequencyFine, pData->waveType);
+
+	if(pData->iLFO == LFO_NONE)
+	{
+		pData->pLine = NULL;
+		return false;
+	}
+
+	if(pData->interpolation >= DELAYLINE_INTERPS)
+		pData->interpolation = DELAYLINE_INTERP_LINEAR;
+
+	// Room for the taps either side of the deepest delay, with any interpolation
+	pData->pLine = delayline_acquire(pData->pLine, pData->nDelay + DELAYLINE_INTERP_TAPS, DELAYLINE_LINEAR);
+	return pData->pLine != NULL;
+}
+
+
+// Releases the oscillator and delay line used by this filter data
+void filter_vibrato_free(void *pUnknown)
+{
+	FilterVibratoData_t *pData = (FilterVibratoData_t *)pUnknown;
+	lfo_release(pData->iLFO);
+	delayline_release(pData->pLine);
+}
+
+
+// Extra cycles per sample of the interpolation over linear
+uint16_t filter_vibrato_cost(const void *pUnknown)
+{
+	const FilterVibratoData_t *pData = (const FilterVibratoData_t *)pUnknown;
+	return delayline_interp_cost(pData->interpolation);
 }
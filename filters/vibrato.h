@@ -16,23 +16,34 @@
 #define _FILTER_VIBRATO_H_
 
 #include <stdbool.h>
+#include "delayline.h"
+#include "context.h"
+
+
+// Longest vibrato delay (samples)
+#define VIBRATO_MAX_DELAY	500
 
 
 // Structure to hold vibrato parameter values
+#pragma pack(push, 1)
 typedef struct
 {
-	uint16_t nDelay;	///< The maximum sample backward to go [0-9999]
-	uint8_t frequency;	///< The frequency of the LFO used
-	uint8_t waveType;	///< 0 = Square, 1 = Sawtooth, 2 = Inverse Sawtooth, 3 = Triangle
+	DelayLine_t *pLine;	///< nDelay + DELAYLINE_INTERP_TAPS samples of input, set by filter_vibrato_mod
+	uint16_t nDelay;	///< The maximum sample backward to go [1-VIBRATO_MAX_DELAY]
+	uint8_t frequency;	///< The frequency of the LFO used (Hz)
+	uint8_t waveType;	///< LFOWave_e, 0 = Square, 1 = Sawtooth, 2 = Inverse Sawtooth, 3 = Triangle, 4 = Sine
+	uint8_t frequencyFine;	///< Added to frequency, in 1/100 Hz [0-99]
+	uint8_t iLFO;		///< Shared oscillator, set by filter_vibrato_mod
+	uint8_t interpolation;	///< How the swept delay is read (DelayLineInterp_e)
 } FilterVibratoData_t;
+#pragma pack(pop)
 
 
-extern volatile bool g_bVibratoActive;
-
-
-float vibrato_get_cursor(void *pUnknown);
-int16_t filter_vibrato_apply(int16_t input, void *pUnknown);
+int16_t filter_vibrato_apply(AudioContext_t *pContext, int16_t input, void *pUnknown);
 void filter_vibrato_debug(void *pUnknown);
-void filter_vibrato_create(void *pUnknown);
+bool filter_vibrato_create(void *pUnknown);
+bool filter_vibrato_mod(void *pUnknown);
+void filter_vibrato_free(void *pUnknown);
+uint16_t filter_vibrato_cost(const void *pUnknown);
 
 #endif
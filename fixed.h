@@ -0,0 +1,158 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * fixed.h - Fixed point arithmetic
+ *
+ * Q15 gains/fractions, Q31 accumulators and saturating helpers used by the
+ * sampling path instead of soft-float.
+ *
+ * Build with FLOAT=1 (defines FLOAT_DSP) to use the original float path.
+ * Gains are rounded to the nearest 1/32768, and fixed point multiplies round
+ * where the float path truncates, so each gain stage is within 1 LSB of the
+ * float path. FIR output is within nCoefficients LSB as the float path
+ * truncates to int16_t after every tap. Biquad output is within 2 LSB per
+ * section at the default 1 kHz cutoff; the poles amplify rounding at low and
+ * high cutoffs, so its frequency response is bounded instead (see biquad.c).
+ *
+ * `make test` checks every filter against these bounds (see hal/test.c).
+ */
+
+#ifndef _FIXED_H_
+#define _FIXED_H_
+
+#include <stdint.h>
+#include "config.h"
+
+
+#define Q15_SHIFT	15
+#define Q15_ONE		(1 << Q15_SHIFT)	///< 1.0 in Q15
+#define Q15_HALF	(1 << (Q15_SHIFT-1))	///< 0.5 in Q15, used for rounding
+
+#define Q16_SHIFT	16
+#define Q16_ONE		(1 << Q16_SHIFT)	///< 1.0 in Q16.16
+
+
+typedef int16_t q15_t;		///< fraction in [-1, 1)
+typedef int32_t q31_t;		///< accumulator of Q15 products
+typedef int32_t qgain_t;	///< Q15 gain held in 32 bits, so it may be >= 1.0 (Q15_ONE = 1.0)
+
+
+/*
+ * qgain_from_float
+ *
+ * Converts a float to the nearest Q15 gain.
+ */
+static inline qgain_t qgain_from_float(float fl)
+{
+	return (qgain_t)(fl * Q15_ONE + (fl < 0 ? -0.5f : 0.5f));
+}
+
+
+/*
+ * q15_from_float
+ *
+ * Converts a float in [-1, 1) to the nearest Q15 fraction, saturating.
+ */
+static inline q15_t q15_from_float(float fl)
+{
+	qgain_t q = qgain_from_float(fl);
+
+	if(q > INT16_MAX)
+		return INT16_MAX;
+	if(q < INT16_MIN)
+		return INT16_MIN;
+
+	return q;
+}
+
+
+/*
+ * q15_round
+ *
+ * Scales a Q31 accumulator back down to a sample, rounding to nearest.
+ */
+static inline int32_t q15_round(q31_t acc)
+{
+	return (acc + Q15_HALF) >> Q15_SHIFT;
+}
+
+
+/*
+ * q15_mul
+ *
+ * Multiplies a sample by a Q15 gain, rounding to nearest.
+ */
+static inline int32_t q15_mul(int32_t iSample, qgain_t qGain)
+{
+	return q15_round(iSample * qGain);
+}
+
+
+/*
+ * sat16
+ *
+ * Saturates to the range of an int16_t.
+ */
+static inline int16_t sat16(int32_t i)
+{
+	if(i > INT16_MAX)
+		return INT16_MAX;
+	if(i < INT16_MIN)
+		return INT16_MIN;
+
+	return i;
+}
+
+
+/*
+ * sat_sample
+ *
+ * Saturates to the range of a signed 12-bit sample.
+ */
+static inline int16_t sat_sample(int32_t i)
+{
+	if(i > ADC_MID_POINT-1)
+		return ADC_MID_POINT-1;
+	if(i < -ADC_MID_POINT)
+		return -ADC_MID_POINT;
+
+	return i;
+}
+
+
+/*
+ * isqrt
+ *
+ * Integer square root, rounded down. Same result as (uint32_t)sqrt(n) without
+ * going through soft-float doubles.
+ */
+static inline uint32_t isqrt(uint32_t n)
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while(bit > n)
+		bit >>= 2;
+
+	while(bit)
+	{
+		if(n >= root + bit)
+		{
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+			root >>= 1;
+
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * governor.c - Overload governor
+ *
+ * Temporarily bypasses the most expensive branches of g_AudioContext while the
+ * sampling path is missing its deadlines, and restores them when there is
+ * headroom again.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "dbg.h"
+#include "hal.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "profile.h"
+#include "admission.h"
+#include "audio.h"
+#include "governor.h"
+
+
+// Shed branches automatically? Missed deadlines are logged either way.
+bool g_bGovernorEnabled = true;
+
+// Consecutive blocks that missed their deadline
+volatile uint8_t g_nGovernorMisses = 0;
+
+// Total blocks that missed their deadline, and the worst cycles per sample
+// since the last warning
+volatile uint32_t g_ulGovernorMissTotal = 0;
+volatile uint32_t g_ulGovernorWorstCycles = 0;
+
+// Last shed/restore, and how long to wait after it before restoring a branch.
+// The wait doubles each time a restored branch has to be shed again.
+static uint32_t s_ulLastEventTick = 0;
+static bool s_bLastEventShed = false;
+static uint32_t s_ulRestoreHold = GOVERNOR_RESTORE_MSEC;
+
+// Might any branches be shed? Saves walking the chain every loop when not.
+static bool s_bAnyShed = false;
+
+// Missed deadline warnings
+static uint32_t s_ulLastWarnTick = 0;
+static uint32_t s_ulWarnedMisses = 0;
+
+// Most recent shed/restore events, s_iLogNext is the oldest
+static GovernorEvent_t s_pLog[GOVERNOR_LOG_SIZE];
+static uint8_t s_iLogNext = 0;
+static uint8_t s_nLogEvents = 0;
+
+
+/*
+ * governor_load
+ *
+ * @returns peak cycles per sample measured in the sampling path in the current
+ * profiling window, or 0 if nothing has been measured yet
+ */
+static uint32_t governor_load(void)
+{
+	ProfileSummary_t tick, chain;
+	profile_summarise(&g_ProfileTick, &tick);
+	profile_summarise(&g_ProfileChain, &chain);
+
+	if(!chain.nMax)
+		return 0;
+
+	return tick.nMax + chain.nMax;
+}
+
+
+/*
+ * governor_log
+ *
+ * Records and prints a shed/restore event, then recompiles the chain so it
+ * takes effect.
+ */
+static void governor_log(uint8_t nStage, uint8_t nBranch, const StageBranch_t *pBranch, bool bShed, uint32_t ulBranchCycles, uint32_t ulLoadCycles)
+{
+	const uint32_t ulTick = hal_tickcount();
+
+	GovernorEvent_t *pEvent = &s_pLog[s_iLogNext];
+	pEvent->ulTick = ulTick;
+	pEvent->nStage = nStage;
+	pEvent->nBranch = nBranch;
+	pEvent->iFilterType = pBranch->pFilter - g_pFilters;
+	pEvent->bShed = bShed;
+	pEvent->nBranchCycles = ulBranchCycles > UINT16_MAX ? UINT16_MAX : ulBranchCycles;
+	pEvent->nLoadCycles = ulLoadCycles > UINT16_MAX ? UINT16_MAX : ulLoadCycles;
+
+	s_iLogNext = (s_iLogNext + 1) % GOVERNOR_LOG_SIZE;
+	if(s_nLogEvents < GOVERNOR_LOG_SIZE)
+		s_nLogEvents++;
+
+	dbg_printf(ANSI_COLOR_YELLOW "Governor" ANSI_COLOR_RESET ": %s branch %u:%u (%s, %lu cycles/sample), load was %lu/%lu cycles/sample\r\n",
+		bShed ? "shed" : "restored", nStage, nBranch, pBranch->pFilter->pszName, ulBranchCycles, ulLoadCycles, g_ulPeriodCycles);
+
+	// A branch that has to be shed straight after being restored will keep
+	// doing so, back off
+	if(bShed && !s_bLastEventShed && ulTick - s_ulLastEventTick < s_ulRestoreHold * 2)
+	{
+		s_ulRestoreHold *= 2;
+		if(s_ulRestoreHold > GOVERNOR_MAX_HOLD_MSEC)
+			s_ulRestoreHold = GOVERNOR_MAX_HOLD_MSEC;
+	}
+
+	s_ulLastEventTick = ulTick;
+	s_bLastEventShed = bShed;
+
+	// Measurements from before the change no longer apply
+	chainplan_compile(&g_AudioContext);
+	profile_reset();
+	g_nGovernorMisses = 0;
+}
+
+
+/*
+ * governor_shed
+ *
+ * Sheds the active branch that costs the most cycles per sample.
+ */
+static void governor_shed(void)
+{
+	const ChainPlan_t *pPlan = g_AudioContext.pChainPlan;
+
+	if(!pPlan)
+		return;
+
+	StageBranch_t *pWorst = NULL;
+	uint8_t nWorstStage = 0;
+	uint8_t nWorstBranch = 0;
+	uint32_t ulWorstCycles = 0;
+
+	// Every active branch has an op in the plan
+	for(uint8_t i = 0; i < pPlan->nOps; ++i)
+	{
+		const PlanOp_t *pOp = &pPlan->pOps[i];
+
+		ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, pOp->nStage);
+		StageBranch_t *pBranch = pStageHdr ? stage_get_branch(pStageHdr, pOp->nBranch) : NULL;
+
+		if(!pBranch)
+			continue;
+
+		// Prefer what was measured, fall back to the cost model
+		ProfileSummary_t summary;
+		profile_summarise(&pOp->stat, &summary);
+
+		uint32_t ulCycles = summary.nAvg;
+		if(!ulCycles)
+			ulCycles = admission_branch_cost(pStageHdr, pBranch);
+
+		if(ulCycles > ulWorstCycles)
+		{
+			pWorst = pBranch;
+			nWorstStage = pOp->nStage;
+			nWorstBranch = pOp->nBranch;
+			ulWorstCycles = ulCycles;
+		}
+	}
+
+	if(!pWorst)
+		return;
+
+	const uint32_t ulLoad = governor_load();
+
+	pWorst->flags |= BRANCHFLAG_SHED;
+	s_bAnyShed = true;
+	governor_log(nWorstStage, nWorstBranch, pWorst, true, ulWorstCycles, ulLoad);
+}
+
+
+/*
+ * governor_restore
+ *
+ * Restores the cheapest shed branch if the measured load leaves room for it.
+ */
+static void governor_restore(void)
+{
+	const uint32_t ulLoad = governor_load();
+
+	if(!ulLoad)
+		return;
+
+	StageBranch_t *pBest = NULL;
+	uint8_t nBestStage = 0;
+	uint8_t nBestBranch = 0;
+	uint32_t ulBestCycles = UINT32_MAX;
+
+	uint8_t nStage = 0;
+	for(ChainStageHeader_t *pStageHdr = g_AudioContext.pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext, nStage++)
+	{
+		uint8_t nBranch = 0;
+		for(StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext, nBranch++)
+		{
+			if(!(pBranch->flags & BRANCHFLAG_SHED))
+				continue;
+
+			uint32_t ulCycles = admission_branch_cost(pStageHdr, pBranch);
+
+			if(ulCycles < ulBestCycles)
+			{
+				pBest = pBranch;
+				nBestStage = nStage;
+				nBestBranch = nBranch;
+				ulBestCycles = ulCycles;
+			}
+		}
+	}
+
+	// Nothing shed (or the shed branches were deleted), start afresh next time
+	if(!pBest)
+	{
+		s_bAnyShed = false;
+		s_ulRestoreHold = GOVERNOR_RESTORE_MSEC;
+		return;
+	}
+
+	if(ulLoad + ulBestCycles > g_ulPeriodCycles * GOVERNOR_RESTORE_PERC / 100)
+		return;
+
+	pBest->flags &= ~BRANCHFLAG_SHED;
+	governor_log(nBestStage, nBestBranch, pBest, false, ulBestCycles, ulLoad);
+}
+
+
+/*
+ * governor_loop
+ *
+ * Called from the main loop. Warns about missed deadlines, and sheds or
+ * restores a branch if needed.
+ */
+void governor_loop(void)
+{
+	const uint32_t ulTick = hal_tickcount();
+
+	// Warn at most once a second
+	const uint32_t ulMisses = g_ulGovernorMissTotal;
+
+	if(ulMisses != s_ulWarnedMisses && ulTick - s_ulLastWarnTick >= 1000)
+	{
+		dbg_printf(ANSI_COLOR_RED "Chain too complex" ANSI_COLOR_RESET ": %lu block(s) missed their deadline, worst took %lu cycles/sample (budget %lu)!\r\n", ulMisses - s_ulWarnedMisses, g_ulGovernorWorstCycles, g_ulPeriodCycles);
+
+		s_ulWarnedMisses = ulMisses;
+		s_ulLastWarnTick = ulTick;
+		g_ulGovernorWorstCycles = 0;
+	}
+
+	// Branches left shed when the governor was turned off are restored as
+	// soon as the chain can be recompiled
+	if(!g_bGovernorEnabled)
+	{
+		if(s_bAnyShed)
+			governor_restore_all();
+
+		return;
+	}
+
+	// Shedding and restoring recompile the chain, wait for the sampling path
+	// to give back an old plan if there isn't one free
+	if(g_nGovernorMisses >= GOVERNOR_MISS_LIMIT)
+	{
+		if(chainplan_reserve(&g_AudioContext))
+			governor_shed();
+	}
+	else if(s_bAnyShed && !g_nGovernorMisses && ulTick - s_ulLastEventTick >= s_ulRestoreHold)
+	{
+		if(chainplan_reserve(&g_AudioContext))
+			governor_restore();
+	}
+}
+
+
+/*
+ * governor_chain_edited
+ *
+ * Called when the UI edits the chain. Misses so far were caused by the old
+ * chain, and any still happening should be warned about straight away.
+ */
+void governor_chain_edited(void)
+{
+	g_nGovernorMisses = 0;
+	s_ulLastWarnTick = 0;
+}
+
+
+/*
+ * governor_set_enabled
+ *
+ * Turns automatic shedding on or off. Shed branches are restored when turned
+ * off.
+ */
+void governor_set_enabled(bool bEnabled)
+{
+	g_bGovernorEnabled = bEnabled;
+
+	if(!bEnabled)
+		governor_restore_all();
+}
+
+
+/*
+ * governor_restore_all
+ *
+ * Restores every shed branch, regardless of load. If the chain can't be
+ * recompiled yet, nothing is restored and governor_loop tries again.
+ */
+void governor_restore_all(void)
+{
+	if(!chainplan_reserve(&g_AudioContext))
+		return;
+
+	bool bRestored = false;
+
+	uint8_t nStage = 0;
+	for(ChainStageHeader_t *pStageHdr = g_AudioContext.pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext, nStage++)
+	{
+		uint8_t nBranch = 0;
+		for(StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext, nBranch++)
+		{
+			if(!(pBranch->flags & BRANCHFLAG_SHED))
+				continue;
+
+			pBranch->flags &= ~BRANCHFLAG_SHED;
+			dbg_printf(ANSI_COLOR_YELLOW "Governor" ANSI_COLOR_RESET ": restored branch %u:%u (%s)\r\n", nStage, nBranch, pBranch->pFilter->pszName);
+			bRestored = true;
+		}
+	}
+
+	s_bAnyShed = false;
+	s_ulRestoreHold = GOVERNOR_RESTORE_MSEC;
+
+	if(bRestored)
+	{
+		chainplan_compile(&g_AudioContext);
+		profile_reset();
+	}
+}
+
+
+/*
+ * governor_debug
+ *
+ * Prints governor state and the most recent shed/restore events.
+ */
+void governor_debug(void)
+{
+	const uint32_t ulTick = hal_tickcount();
+
+	dbg_printf(" === governor_debug ===\r\n");
+	dbg_printf("enabled: %s, consecutive misses: %u (limit %u), total misses: %lu\r\n", g_bGovernorEnabled ? "true" : "false", g_nGovernorMisses, GOVERNOR_MISS_LIMIT, g_ulGovernorMissTotal);
+	dbg_printf("restore below %u%% load, hold %lu msec\r\n", GOVERNOR_RESTORE_PERC, s_ulRestoreHold);
+
+	for(uint8_t i = 0; i < s_nLogEvents; ++i)
+	{
+		const GovernorEvent_t *pEvent = &s_pLog[(s_iLogNext + GOVERNOR_LOG_SIZE - s_nLogEvents + i) % GOVERNOR_LOG_SIZE];
+
+		dbg_printf("  - %lu msec ago: %s branch %u:%u (%s, %u cycles/sample), load %u cycles/sample\r\n",
+			ulTick - pEvent->ulTick, pEvent->bShed ? "shed" : "restored", pEvent->nStage, pEvent->nBranch,
+			g_pFilters[pEvent->iFilterType].pszName, pEvent->nBranchCycles, pEvent->nLoadCycles);
+	}
+
+	dbg_printf("\r\n");
+}
@@ -0,0 +1,85 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * governor.c - Overload governor
+ *
+ * The sampling path reports every block that misses its deadline with
+ * governor_deadline. After GOVERNOR_MISS_LIMIT consecutive misses the main
+ * loop sheds the most expensive active branch (BRANCHFLAG_SHED) and recompiles
+ * the chain. Shed branches are restored, cheapest first, once the measured
+ * load leaves room for them. Each shed/restore is logged.
+ */
+
+#ifndef _GOVERNOR_H_
+#define _GOVERNOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Number of shed/restore events kept for governor_debug
+#define GOVERNOR_LOG_SIZE		16
+
+// Longest time to hold off restoring a branch that keeps being shed (msec)
+#define GOVERNOR_MAX_HOLD_MSEC	60000
+
+
+/*
+ * GovernorEvent_t
+ *
+ * A branch being shed or restored.
+ */
+typedef struct
+{
+	uint32_t ulTick;		///< hal_tickcount() of the event
+	uint8_t nStage;			///< stage index
+	uint8_t nBranch;		///< branch index in stage
+	uint8_t iFilterType;	///< type of filter (index into g_pFilters)
+	bool bShed;				///< true if shed, false if restored
+	uint16_t nBranchCycles;	///< branch cost (measured when shed, predicted when restored), cycles per sample
+	uint16_t nLoadCycles;	///< peak sampling path cost before the event, cycles per sample
+} GovernorEvent_t;
+
+
+extern bool g_bGovernorEnabled;
+extern volatile uint8_t g_nGovernorMisses;
+extern volatile uint32_t g_ulGovernorMissTotal;
+extern volatile uint32_t g_ulGovernorWorstCycles;
+
+
+/*
+ * governor_deadline
+ *
+ * Called from the sampling path after each block. `ulCycles` is the cycles per
+ * sample the block took.
+ */
+static inline void governor_deadline(bool bMissed, uint32_t ulCycles)
+{
+	if(!bMissed)
+	{
+		g_nGovernorMisses = 0;
+		return;
+	}
+
+	if(g_nGovernorMisses < UINT8_MAX)
+		g_nGovernorMisses++;
+
+	g_ulGovernorMissTotal++;
+
+	if(ulCycles > g_ulGovernorWorstCycles)
+		g_ulGovernorWorstCycles = ulCycles;
+}
+
+
+void governor_loop(void);
+void governor_chain_edited(void);
+void governor_set_enabled(bool bEnabled);
+void governor_restore_all(void);
+void governor_debug(void);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * hal.h - Hardware abstraction layer
+ *
+ * Everything the DSP core, the sampling path (audio.c) and the UI protocol
+ * (sercom.c, packets.c) need from the hardware: audio input and output, time,
+ * the cycle counter, the UART, the SD card and the LEDs.
+ *
+ * There are two backends:
+ *  - hal/lpc17xx.c drives the board, on top of the existing drivers (adc.c,
+ *    dac.c, ticktime.c, microtimer.c, led.c, sd.c)
+ *  - hal/host.c runs the same code on a Linux workstation (built with
+ *    HAL_HOST defined, see `make host`). Audio input is read from a file and
+ *    output captured to another, and the sampling timer runs as fast as the
+ *    input can be read.
+ */
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef HAL_HOST
+#	pragma GCC diagnostic push
+#	pragma GCC diagnostic ignored "-pedantic"
+#		include "LPC17xx.h"
+#	pragma GCC diagnostic pop
+#endif
+
+
+/*
+ * HalTickHandler_t
+ *
+ * Called by the sampling timer once per sample period.
+ */
+typedef void (*HalTickHandler_t)(void);
+
+
+// Audio input and output
+// ----------------------------------------------------------------------------
+void hal_adc_init(uint32_t ulSampleRate);
+uint16_t hal_adc_read(void);
+uint16_t hal_adc_read_channel(uint8_t iChannel);
+void hal_dac_init(void);
+void hal_dac_write(uint16_t value);
+
+
+// Time
+// ----------------------------------------------------------------------------
+void hal_time_init(void);
+uint32_t hal_tickcount(void);
+void hal_sleep(uint32_t ulMsec);
+void hal_sample_timer_start(uint32_t ulSampleRate, HalTickHandler_t pfnTick);
+void hal_block_pend(void);
+void hal_cycles_init(void);
+uint32_t hal_core_clock(void);
+
+
+/*
+ * hal_cycles
+ *
+ * @returns the free running cycle counter. On the board this is the DWT cycle
+ * counter, read inline as it's used around every filter.
+ */
+#ifdef HAL_HOST
+uint32_t hal_cycles(void);
+#else
+static inline uint32_t hal_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+#endif
+
+
+// UART (the UI link)
+// ----------------------------------------------------------------------------
+void hal_uart_init(void);
+void hal_uart_send(const void *pBuf, uint32_t nBytes);
+uint32_t hal_uart_receive(void *pBuf, uint32_t nBytes, bool bBlocking);
+
+
+// SD card, as 512 byte blocks (SD_BLOCK_SIZE)
+// ----------------------------------------------------------------------------
+bool hal_sd_init(void);
+bool hal_sd_ready(void);
+bool hal_sd_read(uint8_t *pBuf, uint32_t ulBlock);
+bool hal_sd_write(const uint8_t *pBuf, uint32_t ulBlock);
+
+
+// LEDs (see led.h)
+// ----------------------------------------------------------------------------
+void hal_led_init(void);
+void hal_led_set(uint8_t iLED, bool bOn);
+void hal_led_blink(uint32_t ulMsecInterval, uint16_t nCount);
+
+
+// System
+// ----------------------------------------------------------------------------
+void hal_reset(void);
+void hal_halt(void) __attribute__ ((noreturn));
+
+
+#ifdef HAL_HOST
+// Host backend set up (see hal/host.c)
+// ----------------------------------------------------------------------------
+bool hal_host_open_audio(const char *pszInput, const char *pszOutput);
+void hal_host_open_signal(const int16_t *pSamples, uint32_t nSamples);
+void hal_host_close_audio(void);
+void hal_host_set_tail(uint32_t nSamples);
+uint32_t hal_host_samples_processed(void);
+uint64_t hal_host_output_hash(void);
+bool hal_host_open_uart(const char *pszPath);
+void hal_host_uart_queue(const void *pBuf, uint32_t nBytes);
+bool hal_host_open_sd(const char *pszImage);
+#endif
+
+#endif
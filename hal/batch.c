@@ -0,0 +1,580 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * batch.c - Batch chain renderer (HAL_HOST builds)
+ *
+ * Renders every stored chain (preset) through every input, on all cores:
+ *
+ *	bin/host/batch [-j JOBS] [-d DIR] [-t SECONDS] [-o REPORT] FILE...
+ *
+ * FILEs ending in .bin are presets saved by chain_save (ChainStore format),
+ * the rest are inputs as for bin/host/render. Each preset/input pair is a job.
+ * With -d the output of each job is written to DIR/PRESET__INPUT.wav, either
+ * way its hash is reported (see hal_host_output_hash), so a corpus can be
+ * checked against an earlier report. The report is JSON, to stdout unless -o
+ * is given.
+ *
+ * Each job runs in its own process, forked from one that has set up the core
+ * but not run anything, so a preset that crashes the DSP core is reported
+ * against that job rather than taking the batch down with it. The jobs are
+ * shared out between JOBS worker processes in blocks, and a worker that runs
+ * out steals from the end of another's block (see batch_take).
+ */
+
+// POSIX extensions (fork, mmap, getopt, ...) on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "hal.h"
+#include "config.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "chainstore.h"
+#include "profile.h"
+#include "audio.h"
+#include "dbg.h"
+
+
+// Longest output path
+#define BATCH_MAX_PATH	1024
+
+
+/*
+ * BatchStatus_e
+ *
+ * How a job ended, see BatchJob_t::status.
+ */
+typedef enum
+{
+	BATCHSTATUS_PENDING = 0,	///< not run, or crashed before reporting
+	BATCHSTATUS_OK,
+	BATCHSTATUS_BAD_PRESET,		///< preset couldn't be loaded
+	BATCHSTATUS_BAD_AUDIO,		///< input or output couldn't be opened
+	BATCHSTATUS_BAD_VERSION,	///< preset was saved as another ChainStore version
+} BatchStatus_e;
+
+
+/*
+ * BatchJob_t
+ *
+ * Result of a job, written by the process that ran it into memory shared with
+ * the others.
+ */
+typedef struct
+{
+	uint8_t status;			///< `BatchStatus_e`
+	int iSignal;			///< signal the job's process was killed by, if any
+	uint16_t iWorker;		///< worker that ran the job
+	bool bStolen;			///< stolen from another worker's block
+	uint32_t ulSamples;		///< samples rendered (at SAMPLE_RATE)
+	double dSeconds;		///< time spent rendering
+	uint64_t ullHash;		///< hal_host_output_hash of the output
+} BatchJob_t;
+
+
+/*
+ * BatchQueue_t
+ *
+ * A worker's block of jobs, [iNext, iEnd). Both halves are updated together
+ * with one compare and swap, so the owner taking from the front and thieves
+ * taking from the back can't both get the same job.
+ */
+typedef struct
+{
+	volatile uint64_t ullRange;	///< iNext in the low 32 bits, iEnd in the high 32 bits
+	uint8_t pPadding[56];		///< keep each queue on its own cache line
+} BatchQueue_t;
+
+#define RANGE(iNext, iEnd)	((uint64_t)(iEnd) << 32 | (uint32_t)(iNext))
+#define RANGE_NEXT(ullRange)	((uint32_t)(ullRange))
+#define RANGE_END(ullRange)		((uint32_t)((ullRange) >> 32))
+
+
+// Presets and inputs from the command line
+static const char **s_ppszPresets;
+static uint32_t s_nPresets = 0;
+static const char **s_ppszInputs;
+static uint32_t s_nInputs = 0;
+
+// Where outputs are written, see -d
+static const char *s_pszOutputDir = NULL;
+
+// Shared between the workers
+static BatchQueue_t *s_pQueues;
+static BatchJob_t *s_pJobs;
+static uint16_t s_nWorkers;
+
+
+/*
+ * usage
+ *
+ * Prints usage, then exits.
+ */
+static void usage(const char *pszProgram)
+{
+	fprintf(stderr, "usage: %s [-j JOBS] [-d DIR] [-t SECONDS] [-o REPORT] FILE...\n\n", pszProgram);
+	fprintf(stderr, "Renders each FILE ending in .bin (chain presets) through each other FILE\n");
+	fprintf(stderr, "(.wav, or raw s16le mono at %u Hz)\n", SAMPLE_RATE);
+	fprintf(stderr, "  -j JOBS     render JOBS at once (default: number of cores)\n");
+	fprintf(stderr, "  -d DIR      write outputs to DIR/PRESET__INPUT.wav\n");
+	fprintf(stderr, "  -t SECONDS  render SECONDS of silence after each input (default 0)\n");
+	fprintf(stderr, "  -o REPORT   write the report to REPORT rather than stdout\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * now
+ *
+ * @returns seconds of CLOCK_MONOTONIC
+ */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * path_stem
+ *
+ * Copies the file name of `pszPath` without its directory or extension to
+ * `pszStem`.
+ */
+static void path_stem(const char *pszPath, char *pszStem, size_t nMaxLen)
+{
+	const char *pszName = strrchr(pszPath, '/');
+	pszName = pszName ? pszName + 1 : pszPath;
+
+	const char *pszExt = strrchr(pszName, '.');
+	size_t nLen = pszExt && pszExt != pszName ? (size_t)(pszExt - pszName) : strlen(pszName);
+
+	if(nLen >= nMaxLen)
+		nLen = nMaxLen - 1;
+
+	memcpy(pszStem, pszName, nLen);
+	pszStem[nLen] = '\0';
+}
+
+
+/*
+ * output_path
+ *
+ * Gets where job `iJob` writes its output, "/dev/null" without -d.
+ */
+static void output_path(uint32_t iJob, char *pszPath, size_t nMaxLen)
+{
+	if(!s_pszOutputDir)
+	{
+		snprintf(pszPath, nMaxLen, "/dev/null");
+		return;
+	}
+
+	char pszPreset[BATCH_MAX_PATH / 4], pszInput[BATCH_MAX_PATH / 4];
+	path_stem(s_ppszPresets[iJob / s_nInputs], pszPreset, sizeof(pszPreset));
+	path_stem(s_ppszInputs[iJob % s_nInputs], pszInput, sizeof(pszInput));
+
+	snprintf(pszPath, nMaxLen, "%s/%s__%s.wav", s_pszOutputDir, pszPreset, pszInput);
+}
+
+
+/*
+ * batch_read_file
+ *
+ * ChainStoreRead_t for a file on the host.
+ */
+static bool batch_read_file(void *pReader, void *pBuf, uint16_t nBytes)
+{
+	return fread(pBuf, 1, nBytes, (FILE *)pReader) == nBytes;
+}
+
+
+/*
+ * batch_run_job
+ *
+ * Renders job `iJob` and records the result. Runs in a process of its own,
+ * so it has the DSP core to itself.
+ */
+static void batch_run_job(uint32_t iJob)
+{
+	BatchJob_t *pJob = &s_pJobs[iJob];
+
+	FILE *pFile = fopen(s_ppszPresets[iJob / s_nInputs], "rb");
+
+	// Presets saved by other firmware can't be decoded, report them as such
+	ChainStoreHeader_t hdr;
+	if(pFile && fread(&hdr, sizeof(hdr), 1, pFile) == 1 && hdr.ident == STORE_IDENT && hdr.iVersion != STORE_VERSION)
+	{
+		fclose(pFile);
+		pJob->status = BATCHSTATUS_BAD_VERSION;
+		return;
+	}
+
+	if(pFile)
+		rewind(pFile);
+
+	const bool bLoaded = pFile && chainstore_decode(&g_AudioContext, batch_read_file, pFile);
+
+	if(pFile)
+		fclose(pFile);
+
+	if(!bLoaded)
+	{
+		pJob->status = BATCHSTATUS_BAD_PRESET;
+		return;
+	}
+
+	chainplan_compile(&g_AudioContext);
+	chainplan_reclaim(&g_AudioContext);
+
+	char pszOutput[BATCH_MAX_PATH];
+	output_path(iJob, pszOutput, sizeof(pszOutput));
+
+	if(!hal_host_open_audio(s_ppszInputs[iJob % s_nInputs], pszOutput))
+	{
+		hal_host_close_audio();
+		pJob->status = BATCHSTATUS_BAD_AUDIO;
+		return;
+	}
+
+	const double dStart = now();
+	hal_sample_timer_start(SAMPLE_RATE, audio_tick);
+	pJob->dSeconds = now() - dStart;
+
+	hal_host_close_audio();
+
+	pJob->ulSamples = hal_host_samples_processed();
+	pJob->ullHash = hal_host_output_hash();
+	pJob->status = BATCHSTATUS_OK;
+}
+
+
+/*
+ * batch_take
+ *
+ * Takes the next job from the front of worker `iWorker`'s block or, once
+ * that is empty, the back of the fullest other block.
+ *
+ * @returns false once there are no jobs left
+ */
+static bool batch_take(uint16_t iWorker, uint32_t *piJob, bool *pbStolen)
+{
+	BatchQueue_t *pOwn = &s_pQueues[iWorker];
+
+	for(;;)
+	{
+		uint64_t ullRange = pOwn->ullRange;
+		if(RANGE_NEXT(ullRange) >= RANGE_END(ullRange))
+			break;
+
+		if(__sync_bool_compare_and_swap(&pOwn->ullRange, ullRange, RANGE(RANGE_NEXT(ullRange) + 1, RANGE_END(ullRange))))
+		{
+			*piJob = RANGE_NEXT(ullRange);
+			*pbStolen = false;
+			return true;
+		}
+	}
+
+	// Steal. Blocks only ever shrink, so once none have any jobs left there
+	// is nothing more to do.
+	for(;;)
+	{
+		BatchQueue_t *pVictim = NULL;
+		uint64_t ullVictimRange = 0;
+		uint32_t nMost = 0;
+
+		for(uint16_t i = 0; i < s_nWorkers; ++i)
+		{
+			const uint64_t ullRange = s_pQueues[i].ullRange;
+			const uint32_t nLeft = RANGE_END(ullRange) - RANGE_NEXT(ullRange);
+
+			if(RANGE_NEXT(ullRange) < RANGE_END(ullRange) && nLeft > nMost)
+			{
+				pVictim = &s_pQueues[i];
+				ullVictimRange = ullRange;
+				nMost = nLeft;
+			}
+		}
+
+		if(!pVictim)
+			return false;
+
+		const uint32_t iEnd = RANGE_END(ullVictimRange) - 1;
+		if(__sync_bool_compare_and_swap(&pVictim->ullRange, ullVictimRange, RANGE(RANGE_NEXT(ullVictimRange), iEnd)))
+		{
+			*piJob = iEnd;
+			*pbStolen = true;
+			return true;
+		}
+	}
+}
+
+
+/*
+ * batch_worker
+ *
+ * Runs jobs until there are none left, each in a process forked from this
+ * one.
+ */
+static void batch_worker(uint16_t iWorker)
+{
+	uint32_t iJob;
+	bool bStolen;
+
+	while(batch_take(iWorker, &iJob, &bStolen))
+	{
+		BatchJob_t *pJob = &s_pJobs[iJob];
+		pJob->iWorker = iWorker;
+		pJob->bStolen = bStolen;
+
+		const pid_t pid = fork();
+
+		if(pid == 0)
+		{
+			batch_run_job(iJob);
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		}
+
+		int iStatus = 0;
+		if(pid < 0 || waitpid(pid, &iStatus, 0) < 0)
+		{
+			perror("unable to run job");
+			continue;
+		}
+
+		if(WIFSIGNALED(iStatus))
+			pJob->iSignal = WTERMSIG(iStatus);
+	}
+}
+
+
+/*
+ * json_string
+ *
+ * Writes `psz` as a JSON string.
+ */
+static void json_string(FILE *pFile, const char *psz)
+{
+	fputc('"', pFile);
+
+	for(; *psz; ++psz)
+	{
+		if(*psz == '"' || *psz == '\\')
+			fprintf(pFile, "\\%c", *psz);
+		else if((unsigned char) *psz < ' ')
+			fprintf(pFile, "\\u%04x", *psz);
+		else
+			fputc(*psz, pFile);
+	}
+
+	fputc('"', pFile);
+}
+
+
+/*
+ * batch_report
+ *
+ * Writes the results of all jobs as JSON.
+ *
+ * @returns number of jobs that failed
+ */
+static uint32_t batch_report(FILE *pFile, double dWallSeconds)
+{
+	static const char *s_ppszStatus[] = {"crashed", "ok", "bad preset", "bad audio", "bad preset version"};
+
+	const uint32_t nJobs = s_nPresets * s_nInputs;
+	uint32_t nFailed = 0;
+	double dJobSeconds = 0.0;
+
+	for(uint32_t i = 0; i < nJobs; ++i)
+	{
+		dJobSeconds += s_pJobs[i].dSeconds;
+		nFailed += s_pJobs[i].status != BATCHSTATUS_OK;
+	}
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\"sample_rate\": %u,\n", SAMPLE_RATE);
+	fprintf(pFile, "\"workers\": %u,\n", s_nWorkers);
+	fprintf(pFile, "\"jobs\": %u,\n", nJobs);
+	fprintf(pFile, "\"failed\": %u,\n", nFailed);
+	fprintf(pFile, "\"wall_seconds\": %.3f,\n", dWallSeconds);
+	fprintf(pFile, "\"render_seconds\": %.3f,\n", dJobSeconds);
+	fprintf(pFile, "\"speedup\": %.2f,\n", dWallSeconds > 0.0 ? dJobSeconds / dWallSeconds : 0.0);
+	fprintf(pFile, "\"results\": [\n");
+
+	for(uint32_t i = 0; i < nJobs; ++i)
+	{
+		const BatchJob_t *pJob = &s_pJobs[i];
+		char pszOutput[BATCH_MAX_PATH];
+		output_path(i, pszOutput, sizeof(pszOutput));
+
+		fprintf(pFile, "  {\"preset\": ");
+		json_string(pFile, s_ppszPresets[i / s_nInputs]);
+		fprintf(pFile, ", \"input\": ");
+		json_string(pFile, s_ppszInputs[i % s_nInputs]);
+
+		if(s_pszOutputDir)
+		{
+			fprintf(pFile, ", \"output\": ");
+			json_string(pFile, pszOutput);
+		}
+
+		fprintf(pFile, ", \"status\": \"%s\"", s_ppszStatus[pJob->status]);
+
+		if(pJob->iSignal)
+			fprintf(pFile, ", \"signal\": %d", pJob->iSignal);
+
+		if(pJob->status == BATCHSTATUS_OK)
+		{
+			fprintf(pFile, ", \"samples\": %u, \"seconds\": %.4f, \"realtime\": %.1f, \"hash\": \"%016llx\"",
+				pJob->ulSamples, pJob->dSeconds,
+				pJob->dSeconds > 0.0 ? pJob->ulSamples / pJob->dSeconds / SAMPLE_RATE : 0.0,
+				(unsigned long long) pJob->ullHash);
+		}
+
+		fprintf(pFile, ", \"worker\": %u, \"stolen\": %s}%s\n", pJob->iWorker, pJob->bStolen ? "true" : "false", i + 1 < nJobs ? "," : "");
+	}
+
+	fprintf(pFile, "]\n}\n");
+	return nFailed;
+}
+
+
+int main(int argc, char **argv)
+{
+	long nWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	double dTailSeconds = 0.0;
+	const char *pszReport = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "j:d:t:o:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'j':
+			nWorkers = atoi(optarg);
+			break;
+
+		case 'd':
+			s_pszOutputDir = optarg;
+			break;
+
+		case 't':
+			dTailSeconds = atof(optarg);
+			break;
+
+		case 'o':
+			pszReport = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	// Sort the presets from the inputs
+	s_ppszPresets = calloc(argc, sizeof(*s_ppszPresets));
+	s_ppszInputs = calloc(argc, sizeof(*s_ppszInputs));
+	dbg_assert(s_ppszPresets && s_ppszInputs, "unable to allocate file lists");
+
+	for(int i = optind; i < argc; ++i)
+	{
+		const size_t nLen = strlen(argv[i]);
+
+		if(nLen > 4 && !strcasecmp(argv[i] + nLen - 4, ".bin"))
+			s_ppszPresets[s_nPresets++] = argv[i];
+		else
+			s_ppszInputs[s_nInputs++] = argv[i];
+	}
+
+	if(!s_nPresets || !s_nInputs || nWorkers < 1 || dTailSeconds < 0.0)
+		usage(argv[0]);
+
+	const uint32_t nJobs = s_nPresets * s_nInputs;
+	if(nWorkers > nJobs)
+		nWorkers = nJobs;
+
+	s_nWorkers = nWorkers;
+
+	FILE *pReport = stdout;
+	if(pszReport && !(pReport = fopen(pszReport, "w")))
+	{
+		perror(pszReport);
+		return EXIT_FAILURE;
+	}
+
+	// Set up the core once. Every job starts from a copy of it.
+	hal_time_init();
+	audio_init();
+	profile_init();
+	hal_host_set_tail(dTailSeconds * SAMPLE_RATE);
+
+	// Share the jobs out in blocks
+	s_pQueues = mmap(NULL, s_nWorkers * sizeof(*s_pQueues), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	s_pJobs = mmap(NULL, nJobs * sizeof(*s_pJobs), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(s_pQueues == MAP_FAILED || s_pJobs == MAP_FAILED)
+	{
+		perror("unable to allocate shared memory");
+		return EXIT_FAILURE;
+	}
+
+	for(uint16_t i = 0; i < s_nWorkers; ++i)
+		s_pQueues[i].ullRange = RANGE((uint64_t) nJobs * i / s_nWorkers, (uint64_t) nJobs * (i + 1) / s_nWorkers);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	const double dStart = now();
+
+	for(uint16_t i = 0; i < s_nWorkers; ++i)
+	{
+		const pid_t pid = fork();
+
+		if(pid == 0)
+		{
+			batch_worker(i);
+			_exit(EXIT_SUCCESS);
+		}
+
+		// Run this worker's jobs here, and steal those of the workers that
+		// weren't started
+		if(pid < 0)
+		{
+			perror("unable to start worker");
+			batch_worker(i);
+			break;
+		}
+	}
+
+	while(wait(NULL) > 0)
+		;
+
+	const uint32_t nFailed = batch_report(pReport, now() - dStart);
+
+	if(pReport != stdout)
+		fclose(pReport);
+
+	if(nFailed)
+		fprintf(stderr, "%u of %u jobs failed\n", nFailed, nJobs);
+
+	return nFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
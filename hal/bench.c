@@ -0,0 +1,738 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * bench.c - DSP core benchmarks (HAL_HOST builds)
+ *
+ * Times every filter over representative parameter sets, and a few whole
+ * chains, through the board's sampling path:
+ *
+ *	bin/host/bench [-n SAMPLES] [-r REPEATS] [-b BASELINE] [-t PERCENT] [-o OUT] [SCENARIO]...
+ *
+ * Each scenario is a chain (see bench_build_chain) run over a test signal. The
+ * results are written as JSON (to stdout by default): nanoseconds per sample
+ * in the chain plan and in the whole of chain_process on this machine, and the
+ * admission control estimate of Cortex-M3 cycles per sample (see
+ * admission_branch_cost). Given a BASELINE written by an earlier run, the
+ * times are compared against it and the exit status is non-zero if any
+ * scenario got more than PERCENT slower. SCENARIOs pick scenarios by name
+ * (any containing one of them).
+ */
+
+// POSIX extensions (getopt) on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "config.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "filters.h"
+#include "profile.h"
+#include "admission.h"
+#include "audio.h"
+#include "dbg.h"
+
+
+// Longest chain specification, filter parameter format and baseline line
+#define BENCH_MAX_SPEC		256
+#define BENCH_MAX_FORMAT	1024
+#define BENCH_MAX_LINE		512
+
+
+/*
+ * BenchScenario_t
+ *
+ * A chain to time. Neither field may contain quotes or backslashes, as they
+ * are written to the JSON as they are.
+ */
+typedef struct
+{
+	const char *pszName;
+	const char *pszChain;	///< see bench_build_chain
+} BenchScenario_t;
+
+
+/*
+ * BenchResult_t
+ *
+ * Timings of a scenario, best of the repeats.
+ */
+typedef struct
+{
+	double dPlan;		///< nsec per sample spent in the chain plan
+	double dChain;		///< nsec per sample spent in chain_process
+	uint32_t ulCycles;	///< estimated Cortex-M3 cycles per sample for the chain plan
+} BenchResult_t;
+
+
+static const BenchScenario_t s_pScenarios[] = {
+	{"Empty", ""},
+
+	{"Delay/Linear", "Delay"},
+	{"Delay/Mu-law", "Delay(Encoding=1)"},
+	{"Delay/ADPCM", "Delay(Encoding=2)"},
+
+	{"Reverb", "Reverb"},
+	{"Reverb/Large", "Reverb(Size=100,Damping=20,Mix level=60)"},
+
+	{"Noise Gate/Peak", "Noise Gate"},
+	{"Noise Gate/RMS", "Noise Gate(Detector=1)"},
+	{"Compressor/Peak", "Compressor"},
+	{"Compressor/RMS", "Compressor(Detector=1)"},
+	{"Expander/Peak", "Expander"},
+
+	{"Bitcrusher", "Bitcrusher(Bit loss=4)"},
+
+	{"Vibrato/Linear", "Vibrato(Delay=50,Frequency=5,Wave Type=4)"},
+	{"Vibrato/Hermite", "Vibrato(Delay=50,Frequency=5,Wave Type=4,Interpolation=1)"},
+	{"Vibrato/All-pass", "Vibrato(Delay=50,Frequency=5,Wave Type=4,Interpolation=2)"},
+
+	{"Tremolo/Square", "Tremolo(Frequency=5,Wave Type=0)"},
+	{"Tremolo/Sine", "Tremolo(Frequency=5,Wave Type=4)"},
+
+	{"Band-Pass/1", "Band-Pass(Co-efficients=1)"},
+	{"Band-Pass/15", "Band-Pass(Co-efficients=15)"},
+	{"Band-Pass/50", "Band-Pass(Co-efficients=50)"},
+
+	{"Flange/Linear", "Flange(Delay=40,Frequency=1,Wave Type=3)"},
+	{"Flange/Hermite", "Flange(Delay=40,Frequency=1,Wave Type=3,Interpolation=1)"},
+
+	{"Biquad/1", "Biquad(Type=0,Sections=1)"},
+	{"Biquad/4", "Biquad(Type=4,Sections=4)"},
+
+	{"Waveshaper/Soft Clip", "Waveshaper(Curve=0)"},
+	{"Waveshaper/Custom", "Waveshaper(Curve=4)"},
+
+	// Whole chains
+	{"Chain/Guitar", "Noise Gate > Compressor > Waveshaper(Curve=2) > Biquad(Type=5) > Delay(Delay=3000,Mix level=0.3) > Reverb"},
+	{"Chain/Parallel", "Delay + Flange + Tremolo > Band-Pass(Co-efficients=30)"},
+	{"Chain/Lo-fi", "Bitcrusher(Bit loss=6) > Band-Pass > Vibrato(Delay=20,Frequency=3) > Delay(Encoding=2)"},
+};
+
+#define NUM_SCENARIOS	(sizeof(s_pScenarios) / sizeof(s_pScenarios[0]))
+
+// Silence to run through between scenarios, see bench_clear_chain
+static const int16_t s_pSilence[BLOCK_SAMPLES + 1];
+
+
+/*
+ * usage
+ *
+ * Prints usage and the scenarios, then exits.
+ */
+static void usage(const char *pszProgram)
+{
+	fprintf(stderr, "usage: %s [-n SAMPLES] [-r REPEATS] [-b BASELINE] [-t PERCENT] [-o OUT] [SCENARIO]...\n\n", pszProgram);
+	fprintf(stderr, "  -n SAMPLES   samples of test signal per run (default %u)\n", 10 * SAMPLE_RATE);
+	fprintf(stderr, "  -r REPEATS   runs per scenario, the fastest counts (default 5)\n");
+	fprintf(stderr, "  -b BASELINE  compare against results written by an earlier run\n");
+	fprintf(stderr, "  -t PERCENT   slow down from BASELINE that counts as a regression (default 10)\n");
+	fprintf(stderr, "  -o OUT       write results to OUT rather than stdout\n\n");
+	fprintf(stderr, "scenarios:");
+
+	for(uint8_t i = 0; i < NUM_SCENARIOS; ++i)
+		fprintf(stderr, " \"%s\"", s_pScenarios[i].pszName);
+
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * trim
+ *
+ * Strips spaces from both ends of `psz` in place.
+ *
+ * @returns the first non-space character
+ */
+static char *trim(char *psz)
+{
+	while(*psz == ' ')
+		psz++;
+
+	char *pszEnd = psz + strlen(psz);
+	while(pszEnd > psz && pszEnd[-1] == ' ')
+		*--pszEnd = '\0';
+
+	return psz;
+}
+
+
+/*
+ * param_find
+ *
+ * Looks up parameter `pszName` in the parameter format of `pFilter`, and gets
+ * its format character, offset (into the public filter data) and default
+ * value.
+ *
+ * @returns false if there is no such parameter
+ */
+static bool param_find(const Filter_t *pFilter, const char *pszName, char *pFormat, uint8_t *pOffset, double *pDefault)
+{
+	char pszFormat[BENCH_MAX_FORMAT];
+	strncpy(pszFormat, pFilter->pszParamFormat, sizeof(pszFormat) - 1);
+	pszFormat[sizeof(pszFormat) - 1] = '\0';
+
+	char *pszParamSave;
+	for(char *pszParam = strtok_r(pszFormat, PARAM_SEP, &pszParamSave); pszParam; pszParam = strtok_r(NULL, PARAM_SEP, &pszParamSave))
+	{
+		char *pszFieldSave;
+		char *pszField = strtok_r(pszParam, ";", &pszFieldSave);
+
+		if(!pszField || strcasecmp(pszField, pszName))
+			continue;
+
+		// Choices have no default, the first is selected
+		*pFormat = 0;
+		*pOffset = 0;
+		*pDefault = 0.0;
+
+		while((pszField = strtok_r(NULL, ";", &pszFieldSave)))
+		{
+			if(!strncmp(pszField, "f=", 2))
+				*pFormat = pszField[2];
+			else if(!strncmp(pszField, "o=", 2))
+				*pOffset = atoi(pszField + 2);
+			else if(!strncmp(pszField, "val=", 4))
+				*pDefault = atof(pszField + 4);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * param_write
+ *
+ * Stores `dValue` in the parameter at `iOffset` into the public filter data of
+ * `pBranch`, as struct.pack format `format`.
+ *
+ * @returns false if the format isn't supported or the parameter doesn't fit
+ */
+static bool param_write(StageBranch_t *pBranch, char format, uint8_t iOffset, double dValue)
+{
+	const Filter_t *pFilter = pBranch->pFilter;
+	uint8_t *pDest = (uint8_t *)pBranch->pUnknown + pFilter->nNonPublicDataSize + iOffset;
+
+	uint8_t nSize;
+	switch(format)
+	{
+	case 'b': case 'B': nSize = 1; break;
+	case 'h': case 'H': nSize = 2; break;
+	case 'f': nSize = 4; break;
+	default: return false;
+	}
+
+	if(pFilter->nNonPublicDataSize + iOffset + nSize > pFilter->nFilterDataSize)
+		return false;
+
+	switch(format)
+	{
+	case 'b': *(int8_t *)pDest = (int8_t) dValue; break;
+	case 'B': *pDest = (uint8_t) dValue; break;
+	case 'h': { int16_t value = dValue; memcpy(pDest, &value, sizeof(value)); break; }
+	case 'H': { uint16_t value = dValue; memcpy(pDest, &value, sizeof(value)); break; }
+	case 'f': { float value = dValue; memcpy(pDest, &value, sizeof(value)); break; }
+	}
+
+	return true;
+}
+
+
+/*
+ * bench_build_branch
+ *
+ * Creates a branch from `pszSpec`, a filter name optionally followed by
+ * parameters in brackets, e.g. "Band-Pass(Co-efficients=50,Width=200)".
+ * Parameters that aren't given take their defaults from the parameter format,
+ * as on the UI. Choices are given by index.
+ *
+ * @returns NULL if the specification is invalid or a pool is full
+ */
+static StageBranch_t *bench_build_branch(char *pszSpec, uint8_t flags, float flMixPerc)
+{
+	char *pszParams = strchr(pszSpec, '(');
+
+	if(pszParams)
+	{
+		*pszParams++ = '\0';
+
+		char *pszEnd = strchr(pszParams, ')');
+		if(!pszEnd)
+		{
+			fprintf(stderr, "\"%s\": missing )\n", pszSpec);
+			return NULL;
+		}
+
+		*pszEnd = '\0';
+	}
+
+	pszSpec = trim(pszSpec);
+
+	uint8_t iFilter = 0;
+	while(iFilter < NUM_FILTERS && strcasecmp(g_pFilters[iFilter].pszName, pszSpec))
+		iFilter++;
+
+	if(iFilter == NUM_FILTERS)
+	{
+		fprintf(stderr, "unknown filter \"%s\"\n", pszSpec);
+		return NULL;
+	}
+
+	StageBranch_t *pBranch = branch_alloc(iFilter, flags, flMixPerc, NULL);
+	if(!pBranch)
+	{
+		fprintf(stderr, "out of memory creating \"%s\"\n", pszSpec);
+		return NULL;
+	}
+
+	// Defaults, as the UI would send them
+	const Filter_t *pFilter = pBranch->pFilter;
+	char pszFormat[BENCH_MAX_FORMAT];
+	strncpy(pszFormat, pFilter->pszParamFormat, sizeof(pszFormat) - 1);
+	pszFormat[sizeof(pszFormat) - 1] = '\0';
+
+	char *pszParamSave;
+	for(char *pszParam = strtok_r(pszFormat, PARAM_SEP, &pszParamSave); pszParam; pszParam = strtok_r(NULL, PARAM_SEP, &pszParamSave))
+	{
+		char format;
+		uint8_t iOffset;
+		double dDefault;
+
+		// Name is up to the first key/value
+		char *pszEnd = strchr(pszParam, ';');
+		if(pszEnd)
+			*pszEnd = '\0';
+
+		if(param_find(pFilter, pszParam, &format, &iOffset, &dDefault))
+			param_write(pBranch, format, iOffset, dDefault);
+	}
+
+	// Parameters from the specification
+	if(pszParams)
+	{
+		char *pszAssignSave;
+		for(char *pszAssign = strtok_r(pszParams, ",", &pszAssignSave); pszAssign; pszAssign = strtok_r(NULL, ",", &pszAssignSave))
+		{
+			char *pszValue = strchr(pszAssign, '=');
+			char format;
+			uint8_t iOffset;
+			double dDefault;
+
+			if(pszValue)
+				*pszValue++ = '\0';
+
+			pszAssign = trim(pszAssign);
+
+			if(!pszValue || !param_find(pFilter, pszAssign, &format, &iOffset, &dDefault)
+				|| !param_write(pBranch, format, iOffset, atof(pszValue)))
+			{
+				fprintf(stderr, "%s: invalid parameter \"%s\"\n", pFilter->pszName, pszAssign);
+				branch_free(pBranch);
+				return NULL;
+			}
+		}
+	}
+
+	// Set up the filter as chainstore_decode does
+	if(pFilter->pfnModCallback && !pFilter->pfnModCallback(pBranch->pUnknown))
+	{
+		fprintf(stderr, "out of memory creating \"%s\"\n", pFilter->pszName);
+		branch_free(pBranch);
+		return NULL;
+	}
+
+	return pBranch;
+}
+
+
+/*
+ * bench_clear_chain
+ *
+ * Replaces the chain with an empty one and frees the old one, by running
+ * enough silence through for the sampling path to move off it.
+ */
+static void bench_clear_chain(void)
+{
+	ChainStageHeader_t *pRoot = stage_alloc();
+	dbg_assert(pRoot, "unable to allocate chain root");
+
+	chain_retire(&g_AudioContext, g_AudioContext.pChainRoot);
+	g_AudioContext.pChainRoot = pRoot;
+	chainplan_compile(&g_AudioContext);
+
+	hal_host_open_signal(s_pSilence, sizeof(s_pSilence) / sizeof(s_pSilence[0]));
+	hal_sample_timer_start(SAMPLE_RATE, audio_tick);
+	hal_host_close_audio();
+
+	chainplan_reclaim(&g_AudioContext);
+}
+
+
+/*
+ * bench_build_chain
+ *
+ * Replaces the chain with one built from `pszChain`: stages separated by >,
+ * each with branches separated by + (see bench_build_branch), e.g.
+ * "Delay + Flange > Reverb(Size=80)". Single branch stages are fully mixed,
+ * the branches of other stages are mixed equally.
+ *
+ * @returns false if the specification is invalid or a pool is full
+ */
+static bool bench_build_chain(const char *pszChain)
+{
+	bench_clear_chain();
+
+	char pszSpec[BENCH_MAX_SPEC];
+	strncpy(pszSpec, pszChain, sizeof(pszSpec) - 1);
+	pszSpec[sizeof(pszSpec) - 1] = '\0';
+
+	ChainStageHeader_t *pStageHdr = g_AudioContext.pChainRoot;
+
+	char *pszStageSave;
+	for(char *pszStage = strtok_r(pszSpec, ">", &pszStageSave); pszStage; pszStage = strtok_r(NULL, ">", &pszStageSave))
+	{
+		uint8_t nBranches = 1;
+		for(const char *psz = pszStage; *psz; ++psz)
+			nBranches += *psz == '+';
+
+		const uint8_t flags = BRANCHFLAG_ENABLED | (nBranches == 1 ? BRANCHFLAG_FULL_MIX : 0);
+		const float flMixPerc = 1.0f / nBranches;
+		StageBranch_t *pLastBranch = NULL;
+
+		char *pszBranchSave;
+		for(char *pszBranch = strtok_r(pszStage, "+", &pszBranchSave); pszBranch; pszBranch = strtok_r(NULL, "+", &pszBranchSave))
+		{
+			StageBranch_t *pBranch = bench_build_branch(pszBranch, flags, flMixPerc);
+			if(!pBranch)
+			{
+				chainplan_compile(&g_AudioContext);
+				return false;
+			}
+
+			if(pLastBranch)
+				pLastBranch->pNext = pBranch;
+			else
+				pStageHdr->pFirst = pBranch;
+
+			pLastBranch = pBranch;
+			pStageHdr->nBranches++;
+		}
+
+		// Every stage with branches is followed by another stage
+		pStageHdr->pNext = stage_alloc();
+		pStageHdr = pStageHdr->pNext;
+
+		if(!pStageHdr)
+		{
+			fprintf(stderr, "out of memory creating stage\n");
+			chainplan_compile(&g_AudioContext);
+			return false;
+		}
+	}
+
+	chainplan_compile(&g_AudioContext);
+	return true;
+}
+
+
+/*
+ * bench_signal
+ *
+ * Fills `pSamples` with the test signal: a chord with a little noise, in
+ * bursts with gaps between them so the dynamics filters open and close.
+ * The same every run.
+ */
+static void bench_signal(int16_t *pSamples, uint32_t nSamples)
+{
+	uint32_t ulSeed = 0x48415052;
+
+	for(uint32_t i = 0; i < nSamples; ++i)
+	{
+		const double t = (double) i / SAMPLE_RATE;
+		const bool bBurst = (i % (SAMPLE_RATE / 2)) < (SAMPLE_RATE * 3 / 8);
+
+		ulSeed = ulSeed * 1664525 + 1013904223;
+		const double dNoise = (int16_t)(ulSeed >> 16) / 32768.0;
+
+		const double dValue = bBurst
+			? 0.35 * sin(2 * M_PI * 220 * t) + 0.25 * sin(2 * M_PI * 330 * t) + 0.15 * sin(2 * M_PI * 1250 * t) + 0.02 * dNoise
+			: 0.002 * dNoise;
+
+		pSamples[i] = dValue * INT16_MAX;
+	}
+}
+
+
+/*
+ * stat_average
+ *
+ * @returns average of `pStat` (nsec per sample on the host)
+ */
+static double stat_average(const ProfileStat_t *pStat)
+{
+	return pStat->nCount ? (double) pStat->ullTotal / pStat->nCount : 0.0;
+}
+
+
+/*
+ * bench_run
+ *
+ * Runs the signal through the chain `nRepeats` times, after one run to warm
+ * up, and keeps the fastest.
+ */
+static void bench_run(const int16_t *pSignal, uint32_t nSamples, uint8_t nRepeats, BenchResult_t *pResult)
+{
+	pResult->dPlan = pResult->dChain = INFINITY;
+
+	for(uint8_t i = 0; i <= nRepeats; ++i)
+	{
+		profile_reset();
+
+		hal_host_open_signal(pSignal, nSamples);
+		hal_sample_timer_start(SAMPLE_RATE, audio_tick);
+		hal_host_close_audio();
+
+		if(!i)
+			continue;
+
+		const ChainPlan_t *pPlan = g_AudioContext.pChainPlan;
+		double dPlan = 0.0;
+
+		for(uint8_t j = 0; j < pPlan->nPlanStages; ++j)
+			dPlan += stat_average(&pPlan->pStageStats[j]);
+
+		if(dPlan < pResult->dPlan)
+			pResult->dPlan = dPlan;
+
+		const double dChain = stat_average(&g_ProfileChain);
+		if(dChain < pResult->dChain)
+			pResult->dChain = dChain;
+	}
+
+	// The cost model for the chain plan (see admission_chain_cost)
+	pResult->ulCycles = 0;
+
+	for(const ChainStageHeader_t *pStageHdr = g_AudioContext.pChainRoot; pStageHdr; pStageHdr = pStageHdr->pNext)
+	{
+		for(const StageBranch_t *pBranch = pStageHdr->pFirst; pBranch; pBranch = pBranch->pNext)
+		{
+			if(pBranch->flags & BRANCHFLAG_ENABLED)
+				pResult->ulCycles += admission_branch_cost(pStageHdr, pBranch);
+		}
+	}
+}
+
+
+/*
+ * baseline_find
+ *
+ * Looks up the plan time of scenario `pszName` in baseline results `pFile`.
+ * Results are one scenario per line, as written by main.
+ *
+ * @returns false if the baseline doesn't have it
+ */
+static bool baseline_find(FILE *pFile, const char *pszName, double *pdPlan)
+{
+	char pszLine[BENCH_MAX_LINE];
+	const size_t nNameLen = strlen(pszName);
+
+	rewind(pFile);
+
+	while(fgets(pszLine, sizeof(pszLine), pFile))
+	{
+		const char *pszValue = strstr(pszLine, "\"name\": \"");
+		if(!pszValue)
+			continue;
+
+		pszValue += strlen("\"name\": \"");
+		if(strncmp(pszValue, pszName, nNameLen) || pszValue[nNameLen] != '"')
+			continue;
+
+		pszValue = strstr(pszLine, "\"ns_per_sample\": ");
+		if(!pszValue)
+			return false;
+
+		*pdPlan = atof(pszValue + strlen("\"ns_per_sample\": "));
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * scenario_selected
+ *
+ * @returns true if scenario `pszName` contains one of `ppszFilters`, or there
+ * aren't any
+ */
+static bool scenario_selected(const char *pszName, char **ppszFilters, int nFilters)
+{
+	if(!nFilters)
+		return true;
+
+	for(int i = 0; i < nFilters; ++i)
+	{
+		if(strstr(pszName, ppszFilters[i]))
+			return true;
+	}
+
+	return false;
+}
+
+
+int main(int argc, char **argv)
+{
+	uint32_t nSamples = 10 * SAMPLE_RATE;
+	uint8_t nRepeats = 5;
+	const char *pszBaseline = NULL;
+	const char *pszOutput = NULL;
+	double dTolerance = 10.0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:r:b:t:o:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			nSamples = atoi(optarg);
+			break;
+
+		case 'r':
+			nRepeats = atoi(optarg);
+			break;
+
+		case 'b':
+			pszBaseline = optarg;
+			break;
+
+		case 't':
+			dTolerance = atof(optarg);
+			break;
+
+		case 'o':
+			pszOutput = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if(!nSamples || !nRepeats)
+		usage(argv[0]);
+
+	FILE *pBaseline = NULL;
+	if(pszBaseline && !(pBaseline = fopen(pszBaseline, "r")))
+	{
+		perror(pszBaseline);
+		return EXIT_FAILURE;
+	}
+
+	FILE *pOutput = stdout;
+	if(pszOutput && !(pOutput = fopen(pszOutput, "w")))
+	{
+		perror(pszOutput);
+		return EXIT_FAILURE;
+	}
+
+	hal_time_init();
+	audio_init();
+	profile_init();
+
+	int16_t *pSignal = malloc(nSamples * sizeof(*pSignal));
+	dbg_assert(pSignal, "unable to allocate test signal");
+	bench_signal(pSignal, nSamples);
+
+	fprintf(pOutput, "{\n");
+	fprintf(pOutput, "\"sample_rate\": %u,\n", SAMPLE_RATE);
+	fprintf(pOutput, "\"block_samples\": %u,\n", BLOCK_SAMPLES);
+#ifdef FLOAT_DSP
+	fprintf(pOutput, "\"dsp\": \"float\",\n");
+#else
+	fprintf(pOutput, "\"dsp\": \"fixed\",\n");
+#endif
+	fprintf(pOutput, "\"samples\": %u,\n", nSamples);
+	fprintf(pOutput, "\"repeats\": %u,\n", nRepeats);
+	fprintf(pOutput, "\"scenarios\": [\n");
+
+	if(pBaseline)
+		fprintf(stderr, "%-24s %12s %12s %9s\n", "scenario", "base ns", "ns", "change");
+
+	bool bFirst = true;
+	bool bFailed = false;
+	uint8_t nRegressions = 0;
+
+	for(uint8_t i = 0; i < NUM_SCENARIOS; ++i)
+	{
+		const BenchScenario_t *pScenario = &s_pScenarios[i];
+
+		if(!scenario_selected(pScenario->pszName, &argv[optind], argc - optind))
+			continue;
+
+		if(!bench_build_chain(pScenario->pszChain))
+		{
+			fprintf(stderr, "%s: unable to build chain\n", pScenario->pszName);
+			bFailed = true;
+			continue;
+		}
+
+		BenchResult_t result;
+		bench_run(pSignal, nSamples, nRepeats, &result);
+
+		fprintf(pOutput, "%s  {\"name\": \"%s\", \"chain\": \"%s\", \"ns_per_sample\": %.2f, \"chain_ns_per_sample\": %.2f, \"m3_cycles\": %u, \"m3_chain_cycles\": %u}",
+			bFirst ? "" : ",\n", pScenario->pszName, pScenario->pszChain, result.dPlan, result.dChain,
+			result.ulCycles, result.ulCycles + ADMISSION_COST_CHAIN_IO);
+		bFirst = false;
+
+		if(!pBaseline)
+			continue;
+
+		double dBase;
+		if(!baseline_find(pBaseline, pScenario->pszName, &dBase))
+		{
+			fprintf(stderr, "%-24s %12s %12.2f %9s\n", pScenario->pszName, "-", result.dPlan, "new");
+			continue;
+		}
+
+		// Timer resolution makes tiny changes in tiny times meaningless
+		const double dChange = dBase > 1.0 ? (result.dPlan - dBase) * 100 / dBase : 0.0;
+		const bool bRegressed = dChange > dTolerance;
+		nRegressions += bRegressed;
+
+		fprintf(stderr, "%-24s %12.2f %12.2f %+8.1f%%%s\n", pScenario->pszName, dBase, result.dPlan, dChange, bRegressed ? "  REGRESSED" : "");
+	}
+
+	fprintf(pOutput, "\n]\n}\n");
+
+	if(pOutput != stdout)
+		fclose(pOutput);
+
+	if(pBaseline)
+	{
+		fclose(pBaseline);
+
+		if(nRegressions)
+			fprintf(stderr, "%u scenario(s) more than %.0f%% slower than %s\n", nRegressions, dTolerance, pszBaseline);
+	}
+
+	free(pSignal);
+	return bFailed || nRegressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
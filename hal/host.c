@@ -0,0 +1,629 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * host.c - Linux HAL backend
+ *
+ * Implements hal.h on a workstation (HAL_HOST builds), so the firmware DSP
+ * code can be run and profiled off the board:
+ *  - audio is read from and written to WAV files (see wav.c), or raw 16 bit
+ *    little endian mono files, at SAMPLE_RATE. It's scaled to and from the ADC
+ *    and DAC resolutions, and WAV input at other rates is resampled.
+ *  - the sampling timer calls the tick handler back to back until the input
+ *    runs out, and block filtering runs synchronously
+ *  - cycles are nanoseconds of CLOCK_MONOTONIC, so profiling reports the
+ *    workstation's real time against the sample period
+ *  - the UART is a queue of inbound packets, and B2U_PRINT packets are printed
+ *    to stderr (or every packet written raw to a file, see hal_host_open_uart)
+ *  - the SD card is a disk image
+ */
+
+// POSIX and BSD extensions (clock_gettime, getopt, ...) on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "config.h"
+#include "packets.h"
+#include "audio.h"
+#include "sd.h"
+#include "wav.h"
+
+
+// Audio input and output, see hal_host_open_audio. Raw files if the WAV
+// files aren't open.
+static FILE *s_pInput = NULL;
+static FILE *s_pOutput = NULL;
+static WavFile_t s_InputWav;
+static WavFile_t s_OutputWav;
+static uint32_t s_ulSamples = 0;
+
+// FNV-1a hash of the output samples, see hal_host_output_hash
+#define HASH_FNV_OFFSET	0xCBF29CE484222325ULL
+#define HASH_FNV_PRIME	0x100000001B3ULL
+static uint64_t s_ullOutputHash = HASH_FNV_OFFSET;
+
+// Input from memory instead, see hal_host_open_signal
+static const int16_t *s_pSignal = NULL;
+static uint32_t s_nSignalLeft = 0;
+
+// Silence to run through after the input, see hal_host_set_tail
+static uint32_t s_nTailSamples = 0;
+static uint32_t s_nTailLeft = 0;
+
+// Resampling of WAV input to SAMPLE_RATE. s_qPhase (Q16) is the position of
+// the next sample after s_pResample[0], the older of the two input samples
+// around it.
+static uint32_t s_qStep = 1 << 16;
+static uint32_t s_qPhase = 0;
+static int16_t s_pResample[2];
+static bool s_bInputEnded = false;
+
+// Input sample hal_adc_read returns
+static int16_t s_iInput = 0;
+
+// Raw UART output, see hal_host_open_uart
+static FILE *s_pUART = NULL;
+
+// Packets queued for hal_uart_receive
+static uint8_t *s_pRxQueue = NULL;
+static uint32_t s_nRxQueued = 0;
+static uint32_t s_iRxRead = 0;
+
+// Outbound packet being parsed for B2U_PRINT
+static PacketHeader_t s_TxHdr;
+static uint32_t s_nTxHdrBytes = 0;
+static uint32_t s_nTxPayloadLeft = 0;
+
+// SD card image, see hal_host_open_sd
+static FILE *s_pSDImage = NULL;
+
+static struct timespec s_StartTime;
+static bool s_pLEDs[4];
+
+
+/*
+ * audio_reset
+ *
+ * Resets the input position, tail and output hash ahead of opening new audio.
+ */
+static void audio_reset(void)
+{
+	s_ulSamples = 0;
+	s_nTailLeft = s_nTailSamples;
+	s_qStep = 1 << 16;
+	s_qPhase = 2 << 16;
+	s_pResample[0] = s_pResample[1] = 0;
+	s_bInputEnded = false;
+	s_ullOutputHash = HASH_FNV_OFFSET;
+}
+
+
+/*
+ * hal_host_open_audio
+ *
+ * Opens the audio input and output files. Files ending in .wav are read or
+ * written as WAV, anything else as raw 16 bit mono at SAMPLE_RATE ("-" for
+ * stdin/stdout).
+ *
+ * @returns false if either can't be opened
+ */
+bool hal_host_open_audio(const char *pszInput, const char *pszOutput)
+{
+	audio_reset();
+
+	if(wav_is_wav_path(pszInput))
+	{
+		if(!wav_open_read(&s_InputWav, pszInput))
+			return false;
+
+		s_qStep = ((uint64_t) s_InputWav.ulSampleRate << 16) / SAMPLE_RATE;
+	}
+	else if(!(s_pInput = strcmp(pszInput, "-") ? fopen(pszInput, "rb") : stdin))
+		return false;
+
+	if(wav_is_wav_path(pszOutput))
+		return wav_open_write(&s_OutputWav, pszOutput, SAMPLE_RATE);
+
+	s_pOutput = strcmp(pszOutput, "-") ? fopen(pszOutput, "wb") : stdout;
+	return s_pOutput;
+}
+
+
+/*
+ * hal_host_open_signal
+ *
+ * Uses the `nSamples` samples at `pSamples` (at SAMPLE_RATE) as the audio
+ * input, and discards the output. `pSamples` must stay valid until
+ * hal_host_close_audio.
+ */
+void hal_host_open_signal(const int16_t *pSamples, uint32_t nSamples)
+{
+	audio_reset();
+
+	s_pSignal = pSamples;
+	s_nSignalLeft = nSamples;
+}
+
+
+void hal_host_close_audio(void)
+{
+	if(s_pInput && s_pInput != stdin)
+		fclose(s_pInput);
+
+	if(s_pOutput && s_pOutput != stdout)
+		fclose(s_pOutput);
+
+	s_pInput = s_pOutput = NULL;
+	s_pSignal = NULL;
+	s_nSignalLeft = 0;
+	wav_close(&s_InputWav);
+	wav_close(&s_OutputWav);
+}
+
+
+/*
+ * hal_host_set_tail
+ *
+ * Runs `nSamples` of silence through after the input, so the tails of delays
+ * and reverbs are heard. Call before hal_host_open_audio.
+ */
+void hal_host_set_tail(uint32_t nSamples)
+{
+	s_nTailSamples = nSamples;
+}
+
+
+/*
+ * hal_host_samples_processed
+ *
+ * @returns samples read from the input so far (at SAMPLE_RATE, including the
+ * tail)
+ */
+uint32_t hal_host_samples_processed(void)
+{
+	return s_ulSamples;
+}
+
+
+/*
+ * hal_host_output_hash
+ *
+ * @returns 64 bit FNV-1a hash of the output so far, as 16 bit little endian
+ * samples (the same whatever it is written to)
+ */
+uint64_t hal_host_output_hash(void)
+{
+	return s_ullOutputHash;
+}
+
+
+/*
+ * input_read_file
+ *
+ * Reads the next sample of the input file (or signal, see
+ * hal_host_open_signal), at its own sample rate.
+ *
+ * @returns false at the end of the input
+ */
+static bool input_read_file(int16_t *pSample)
+{
+	if(s_pSignal)
+	{
+		if(!s_nSignalLeft)
+			return false;
+
+		s_nSignalLeft--;
+		*pSample = *s_pSignal++;
+		return true;
+	}
+
+	if(s_InputWav.pFile)
+		return wav_read(&s_InputWav, pSample);
+
+	uint8_t pBytes[2];
+
+	if(!s_pInput || fread(pBytes, 1, sizeof(pBytes), s_pInput) != sizeof(pBytes))
+		return false;
+
+	*pSample = pBytes[0] | (pBytes[1] << 8);
+	return true;
+}
+
+
+/*
+ * input_read
+ *
+ * Reads the next input sample at SAMPLE_RATE (linearly interpolated from the
+ * input file), followed by the tail.
+ *
+ * @returns false at the end of the input and tail
+ */
+static bool input_read(int16_t *pSample)
+{
+	// Move on through the input until the sample falls between s_pResample.
+	// The input is followed by one silent sample to interpolate towards.
+	while(s_qPhase >= (1 << 16))
+	{
+		if(s_bInputEnded)
+			goto tail;
+
+		s_pResample[0] = s_pResample[1];
+
+		if(!input_read_file(&s_pResample[1]))
+		{
+			s_pResample[1] = 0;
+			s_bInputEnded = true;
+		}
+
+		s_qPhase -= 1 << 16;
+	}
+
+	*pSample = s_pResample[0] + (((int64_t) s_pResample[1] - s_pResample[0]) * s_qPhase >> 16);
+	s_qPhase += s_qStep;
+	return true;
+
+tail:
+	if(!s_nTailLeft)
+		return false;
+
+	s_nTailLeft--;
+	*pSample = 0;
+	return true;
+}
+
+
+void hal_adc_init(uint32_t ulSampleRate)
+{
+}
+
+
+/*
+ * hal_adc_read
+ *
+ * Gets the current input sample (see hal_sample_timer_start), as a 12 bit ADC
+ * value.
+ */
+uint16_t hal_adc_read(void)
+{
+	return (s_iInput >> 4) + ADC_MID_POINT;
+}
+
+
+uint16_t hal_adc_read_channel(uint8_t iChannel)
+{
+	return 0;
+}
+
+
+void hal_dac_init(void)
+{
+}
+
+
+/*
+ * hal_dac_write
+ *
+ * Writes a 10 bit DAC value to the output as a 16 bit sample.
+ */
+void hal_dac_write(uint16_t value)
+{
+	const int16_t iSample = ((int16_t) value - (DAC_MAX_VALUE + 1) / 2) << 6;
+
+	s_ullOutputHash = (s_ullOutputHash ^ (iSample & 0xFF)) * HASH_FNV_PRIME;
+	s_ullOutputHash = (s_ullOutputHash ^ ((iSample >> 8) & 0xFF)) * HASH_FNV_PRIME;
+
+	if(s_OutputWav.pFile)
+		wav_write(&s_OutputWav, iSample);
+	else if(s_pOutput)
+	{
+		const uint8_t pBytes[2] = {iSample & 0xFF, (iSample >> 8) & 0xFF};
+		fwrite(pBytes, 1, sizeof(pBytes), s_pOutput);
+	}
+}
+
+
+void hal_time_init(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &s_StartTime);
+}
+
+
+/*
+ * hal_tickcount
+ *
+ * @returns msec since hal_time_init
+ */
+uint32_t hal_tickcount(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - s_StartTime.tv_sec) * 1000 + (now.tv_nsec - s_StartTime.tv_nsec) / 1000000;
+}
+
+
+void hal_sleep(uint32_t ulMsec)
+{
+	usleep(ulMsec * 1000);
+}
+
+
+/*
+ * hal_sample_timer_start
+ *
+ * Calls `pfnTick` once per input sample, as fast as possible, and returns at
+ * the end of the input. `ulSampleRate` is ignored.
+ */
+void hal_sample_timer_start(uint32_t ulSampleRate, HalTickHandler_t pfnTick)
+{
+	while(input_read(&s_iInput))
+	{
+		s_ulSamples++;
+		pfnTick();
+	}
+
+	if(s_pOutput)
+		fflush(s_pOutput);
+}
+
+
+/*
+ * hal_block_pend
+ *
+ * Filters the block straight away. There's nothing to preempt it.
+ */
+void hal_block_pend(void)
+{
+	audio_block_process();
+}
+
+
+void hal_cycles_init(void)
+{
+}
+
+
+/*
+ * hal_cycles
+ *
+ * @returns CLOCK_MONOTONIC in nsec (see hal_core_clock)
+ */
+uint32_t hal_cycles(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint32_t) now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+
+uint32_t hal_core_clock(void)
+{
+	return 1000000000UL;
+}
+
+
+/*
+ * hal_host_open_uart
+ *
+ * Writes everything sent on the UART, raw, to `pszPath` rather than printing
+ * B2U_PRINT packets.
+ *
+ * @returns false if it can't be opened
+ */
+bool hal_host_open_uart(const char *pszPath)
+{
+	s_pUART = fopen(pszPath, "wb");
+	return s_pUART;
+}
+
+
+/*
+ * hal_host_uart_queue
+ *
+ * Queues bytes (packets from the UI) for hal_uart_receive.
+ */
+void hal_host_uart_queue(const void *pBuf, uint32_t nBytes)
+{
+	s_pRxQueue = realloc(s_pRxQueue, s_nRxQueued + nBytes);
+
+	if(!s_pRxQueue)
+	{
+		fprintf(stderr, "unable to queue %u UART bytes\n", nBytes);
+		abort();
+	}
+
+	memcpy(&s_pRxQueue[s_nRxQueued], pBuf, nBytes);
+	s_nRxQueued += nBytes;
+}
+
+
+void hal_uart_init(void)
+{
+}
+
+
+/*
+ * hal_uart_send
+ *
+ * Prints the payload of B2U_PRINT packets to stderr, and drops the rest.
+ */
+void hal_uart_send(const void *pBuf, uint32_t nBytes)
+{
+	if(s_pUART)
+	{
+		fwrite(pBuf, 1, nBytes, s_pUART);
+		fflush(s_pUART);
+		return;
+	}
+
+	const uint8_t *pBytes = pBuf;
+
+	while(nBytes)
+	{
+		// Header
+		if(s_nTxHdrBytes < sizeof(s_TxHdr))
+		{
+			((uint8_t *)&s_TxHdr)[s_nTxHdrBytes++] = *pBytes++;
+			nBytes--;
+
+			if(s_nTxHdrBytes == sizeof(s_TxHdr))
+			{
+				s_nTxPayloadLeft = s_TxHdr.size;
+
+				if(!s_nTxPayloadLeft)
+					s_nTxHdrBytes = 0;
+			}
+
+			continue;
+		}
+
+		// Payload
+		uint32_t nChunk = nBytes < s_nTxPayloadLeft ? nBytes : s_nTxPayloadLeft;
+
+		if(s_TxHdr.type == B2U_PRINT)
+			fwrite(pBytes, 1, nChunk, stderr);
+
+		pBytes += nChunk;
+		nBytes -= nChunk;
+
+		if(!(s_nTxPayloadLeft -= nChunk))
+			s_nTxHdrBytes = 0;
+	}
+}
+
+
+/*
+ * hal_uart_receive
+ *
+ * Reads up to `nBytes` queued by hal_host_uart_queue. Never blocks, there's
+ * nothing else to wait for.
+ *
+ * @returns bytes read
+ */
+uint32_t hal_uart_receive(void *pBuf, uint32_t nBytes, bool bBlocking)
+{
+	uint32_t nLeft = s_nRxQueued - s_iRxRead;
+
+	if(nBytes > nLeft)
+		nBytes = nLeft;
+
+	memcpy(pBuf, &s_pRxQueue[s_iRxRead], nBytes);
+	s_iRxRead += nBytes;
+
+	// Start the queue again once it has been read
+	if(s_iRxRead == s_nRxQueued)
+		s_iRxRead = s_nRxQueued = 0;
+
+	return nBytes;
+}
+
+
+/*
+ * hal_host_open_sd
+ *
+ * Uses the disk image `pszImage` as the SD card.
+ *
+ * @returns false if it can't be opened
+ */
+bool hal_host_open_sd(const char *pszImage)
+{
+	s_pSDImage = fopen(pszImage, "r+b");
+	return s_pSDImage;
+}
+
+
+bool hal_sd_init(void)
+{
+	return hal_sd_ready();
+}
+
+
+bool hal_sd_ready(void)
+{
+	return s_pSDImage;
+}
+
+
+bool hal_sd_read(uint8_t *pBuf, uint32_t ulBlock)
+{
+	return s_pSDImage
+		&& !fseek(s_pSDImage, (long) ulBlock * SD_BLOCK_SIZE, SEEK_SET)
+		&& fread(pBuf, 1, SD_BLOCK_SIZE, s_pSDImage) == SD_BLOCK_SIZE;
+}
+
+
+bool hal_sd_write(const uint8_t *pBuf, uint32_t ulBlock)
+{
+	return s_pSDImage
+		&& !fseek(s_pSDImage, (long) ulBlock * SD_BLOCK_SIZE, SEEK_SET)
+		&& fwrite(pBuf, 1, SD_BLOCK_SIZE, s_pSDImage) == SD_BLOCK_SIZE;
+}
+
+
+/*
+ * get_fattime
+ *
+ * Time to save files as, from the system clock (sd.c consults the RTC on the
+ * board).
+ */
+DWORD get_fattime(void)
+{
+	const time_t now = time(NULL);
+	const struct tm *pTime = localtime(&now);
+
+	return (pTime->tm_sec / 2) |
+			(pTime->tm_min << 5) |
+			(pTime->tm_hour << 11) |
+			(pTime->tm_mday << 16) |
+			((pTime->tm_mon + 1) << 21) |
+			((DWORD) (pTime->tm_year - 80) << 25);
+}
+
+
+void hal_led_init(void)
+{
+}
+
+
+void hal_led_set(uint8_t iLED, bool bOn)
+{
+	if(iLED < sizeof(s_pLEDs) / sizeof(s_pLEDs[0]))
+		s_pLEDs[iLED] = bOn;
+}
+
+
+void hal_led_blink(uint32_t ulMsecInterval, uint16_t nCount)
+{
+}
+
+
+void hal_reset(void)
+{
+	fflush(stdout);
+	exit(EXIT_SUCCESS);
+}
+
+
+/*
+ * hal_halt
+ *
+ * Aborts, so a debugger or core dump catches the failed assertion.
+ */
+void hal_halt(void)
+{
+	fflush(stdout);
+	abort();
+}
@@ -0,0 +1,258 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * host_main.c - Workstation program entry (HAL_HOST builds)
+ *
+ * Runs raw audio through the firmware's filter chain, as the board would:
+ *
+ *	bin/host/audiofx [-f FILTER]... [-c COMMAND]... [-u UART] [-s IMAGE] IN OUT
+ *
+ * IN and OUT are WAV files, or raw 16 bit little endian mono at SAMPLE_RATE
+ * ("-" for stdin/stdout), see hal_host_open_audio. Each -f adds a stage with
+ * one FILTER (by name, e.g. -f Delay) with its default parameters. Each -c runs
+ * a console command (e.g. -c profile, -c "chain_plan") once the input has been
+ * processed. Both are sent as UI packets, so they take the same path as on the
+ * board.
+ */
+
+// POSIX and BSD extensions (clock_gettime, getopt, ...) on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "config.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "sercom.h"
+#include "filters.h"
+#include "packets.h"
+#include "profile.h"
+#include "governor.h"
+#include "audio.h"
+#include "sd.h"
+
+
+/*
+ * usage
+ *
+ * Prints usage and the available filters, then exits.
+ */
+static void usage(const char *pszProgram)
+{
+	fprintf(stderr, "usage: %s [-f FILTER]... [-c COMMAND]... [-u UART] [-s IMAGE] IN OUT\n\n", pszProgram);
+	fprintf(stderr, "IN and OUT are .wav, or raw s16le mono at %u Hz (- for stdin/stdout)\n", SAMPLE_RATE);
+	fprintf(stderr, "  -f FILTER   add a stage running FILTER, with default parameters\n");
+	fprintf(stderr, "  -c COMMAND  run a console command after processing (e.g. profile)\n");
+	fprintf(stderr, "  -u UART     write raw UART packets to UART instead of printing\n");
+	fprintf(stderr, "  -s IMAGE    use disk image IMAGE as the SD card\n\n");
+	fprintf(stderr, "filters:");
+
+	for(uint8_t i = 0; i < NUM_FILTERS; ++i)
+		fprintf(stderr, " \"%s\"", g_pFilters[i].pszName);
+
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * queue_packet
+ *
+ * Queues a packet from the "UI" and runs it through packet_loop.
+ */
+static void queue_packet(PacketType_e type, const void *pPayload, uint16_t size)
+{
+	const PacketHeader_t hdr = {
+		.ident=PACKET_IDENT,
+		.type=type,
+		.size=size
+	};
+
+	hal_host_uart_queue(&hdr, sizeof(hdr));
+	hal_host_uart_queue(pPayload, size);
+
+	packet_loop();
+	chainplan_reclaim(&g_AudioContext);
+}
+
+
+/*
+ * queue_filter_create
+ *
+ * Adds a stage running filter `pszName` to the end of the chain.
+ *
+ * @returns false if there is no such filter
+ */
+static bool queue_filter_create(const char *pszName, uint8_t nStage)
+{
+	uint8_t iFilter = 0;
+
+	while(iFilter < NUM_FILTERS && strcasecmp(g_pFilters[iFilter].pszName, pszName))
+		iFilter++;
+
+	if(iFilter == NUM_FILTERS)
+		return false;
+
+	const FilterCreatePacket_t create = {
+		.nStage=nStage,
+		.iFilterType=iFilter,
+		.flags=BRANCHFLAG_ENABLED | BRANCHFLAG_FULL_MIX,
+		.flMixPerc=1.0f
+	};
+
+	queue_packet(U2B_FILTER_CREATE, &create, sizeof(create));
+	return true;
+}
+
+
+/*
+ * queue_command
+ *
+ * Runs console command `pszCommand` (arguments separated by spaces).
+ */
+static void queue_command(const char *pszCommand)
+{
+	uint8_t pPayload[256];
+	CommandPacket_t *pCmd = (CommandPacket_t *)pPayload;
+	char *pszArgs = (char *)(pCmd + 1);
+
+	const size_t nMaxLen = sizeof(pPayload) - sizeof(*pCmd) - 1;
+	strncpy(pszArgs, pszCommand, nMaxLen);
+	pszArgs[nMaxLen] = '\0';
+
+	// Split arguments into NUL delimited strings
+	pCmd->nArgs = 0;
+	size_t nLen = 0;
+
+	for(char *pszArg = strtok(pszArgs, " "); pszArg; pszArg = strtok(NULL, " "))
+	{
+		const size_t nArgLen = strlen(pszArg) + 1;
+		memmove(&pszArgs[nLen], pszArg, nArgLen);
+		nLen += nArgLen;
+		pCmd->nArgs++;
+	}
+
+	queue_packet(U2B_ARB_CMD, pPayload, sizeof(*pCmd) + nLen);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *ppszCommands[32];
+	uint8_t nCommands = 0;
+	const char *ppszFilters[POOL_STAGES];
+	uint8_t nFilters = 0;
+	const char *pszUART = NULL;
+	const char *pszImage = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "f:c:u:s:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'f':
+			if(nFilters == sizeof(ppszFilters) / sizeof(ppszFilters[0]))
+				usage(argv[0]);
+
+			ppszFilters[nFilters++] = optarg;
+			break;
+
+		case 'c':
+			if(nCommands == sizeof(ppszCommands) / sizeof(ppszCommands[0]))
+				usage(argv[0]);
+
+			ppszCommands[nCommands++] = optarg;
+			break;
+
+		case 'u':
+			pszUART = optarg;
+			break;
+
+		case 's':
+			pszImage = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if(argc - optind != 2)
+		usage(argv[0]);
+
+	if(pszUART && !hal_host_open_uart(pszUART))
+	{
+		perror(pszUART);
+		return EXIT_FAILURE;
+	}
+
+	if(pszImage && !hal_host_open_sd(pszImage))
+	{
+		perror(pszImage);
+		return EXIT_FAILURE;
+	}
+
+	//-----------------------------------------------------
+	// Initialisation, as on the board (see main.c)
+	//-----------------------------------------------------
+	hal_led_init();
+	hal_uart_init();
+	hal_time_init();
+
+	if(pszImage)
+		fs_init();
+
+	hal_adc_init(SAMPLE_RATE);
+	hal_dac_init();
+	audio_init();
+
+	// Admission control budgets chain edits against the sample period
+	profile_init();
+
+	for(uint8_t i = 0; i < nFilters; ++i)
+	{
+		if(!queue_filter_create(ppszFilters[i], i))
+		{
+			fprintf(stderr, "unknown filter \"%s\"\n", ppszFilters[i]);
+			usage(argv[0]);
+		}
+	}
+
+	if(!hal_host_open_audio(argv[optind], argv[optind + 1]))
+	{
+		perror("unable to open audio");
+		return EXIT_FAILURE;
+	}
+
+	//-----------------------------------------------------
+	// Process the input
+	//-----------------------------------------------------
+	const uint32_t ulStartTick = hal_tickcount();
+	hal_sample_timer_start(SAMPLE_RATE, audio_tick);
+	const uint32_t ulElapsedTicks = hal_tickcount() - ulStartTick;
+
+	hal_host_close_audio();
+
+	const uint32_t ulSamples = hal_host_samples_processed();
+	fprintf(stderr, "Processed %u samples (%.2f sec of audio) in %u msec (%.1fx real time)\n",
+		ulSamples, (double) ulSamples / SAMPLE_RATE, ulElapsedTicks,
+		ulElapsedTicks ? (double) ulSamples * 1000 / SAMPLE_RATE / ulElapsedTicks : 0.0);
+
+	for(uint8_t i = 0; i < nCommands; ++i)
+		queue_command(ppszCommands[i]);
+
+	fflush(stdout);
+	return EXIT_SUCCESS;
+}
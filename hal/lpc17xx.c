@@ -0,0 +1,380 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * lpc17xx.c - LPC1768 HAL backend
+ *
+ * Implements hal.h on the board, on top of the existing drivers.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-pedantic"
+#	include "LPC17xx.h"
+#	include "lpc17xx_uart.h"
+#	include "lpc17xx_pinsel.h"
+#pragma GCC diagnostic pop
+
+#include "hal.h"
+#include "config.h"
+#include "adc.h"
+#include "dac.h"
+#include "ticktime.h"
+#include "microtimer.h"
+#include "led.h"
+#include "audio.h"
+
+#ifdef INDIVIDUAL_BUILD_SAUL
+#	include "sd.h"
+#endif
+
+
+// Called by the sampling timer, see hal_sample_timer_start
+static HalTickHandler_t s_pfnTick = NULL;
+
+
+/*
+ * hal_adc_init
+ *
+ * Starts the ADC converting the three audio inputs (and the TOM control
+ * input) continuously at `ulSampleRate`.
+ */
+void hal_adc_init(uint32_t ulSampleRate)
+{
+	adc_init(ulSampleRate);
+	adc_config(0, true); // MBED pin 15
+	adc_config(4, true); // MBED pin 19
+	adc_config(5, true); // MBED pin 20
+#ifdef INDIVIDUAL_BUILD_TOM
+	adc_config(1, true); // MBED pin 16
+#endif
+	adc_start(ADC_START_CONTINUOUS);
+	adc_burst_config(true);
+}
+
+
+/*
+ * hal_adc_read
+ *
+ * Gets the median sample of all 3 input ADC channels (removes most of
+ * salt+pepper noise).
+ */
+uint16_t hal_adc_read(void)
+{
+	uint16_t iSamples[] = {
+		ADC_ChannelGetData(LPC_ADC, ADC_CHANNEL_0),
+		ADC_ChannelGetData(LPC_ADC, ADC_CHANNEL_4),
+		ADC_ChannelGetData(LPC_ADC, ADC_CHANNEL_5),
+	};
+
+	if(iSamples[0] > iSamples[1])
+	{
+		if(iSamples[1] > iSamples[2])
+			return iSamples[1];
+
+		if(iSamples[0] > iSamples[2])
+			return iSamples[2];
+
+		return iSamples[0];
+	}
+
+	if(iSamples[0] > iSamples[2])
+		return iSamples[0];
+
+	if(iSamples[1] > iSamples[2])
+		return iSamples[2];
+
+	return iSamples[1];
+}
+
+
+/*
+ * hal_adc_read_channel
+ *
+ * Gets the last sample of a single ADC channel.
+ */
+uint16_t hal_adc_read_channel(uint8_t iChannel)
+{
+	return ADC_ChannelGetData(LPC_ADC, iChannel);
+}
+
+
+void hal_dac_init(void)
+{
+	dac_init();
+}
+
+
+void hal_dac_write(uint16_t value)
+{
+	dac_set(value);
+}
+
+
+/*
+ * hal_time_init
+ *
+ * Starts the tick count, at 1 tick/msec.
+ */
+void hal_time_init(void)
+{
+	time_init(1);
+}
+
+
+uint32_t hal_tickcount(void)
+{
+	return time_tickcount();
+}
+
+
+void hal_sleep(uint32_t ulMsec)
+{
+	time_sleep(ulMsec);
+}
+
+
+/*
+ * sample_timer_tick
+ *
+ * Microtimer callback, see hal_sample_timer_start.
+ */
+static void sample_timer_tick(void *pUserData)
+{
+	s_pfnTick();
+}
+
+
+/*
+ * hal_sample_timer_start
+ *
+ * Calls `pfnTick` `ulSampleRate` times per second, from the highest priority
+ * timer interrupt. Returns straight away.
+ */
+void hal_sample_timer_start(uint32_t ulSampleRate, HalTickHandler_t pfnTick)
+{
+	s_pfnTick = pfnTick;
+
+#if BLOCK_SAMPLES > 1
+	// Block filtering must be preemptible by the sampling interrupt
+	NVIC_SetPriority(PendSV_IRQn, 0x1F);
+#endif
+
+	microtimer_enable(0, TIM_PRESCALE_USVAL, 100, 10000 / ulSampleRate, sample_timer_tick, NULL);
+}
+
+
+/*
+ * hal_block_pend
+ *
+ * Pends PendSV, so audio_block_process runs as soon as the sampling interrupt
+ * returns.
+ */
+void hal_block_pend(void)
+{
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+
+#if BLOCK_SAMPLES > 1
+/*
+ * PendSV_Handler
+ *
+ * Lowest priority interrupt, pended by audio_tick whenever a block of input
+ * samples is ready.
+ */
+void PendSV_Handler(void)
+{
+	audio_block_process();
+}
+#endif
+
+
+/*
+ * hal_cycles_init
+ *
+ * Starts the DWT cycle counter.
+ */
+void hal_cycles_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
+uint32_t hal_core_clock(void)
+{
+	return SystemCoreClock;
+}
+
+
+/*
+ * hal_uart_init
+ *
+ * Initialises the USB pins and UART config.
+ */
+void hal_uart_init(void)
+{
+	UART_CFG_Type UARTConfigStruct;
+	UART_FIFO_CFG_Type UARTFIFOConfigStruct;
+	PINSEL_CFG_Type PinCfg;
+
+	/*
+	 * Initialize UART pin connect
+	 */
+	PinCfg.Funcnum = 1;
+	PinCfg.OpenDrain = 0;
+	PinCfg.Pinmode = 0;
+
+	// USB serial first
+	PinCfg.Portnum = 0;
+	PinCfg.Pinnum = 2;
+	PINSEL_ConfigPin(&PinCfg);
+
+	PinCfg.Pinnum = 3;
+	PINSEL_ConfigPin(&PinCfg);
+
+	/* Initialize UART Configuration parameter structure to default state:
+	 * - baud rate = 9600bps
+	 * - 8 data bit
+	 * - 1 stop bit
+	 * - None parity
+	 */
+	UART_ConfigStructInit(&UARTConfigStruct);
+
+	/* Initialize FIFOConfigStruct to default state:
+	 * - FIFO_DMAMode = DISABLE
+	 * - FIFO_Level = UART_FIFO_TRGLEV0
+	 * - FIFO_ResetRxBuf = ENABLE
+	 * - FIFO_ResetTxBuf = ENABLE
+	 * - FIFO_State = ENABLE
+	 */
+	UART_FIFOConfigStructInit(&UARTFIFOConfigStruct);
+
+	// Initialize UART0 peripheral with given to corresponding parameter
+	UART_Init((LPC_UART_TypeDef *)LPC_UART0, &UARTConfigStruct);
+
+	// Initialize FIFO for UART0 peripheral
+	UART_FIFOConfig((LPC_UART_TypeDef *)LPC_UART0, &UARTFIFOConfigStruct);
+
+	// Enable UART Transmit
+	UART_TxCmd((LPC_UART_TypeDef *)LPC_UART0, ENABLE);
+}
+
+
+void hal_uart_send(const void *pBuf, uint32_t nBytes)
+{
+	UART_Send((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)pBuf, nBytes, BLOCKING);
+}
+
+
+/*
+ * hal_uart_receive
+ *
+ * Reads up to `nBytes` into `pBuf`. If `bBlocking`, waits for all of them.
+ *
+ * @returns bytes read
+ */
+uint32_t hal_uart_receive(void *pBuf, uint32_t nBytes, bool bBlocking)
+{
+	return UART_Receive((LPC_UART_TypeDef *)LPC_UART0, pBuf, nBytes, bBlocking ? BLOCKING : NONE_BLOCKING);
+}
+
+
+/*
+ * hal_sd_init
+ *
+ * Initialises the SD card (SAUL builds only, the only ones with a card).
+ *
+ * @returns true if the card is ready
+ */
+bool hal_sd_init(void)
+{
+#ifdef INDIVIDUAL_BUILD_SAUL
+	sd_init();
+#endif
+
+	return hal_sd_ready();
+}
+
+
+bool hal_sd_ready(void)
+{
+#ifdef INDIVIDUAL_BUILD_SAUL
+	return g_fSDStatus & SD_STATUS_READY;
+#else
+	return false;
+#endif
+}
+
+
+bool hal_sd_read(uint8_t *pBuf, uint32_t ulBlock)
+{
+#ifdef INDIVIDUAL_BUILD_SAUL
+	return sd_read_block(pBuf, ulBlock);
+#else
+	return false;
+#endif
+}
+
+
+bool hal_sd_write(const uint8_t *pBuf, uint32_t ulBlock)
+{
+#ifdef INDIVIDUAL_BUILD_SAUL
+	return sd_write_block(pBuf, ulBlock);
+#else
+	return false;
+#endif
+}
+
+
+void hal_led_init(void)
+{
+	led_init();
+}
+
+
+void hal_led_set(uint8_t iLED, bool bOn)
+{
+	led_set(iLED, bOn);
+}
+
+
+void hal_led_blink(uint32_t ulMsecInterval, uint16_t nCount)
+{
+	led_blink(ulMsecInterval, nCount);
+}
+
+
+void hal_reset(void)
+{
+	NVIC_SystemReset();
+}
+
+
+/*
+ * hal_halt
+ *
+ * Stops sampling and halts program execution. If the LED subsystem has been
+ * setup, the LEDs will blink indefinitely.
+ */
+void hal_halt(void)
+{
+	// Disable all microtimers
+	for(uint8_t i = 0; i < UTIM_NUM_TIMERS; ++i)
+		microtimer_disable(i);
+
+	// Blink LEDs infinitely if LEDs are setup
+	if(led_setup())
+		led_blink(200, LED_BLINK_INDEFINITE);
+
+	// Halt program
+	while(1);
+}
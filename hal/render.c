@@ -0,0 +1,223 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * render.c - Offline chain renderer (HAL_HOST builds)
+ *
+ * Renders audio through a chain saved by chain_save (ChainStore format, see
+ * chainstore.h), as fast as the workstation can:
+ *
+ *	bin/host/render [-t SECONDS] [-q] CHAIN.bin IN OUT
+ *
+ * IN and OUT are WAV files, or raw 16 bit mono at SAMPLE_RATE (see
+ * hal_host_open_audio). The audio takes the board's sampling path, so it is
+ * quantised to the ADC's 12 bits on the way in and the DAC's 10 bits on the
+ * way out, at SAMPLE_RATE. Afterwards the throughput and the time spent in
+ * each stage are reported.
+ */
+
+// POSIX extensions (clock_gettime, getopt) on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "config.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "chainstore.h"
+#include "filters.h"
+#include "profile.h"
+#include "audio.h"
+
+
+/*
+ * usage
+ *
+ * Prints usage, then exits.
+ */
+static void usage(const char *pszProgram)
+{
+	fprintf(stderr, "usage: %s [-t SECONDS] [-q] CHAIN.bin IN OUT\n\n", pszProgram);
+	fprintf(stderr, "IN and OUT are .wav, or raw s16le mono at %u Hz (- for stdin/stdout)\n", SAMPLE_RATE);
+	fprintf(stderr, "  -t SECONDS  render SECONDS of silence after the input (default 0)\n");
+	fprintf(stderr, "  -q          only report errors\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * render_read_file
+ *
+ * ChainStoreRead_t for a file on the host.
+ */
+static bool render_read_file(void *pReader, void *pBuf, uint16_t nBytes)
+{
+	return fread(pBuf, 1, nBytes, (FILE *)pReader) == nBytes;
+}
+
+
+/*
+ * render_load_chain
+ *
+ * Replaces the chain with the stored chain at `pszPath`, and publishes it.
+ *
+ * @returns false if it can't be loaded
+ */
+static bool render_load_chain(const char *pszPath)
+{
+	FILE *pFile = fopen(pszPath, "rb");
+
+	if(!pFile)
+	{
+		perror(pszPath);
+		return false;
+	}
+
+	// Chains saved by other firmware can't be decoded, say why
+	ChainStoreHeader_t hdr;
+	if(fread(&hdr, sizeof(hdr), 1, pFile) == 1 && hdr.ident == STORE_IDENT && hdr.iVersion != STORE_VERSION)
+	{
+		fprintf(stderr, "%s: saved as ChainStore version %u, this build reads version %u (save the chain again)\n", pszPath, hdr.iVersion, STORE_VERSION);
+		fclose(pFile);
+		return false;
+	}
+
+	rewind(pFile);
+
+	const bool bLoaded = chainstore_decode(&g_AudioContext, render_read_file, pFile);
+	fclose(pFile);
+
+	if(!bLoaded)
+	{
+		fprintf(stderr, "%s: unable to load chain\n", pszPath);
+		return false;
+	}
+
+	chainplan_compile(&g_AudioContext);
+	chainplan_reclaim(&g_AudioContext);
+	return true;
+}
+
+
+/*
+ * stat_average
+ *
+ * @returns average of `pStat` (nsec per sample on the host)
+ */
+static double stat_average(const ProfileStat_t *pStat)
+{
+	return pStat->nCount ? (double) pStat->ullTotal / pStat->nCount : 0.0;
+}
+
+
+/*
+ * render_report
+ *
+ * Prints the throughput of the render, and the time spent in each stage of
+ * the chain.
+ */
+static void render_report(uint32_t ulSamples, double dSeconds)
+{
+	const double dSamplesPerSec = dSeconds > 0.0 ? ulSamples / dSeconds : 0.0;
+	const double dChain = stat_average(&g_ProfileChain);
+
+	fprintf(stderr, "samples:     %u (%.2f sec at %u Hz)\n", ulSamples, (double) ulSamples / SAMPLE_RATE, SAMPLE_RATE);
+	fprintf(stderr, "render time: %.3f sec\n", dSeconds);
+	fprintf(stderr, "throughput:  %.0f samples/sec (%.1fx real time)\n", dSamplesPerSec, dSamplesPerSec / SAMPLE_RATE);
+	fprintf(stderr, "sample io:   %.1f nsec/sample\n", stat_average(&g_ProfileTick));
+	fprintf(stderr, "chain:       %.1f nsec/sample\n", dChain);
+	fprintf(stderr, "output hash: %016llx\n", (unsigned long long) hal_host_output_hash());
+
+	const ChainPlan_t *pPlan = g_AudioContext.pChainPlan;
+
+	if(!pPlan)
+		return;
+
+#if !PROFILE_CHAIN
+	fprintf(stderr, "(per stage profiling disabled, see PROFILE_CHAIN)\n");
+#endif
+
+	uint8_t iStageStat = 0;
+
+	for(uint8_t i = 0; i < pPlan->nOps; ++i)
+	{
+		const PlanOp_t *pOp = &pPlan->pOps[i];
+
+		// First op of each stage
+		if(pOp->type == PLANOP_APPLY || pOp->type == PLANOP_MIX_BEGIN)
+		{
+			const double dStage = stat_average(&pPlan->pStageStats[iStageStat++]);
+			fprintf(stderr, "  stage #%u: %.1f nsec/sample (%.0f%% of chain)\n", pOp->nStage, dStage, dChain > 0.0 ? dStage * 100 / dChain : 0.0);
+		}
+
+		fprintf(stderr, "    branch #%u (%s): %.1f nsec/sample\n", pOp->nBranch, pOp->pFilter->pszName, stat_average(&pOp->stat));
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	double dTailSeconds = 0.0;
+	bool bQuiet = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "t:qh")) != -1)
+	{
+		switch(opt)
+		{
+		case 't':
+			dTailSeconds = atof(optarg);
+			break;
+
+		case 'q':
+			bQuiet = true;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if(argc - optind != 3 || dTailSeconds < 0.0)
+		usage(argv[0]);
+
+	hal_time_init();
+	audio_init();
+	profile_init();
+
+	if(!render_load_chain(argv[optind]))
+		return EXIT_FAILURE;
+
+	hal_host_set_tail(dTailSeconds * SAMPLE_RATE);
+
+	if(!hal_host_open_audio(argv[optind + 1], argv[optind + 2]))
+	{
+		perror("unable to open audio");
+		return EXIT_FAILURE;
+	}
+
+	profile_reset();
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	hal_sample_timer_start(SAMPLE_RATE, audio_tick);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	hal_host_close_audio();
+
+	if(!bQuiet)
+		render_report(hal_host_samples_processed(), (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	return EXIT_SUCCESS;
+}
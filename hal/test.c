@@ -0,0 +1,952 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * test.c - DSP core tests (HAL_HOST builds)
+ *
+ * Checks the DSP core against the tolerances documented for it:
+ *
+ *	bin/host/test [-w REFERENCE] [-c REFERENCE]
+ *
+ * Every filter is run with its default parameters, through a chain of its
+ * own, over a test signal. -w writes the output to REFERENCE, and -c compares
+ * it with a REFERENCE written by a float path build (see `make test`): the
+ * fixed point path must stay within the bounds documented in fixed.h.
+ *
+ * The frequency response of the biquad filter is also measured with tones,
+ * for every type and number of sections, and checked against its design
+ * formulas (see biquad.c), as are its coefficients at the most boost and cut
+ * (see BIQUAD_MAX_GAIN). The Delay filter is checked to be able to change to
+ * any length and encoding (see DELAY_MAX_SAMPLES). Stored chains that fill the
+ * reverb pool or the delay budget are checked to restore over themselves (see
+ * chainstore_decode), and two contexts run a block at a time in turn are
+ * checked to give the same output as each run alone (see context.h).
+ *
+ * The exit status is non-zero if any check fails.
+ */
+
+// POSIX extensions (getopt) on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "chainstore.h"
+#include "context.h"
+#include "filters.h"
+#include "lfo.h"
+#include "envelope.h"
+#include "pool.h"
+#include "filters/biquad.h"
+#include "filters/delay.h"
+
+
+// Samples of test signal each filter is run over
+#define TEST_SAMPLES			(2 * SAMPLE_RATE)
+
+// Identifies a reference file
+#define TEST_REFERENCE_MAGIC	0x46455254
+
+// Biquad frequency response is measured over TEST_RESPONSE_SAMPLES (a whole
+// number of cycles of every tone), after letting the filter settle for
+// TEST_SETTLE_SAMPLES, from a tone of TEST_TONE_AMPLITUDE
+#define TEST_SETTLE_SAMPLES		(SAMPLE_RATE / 2)
+#define TEST_RESPONSE_SAMPLES	SAMPLE_RATE
+#define TEST_TONE_AMPLITUDE		800
+
+// Most the measured biquad response may differ from the design formulas
+// (dB), wherever they give more than TEST_RESPONSE_FLOOR_DB (see biquad.c)
+#ifdef FLOAT_DSP
+#	define TEST_RESPONSE_BOUND_DB	0.08
+#else
+#	define TEST_RESPONSE_BOUND_DB	0.05
+#endif
+#define TEST_RESPONSE_FLOOR_DB	-24.0
+
+// Most a biquad coefficient may differ from the design formulas, and the
+// value of 1.0 in a coefficient
+#define TEST_COEFFICIENT_BOUND	1e-4
+#ifdef FLOAT_DSP
+#	define TEST_COEFFICIENT_ONE	1.0
+#else
+#	define TEST_COEFFICIENT_ONE	(double)(1 << BIQUAD_SHIFT)
+#endif
+
+
+/*
+ * TestReferenceHeader_t
+ *
+ * Start of a reference file, followed by TEST_SAMPLES samples of output for
+ * each filter, in g_pFilters order.
+ */
+typedef struct
+{
+	uint32_t ulMagic;	///< TEST_REFERENCE_MAGIC
+	uint32_t nFilters;	///< NUM_FILTERS of the build that wrote it
+	uint32_t nSamples;	///< TEST_SAMPLES
+	uint32_t bFloat;	///< written by the float path?
+} TestReferenceHeader_t;
+
+
+static AudioContext_t s_Context;
+static int16_t s_pSignal[TEST_SAMPLES];
+
+// Checks run and failed so far
+static uint16_t s_nChecks = 0;
+static uint16_t s_nFailures = 0;
+
+
+/*
+ * usage
+ *
+ * Prints usage, then exits.
+ */
+static void usage(const char *pszProgram)
+{
+	fprintf(stderr, "usage: %s [-w REFERENCE] [-c REFERENCE]\n\n", pszProgram);
+	fprintf(stderr, "  -w REFERENCE  write the output of every filter to REFERENCE\n");
+	fprintf(stderr, "  -c REFERENCE  check the output of every filter against a float path REFERENCE\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * test_check
+ *
+ * Counts a check, and reports it if it failed.
+ */
+static void test_check(bool bPassed, const char *pszName)
+{
+	s_nChecks++;
+
+	if(bPassed)
+		return;
+
+	s_nFailures++;
+	fprintf(stderr, "FAIL: %s\n", pszName);
+}
+
+
+/*
+ * test_signal
+ *
+ * Fills `pSamples` with the test signal: a chord with a little noise at
+ * about -6 dBFS of the ADC, in bursts with quiet gaps between them so the
+ * dynamics filters open and close. The same every run.
+ */
+static void test_signal(int16_t *pSamples, uint32_t nSamples)
+{
+	uint32_t ulSeed = 0x48415052;
+
+	for(uint32_t i = 0; i < nSamples; ++i)
+	{
+		const double t = (double) i / SAMPLE_RATE;
+		const bool bBurst = (i % (SAMPLE_RATE / 2)) < (SAMPLE_RATE * 3 / 8);
+
+		ulSeed = ulSeed * 1664525 + 1013904223;
+		const double dNoise = (int16_t)(ulSeed >> 16) / 32768.0;
+
+		const double dValue = bBurst
+			? 0.25 * sin(2 * M_PI * 220 * t) + 0.15 * sin(2 * M_PI * 330 * t) + 0.08 * sin(2 * M_PI * 1250 * t) + 0.02 * dNoise
+			: 0.002 * dNoise;
+
+		pSamples[i] = lrint(dValue * ADC_MID_POINT);
+	}
+}
+
+
+/*
+ * test_render_filter
+ *
+ * Runs the test signal through a chain of just filter `iFilter`, created with
+ * its default parameters, into `pOutput`.
+ *
+ * @returns false if the filter couldn't be created
+ */
+static bool test_render_filter(uint8_t iFilter, int16_t *pOutput)
+{
+	if(!context_init(&s_Context))
+		return false;
+
+	const Filter_t *pFilter = &g_pFilters[iFilter];
+	StageBranch_t *pBranch = branch_alloc(iFilter, BRANCHFLAG_ENABLED | BRANCHFLAG_FULL_MIX, 1.0f, NULL);
+	ChainStageHeader_t *pNextStageHdr = stage_alloc();
+
+	if(!pBranch || !pNextStageHdr || (pFilter->pfnCreateCallback && !pFilter->pfnCreateCallback(pBranch->pUnknown)))
+	{
+		if(pBranch)
+			branch_free(pBranch);
+
+		if(pNextStageHdr)
+			stage_free(pNextStageHdr);
+
+		context_free(&s_Context);
+		return false;
+	}
+
+	s_Context.pChainRoot->pFirst = pBranch;
+	s_Context.pChainRoot->nBranches = 1;
+	s_Context.pChainRoot->pNext = pNextStageHdr;
+	chainplan_compile(&s_Context);
+
+	memcpy(pOutput, s_pSignal, sizeof(s_pSignal));
+
+	for(uint32_t i = 0; i < TEST_SAMPLES; i += BLOCK_SAMPLES)
+		context_process(&s_Context, pOutput + i, TEST_SAMPLES - i < BLOCK_SAMPLES ? TEST_SAMPLES - i : BLOCK_SAMPLES, false);
+
+	context_free(&s_Context);
+	return true;
+}
+
+
+/*
+ * TestBound_t
+ *
+ * Most the fixed point output of a filter, with its default parameters, may
+ * differ from the float path (see fixed.h). Filters that aren't listed have
+ * no float path, so must match exactly.
+ */
+typedef struct
+{
+	const char *pszFilter;
+	uint16_t nLSB;
+} TestBound_t;
+
+static const TestBound_t s_pFixedBounds[] = {
+	{"Delay", 1},		// mix gain
+	{"Noise Gate", 1},	// envelope gain
+	{"Compressor", 1},
+	{"Expander", 1},
+	{"Vibrato", 1},		// interpolation between two samples
+	{"Tremolo", 1},		// LFO gain
+	{"Flange", 1},		// mix gain
+	{"Band-Pass", 15},	// nCoefficients
+	{"Biquad", 2},		// 2 per section at the default 1 kHz
+};
+
+
+/*
+ * test_fixed_bound
+ *
+ * @returns the bound in s_pFixedBounds for filter `pFilter`
+ */
+static uint16_t test_fixed_bound(const Filter_t *pFilter)
+{
+	for(uint8_t i = 0; i < sizeof(s_pFixedBounds) / sizeof(s_pFixedBounds[0]); ++i)
+	{
+		if(!strcmp(s_pFixedBounds[i].pszFilter, pFilter->pszName))
+			return s_pFixedBounds[i].nLSB;
+	}
+
+	return 0;
+}
+
+
+/*
+ * test_filters
+ *
+ * Renders every filter, writes the output to `pszWrite` and checks it against
+ * the reference in `pszCompare` (either may be NULL).
+ */
+static void test_filters(const char *pszWrite, const char *pszCompare)
+{
+	int16_t (*ppOutput)[TEST_SAMPLES] = calloc(NUM_FILTERS, sizeof(*ppOutput));
+	int16_t (*ppReference)[TEST_SAMPLES] = calloc(NUM_FILTERS, sizeof(*ppReference));
+
+	if(!ppOutput || !ppReference)
+	{
+		fprintf(stderr, "unable to allocate filter output\n");
+		exit(EXIT_FAILURE);
+	}
+
+	test_signal(s_pSignal, TEST_SAMPLES);
+
+	for(uint8_t i = 0; i < NUM_FILTERS; ++i)
+	{
+		char pszName[64];
+		snprintf(pszName, sizeof(pszName), "%s created", g_pFilters[i].pszName);
+		test_check(test_render_filter(i, ppOutput[i]), pszName);
+	}
+
+	TestReferenceHeader_t hdr = {TEST_REFERENCE_MAGIC, NUM_FILTERS, TEST_SAMPLES, 0};
+#ifdef FLOAT_DSP
+	hdr.bFloat = 1;
+#endif
+
+	if(pszWrite)
+	{
+		FILE *pFile = fopen(pszWrite, "wb");
+
+		if(!pFile || fwrite(&hdr, sizeof(hdr), 1, pFile) != 1 || fwrite(ppOutput, sizeof(*ppOutput), NUM_FILTERS, pFile) != NUM_FILTERS)
+		{
+			perror(pszWrite);
+			exit(EXIT_FAILURE);
+		}
+
+		fclose(pFile);
+	}
+
+	if(pszCompare)
+	{
+		FILE *pFile = fopen(pszCompare, "rb");
+		TestReferenceHeader_t reference;
+
+		if(!pFile || fread(&reference, sizeof(reference), 1, pFile) != 1)
+		{
+			perror(pszCompare);
+			exit(EXIT_FAILURE);
+		}
+
+		if(reference.ulMagic != TEST_REFERENCE_MAGIC || reference.nFilters != NUM_FILTERS || reference.nSamples != TEST_SAMPLES || !reference.bFloat || hdr.bFloat)
+		{
+			fprintf(stderr, "%s: not a float path reference for this build\n", pszCompare);
+			exit(EXIT_FAILURE);
+		}
+
+		if(fread(ppReference, sizeof(*ppReference), NUM_FILTERS, pFile) != NUM_FILTERS)
+		{
+			fprintf(stderr, "%s: truncated\n", pszCompare);
+			exit(EXIT_FAILURE);
+		}
+
+		fclose(pFile);
+
+		for(uint8_t i = 0; i < NUM_FILTERS; ++i)
+		{
+			const Filter_t *pFilter = &g_pFilters[i];
+			const uint16_t nBound = test_fixed_bound(pFilter);
+			uint16_t nWorst = 0;
+			uint32_t iWorst = 0;
+
+			for(uint32_t n = 0; n < TEST_SAMPLES; ++n)
+			{
+				const uint16_t nError = abs(ppOutput[i][n] - ppReference[i][n]);
+
+				if(nError > nWorst)
+				{
+					nWorst = nError;
+					iWorst = n;
+				}
+			}
+
+			printf("%-12s fixed within %u LSB of float (bound %u, worst at sample %u)\n", pFilter->pszName, nWorst, nBound, iWorst);
+
+			char pszName[64];
+			snprintf(pszName, sizeof(pszName), "%s fixed point within %u LSB of float", pFilter->pszName, nBound);
+			test_check(nWorst <= nBound, pszName);
+		}
+	}
+
+	free(ppOutput);
+	free(ppReference);
+}
+
+
+/*
+ * test_biquad_design
+ *
+ * Calculates the coefficients `pB` and `pA` (not normalised) of one biquad
+ * section of type `iType` from the design formulas in double precision (see
+ * biquad_design)
+ */
+static void test_biquad_design(uint8_t iType, double dFrequency, double dQ, double dGain, double *pB, double *pA)
+{
+	const double w0 = 2 * M_PI * dFrequency / SAMPLE_RATE;
+	const double dCos = cos(w0);
+	const double dAlpha = sin(w0) / (2 * dQ);
+	const double A = pow(10, dGain / 40);
+	const double dSqrtA = sqrt(A);
+
+	double b0, b1, b2, a0, a1, a2;
+
+	switch(iType)
+	{
+		default:
+		case BIQUAD_LOWPASS:
+			b0 = (1 - dCos) / 2; b1 = 1 - dCos; b2 = b0;
+			a0 = 1 + dAlpha; a1 = -2 * dCos; a2 = 1 - dAlpha;
+			break;
+
+		case BIQUAD_HIGHPASS:
+			b0 = (1 + dCos) / 2; b1 = -(1 + dCos); b2 = b0;
+			a0 = 1 + dAlpha; a1 = -2 * dCos; a2 = 1 - dAlpha;
+			break;
+
+		case BIQUAD_BANDPASS:
+			b0 = dAlpha; b1 = 0; b2 = -dAlpha;
+			a0 = 1 + dAlpha; a1 = -2 * dCos; a2 = 1 - dAlpha;
+			break;
+
+		case BIQUAD_NOTCH:
+			b0 = 1; b1 = -2 * dCos; b2 = 1;
+			a0 = 1 + dAlpha; a1 = -2 * dCos; a2 = 1 - dAlpha;
+			break;
+
+		case BIQUAD_PEAK:
+			b0 = 1 + dAlpha * A; b1 = -2 * dCos; b2 = 1 - dAlpha * A;
+			a0 = 1 + dAlpha / A; a1 = -2 * dCos; a2 = 1 - dAlpha / A;
+			break;
+
+		case BIQUAD_LOWSHELF:
+			b0 = A * ((A + 1) - (A - 1) * dCos + 2 * dSqrtA * dAlpha);
+			b1 = 2 * A * ((A - 1) - (A + 1) * dCos);
+			b2 = A * ((A + 1) - (A - 1) * dCos - 2 * dSqrtA * dAlpha);
+			a0 = (A + 1) + (A - 1) * dCos + 2 * dSqrtA * dAlpha;
+			a1 = -2 * ((A - 1) + (A + 1) * dCos);
+			a2 = (A + 1) + (A - 1) * dCos - 2 * dSqrtA * dAlpha;
+			break;
+
+		case BIQUAD_HIGHSHELF:
+			b0 = A * ((A + 1) + (A - 1) * dCos + 2 * dSqrtA * dAlpha);
+			b1 = -2 * A * ((A - 1) + (A + 1) * dCos);
+			b2 = A * ((A + 1) + (A - 1) * dCos - 2 * dSqrtA * dAlpha);
+			a0 = (A + 1) - (A - 1) * dCos + 2 * dSqrtA * dAlpha;
+			a1 = 2 * ((A - 1) - (A + 1) * dCos);
+			a2 = (A + 1) - (A - 1) * dCos - 2 * dSqrtA * dAlpha;
+			break;
+	}
+
+	pB[0] = b0; pB[1] = b1; pB[2] = b2;
+	pA[0] = a0; pA[1] = a1; pA[2] = a2;
+}
+
+
+/*
+ * test_biquad_design_response
+ *
+ * @returns the response in dB of `nSections` biquad sections of type `iType`
+ * at `dTone` Hz, from the design formulas in double precision
+ */
+static double test_biquad_design_response(uint8_t iType, uint8_t nSections, double dFrequency, double dQ, double dGain, double dTone)
+{
+	double pB[3], pA[3];
+	test_biquad_design(iType, dFrequency, dQ, dGain / nSections, pB, pA);
+
+	// |H(e^jw)| = |b0 + b1.z^-1 + b2.z^-2| / |a0 + a1.z^-1 + a2.z^-2|
+	const double w = 2 * M_PI * dTone / SAMPLE_RATE;
+	const double dNumRe = pB[0] + pB[1] * cos(w) + pB[2] * cos(2 * w);
+	const double dNumIm = -pB[1] * sin(w) - pB[2] * sin(2 * w);
+	const double dDenRe = pA[0] + pA[1] * cos(w) + pA[2] * cos(2 * w);
+	const double dDenIm = -pA[1] * sin(w) - pA[2] * sin(2 * w);
+
+	const double dSection = hypot(dNumRe, dNumIm) / hypot(dDenRe, dDenIm);
+	return 20 * nSections * log10(dSection);
+}
+
+
+/*
+ * test_tone_amplitude
+ *
+ * @returns the amplitude of the `dTone` Hz component of `pSamples`, which must
+ * hold a whole number of its cycles
+ */
+static double test_tone_amplitude(const int16_t *pSamples, uint32_t nSamples, double dTone)
+{
+	double dRe = 0;
+	double dIm = 0;
+
+	for(uint32_t i = 0; i < nSamples; ++i)
+	{
+		const double w = 2 * M_PI * dTone * i / SAMPLE_RATE;
+		dRe += pSamples[i] * cos(w);
+		dIm += pSamples[i] * sin(w);
+	}
+
+	return 2 * hypot(dRe, dIm) / nSamples;
+}
+
+
+/*
+ * test_biquad_response
+ *
+ * Runs tones through the biquad filter of every type with every number of
+ * sections, at cutoffs across its range, and checks the measured response is
+ * within TEST_RESPONSE_BOUND_DB of the design formulas wherever they give
+ * more than TEST_RESPONSE_FLOOR_DB.
+ */
+static void test_biquad_response(void)
+{
+	static const uint16_t pFrequencies[] = {20, 100, 1000, 4000};
+	static const uint16_t pTones[] = {10, 20, 50, 100, 200, 500, 1000, 2000, 3000, 4000, 4800};
+	static const char *ppszTypes[] = {"low-pass", "high-pass", "band-pass", "notch", "peak", "low shelf", "high shelf"};
+	static int16_t pInput[TEST_SETTLE_SAMPLES + TEST_RESPONSE_SAMPLES];
+	static int16_t pOutput[TEST_SETTLE_SAMPLES + TEST_RESPONSE_SAMPLES];
+	const uint32_t nSamples = TEST_SETTLE_SAMPLES + TEST_RESPONSE_SAMPLES;
+
+	for(uint8_t iType = 0; iType < BIQUAD_TYPES; ++iType)
+	{
+		for(uint8_t nSections = 1; nSections <= BIQUAD_MAX_SECTIONS; ++nSections)
+		{
+			double dWorst = 0;
+			uint16_t iWorstFrequency = 0;
+			uint16_t iWorstTone = 0;
+			bool bCreated = true;
+
+			for(uint8_t f = 0; f < sizeof(pFrequencies) / sizeof(pFrequencies[0]); ++f)
+			{
+				for(uint8_t t = 0; t < sizeof(pTones) / sizeof(pTones[0]); ++t)
+				{
+					const double dExpected = test_biquad_design_response(iType, nSections, pFrequencies[f], 0.707f, 6, pTones[t]);
+					if(dExpected <= TEST_RESPONSE_FLOOR_DB)
+						continue;
+
+					FilterBiquadData_t data = {NULL, iType, nSections, pFrequencies[f], 0.707f, 6};
+					if(!filter_biquad_mod(&data))
+					{
+						bCreated = false;
+						continue;
+					}
+
+					for(uint32_t i = 0; i < nSamples; ++i)
+						pInput[i] = pOutput[i] = lrint(TEST_TONE_AMPLITUDE * sin(2 * M_PI * pTones[t] * i / SAMPLE_RATE));
+
+					for(uint32_t i = 0; i < nSamples; i += BLOCK_SAMPLES)
+						filter_biquad_apply_block(&s_Context, pOutput + i, nSamples - i < BLOCK_SAMPLES ? nSamples - i : BLOCK_SAMPLES, &data);
+
+					filter_biquad_free(&data);
+
+					const double dInput = test_tone_amplitude(pInput + TEST_SETTLE_SAMPLES, TEST_RESPONSE_SAMPLES, pTones[t]);
+					const double dOutput = test_tone_amplitude(pOutput + TEST_SETTLE_SAMPLES, TEST_RESPONSE_SAMPLES, pTones[t]);
+					const double dError = fabs(20 * log10(dOutput / dInput) - dExpected);
+
+					if(dError > dWorst)
+					{
+						dWorst = dError;
+						iWorstFrequency = pFrequencies[f];
+						iWorstTone = pTones[t];
+					}
+				}
+			}
+
+			printf("Biquad %-10s x%u within %.3f dB of design (bound %.2f, worst at %u Hz cutoff, %u Hz tone)\n",
+				ppszTypes[iType], nSections, dWorst, TEST_RESPONSE_BOUND_DB, iWorstFrequency, iWorstTone);
+
+			char pszName[80];
+			snprintf(pszName, sizeof(pszName), "Biquad %s x%u response within %.2f dB of design", ppszTypes[iType], nSections, TEST_RESPONSE_BOUND_DB);
+			test_check(bCreated && dWorst <= TEST_RESPONSE_BOUND_DB, pszName);
+		}
+	}
+}
+
+
+/*
+ * test_biquad_gain
+ *
+ * Designs a single peak and shelf section at the most boost and cut, at
+ * cutoffs and Qs across their ranges, and checks the coefficients are within
+ * TEST_COEFFICIENT_BOUND of the design formulas, so none overflowed (see
+ * BIQUAD_MAX_GAIN). Gains beyond that are clamped to it, and NaN to 0 dB.
+ */
+static void test_biquad_gain(void)
+{
+	static const uint16_t pFrequencies[] = {20, 100, 1000, 4900};
+	static const float pQs[] = {0.1f, 0.707f, 10};
+	static const float pGains[] = {-BIQUAD_MAX_GAIN, BIQUAD_MAX_GAIN, -40, 40, NAN};
+	static const float pKept[] = {-BIQUAD_MAX_GAIN, BIQUAD_MAX_GAIN, -BIQUAD_MAX_GAIN, BIQUAD_MAX_GAIN, 0};
+	static const char *ppszTypes[] = {"peak", "low shelf", "high shelf"};
+
+	for(uint8_t iType = BIQUAD_PEAK; iType < BIQUAD_TYPES; ++iType)
+	{
+		for(uint8_t g = 0; g < sizeof(pGains) / sizeof(pGains[0]); ++g)
+		{
+			double dWorst = 0;
+			bool bKept = true;
+
+			for(uint8_t f = 0; f < sizeof(pFrequencies) / sizeof(pFrequencies[0]); ++f)
+			{
+				for(uint8_t q = 0; q < sizeof(pQs) / sizeof(pQs[0]); ++q)
+				{
+					FilterBiquadData_t data = {NULL, iType, 1, pFrequencies[f], pQs[q], pGains[g]};
+					if(!filter_biquad_mod(&data) || data.flGain != pKept[g])
+					{
+						filter_biquad_free(&data);
+						bKept = false;
+						continue;
+					}
+
+					double pB[3], pA[3];
+					test_biquad_design(iType, pFrequencies[f], pQs[q], data.flGain, pB, pA);
+
+					const BiquadSection_t *pSection = &data.pCascade->pSections[0];
+					const BiquadCoefficient_t pCoefficients[] = {pSection->b0, pSection->b1, pSection->b2, pSection->a1, pSection->a2};
+					const double pDesigned[] = {pB[0] / pA[0], pB[1] / pA[0], pB[2] / pA[0], pA[1] / pA[0], pA[2] / pA[0]};
+
+					for(uint8_t i = 0; i < sizeof(pDesigned) / sizeof(pDesigned[0]); ++i)
+					{
+						const double dError = fabs(pCoefficients[i] / TEST_COEFFICIENT_ONE - pDesigned[i]);
+						if(dError > dWorst)
+							dWorst = dError;
+					}
+
+					filter_biquad_free(&data);
+				}
+			}
+
+			printf("Biquad %-10s at %+.0f dB: coefficients within %.1e of design (bound %.0e)\n", ppszTypes[iType - BIQUAD_PEAK], pGains[g], dWorst, TEST_COEFFICIENT_BOUND);
+
+			char pszName[80];
+			snprintf(pszName, sizeof(pszName), "Biquad %s at %+.0f dB kept at %+.0f dB within range", ppszTypes[iType - BIQUAD_PEAK], pGains[g], pKept[g]);
+			test_check(bKept && dWorst <= TEST_COEFFICIENT_BOUND, pszName);
+		}
+	}
+}
+
+
+/*
+ * test_delay_resize
+ *
+ * Changes the delay of a Delay filter, created with its default parameters, to
+ * the longest, shortest, middle and longest delay of every encoding in turn.
+ * Each change is made the way U2B_FILTER_MOD makes it: the original data keeps
+ * its line until the modified copy has one, so going from one longest line to
+ * the next needs the budget to keep the old one out of the middle.
+ */
+static void test_delay_resize(void)
+{
+	FilterDelayData_t data = {0};
+	test_check(filter_delay_create(&data), "Delay created for resizing");
+
+	for(uint8_t iEncoding = 0; iEncoding < DELAYLINE_ENCODINGS; ++iEncoding)
+	{
+		const uint32_t pDelays[] = {DELAY_MAX_SAMPLES(iEncoding) - 1, 0, DELAY_MAX_SAMPLES(iEncoding) / 2, DELAY_MAX_SAMPLES(iEncoding) - 1};
+
+		for(uint8_t i = 0; i < sizeof(pDelays) / sizeof(pDelays[0]); ++i)
+		{
+			FilterDelayData_t next = data;
+			next.nDelay = pDelays[i];
+			next.encoding = iEncoding;
+
+			char pszName[64];
+			snprintf(pszName, sizeof(pszName), "Delay resized to %u samples, encoding %u", (unsigned) pDelays[i], iEncoding);
+			test_check(filter_delay_mod(&next) && next.nDelay == pDelays[i], pszName);
+
+			filter_delay_free(&data);
+			data = next;
+		}
+	}
+
+	filter_delay_free(&data);
+}
+
+
+/*
+ * test_delay_clamp
+ *
+ * Asks a Delay filter for one sample more than each encoding can hold and
+ * checks filter_params_equal spots the clamp, which is how U2B_FILTER_MOD
+ * knows to send the kept values back to the UI. A delay that fits must not be
+ * reported.
+ */
+static void test_delay_clamp(void)
+{
+	const Filter_t *pFilter = &g_pFilters[FILTER_DELAY];
+
+	FilterDelayData_t data = {0};
+	test_check(filter_delay_create(&data), "Delay created for clamping");
+
+	for(uint8_t iEncoding = 0; iEncoding < DELAYLINE_ENCODINGS; ++iEncoding)
+	{
+		const uint32_t pDelays[] = {DELAY_MAX_SAMPLES(iEncoding) - 1, DELAY_MAX_SAMPLES(iEncoding)};
+
+		for(uint8_t i = 0; i < sizeof(pDelays) / sizeof(pDelays[0]); ++i)
+		{
+			FilterDelayData_t next = data;
+			next.nDelay = pDelays[i];
+			next.encoding = iEncoding;
+
+			const FilterDelayData_t requested = next;
+			const bool bModded = filter_delay_mod(&next);
+			const bool bClamped = !filter_params_equal(pFilter, (const uint8_t *)&requested + pFilter->nNonPublicDataSize, (const uint8_t *)&next + pFilter->nNonPublicDataSize);
+
+			char pszName[64];
+			snprintf(pszName, sizeof(pszName), "Delay of %u samples, encoding %u, %s", (unsigned) pDelays[i], iEncoding, i ? "clamped" : "kept");
+			test_check(bModded && bClamped == (i == 1), pszName);
+
+			filter_delay_free(&data);
+			data = next;
+		}
+	}
+
+	filter_delay_free(&data);
+}
+
+
+/*
+ * TestStoreReader_t
+ *
+ * A stored chain in memory, read by test_store_read.
+ */
+typedef struct
+{
+	const uint8_t *pData;
+	uint16_t nSize;
+	uint16_t iCursor;
+} TestStoreReader_t;
+
+
+/*
+ * test_store_read
+ *
+ * ChainStoreRead_t for a TestStoreReader_t.
+ */
+static bool test_store_read(void *pReader, void *pBuf, uint16_t nBytes)
+{
+	TestStoreReader_t *pStore = (TestStoreReader_t *)pReader;
+
+	if(pStore->iCursor + nBytes > pStore->nSize)
+		return false;
+
+	memcpy(pBuf, pStore->pData + pStore->iCursor, nBytes);
+	pStore->iCursor += nBytes;
+	return true;
+}
+
+
+/*
+ * test_store_branch
+ *
+ * Writes filter `iFilter`, with the default value of each parameter in its
+ * parameter string, to `pBuf` as a stored branch.
+ *
+ * @returns the number of bytes written
+ */
+static uint16_t test_store_branch(uint8_t *pBuf, uint8_t iFilter)
+{
+	ChainStoreBranchHeader_t branchHdr = {iFilter, BRANCHFLAG_ENABLED | BRANCHFLAG_FULL_MIX, 1.0f, 0};
+	uint16_t nBytes = sizeof(ChainStoreBranchHeader_t);
+
+	for(const char *pParam = g_pFilters[iFilter].pszParamFormat; pParam; pParam = strstr(pParam + 1, PARAM_SEP))
+	{
+		const char *pszNextParam = strstr(pParam + 1, PARAM_SEP);
+		const char *pszFormat = strstr(pParam, ";f=") + 3;
+		const char *pszVal = strstr(pParam, ";val=");
+
+		// Choices default to the first
+		const double dVal = pszVal && (!pszNextParam || pszVal < pszNextParam) ? atof(pszVal + 5) : 0.0;
+
+		ChainStoreParam_t param = {atoi(strstr(pParam, ";o=") + 3), filter_param_size(*pszFormat)};
+		memcpy(pBuf + nBytes, &param, sizeof(param));
+		nBytes += sizeof(param);
+
+		if(*pszFormat == 'f')
+		{
+			const float flVal = dVal;
+			memcpy(pBuf + nBytes, &flVal, sizeof(flVal));
+		}
+		else
+		{
+			// Little endian, as on the board
+			const int32_t iVal = lrint(dVal);
+			memcpy(pBuf + nBytes, &iVal, param.nSize);
+		}
+
+		nBytes += param.nSize;
+		branchHdr.nParams++;
+	}
+
+	memcpy(pBuf, &branchHdr, sizeof(branchHdr));
+	return nBytes;
+}
+
+
+/*
+ * test_store_chain
+ *
+ * Writes a stored chain of one stage for each of `ppszFilters`, with their
+ * default parameters, to `pStore`.
+ *
+ * @returns the size of the stored chain
+ */
+static uint16_t test_store_chain(uint8_t *pStore, const char **ppszFilters, uint8_t nFilters)
+{
+	const ChainStoreHeader_t hdr = {STORE_IDENT, STORE_VERSION, nFilters};
+	memcpy(pStore, &hdr, sizeof(hdr));
+	uint16_t nSize = sizeof(hdr);
+
+	for(uint8_t i = 0; i < nFilters; ++i)
+	{
+		uint8_t iFilter = 0;
+		while(strcmp(g_pFilters[iFilter].pszName, ppszFilters[i]))
+			iFilter++;
+
+		const ChainStoreStageHeader_t stageHdr = {1};
+		memcpy(pStore + nSize, &stageHdr, sizeof(stageHdr));
+		nSize += sizeof(stageHdr);
+
+		nSize += test_store_branch(pStore + nSize, iFilter);
+	}
+
+	return nSize;
+}
+
+
+/*
+ * test_chain_decode
+ *
+ * Decodes the `nSize` byte stored chain `pStore` into `pContext` and compiles
+ * it, as chain_restore does. The plans it replaced are freed straight away,
+ * so two contexts fit in the plan pool.
+ *
+ * @returns false if the chain couldn't be decoded
+ */
+static bool test_chain_decode(AudioContext_t *pContext, const uint8_t *pStore, uint16_t nSize)
+{
+	TestStoreReader_t reader = {pStore, nSize, 0};
+	const bool bDecoded = chainstore_decode(pContext, test_store_read, &reader);
+
+	chainplan_compile(pContext);
+	chainplan_flush(pContext);
+	return bDecoded;
+}
+
+
+/*
+ * test_chain_reload
+ *
+ * Decodes a stored chain of one stage for each of `ppszFilters`, with their
+ * default parameters, then decodes it again over itself, as chain_restore
+ * does when the same chain is restored twice. The current chain is freed
+ * first, so this must not need room in the pools or the delay budget for two
+ * copies.
+ */
+static void test_chain_reload(const char *pszChain, const char **ppszFilters, uint8_t nFilters)
+{
+	uint8_t pStore[256];
+	const uint16_t nSize = test_store_chain(pStore, ppszFilters, nFilters);
+
+	test_check(context_init(&s_Context), "context created for reloading");
+
+	int16_t pBlock[BLOCK_SAMPLES] = {0};
+
+	for(uint8_t i = 0; i < 2; ++i)
+	{
+		const bool bDecoded = test_chain_decode(&s_Context, pStore, nSize);
+
+		context_process(&s_Context, pBlock, BLOCK_SAMPLES, false);
+		chainplan_reclaim(&s_Context);
+
+		char pszName[64];
+		snprintf(pszName, sizeof(pszName), "%s chain %s", pszChain, i ? "restored over itself" : "restored");
+		test_check(bDecoded && s_Context.pChainPlan->nOps == nFilters, pszName);
+	}
+
+	context_free(&s_Context);
+}
+
+
+/*
+ * test_context_interleave
+ *
+ * Runs the first and second halves of the test signal through a chain of one
+ * stage for each of `ppszFilters`, each half in its own context, and checks
+ * that running the two contexts a block of each at a time gives the same
+ * output as running each alone. The chains share LFOs and the pools, but
+ * nothing one context does may change the other's output.
+ */
+static void test_context_interleave(const char *pszChain, const char **ppszFilters, uint8_t nFilters)
+{
+	static AudioContext_t s_OtherContext;
+	static int16_t ppAlone[2][TEST_SAMPLES / 2];
+	static int16_t ppInterleaved[2][TEST_SAMPLES / 2];
+	AudioContext_t *ppContexts[2] = {&s_Context, &s_OtherContext};
+	const uint32_t nSamples = TEST_SAMPLES / 2;
+
+	uint8_t pStore[512];
+	const uint16_t nSize = test_store_chain(pStore, ppszFilters, nFilters);
+
+	test_signal(s_pSignal, TEST_SAMPLES);
+
+	bool bDecoded = true;
+
+	for(uint8_t k = 0; k < 2; ++k)
+	{
+		memcpy(ppAlone[k], s_pSignal + k * nSamples, sizeof(ppAlone[k]));
+
+		bDecoded &= context_init(&s_Context) && test_chain_decode(&s_Context, pStore, nSize);
+
+		for(uint32_t i = 0; i < nSamples; i += BLOCK_SAMPLES)
+			context_process(&s_Context, ppAlone[k] + i, nSamples - i < BLOCK_SAMPLES ? nSamples - i : BLOCK_SAMPLES, false);
+
+		context_free(&s_Context);
+	}
+
+	for(uint8_t k = 0; k < 2; ++k)
+	{
+		memcpy(ppInterleaved[k], s_pSignal + k * nSamples, sizeof(ppInterleaved[k]));
+		bDecoded &= context_init(ppContexts[k]) && test_chain_decode(ppContexts[k], pStore, nSize);
+	}
+
+	for(uint32_t i = 0; i < nSamples; i += BLOCK_SAMPLES)
+	{
+		for(uint8_t k = 0; k < 2; ++k)
+			context_process(ppContexts[k], ppInterleaved[k] + i, nSamples - i < BLOCK_SAMPLES ? nSamples - i : BLOCK_SAMPLES, false);
+	}
+
+	for(uint8_t k = 0; k < 2; ++k)
+		context_free(ppContexts[k]);
+
+	char pszName[80];
+	snprintf(pszName, sizeof(pszName), "%s chain interleaved with itself", pszChain);
+	test_check(bDecoded && !memcmp(ppAlone, ppInterleaved, sizeof(ppAlone)), pszName);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *pszWrite = NULL;
+	const char *pszCompare = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "w:c:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'w':
+			pszWrite = optarg;
+			break;
+
+		case 'c':
+			pszCompare = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if(optind != argc)
+		usage(argv[0]);
+
+	pool_check_filters();
+	lfo_init();
+	envelope_init();
+
+	test_filters(pszWrite, pszCompare);
+	test_biquad_response();
+	test_biquad_gain();
+	test_delay_resize();
+	test_delay_clamp();
+
+	const char *ppszReverb[] = {"Reverb"};
+	const char *ppszDelays[] = {"Delay", "Delay"};
+	test_chain_reload("Reverb", ppszReverb, 1);
+	test_chain_reload("Two Delay", ppszDelays, 2);
+
+	const char *ppszInterleaved[] = {"Compressor", "Tremolo", "Biquad", "Delay"};
+	test_context_interleave("Compressor, Tremolo, Biquad, Delay", ppszInterleaved, 4);
+
+	printf("%u/%u checks passed\n", s_nChecks - s_nFailures, s_nChecks);
+	return s_nFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
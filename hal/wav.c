@@ -0,0 +1,290 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * wav.c - WAV file reading and writing (HAL_HOST builds)
+ *
+ * Reads 8, 16 and 24 bit PCM and 32 bit float WAV files of any sample rate and
+ * channel count, mixed down to mono 16 bit samples. Writes mono 16 bit PCM.
+ */
+
+// strcasecmp on top of -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "wav.h"
+
+
+// RIFF chunk identifiers
+#define WAV_ID(a, b, c, d)	((a) | ((b) << 8) | ((c) << 16) | ((uint32_t)(d) << 24))
+#define WAV_RIFF			WAV_ID('R', 'I', 'F', 'F')
+#define WAV_WAVE			WAV_ID('W', 'A', 'V', 'E')
+#define WAV_FMT				WAV_ID('f', 'm', 't', ' ')
+#define WAV_DATA			WAV_ID('d', 'a', 't', 'a')
+
+// fmt chunk wFormatTag values
+#define WAV_FORMAT_PCM			1
+#define WAV_FORMAT_FLOAT		3
+#define WAV_FORMAT_EXTENSIBLE	0xFFFE
+
+// Size of the header wav_open_write writes, up to the sample data
+#define WAV_HEADER_SIZE	44
+
+
+/*
+ * read_le
+ *
+ * Reads an `nBytes` little endian unsigned integer.
+ */
+static bool read_le(FILE *pFile, uint8_t nBytes, uint32_t *pValue)
+{
+	uint8_t pBytes[4];
+
+	if(fread(pBytes, 1, nBytes, pFile) != nBytes)
+		return false;
+
+	*pValue = 0;
+	for(uint8_t i = 0; i < nBytes; ++i)
+		*pValue |= (uint32_t) pBytes[i] << (8 * i);
+
+	return true;
+}
+
+
+/*
+ * write_le
+ *
+ * Writes an `nBytes` little endian unsigned integer.
+ */
+static void write_le(FILE *pFile, uint8_t nBytes, uint32_t value)
+{
+	for(uint8_t i = 0; i < nBytes; ++i)
+		fputc((value >> (8 * i)) & 0xFF, pFile);
+}
+
+
+/*
+ * wav_open_read
+ *
+ * Opens the WAV file at `pszPath` and finds its sample data.
+ *
+ * @returns false if it can't be opened or isn't a supported WAV file
+ */
+bool wav_open_read(WavFile_t *pWav, const char *pszPath)
+{
+	memset(pWav, 0, sizeof(*pWav));
+
+	if(!(pWav->pFile = fopen(pszPath, "rb")))
+		return false;
+
+	uint32_t ulId, ulSize, ulForm;
+	if(!read_le(pWav->pFile, 4, &ulId) || !read_le(pWav->pFile, 4, &ulSize) || !read_le(pWav->pFile, 4, &ulForm)
+		|| ulId != WAV_RIFF || ulForm != WAV_WAVE)
+	{
+		fprintf(stderr, "%s: not a WAV file\n", pszPath);
+		goto error;
+	}
+
+	// Walk the chunks until the sample data, which must follow the format
+	bool bFormat = false;
+
+	while(read_le(pWav->pFile, 4, &ulId) && read_le(pWav->pFile, 4, &ulSize))
+	{
+		if(ulId == WAV_FMT && ulSize >= 16)
+		{
+			uint32_t ulFormat = 0, ulChannels = 0, ulRate = 0, ulByteRate, ulAlign, ulBits;
+			read_le(pWav->pFile, 2, &ulFormat);
+			read_le(pWav->pFile, 2, &ulChannels);
+			read_le(pWav->pFile, 4, &ulRate);
+			read_le(pWav->pFile, 4, &ulByteRate);
+			read_le(pWav->pFile, 2, &ulAlign);
+
+			if(!read_le(pWav->pFile, 2, &ulBits))
+				break;
+
+			// WAVE_FORMAT_EXTENSIBLE keeps the real format in its sub-format
+			if(ulFormat == WAV_FORMAT_EXTENSIBLE && ulSize >= 26)
+			{
+				uint32_t ulExtSize, ulValidBits, ulMask;
+				read_le(pWav->pFile, 2, &ulExtSize);
+				read_le(pWav->pFile, 2, &ulValidBits);
+				read_le(pWav->pFile, 4, &ulMask);
+				read_le(pWav->pFile, 2, &ulFormat);
+				ulSize -= 10;
+			}
+
+			pWav->nChannels = ulChannels;
+			pWav->ulSampleRate = ulRate;
+			pWav->nBits = ulBits;
+			pWav->bFloat = ulFormat == WAV_FORMAT_FLOAT;
+
+			const bool bSupported = ulChannels > 0 && ulRate > 0 && (pWav->bFloat ? ulBits == 32 :
+				ulFormat == WAV_FORMAT_PCM && (ulBits == 8 || ulBits == 16 || ulBits == 24));
+
+			if(!bSupported)
+			{
+				fprintf(stderr, "%s: unsupported format %u (%u bit)\n", pszPath, ulFormat, ulBits);
+				goto error;
+			}
+
+			bFormat = true;
+			ulSize -= 16;
+		}
+		else if(ulId == WAV_DATA && bFormat)
+		{
+			pWav->ulDataBytes = ulSize;
+			return true;
+		}
+
+		// Skip the rest of the chunk (chunks are word aligned)
+		if(fseek(pWav->pFile, ulSize + (ulSize & 1), SEEK_CUR))
+			break;
+	}
+
+	fprintf(stderr, "%s: no sample data\n", pszPath);
+
+error:
+	fclose(pWav->pFile);
+	pWav->pFile = NULL;
+	return false;
+}
+
+
+/*
+ * wav_open_write
+ *
+ * Creates a mono 16 bit WAV file at `pszPath`. The sizes in the header are
+ * filled in by wav_close.
+ *
+ * @returns false if it can't be created
+ */
+bool wav_open_write(WavFile_t *pWav, const char *pszPath, uint32_t ulSampleRate)
+{
+	memset(pWav, 0, sizeof(*pWav));
+
+	if(!(pWav->pFile = fopen(pszPath, "wb")))
+		return false;
+
+	pWav->ulSampleRate = ulSampleRate;
+	pWav->nChannels = 1;
+	pWav->nBits = 16;
+	pWav->bWriting = true;
+
+	write_le(pWav->pFile, 4, WAV_RIFF);
+	write_le(pWav->pFile, 4, 0);
+	write_le(pWav->pFile, 4, WAV_WAVE);
+
+	write_le(pWav->pFile, 4, WAV_FMT);
+	write_le(pWav->pFile, 4, 16);
+	write_le(pWav->pFile, 2, WAV_FORMAT_PCM);
+	write_le(pWav->pFile, 2, pWav->nChannels);
+	write_le(pWav->pFile, 4, ulSampleRate);
+	write_le(pWav->pFile, 4, ulSampleRate * pWav->nChannels * 2);
+	write_le(pWav->pFile, 2, pWav->nChannels * 2);
+	write_le(pWav->pFile, 2, pWav->nBits);
+
+	write_le(pWav->pFile, 4, WAV_DATA);
+	write_le(pWav->pFile, 4, 0);
+
+	return true;
+}
+
+
+/*
+ * wav_read
+ *
+ * Reads the next frame, mixed down to a mono 16 bit sample.
+ *
+ * @returns false at the end of the sample data
+ */
+bool wav_read(WavFile_t *pWav, int16_t *pSample)
+{
+	const uint8_t nBytes = pWav->nBits / 8;
+
+	if(pWav->ulDataBytes < (uint32_t) nBytes * pWav->nChannels)
+		return false;
+
+	pWav->ulDataBytes -= nBytes * pWav->nChannels;
+
+	int32_t iSum = 0;
+
+	for(uint16_t i = 0; i < pWav->nChannels; ++i)
+	{
+		uint32_t ulRaw;
+		if(!read_le(pWav->pFile, nBytes, &ulRaw))
+			return false;
+
+		if(pWav->bFloat)
+		{
+			float flValue;
+			memcpy(&flValue, &ulRaw, sizeof(flValue));
+
+			if(flValue > 1.0f)
+				flValue = 1.0f;
+			else if(flValue < -1.0f)
+				flValue = -1.0f;
+
+			iSum += (int32_t)(flValue * INT16_MAX);
+		}
+		else if(nBytes == 1)
+			iSum += ((int32_t) ulRaw - 128) << 8;
+		else if(nBytes == 2)
+			iSum += (int16_t) ulRaw;
+		else
+			iSum += (int32_t)(ulRaw << 8) >> 16;
+	}
+
+	*pSample = iSum / pWav->nChannels;
+	return true;
+}
+
+
+void wav_write(WavFile_t *pWav, int16_t sample)
+{
+	write_le(pWav->pFile, 2, (uint16_t) sample);
+	pWav->ulDataBytes += 2;
+}
+
+
+/*
+ * wav_close
+ *
+ * Closes the file, filling in the header sizes if it was written.
+ */
+void wav_close(WavFile_t *pWav)
+{
+	if(!pWav->pFile)
+		return;
+
+	if(pWav->bWriting)
+	{
+		fseek(pWav->pFile, 4, SEEK_SET);
+		write_le(pWav->pFile, 4, WAV_HEADER_SIZE - 8 + pWav->ulDataBytes);
+		fseek(pWav->pFile, WAV_HEADER_SIZE - 4, SEEK_SET);
+		write_le(pWav->pFile, 4, pWav->ulDataBytes);
+	}
+
+	fclose(pWav->pFile);
+	pWav->pFile = NULL;
+}
+
+
+/*
+ * wav_is_wav_path
+ *
+ * @returns true if `pszPath` ends in .wav
+ */
+bool wav_is_wav_path(const char *pszPath)
+{
+	const size_t nLen = strlen(pszPath);
+	return nLen > 4 && !strcasecmp(pszPath + nLen - 4, ".wav");
+}
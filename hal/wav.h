@@ -0,0 +1,47 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * wav.c - WAV file reading and writing (HAL_HOST builds)
+ *
+ * Reads 8, 16 and 24 bit PCM and 32 bit float WAV files of any sample rate and
+ * channel count, mixed down to mono 16 bit samples. Writes mono 16 bit PCM.
+ */
+
+#ifndef _WAV_H_
+#define _WAV_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*
+ * WavFile_t
+ *
+ * An open WAV file, see wav_open_read and wav_open_write.
+ */
+typedef struct
+{
+	FILE *pFile;
+	uint32_t ulSampleRate;	///< frames per second
+	uint16_t nChannels;		///< samples per frame
+	uint16_t nBits;			///< bits per sample
+	bool bFloat;			///< 32 bit IEEE float samples, rather than PCM
+	bool bWriting;			///< opened by wav_open_write
+	uint32_t ulDataBytes;	///< bytes of sample data left to read, or written so far
+} WavFile_t;
+
+
+bool wav_open_read(WavFile_t *pWav, const char *pszPath);
+bool wav_open_write(WavFile_t *pWav, const char *pszPath, uint32_t ulSampleRate);
+bool wav_read(WavFile_t *pWav, int16_t *pSample);
+void wav_write(WavFile_t *pWav, int16_t sample);
+void wav_close(WavFile_t *pWav);
+bool wav_is_wav_path(const char *pszPath);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * lfo.c - Shared low frequency oscillator bank
+ *
+ * Vibrato, Tremolo and Flange read their modulation from a bank of
+ * oscillators, allocated from g_LFOPool. Each oscillator looks its wave up in
+ * a table at a 32 bit phase worked out from the audio context's sample count
+ * (see context.h), so oscillators hold no state of their own and every context
+ * can share the bank. Filters with the same rate and wave share an oscillator.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "config.h"
+#include "dbg.h"
+#include "fixed.h"
+#include "pool.h"
+#include "samples.h"
+#include "context.h"
+#include "lfo.h"
+
+
+// Wave tables in Q15 [0-Q15_ONE]. The extra entry is the value at the end of
+// the period, so the last step can be interpolated without wrapping.
+static uint16_t s_ppWaveTables[LFO_WAVES][LFO_TABLE_SIZE + 1];
+
+// Names of each LFOWave_e, for lfo_debug
+static const char *s_ppszWaves[LFO_WAVES] = {"square", "sawtooth", "inverse sawtooth", "triangle", "sine"};
+
+
+/*
+ * lfo_get_block
+ *
+ * @returns oscillator `iLFO` (block `iLFO` of g_LFOPool)
+ */
+static inline LFO_t *lfo_get_block(uint8_t iLFO)
+{
+	return (LFO_t *)(g_LFOPool.pStorage + iLFO * g_LFOPool.nBlockSize);
+}
+
+
+/*
+ * lfo_wave
+ *
+ * @returns the value of wave `iWave` at `flPhase` [0-1] in a period, [0-1]
+ */
+static float lfo_wave(uint8_t iWave, float flPhase)
+{
+	switch(iWave)
+	{
+		case LFO_SQUARE:
+			return flPhase > 0.5f ? 1 : 0;
+		case LFO_SAWTOOTH:
+			return flPhase;
+		case LFO_INVERSE_SAWTOOTH:
+			return 1 - flPhase;
+		case LFO_TRIANGLE:
+			return flPhase < 0.5f ? 2 * flPhase : 2 - 2 * flPhase;
+		case LFO_SINE:
+			return 0.5f - 0.5f * cosf(2 * PI_F * flPhase);
+	}
+
+	return 0;
+}
+
+
+/*
+ * lfo_init
+ *
+ * Fills the wave tables. Called once at boot.
+ */
+void lfo_init(void)
+{
+	for(uint8_t i = 0; i < LFO_WAVES; ++i)
+	{
+		for(uint16_t j = 0; j <= LFO_TABLE_SIZE; ++j)
+			s_ppWaveTables[i][j] = lfo_wave(i, (float) j / LFO_TABLE_SIZE) * Q15_ONE + 0.5f;
+	}
+}
+
+
+/*
+ * lfo_get_q15
+ *
+ * @returns the value of oscillator `iLFO` at the current sample of `pContext`
+ * in Q15 [0-Q15_ONE]
+ */
+uint16_t lfo_get_q15(const AudioContext_t *pContext, uint8_t iLFO)
+{
+	const LFO_t *pLFO = lfo_get_block(iLFO);
+
+	// Samples since the context started, up to the current sample, which may
+	// be part way through the block. Every oscillator is in step with one
+	// that had been running since then.
+	const uint32_t ulSamples = pContext->ulSamples + ((pContext->history.iCursor - pContext->iBlockCursor) & BUFFER_MASK);
+	const uint32_t ulPhase = pLFO->ulIncrement * ulSamples;
+
+	const uint16_t *pTable = s_ppWaveTables[pLFO->iWave];
+	const uint32_t i = ulPhase >> (32 - LFO_TABLE_LOG2);
+	const int32_t qFrac = (ulPhase >> (32 - LFO_TABLE_LOG2 - Q15_SHIFT)) & (Q15_ONE - 1);
+
+	return pTable[i] + (((pTable[i + 1] - pTable[i]) * qFrac) >> Q15_SHIFT);
+}
+
+
+// Float version of lfo_get_q15, [0-1]
+float lfo_get(const AudioContext_t *pContext, uint8_t iLFO)
+{
+	return lfo_get_q15(pContext, iLFO) * (1.0f / Q15_ONE);
+}
+
+
+/*
+ * lfo_acquire
+ *
+ * Finds an oscillator running at `frequency` + `frequencyFine`/100 Hz with
+ * wave `iWave`, or starts one. Each call must be paired with lfo_release.
+ *
+ * @returns index of the oscillator, or LFO_NONE if the bank is full
+ */
+uint8_t lfo_acquire(uint8_t frequency, uint8_t frequencyFine, uint8_t iWave)
+{
+	const uint16_t nCentiHz = frequency * 100 + frequencyFine;
+
+	if(iWave >= LFO_WAVES)
+	{
+		dbg_warning("invalid wave type %u\r\n", iWave);
+		iWave = LFO_SQUARE;
+	}
+
+	// Share an oscillator that is already running
+	for(uint16_t i = 0; i < g_LFOPool.nCarved; ++i)
+	{
+		LFO_t *pLFO = lfo_get_block(i);
+
+		if(pLFO->nUsers && pLFO->nCentiHz == nCentiHz && pLFO->iWave == iWave)
+		{
+			pLFO->nUsers++;
+			return i;
+		}
+	}
+
+	LFO_t *pLFO = (LFO_t *)pool_alloc(&g_LFOPool);
+	if(!pLFO)
+		return LFO_NONE;
+
+	pLFO->nCentiHz = nCentiHz;
+	pLFO->iWave = iWave;
+	pLFO->ulIncrement = ((uint64_t) nCentiHz << 32) / (100 * SAMPLE_RATE);
+	pLFO->nUsers = 1;
+
+	return ((uint8_t *)pLFO - g_LFOPool.pStorage) / g_LFOPool.nBlockSize;
+}
+
+
+/*
+ * lfo_release
+ *
+ * Releases a reference from lfo_acquire. Releasing LFO_NONE does nothing.
+ */
+void lfo_release(uint8_t iLFO)
+{
+	if(iLFO == LFO_NONE)
+		return;
+
+	LFO_t *pLFO = lfo_get_block(iLFO);
+	dbg_assert(iLFO < g_LFOPool.nCarved && pLFO->nUsers > 0, "LFO %u is not in use", iLFO);
+
+	if(--pLFO->nUsers == 0)
+		pool_free(&g_LFOPool, pLFO);
+}
+
+
+/*
+ * lfo_debug
+ *
+ * Prints every running oscillator.
+ */
+void lfo_debug(void)
+{
+	dbg_printf(" === lfo_debug ===\r\n");
+
+	for(uint16_t i = 0; i < g_LFOPool.nCarved; ++i)
+	{
+		const LFO_t *pLFO = lfo_get_block(i);
+
+		if(pLFO->nUsers)
+			dbg_printf("#%u: %u.%02u Hz %s, %u user(s)\r\n", i, pLFO->nCentiHz / 100, pLFO->nCentiHz % 100, s_ppszWaves[pLFO->iWave], pLFO->nUsers);
+	}
+
+	dbg_printf("\r\n");
+}
@@ -0,0 +1,75 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * lfo.c - Shared low frequency oscillator bank
+ *
+ * Vibrato, Tremolo and Flange read their modulation from a bank of
+ * oscillators, allocated from g_LFOPool. Each oscillator looks its wave up in
+ * a table at a 32 bit phase worked out from the audio context's sample count
+ * (see context.h), so oscillators hold no state of their own and every context
+ * can share the bank. Filters with the same rate and wave share an oscillator.
+ */
+
+#ifndef _LFO_H_
+#define _LFO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Samples per wave table (as a power of two). Values between entries are
+// linearly interpolated.
+#define LFO_TABLE_LOG2	8
+#define LFO_TABLE_SIZE	(1 << LFO_TABLE_LOG2)
+
+// Index returned by lfo_acquire when the bank is full
+#define LFO_NONE		0xFF
+
+
+/*
+ * LFOWave_e
+ *
+ * Wave shapes, in the order of the "Wave Type" filter parameter
+ */
+typedef enum
+{
+	LFO_SQUARE = 0,
+	LFO_SAWTOOTH,
+	LFO_INVERSE_SAWTOOTH,
+	LFO_TRIANGLE,
+	LFO_SINE,
+	LFO_WAVES
+} LFOWave_e;
+
+
+struct AudioContext_t;
+
+
+/*
+ * LFO_t
+ *
+ * An oscillator in the bank. ulIncrement overlaps the pool free list pointer,
+ * so it is only valid while nUsers > 0.
+ */
+typedef struct
+{
+	uint32_t ulIncrement;	///< phase per sample, 2^32 is one period
+	uint16_t nCentiHz;		///< rate in 1/100 Hz
+	uint8_t iWave;			///< LFOWave_e
+	uint8_t nUsers;			///< filter data referencing this oscillator, 0 when free
+} LFO_t;
+
+
+void lfo_init(void);
+uint16_t lfo_get_q15(const struct AudioContext_t *pContext, uint8_t iLFO);
+float lfo_get(const struct AudioContext_t *pContext, uint8_t iLFO);
+uint8_t lfo_acquire(uint8_t frequency, uint8_t frequencyFine, uint8_t iWave);
+void lfo_release(uint8_t iLFO);
+void lfo_debug(void);
+
+#endif
@@ -24,7 +24,7 @@
 // `chan` in the functions below must be in the range [0..UTIM_NUM_TIMERS)
 #define UTIM_NUM_TIMERS 4
 
-// Prototype of timer callbacks (e.g., time_tick in main.c)
+// Prototype of timer callbacks (e.g., the sampling timer in hal/lpc17xx.c)
 typedef void (*TimerHandler_t)(void *pUserData);
 
 
@@ -15,21 +15,24 @@
 #include <string.h>
 #include <stdint.h>
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-pedantic"
-#	include "LPC17xx.h"
-#	include "lpc_types.h"
-#	include "lpc17xx_uart.h"
-#pragma GCC diagnostic pop
-
+#include "hal.h"
 #include "sercom.h"
 #include "filters.h"
+#include "filters/fir.h"
 #include "bytebuffer.h"
 #include "dbg.h"
-#include "ticktime.h"
 #include "packets.h"
 #include "chain.h"
+#include "chainplan.h"
+#include "profile.h"
+#include "admission.h"
+#include "governor.h"
+#include "pool.h"
+#include "lfo.h"
+#include "envelope.h"
+#include "delayline.h"
 #include "samples.h"
+#include "audio.h"
 #include "config.h"
 #ifdef INDIVIDUAL_BUILD_SAUL
 #	include "chainstore.h"
@@ -60,6 +63,9 @@ const char *g_ppszPacketTypes[] = {
 	"B2U_STORED_LIST",
 	"B2U_CHAIN_BLOB",
 #endif
+	"B2U_PROFILE",
+	"B2U_ADMISSION",
+	"B2U_ERROR",
 };
 
 
@@ -78,7 +84,7 @@ PacketHandler_t g_pPacketHandlers[] = {
 	{packet_filter_flag_receive, true, PACKET_SIZE_EXACT(sizeof(FilterFlagPacket_t))}, // U2B_FILTER_FLAG
 	{packet_filter_mod_receive, true, PACKET_SIZE_MIN(sizeof(FilterModPacket_t))}, // U2B_FILTER_MOD
 	{packet_filter_mix_receive, true, PACKET_SIZE_EXACT(sizeof(FilterMixPacket_t))}, // U2B_FILTER_MIX
-	{packet_cmd_receive, true, PACKET_SIZE_MIN(sizeof(CommandPacket_t))}, // U2B_ARB_CMD
+	{packet_cmd_receive, false, PACKET_SIZE_MIN(sizeof(CommandPacket_t))}, // U2B_ARB_CMD
 #ifdef INDIVIDUAL_BUILD_TOM
 	{NULL, false, 0}, // B2U_ANALOG_CONTROL
 #endif
@@ -86,12 +92,15 @@ PacketHandler_t g_pPacketHandlers[] = {
 	{NULL, false, 0}, // B2U_STORED_LIST
 	{NULL, false, 0}, // B2U_CHAIN_BLOB
 #endif
+	{NULL, false, 0}, // B2U_PROFILE
+	{NULL, false, 0}, // B2U_ADMISSION
+	{NULL, false, 0}, // B2U_ERROR
 };
 
 // Should each receipt of each packet be debugged?
 static bool s_bDebugPacketReceipt = false;
 
-// Should the chain be debugged to console after the chain is unlocked?
+// Should the chain be debugged to console after the chain is edited?
 static bool s_bDebugChainAfterLock = false;
 
 
@@ -251,6 +260,22 @@ void packet_chain_blob_send(const char *pszPath)
 	// Get file size
 	DWORD size = f_size(&fh);
 
+	// Check the store header before sending anything, so a chain that can't be
+	// restored (e.g. from older firmware) isn't sent
+	ChainStoreHeader_t storeHdr;
+	if((res = f_read(&fh, &storeHdr, sizeof(storeHdr), &nRead)) || nRead != sizeof(storeHdr))
+	{
+		dbg_warning("header read failed %d\r\n", res);
+		f_close(&fh);
+		return;
+	}
+
+	if(!chainstore_header_validate(&storeHdr))
+	{
+		f_close(&fh);
+		return;
+	}
+
 	// We manually send the packet data instead of using sercom_send as we send
 	// the file in chunks of 128 bytes
 
@@ -265,23 +290,10 @@ void packet_chain_blob_send(const char *pszPath)
 	g_bUARTLock = true;
 
 	// Send packet header
-	UART_Send((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)&packetHdr, sizeof(packetHdr), BLOCKING);
-
-	// Read store header
-	ChainStoreHeader_t storeHdr;
-	if((res = f_read(&fh, &storeHdr, sizeof(storeHdr), &nRead)) || nRead != sizeof(storeHdr))
-	{
-		dbg_warning("header read failed %d\r\n", res);
-
-		g_bUARTLock = false;
-		return;
-	}
-
-	if(!chainstore_header_validate(&storeHdr))
-		goto error;
+	hal_uart_send(&packetHdr, sizeof(packetHdr));
 
 	// Write header
-	UART_Send((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)&storeHdr, sizeof(storeHdr), BLOCKING);
+	hal_uart_send(&storeHdr, sizeof(storeHdr));
 
 	// Write remaining file data
 	uint8_t pData[128];
@@ -295,7 +307,7 @@ void packet_chain_blob_send(const char *pszPath)
 		}
 
 		// Write file data to UART
-		UART_Send((LPC_UART_TypeDef *)LPC_UART0, pData, nRead, BLOCKING);
+		hal_uart_send(pData, nRead);
 	}
 	while(nRead > 0);
 
@@ -307,6 +319,130 @@ error:
 #endif
 
 
+/*
+ * packet_profile_send
+ *
+ * Send the current profiling window for the sampling path and each stage and
+ * branch of the compiled chain to the UI.
+ */
+void packet_profile_send(void)
+{
+	const ChainPlan_t *pPlan = g_AudioContext.pChainPlan;
+
+	uint8_t nStages = pPlan ? pPlan->nPlanStages : 0;
+	uint8_t nBranches = pPlan ? pPlan->nOps : 0;
+
+	uint16_t size = sizeof(ProfilePacket_t) + nStages * sizeof(ProfileStagePacket_t) + nBranches * sizeof(ProfileBranchPacket_t);
+	uint8_t *pBuf = malloc(size);
+
+	if(!pBuf)
+	{
+		dbg_warning("unable to allocate %u bytes for profile packet\r\n", size);
+		return;
+	}
+
+	ProfilePacket_t *pHdr = (ProfilePacket_t *)pBuf;
+	pHdr->nPeriodCycles = g_ulPeriodCycles > UINT16_MAX ? UINT16_MAX : g_ulPeriodCycles;
+	pHdr->nStages = nStages;
+	pHdr->nBranches = nBranches;
+	profile_summarise(&g_ProfileTick, &pHdr->tick);
+	profile_summarise(&g_ProfileChain, &pHdr->chain);
+
+	ProfileStagePacket_t *pStage = (ProfileStagePacket_t *)(pHdr + 1);
+	ProfileBranchPacket_t *pBranch = (ProfileBranchPacket_t *)(pStage + nStages);
+	uint8_t iStage = 0;
+
+	for(uint8_t i = 0; i < nBranches; ++i)
+	{
+		const PlanOp_t *pOp = &pPlan->pOps[i];
+
+		// First op of each stage
+		if(pOp->type == PLANOP_APPLY || pOp->type == PLANOP_MIX_BEGIN)
+		{
+			pStage->nStage = pOp->nStage;
+			profile_summarise(&pPlan->pStageStats[iStage++], &pStage->cycles);
+			pStage++;
+		}
+
+		pBranch->nStage = pOp->nStage;
+		pBranch->nBranch = pOp->nBranch;
+		pBranch->iFilterType = pOp->pFilter - g_pFilters;
+		profile_summarise(&pOp->stat, &pBranch->cycles);
+		pBranch++;
+	}
+
+	sercom_send(B2U_PROFILE, pBuf, size);
+	free(pBuf);
+}
+
+
+/*
+ * packet_admission_send
+ *
+ * Send the result of checking a chain edit against the cycle budget to the UI.
+ */
+void packet_admission_send(uint8_t type, uint8_t nStage, uint8_t nBranch, uint8_t result, uint32_t ulPredictedCycles, uint32_t ulBudgetCycles)
+{
+	AdmissionPacket_t admission;
+	admission.type = type;
+	admission.nStage = nStage;
+	admission.nBranch = nBranch;
+	admission.result = result;
+	admission.nPredictedCycles = ulPredictedCycles > UINT16_MAX ? UINT16_MAX : ulPredictedCycles;
+	admission.nBudgetCycles = ulBudgetCycles > UINT16_MAX ? UINT16_MAX : ulBudgetCycles;
+
+	sercom_send(B2U_ADMISSION, (uint8_t *)&admission, sizeof(admission));
+}
+
+
+/*
+ * packet_error_detail_send
+ *
+ * Tells the UI a packet couldn't be carried out as sent, with `nDetail` bytes
+ * of detail.
+ */
+static void packet_error_detail_send(uint8_t type, uint8_t iError, uint8_t nStage, uint8_t nBranch, const void *pDetail, uint16_t nDetail)
+{
+	uint8_t pBuf[sizeof(ErrorPacket_t) + ERROR_DETAIL_MAX];
+
+	ErrorPacket_t *pError = (ErrorPacket_t *)pBuf;
+	pError->type = type;
+	pError->iError = iError;
+	pError->nStage = nStage;
+	pError->nBranch = nBranch;
+
+	if(nDetail > ERROR_DETAIL_MAX)
+		nDetail = ERROR_DETAIL_MAX;
+
+	memcpy(pError + 1, pDetail, nDetail);
+
+	sercom_send(B2U_ERROR, pBuf, sizeof(ErrorPacket_t) + nDetail);
+}
+
+
+/*
+ * packet_error_send
+ *
+ * Tells the UI a packet couldn't be carried out, so it can undo its side of
+ * the change.
+ */
+void packet_error_send(uint8_t type, uint8_t iError, uint8_t nStage, uint8_t nBranch, const char *pszDetail)
+{
+	packet_error_detail_send(type, iError, nStage, nBranch, pszDetail, strlen(pszDetail));
+}
+
+
+/*
+ * packet_out_of_memory_send
+ *
+ * Sends PACKETERROR_OUT_OF_MEMORY for the pool that last ran out of blocks.
+ */
+void packet_out_of_memory_send(uint8_t type, uint8_t nStage, uint8_t nBranch)
+{
+	packet_error_send(type, PACKETERROR_OUT_OF_MEMORY, nStage, nBranch, g_pLastFullPool ? g_pLastFullPool->pszName : "");
+}
+
+
 /*
  * packet_loop
  *
@@ -345,22 +481,25 @@ void packet_loop(void)
 	if(s_bDebugPacketReceipt)
 		dbg_printf("Received packet %u(%s) with size %u bytes\r\n", pHdr->type, g_ppszPacketTypes[pHdr->type], pHdr->size);
 
-	// Lock the chain if the callback requires it
-	if(pHandler->bLocksChain)
+	// Refuse chain edits that couldn't be published, before anything changes.
+	// Every chain edit packet starts with the stage, then the branch (except
+	// U2B_FILTER_CREATE, which adds one).
+	if(pHandler->bEditsChain && !chainplan_reserve(&g_AudioContext))
 	{
-		dbg_assert(!g_bChainLock, "chain already locked");
-		g_bChainLock = true;
+		packet_out_of_memory_send(pHdr->type, pPayload[0], pHdr->type == U2B_FILTER_CREATE ? 0 : pPayload[1]);
+		goto error;
 	}
 
 	pHandler->pfnCallback(pHdr, pPayload);
 
-	// Unlock the chain
-	if(pHandler->bLocksChain)
+	// Publish the edited chain. The sampling interrupt keeps running the
+	// previous plan until this point, so there is no need to lock it out.
+	if(pHandler->bEditsChain)
 	{
-		g_bChainLock = false;
+		chainplan_compile(&g_AudioContext);
 
 		if(s_bDebugChainAfterLock)
-			chain_debug();
+			chain_debug(&g_AudioContext);
 	}
 
 error:
@@ -376,9 +515,9 @@ error:
 void packet_reset_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 {
 	dbg_printf("Received %s packet, system rebooting in 1 second...\r\n", g_ppszPacketTypes[pHdr->type]);
-	time_sleep(1000);
+	hal_sleep(1000);
 
-	NVIC_SystemReset();
+	hal_reset();
 }
 
 
@@ -392,14 +531,41 @@ void packet_filter_create_receive(const PacketHeader_t *pHdr, const uint8_t *pPa
 {
 	const FilterCreatePacket_t *pFilterCreate = (FilterCreatePacket_t *)pPayload;
 
-	ChainStageHeader_t *pStageHdr = chain_get_stage(pFilterCreate->nStage);
+	ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, pFilterCreate->nStage);
 	if(!pStageHdr)
 		return;
 
 	// Create the branch
-	dbg_printf("Creating %u(%s) filter...", pFilterCreate->iFilterType, g_pFilters[pFilterCreate->iFilterType].pszName);
-	StageBranch_t *pBranch = branch_alloc(pFilterCreate->iFilterType, pFilterCreate->flags, pFilterCreate->flMixPerc, NULL);
-	dbg_printf(" ok!\r\n");
+	dbg_printf("Creating %u(%s) filter...\r\n", pFilterCreate->iFilterType, g_pFilters[pFilterCreate->iFilterType].pszName);
+	const uint32_t ulPreviousCost = admission_chain_cost(&g_AudioContext);
+	StageBranch_t *pBranch = branch_alloc(pFilterCreate->iFilterType, pFilterCreate->flags & ~BRANCHFLAG_SHED, pFilterCreate->flMixPerc, NULL);
+
+	// The first branch in a stage needs a new empty stage after it
+	ChainStageHeader_t *pNextStageHdr = NULL;
+	if(pBranch && !pStageHdr->pFirst)
+		pNextStageHdr = stage_alloc();
+
+	bool bCreated = pBranch && (pStageHdr->pFirst || pNextStageHdr);
+
+	// Call creation callback
+	if(bCreated && pBranch->pFilter->pfnCreateCallback)
+		bCreated = pBranch->pFilter->pfnCreateCallback((void *)pBranch->pUnknown);
+	else if(bCreated)
+		dbg_warning("filter has no creation callback, UI/board data may be out of sync!\r\n");
+
+	// Out of memory. Nothing has been linked in yet, so just free what we got
+	// and let the UI remove the filter.
+	if(!bCreated)
+	{
+		if(pBranch)
+			branch_free(pBranch);
+
+		if(pNextStageHdr)
+			stage_free(pNextStageHdr);
+
+		packet_out_of_memory_send(U2B_FILTER_CREATE, pFilterCreate->nStage, pStageHdr->nBranches);
+		return;
+	}
 
 	// Add branch to stage
 	pStageHdr->nBranches++;
@@ -417,15 +583,13 @@ void packet_filter_create_receive(const PacketHeader_t *pHdr, const uint8_t *pPa
 		// Add branch as only stage
 		pStageHdr->pFirst = pBranch;
 
-		// Create a new empty stage
-		pStageHdr->pNext = stage_alloc();
+		// Add the new empty stage
+		pStageHdr->pNext = pNextStageHdr;
 	}
 
-	// Call creation callback
-	if(pBranch->pFilter->pfnCreateCallback)
-		pBranch->pFilter->pfnCreateCallback((void *)pBranch->pUnknown);
-	else
-		dbg_warning("filter has no creation callback, UI/board data may be out of sync!\r\n");
+	// Keep the branch so the UI and board stay in sync, but don't run it
+	if(admission_check(&g_AudioContext, U2B_FILTER_CREATE, pFilterCreate->nStage, pStageHdr->nBranches - 1, ulPreviousCost) == ADMISSION_REFUSED)
+		pBranch->flags &= ~BRANCHFLAG_ENABLED;
 }
 
 
@@ -439,7 +603,7 @@ void packet_filter_delete_receive(const PacketHeader_t *pHdr, const uint8_t *pPa
 {
 	const FilterDeletePacket_t *pFilterDelete = (FilterDeletePacket_t *)pPayload;
 
-	ChainStageHeader_t *pStageHdr = chain_get_stage(pFilterDelete->nStage);
+	ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, pFilterDelete->nStage);
 	if(!pStageHdr)
 		return;
 
@@ -458,8 +622,8 @@ void packet_filter_delete_receive(const PacketHeader_t *pHdr, const uint8_t *pPa
 		pPrevBranch->pNext = pBranch->pNext;
 	}
 
-	// Free branch
-	branch_free(pBranch);
+	// Free branch once the sampling interrupt has stopped using it
+	branch_retire(&g_AudioContext, pBranch);
 
 	pStageHdr->nBranches--;
 
@@ -471,16 +635,16 @@ void packet_filter_delete_receive(const PacketHeader_t *pHdr, const uint8_t *pPa
 	// Unlink stage from chain
 	if(pFilterDelete->nStage == 0)
 	{
-		g_pChainRoot = pStageHdr->pNext;
+		g_AudioContext.pChainRoot = pStageHdr->pNext;
 	}
 	else
 	{
-		ChainStageHeader_t *pPrevStageHdr = chain_get_stage(pFilterDelete->nStage - 1);
+		ChainStageHeader_t *pPrevStageHdr = chain_get_stage(&g_AudioContext, pFilterDelete->nStage - 1);
 		pPrevStageHdr->pNext = pStageHdr->pNext;
 	}
 
 	// Free stage
-	stage_free(pStageHdr);
+	stage_retire(&g_AudioContext, pStageHdr);
 }
 
 
@@ -493,7 +657,7 @@ void packet_filter_flag_receive(const PacketHeader_t *pHdr, const uint8_t *pPayl
 {
 	const FilterFlagPacket_t *pFilterFlag = (FilterFlagPacket_t *)pPayload;
 
-	ChainStageHeader_t *pStageHdr = chain_get_stage(pFilterFlag->nStage);
+	ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, pFilterFlag->nStage);
 	if(!pStageHdr)
 		return;
 
@@ -501,11 +665,28 @@ void packet_filter_flag_receive(const PacketHeader_t *pHdr, const uint8_t *pPayl
 	if(!pBranch)
 		return;
 
+	// BRANCHFLAG_SHED belongs to the overload governor
+	const uint8_t flag = pFilterFlag->iBit < 8 ? (1<<pFilterFlag->iBit) : 0;
+
+	if(flag != BRANCHFLAG_ENABLED && flag != BRANCHFLAG_FULL_MIX)
+	{
+		dbg_warning("flag bit %u can't be changed by the UI\r\n", pFilterFlag->iBit);
+		return;
+	}
+
+	const uint32_t ulPreviousCost = admission_chain_cost(&g_AudioContext);
+	const uint8_t oldFlags = pBranch->flags;
+
 	// Toggle branch flag
 	if(pFilterFlag->bEnable)
-		pBranch->flags |= (1<<pFilterFlag->iBit);
+		pBranch->flags |= flag;
 	else
-		pBranch->flags &= ~(1<<pFilterFlag->iBit);
+		pBranch->flags &= ~flag;
+
+	// Branches are created disabled, so this is where most filters start
+	// costing cycles
+	if(admission_check(&g_AudioContext, U2B_FILTER_FLAG, pFilterFlag->nStage, pFilterFlag->nBranch, ulPreviousCost) == ADMISSION_REFUSED)
+		pBranch->flags = oldFlags;
 }
 
 
@@ -518,7 +699,7 @@ void packet_filter_mod_receive(const PacketHeader_t *pHdr, const uint8_t *pPaylo
 {
 	const FilterModPacket_t *pFilterMod = (FilterModPacket_t *)pPayload;
 
-	ChainStageHeader_t *pStageHdr = chain_get_stage(pFilterMod->nStage);
+	ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, pFilterMod->nStage);
 	if(!pStageHdr)
 		return;
 
@@ -532,27 +713,72 @@ void packet_filter_mod_receive(const PacketHeader_t *pHdr, const uint8_t *pPaylo
 	// Calculate number of bytes to copy
 	uint16_t nToCopy = pHdr->size - sizeof(FilterModPacket_t);
 
-	// Calculate destination in memory to copy packet payload to
-	uint8_t *pDest = ((uint8_t *)pBranch->pUnknown) + pFilterMod->iOffset + pBranch->pFilter->nNonPublicDataSize;
-
-	// Buffer overflow protection
-	if(pFilterMod->iOffset + nToCopy > pBranch->pFilter->nFilterDataSize)
+	// Buffer overflow protection. The offset is into the public data, which
+	// follows the filter's private data.
+	if(pFilterMod->iOffset + nToCopy > pBranch->pFilter->nFilterDataSize - pBranch->pFilter->nNonPublicDataSize)
 	{
 		dbg_warning("blocked attempted arbitrary memory modification\r\n");
 		return;
 	}
 
+	const uint32_t ulPreviousCost = admission_chain_cost(&g_AudioContext);
+
+	// The sampling interrupt is still using this branch, so modify a copy
+	StageBranch_t *pClone = branch_clone(pBranch);
+
+	if(!pClone)
+	{
+		packet_out_of_memory_send(U2B_FILTER_MOD, pFilterMod->nStage, pFilterMod->nBranch);
+		return;
+	}
+
+	// Calculate destination in memory to copy packet payload to
+	uint8_t *pDest = ((uint8_t *)pClone->pUnknown) + pFilterMod->iOffset + pClone->pFilter->nNonPublicDataSize;
+
 	// Copy new parameter value into memory
 	memcpy(pDest, pSource, nToCopy);
 
+	// Keep what the UI asked for, so we can tell if the mod callback had to
+	// clamp any of it (e.g. a delay too long for the encoding)
+	const uint8_t nPublicDataSize = pClone->pFilter->nFilterDataSize - pClone->pFilter->nNonPublicDataSize;
+	uint8_t *pPublic = ((uint8_t *)pClone->pUnknown) + pClone->pFilter->nNonPublicDataSize;
+	uint8_t pRequested[UINT8_MAX];
+	memcpy(pRequested, pPublic, nPublicDataSize);
+
 	// Call modification callback
-	if(pBranch->pFilter->pfnModCallback)
-		pBranch->pFilter->pfnModCallback((void *)pBranch->pUnknown);
+	if(pClone->pFilter->pfnModCallback && !pClone->pFilter->pfnModCallback((void *)pClone->pUnknown))
+	{
+		branch_free(pClone);
+		packet_out_of_memory_send(U2B_FILTER_MOD, pFilterMod->nStage, pFilterMod->nBranch);
+		return;
+	}
+
+	// Swap the copy into the chain in place of the original
+	StageBranch_t **ppLink = &pStageHdr->pFirst;
+	if(pFilterMod->nBranch > 0)
+		ppLink = &stage_get_branch(pStageHdr, pFilterMod->nBranch - 1)->pNext;
+
+	*ppLink = pClone;
+
+	// The copy hasn't been published yet, so a refused edit can just put the
+	// original back
+	if(admission_check(&g_AudioContext, U2B_FILTER_MOD, pFilterMod->nStage, pFilterMod->nBranch, ulPreviousCost) == ADMISSION_REFUSED)
+	{
+		*ppLink = pBranch;
+		branch_free(pClone);
+		return;
+	}
+
+	branch_retire(&g_AudioContext, pBranch);
+
+	// Send back the values actually in use so the UI can move its widgets to
+	// them
+	if(!filter_params_equal(pClone->pFilter, pRequested, pPublic))
+		packet_error_detail_send(U2B_FILTER_MOD, PACKETERROR_PARAM_CLAMPED, pFilterMod->nStage, pFilterMod->nBranch, pPublic, nPublicDataSize);
 
-	// Reset last slow tick. This makes sure we reissue the "slow tick" warning
-	// if the chain is still too complex.
-	extern uint32_t g_ulLastLongTick;
-	g_ulLastLongTick = 0;
+	// Makes sure we reissue the "chain too complex" warning if the chain is
+	// still too complex
+	governor_chain_edited();
 }
 
 
@@ -567,7 +793,7 @@ void packet_filter_mix_receive(const PacketHeader_t *pHdr, const uint8_t *pPaylo
 {
 	const FilterMixPacket_t *pFilterMix = (FilterMixPacket_t *)pPayload;
 
-	ChainStageHeader_t *pStageHdr = chain_get_stage(pFilterMix->nStage);
+	ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, pFilterMix->nStage);
 	if(!pStageHdr)
 		return;
 
@@ -581,7 +807,14 @@ void packet_filter_mix_receive(const PacketHeader_t *pHdr, const uint8_t *pPaylo
 		return;
 	}
 
+	const uint32_t ulPreviousCost = admission_chain_cost(&g_AudioContext);
+	const float flOldMixPerc = pBranch->flMixPerc;
+
 	pBranch->flMixPerc = pFilterMix->flMixPerc;
+
+	// Moving off unity gain adds a multiply to the branch (PLAN_COST_MIX)
+	if(admission_check(&g_AudioContext, U2B_FILTER_MIX, pFilterMix->nStage, pFilterMix->nBranch, ulPreviousCost) == ADMISSION_REFUSED)
+		pBranch->flMixPerc = flOldMixPerc;
 }
 #pragma GCC diagnostic push
 
@@ -657,7 +890,114 @@ void packet_cmd_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 	// Debug entire chain
 	if(!strcmp(ppszArgs[0], "chain_debug"))
 	{
-		chain_debug();
+		chain_debug(&g_AudioContext);
+	}
+
+	// Debug the compiled chain
+	else if(!strcmp(ppszArgs[0], "chain_plan"))
+	{
+		chainplan_debug(g_AudioContext.pChainPlan);
+	}
+
+	// Cycle counts for the sampling path and each stage/branch
+	else if(!strcmp(ppszArgs[0], "profile"))
+	{
+		if(pCmd->nArgs == 1)
+			profile_debug();
+		else if(pCmd->nArgs == 2 && !strcmp(ppszArgs[1], "reset"))
+			profile_reset();
+		else if(pCmd->nArgs == 3 && !strcmp(ppszArgs[1], "telemetry"))
+			profile_set_telemetry(atoi(ppszArgs[2]));
+		else
+			dbg_warning("syntax: [reset|telemetry <msec, 0 = off>]\r\n");
+	}
+
+	// Chain edit admission control
+	else if(!strcmp(ppszArgs[0], "admission"))
+	{
+		uint8_t iMode = 0;
+		for(; iMode < ADMISSION_MODE_COUNT; ++iMode)
+		{
+			if(pCmd->nArgs >= 2 && !strcmp(ppszArgs[1], g_ppszAdmissionModes[iMode]))
+				break;
+		}
+
+		if(pCmd->nArgs == 1)
+			admission_debug(&g_AudioContext);
+		else if(pCmd->nArgs == 2 && iMode < ADMISSION_MODE_COUNT)
+			g_iAdmissionMode = iMode;
+		else if(pCmd->nArgs == 3 && !strcmp(ppszArgs[1], "budget") && atoi(ppszArgs[2]) > 0 && atoi(ppszArgs[2]) <= 100)
+			g_nAdmissionBudgetPerc = atoi(ppszArgs[2]);
+		else
+			dbg_warning("syntax: [off|warn|refuse|budget <perc, 1-100>]\r\n");
+	}
+
+	// Overload governor
+	else if(!strcmp(ppszArgs[0], "governor"))
+	{
+		if(pCmd->nArgs == 1)
+			governor_debug();
+		else if(pCmd->nArgs == 2 && !strcmp(ppszArgs[1], "on"))
+			governor_set_enabled(true);
+		else if(pCmd->nArgs == 2 && !strcmp(ppszArgs[1], "off"))
+			governor_set_enabled(false);
+		else if(pCmd->nArgs == 2 && !strcmp(ppszArgs[1], "restore"))
+			governor_restore_all();
+		else
+			dbg_warning("syntax: [on|off|restore]\r\n");
+	}
+
+	// Memory pool usage
+	else if(!strcmp(ppszArgs[0], "pool_debug"))
+	{
+		pool_debug();
+	}
+
+	// Running LFOs
+	else if(!strcmp(ppszArgs[0], "lfo_debug"))
+	{
+		lfo_debug();
+	}
+
+	// Running envelope detectors
+	else if(!strcmp(ppszArgs[0], "envelope_debug"))
+	{
+		envelope_debug(&g_AudioContext);
+	}
+
+	// Delay lines and the budget they share
+	else if(!strcmp(ppszArgs[0], "delayline_debug"))
+	{
+		delayline_debug();
+	}
+
+	// Delay line encoding benchmark and SNR
+	else if(!strcmp(ppszArgs[0], "delayline_bench"))
+	{
+		delayline_benchmark();
+	}
+
+	// FIR kernel benchmark
+	else if(!strcmp(ppszArgs[0], "fir_bench"))
+	{
+		fir_benchmark(&g_AudioContext);
+	}
+
+	// FIR coefficient design cache
+	else if(!strcmp(ppszArgs[0], "fir_cache"))
+	{
+		if(pCmd->nArgs == 1)
+			fir_cache_debug();
+		else if(pCmd->nArgs == 2 && !strcmp(ppszArgs[1], "reset"))
+			fir_cache_reset();
+		else
+			dbg_warning("syntax: [reset]\r\n");
+	}
+
+	// Sample history layout benchmark
+	else if(!strcmp(ppszArgs[0], "sample_bench"))
+	{
+		sample_benchmark(&g_AudioContext.history);
 	}
 
 	// Debug all filters
@@ -675,7 +1015,7 @@ void packet_cmd_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 			goto cleanup;
 		}
 
-		ChainStageHeader_t *pStageHdr = chain_get_stage(atoi(ppszArgs[1]));
+		ChainStageHeader_t *pStageHdr = chain_get_stage(&g_AudioContext, atoi(ppszArgs[1]));
 
 		if(pStageHdr)
 			stage_debug(pStageHdr);
@@ -705,7 +1045,10 @@ void packet_cmd_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 		if(pCmd->nArgs != 2)
 			dbg_printf("volume = %.2f\r\n", g_flChainVolume);
 		else
+		{
 			g_flChainVolume = atof(ppszArgs[1]);
+			g_qChainVolume = qgain_from_float(g_flChainVolume);
+		}
 	}
 
 	// Calculate average over a number of samples
@@ -717,7 +1060,14 @@ void packet_cmd_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 			goto cleanup;
 		}
 
-		uint16_t iAverage = sample_get_average(atoi(ppszArgs[1]));
+		int nSamples = atoi(ppszArgs[1]);
+		if(nSamples < 1 || nSamples > SAMPLE_AVERAGE_MAX)
+		{
+			dbg_warning("samples must be 1-%u\r\n", SAMPLE_AVERAGE_MAX);
+			goto cleanup;
+		}
+
+		uint16_t iAverage = sample_get_average(&g_AudioContext.history, nSamples);
 		float flVolume = (iAverage * 100.0) / ADC_MAX_VALUE;
 		dbg_printf("average = %.2f%%\r\n", flVolume);
 	}
@@ -743,7 +1093,7 @@ void packet_cmd_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 		snprintf(pszPath, sizeof(pszPath), STORE_DIRECTORY "/%s.bin", ppszArgs[1]);
 
 		// Save chain
-		chainstore_save(pszPath);
+		chainstore_save(&g_AudioContext, pszPath);
 
 		// Send stored chain list to UI
 		packet_stored_list_send();
@@ -762,8 +1112,21 @@ void packet_cmd_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload)
 		char pszPath[32];
 		snprintf(pszPath, sizeof(pszPath), STORE_DIRECTORY "/%s.bin", ppszArgs[1]);
 
-		// Restore chain
-		chainstore_restore(pszPath);
+		// Restore chain, and publish it. Commands don't recompile the chain
+		// unless they edit it, so the plan's profile stats survive the others.
+		const ChainStageHeader_t *pOldRoot = g_AudioContext.pChainRoot;
+
+		if(!chainstore_restore(&g_AudioContext, pszPath))
+		{
+			// Tell the UI which chain the board is left running. If the
+			// current chain had been freed to make room, it's an empty one
+			// (already published).
+			const uint8_t iError = g_AudioContext.pChainRoot == pOldRoot ? PACKETERROR_RESTORE_FAILED : PACKETERROR_RESTORE_CLEARED;
+			packet_error_send(U2B_ARB_CMD, iError, 0, 0, ppszArgs[1]);
+			goto cleanup;
+		}
+
+		chainplan_compile(&g_AudioContext);
 
 		// Send chain blob to UI
 		packet_chain_blob_send(pszPath);
@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "profile.h"
 
 // Packet type enumeration
 // ----------------------------------------------------------------------------
@@ -44,6 +45,9 @@ typedef enum
 	B2U_STORED_LIST,	///< Board sends list of possible chains to load
 	B2U_CHAIN_BLOB,		///< Board sends a binary chain blob to the UI to sync up restored chain
 #endif
+	B2U_PROFILE,		///< Board sends cycle counts for the sampling path and each branch
+	B2U_ADMISSION,		///< Board sends the result of checking a chain edit against the cycle budget
+	B2U_ERROR,			///< Board couldn't carry out a packet from the UI
 
 	// Must be last
 	PACKET_TYPE_MAX,
@@ -81,7 +85,7 @@ typedef void (*PacketCallback_t)(const PacketHeader_t *pHdr, const uint8_t *pPay
 typedef struct
 {
 	PacketCallback_t pfnCallback;	///< Function to call when packet is received
-	bool bLocksChain;				///< Should the filter chain be locked while the packet is processed?
+	bool bEditsChain;				///< Does the callback edit the filter chain? If so, the chain is recompiled afterwards
 	uint16_t nPacketSize;			///< Expected size of packet payload (use PACKET_SIZE_EXACT and PACKET_SIZE_MIN above)
 } PacketHandler_t;
 
@@ -124,6 +128,76 @@ void packet_stored_list_send(void);
 void packet_chain_blob_send(const char *pszPath);
 #endif
 
+// B2U_PROFILE
+// ==============================================
+#pragma pack(push, 1)
+typedef struct
+{
+	uint16_t nPeriodCycles;	///< cycles in one sample period
+	ProfileSummary_t tick;	///< sample input/output, cycles per sample
+	ProfileSummary_t chain;	///< filter chain, cycles per sample
+	uint8_t nStages;		///< number of ProfileStagePacket_t following this header
+	uint8_t nBranches;		///< number of ProfileBranchPacket_t following the stages
+} ProfilePacket_t;
+
+typedef struct
+{
+	uint8_t nStage;				///< stage index
+	ProfileSummary_t cycles;	///< cycles per sample
+} ProfileStagePacket_t;
+
+typedef struct
+{
+	uint8_t nStage;				///< stage index
+	uint8_t nBranch;			///< branch index in stage
+	uint8_t iFilterType;		///< type of filter (index into g_pFilters)
+	ProfileSummary_t cycles;	///< cycles per sample
+} ProfileBranchPacket_t;
+#pragma pack(pop)
+
+void packet_profile_send(void);
+
+// B2U_ADMISSION
+// ==============================================
+#pragma pack(push, 1)
+typedef struct
+{
+	uint8_t type;				///< packet type of the edit (U2B_FILTER_CREATE, U2B_FILTER_FLAG, U2B_FILTER_MOD or U2B_FILTER_MIX)
+	uint8_t nStage;				///< stage index
+	uint8_t nBranch;			///< branch index in stage
+	uint8_t result;				///< result of the check (AdmissionResult_e)
+	uint16_t nPredictedCycles;	///< predicted cycles per sample with the edit applied
+	uint16_t nBudgetCycles;		///< cycles per sample the chain is allowed
+} AdmissionPacket_t;
+#pragma pack(pop)
+
+void packet_admission_send(uint8_t type, uint8_t nStage, uint8_t nBranch, uint8_t result, uint32_t ulPredictedCycles, uint32_t ulBudgetCycles);
+
+// B2U_ERROR
+// ==============================================
+#define ERROR_DETAIL_MAX	32	///< longest detail string sent with an error
+
+typedef enum
+{
+	PACKETERROR_OUT_OF_MEMORY = 0,	///< a memory pool is full, detail is the name of the pool
+	PACKETERROR_PARAM_CLAMPED = 1,	///< U2B_FILTER_MOD was applied but the filter kept different parameter values, detail is the public filter data it kept
+	PACKETERROR_RESTORE_FAILED = 2,	///< chain_restore couldn't decode the stored chain, detail is its name, the current chain is kept
+	PACKETERROR_RESTORE_CLEARED = 3,	///< chain_restore freed the current chain to make room but couldn't decode the stored one, so the chain is left empty, detail is its name
+} PacketError_e;
+
+#pragma pack(push, 1)
+typedef struct
+{
+	uint8_t type;		///< packet type that failed
+	uint8_t iError;		///< what went wrong (PacketError_e)
+	uint8_t nStage;		///< stage index
+	uint8_t nBranch;	///< branch index in stage
+} ErrorPacket_t;		///< followed by up to ERROR_DETAIL_MAX bytes of detail (not NULL terminated)
+#pragma pack(pop)
+
+void packet_error_send(uint8_t type, uint8_t iError, uint8_t nStage, uint8_t nBranch, const char *pszDetail);
+void packet_out_of_memory_send(uint8_t type, uint8_t nStage, uint8_t nBranch);
+
 // U2B_RESET
 // ==============================================
 void packet_reset_receive(const PacketHeader_t *pHdr, const uint8_t *pPayload);
@@ -161,7 +235,7 @@ typedef struct
 {
 	uint8_t nStage;		///< stage to update branch
 	uint8_t nBranch;	///< index to branch in stage
-	uint8_t iBit;		///< flag bit to change
+	uint8_t iBit;		///< flag bit to change (BRANCHFLAG_ENABLED or BRANCHFLAG_FULL_MIX)
 	bool bEnable;		///< true = set bit, false = clear bit
 } FilterFlagPacket_t;
 #pragma pack(pop)
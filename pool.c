@@ -0,0 +1,202 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * pool.c - Fixed-size block pools
+ *
+ * Chain stages, branches, filter data, FIR kernels and designs, LFOs, envelope
+ * detectors, dynamics gain curves, biquad cascades, delay line descriptors,
+ * waveshaper tables, reverb delay lines, compiled chain plans and retired block
+ * records are allocated from statically sized pools rather than the heap, so
+ * chain editing can't fragment memory and allocation takes constant time.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "dbg.h"
+#include "chain.h"
+#include "chainplan.h"
+#include "filters.h"
+#include "filters/fir.h"
+#include "filters/biquad.h"
+#include "filters/distortion.h"
+#include "filters/reverb.h"
+#include "lfo.h"
+#include "envelope.h"
+#include "filters/dynamic.h"
+#include "delayline.h"
+#include "pool.h"
+
+
+POOL_DEFINE(g_StagePool, "stage", sizeof(ChainStageHeader_t), POOL_STAGES);
+POOL_DEFINE(g_BranchPool, "branch", sizeof(StageBranch_t), POOL_BRANCHES);
+POOL_DEFINE(g_FilterDataPool, "filter data", POOL_FILTER_DATA_SIZE, POOL_BRANCHES);
+POOL_DEFINE(g_FIRKernelPool, "FIR kernel", sizeof(FIRKernel_t), POOL_FIR_KERNELS);
+POOL_DEFINE(g_FIRDesignPool, "FIR design", sizeof(FIRDesign_t), POOL_FIR_DESIGNS);
+POOL_DEFINE(g_LFOPool, "LFO", sizeof(LFO_t), POOL_LFOS);
+POOL_DEFINE(g_EnvelopePool, "envelope", sizeof(Envelope_t), POOL_ENVELOPES);
+POOL_DEFINE(g_DynamicsPool, "dynamics", sizeof(DynamicsState_t), POOL_DYNAMICS);
+POOL_DEFINE(g_BiquadPool, "biquad", sizeof(BiquadCascade_t), POOL_BIQUADS);
+POOL_DEFINE(g_DelayLinePool, "delay line", sizeof(DelayLine_t), POOL_DELAY_LINES);
+POOL_DEFINE(g_PlanPool, "chain plan", CHAINPLAN_MAX_SIZE, POOL_PLANS);
+POOL_DEFINE(g_RetiredPool, "retired block", sizeof(RetiredBlock_t), POOL_RETIRED);
+
+// AHB SRAM is shared out between the pools that don't fit in local SRAM
+#define SHAPER_POOL_BYTES	(POOL_BLOCK_SIZE(sizeof(ShaperTable_t)) * POOL_SHAPER_TABLES)
+#define REVERB_POOL_BYTES	(POOL_BLOCK_SIZE(sizeof(ReverbLines_t)) * POOL_REVERBS)
+
+POOL_DEFINE_AT(g_ShaperPool, "shaper table", sizeof(ShaperTable_t), POOL_SHAPER_TABLES, AHB_SRAM_BASE);
+POOL_DEFINE_AT(g_ReverbPool, "reverb", sizeof(ReverbLines_t), POOL_REVERBS, AHB_SRAM_BASE + SHAPER_POOL_BYTES);
+
+// Fails to compile if the pools don't fit in AHB SRAM
+typedef char AHBPoolsFit_t[SHAPER_POOL_BYTES + REVERB_POOL_BYTES <= AHB_SRAM_SIZE ? 1 : -1];
+
+// Pool the last allocation failed in, for error reporting
+const Pool_t *g_pLastFullPool = NULL;
+
+static Pool_t *s_ppPools[] =
+{
+	&g_StagePool,
+	&g_BranchPool,
+	&g_FilterDataPool,
+	&g_FIRKernelPool,
+	&g_FIRDesignPool,
+	&g_LFOPool,
+	&g_EnvelopePool,
+	&g_DynamicsPool,
+	&g_BiquadPool,
+	&g_DelayLinePool,
+	&g_PlanPool,
+	&g_RetiredPool,
+	&g_ShaperPool,
+	&g_ReverbPool,
+};
+
+
+/*
+ * pool_alloc
+ *
+ * Allocates a zeroed block from `pPool`.
+ *
+ * @returns pointer to the block, or NULL if the pool is full
+ */
+void *pool_alloc(Pool_t *pPool)
+{
+	uint8_t *pBlock;
+
+	if(pPool->pFree)
+	{
+		pBlock = (uint8_t *)pPool->pFree;
+		pPool->pFree = pPool->pFree->pNext;
+	}
+	else if(pPool->nCarved < pPool->nBlocks)
+	{
+		pBlock = pPool->pStorage + pPool->nCarved++ * pPool->nBlockSize;
+	}
+	else
+	{
+		pool_report_full(pPool);
+		dbg_warning("%s pool full (%u blocks)\r\n", pPool->pszName, pPool->nBlocks);
+		return NULL;
+	}
+
+	if(++pPool->nUsed > pPool->nHighWater)
+		pPool->nHighWater = pPool->nUsed;
+
+	memset(pBlock, 0, pPool->nBlockSize);
+	return pBlock;
+}
+
+
+/*
+ * pool_report_full
+ *
+ * Counts a refused allocation against `pPool`, and makes it the pool reported
+ * to the UI by packet_out_of_memory_send. Also used by allocators built on a
+ * pool that can run out of something other than blocks (see delayline.c).
+ */
+void pool_report_full(Pool_t *pPool)
+{
+	pPool->nFailures++;
+	g_pLastFullPool = pPool;
+}
+
+
+/*
+ * pool_free
+ *
+ * Returns a block to `pPool`. Freeing NULL does nothing.
+ */
+void pool_free(Pool_t *pPool, void *pBlock)
+{
+	if(!pBlock)
+		return;
+
+	uint32_t iOffset = (uint8_t *)pBlock - pPool->pStorage;
+	dbg_assert(iOffset < pPool->nCarved * pPool->nBlockSize && iOffset % pPool->nBlockSize == 0, "%p is not a block in the %s pool", pBlock, pPool->pszName);
+	dbg_assert(pPool->nUsed > 0, "%s pool double free", pPool->pszName);
+
+	PoolBlock_t *pFree = (PoolBlock_t *)pBlock;
+	pFree->pNext = pPool->pFree;
+	pPool->pFree = pFree;
+	pPool->nUsed--;
+}
+
+
+/*
+ * pool_reserve
+ *
+ * Checks `nBlocks` blocks can be allocated from `pPool`, reporting it as full
+ * (see pool_report_full) if not. Nothing is allocated.
+ *
+ * @returns false if fewer blocks are free
+ */
+bool pool_reserve(Pool_t *pPool, uint16_t nBlocks)
+{
+	if(pPool->nBlocks - pPool->nUsed >= nBlocks)
+		return true;
+
+	pool_report_full(pPool);
+	dbg_warning("%s pool full (%u/%u blocks used, %u needed)\r\n", pPool->pszName, pPool->nUsed, pPool->nBlocks, nBlocks);
+	return false;
+}
+
+
+/*
+ * pool_check_filters
+ *
+ * Checks every filter's data fits in a g_FilterDataPool block. Called at boot,
+ * so a filter that outgrows POOL_FILTER_DATA_SIZE is caught straight away.
+ */
+void pool_check_filters(void)
+{
+	for(uint8_t i = 0; i < NUM_FILTERS; ++i)
+	{
+		dbg_assert(g_pFilters[i].nFilterDataSize <= POOL_FILTER_DATA_SIZE, "%s data (%u bytes) exceeds POOL_FILTER_DATA_SIZE",
+			g_pFilters[i].pszName, g_pFilters[i].nFilterDataSize);
+	}
+}
+
+
+/*
+ * pool_debug
+ *
+ * Prints usage and high water marks of each pool.
+ */
+void pool_debug(void)
+{
+	dbg_printf(" === pool_debug ===\r\n");
+
+	for(uint8_t i = 0; i < sizeof(s_ppPools) / sizeof(s_ppPools[0]); ++i)
+	{
+		const Pool_t *pPool = s_ppPools[i];
+		dbg_printf("%s: %u/%u used, high water %u, %u failed, %u bytes each\r\n", pPool->pszName, pPool->nUsed, pPool->nBlocks, pPool->nHighWater, pPool->nFailures, pPool->nBlockSize);
+	}
+
+	dbg_printf("\r\n");
+}
@@ -0,0 +1,101 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * pool.c - Fixed-size block pools
+ *
+ * Chain stages, branches, filter data, the tables/state filters allocate and
+ * compiled chain plans are allocated from statically sized pools rather than
+ * the heap, so chain editing can't fragment memory and allocation takes
+ * constant time. Capacities are set in config.h.
+ *
+ * Running out of blocks isn't fatal: pool_alloc returns NULL and the caller
+ * reports the error to the UI (see B2U_ERROR).
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*
+ * PoolBlock_t
+ *
+ * Header of a free block, overlaps the block data.
+ */
+typedef struct PoolBlock_t
+{
+	struct PoolBlock_t *pNext;	///< next free block
+} PoolBlock_t;
+
+
+/*
+ * Pool_t
+ *
+ * A pool of `nBlocks` blocks of `nBlockSize` bytes.
+ */
+typedef struct
+{
+	const char *pszName;
+	uint8_t *pStorage;		///< nBlocks * nBlockSize bytes
+	uint16_t nBlockSize;	///< size of each block, rounded up to a word
+	uint16_t nBlocks;		///< capacity
+	uint16_t nCarved;		///< blocks handed out from pStorage at least once
+	PoolBlock_t *pFree;		///< freed blocks
+	uint16_t nUsed;			///< blocks currently allocated
+	uint16_t nHighWater;	///< most blocks allocated at once
+	uint16_t nFailures;		///< allocations refused because the pool was full
+} Pool_t;
+
+
+// Rounds a block size up to a whole number of pointers (words on the board)
+#define POOL_BLOCK_SIZE(size) ((((size) < sizeof(PoolBlock_t) ? sizeof(PoolBlock_t) : (size)) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+// Defines pool `name` with static storage for `nBlocks` blocks of `size` bytes
+#define POOL_DEFINE(name, pszName, size, nBlocks) \
+	static void *name##Storage[POOL_BLOCK_SIZE(size) / sizeof(void *) * (nBlocks)]; \
+	Pool_t name = {pszName, (uint8_t *)name##Storage, POOL_BLOCK_SIZE(size), nBlocks, 0, NULL, 0, 0, 0}
+
+// Defines pool `name` of `nBlocks` blocks of `size` bytes stored at `address`,
+// for memory the linker doesn't manage. The host has no such memory, so the
+// pool gets static storage there.
+#ifdef HAL_HOST
+#	define POOL_DEFINE_AT(name, pszName, size, nBlocks, address) \
+		POOL_DEFINE(name, pszName, size, nBlocks)
+#else
+#	define POOL_DEFINE_AT(name, pszName, size, nBlocks, address) \
+		Pool_t name = {pszName, (uint8_t *)(address), POOL_BLOCK_SIZE(size), nBlocks, 0, NULL, 0, 0, 0}
+#endif
+
+
+extern Pool_t g_StagePool;
+extern Pool_t g_BranchPool;
+extern Pool_t g_FilterDataPool;
+extern Pool_t g_FIRKernelPool;
+extern Pool_t g_FIRDesignPool;
+extern Pool_t g_LFOPool;
+extern Pool_t g_EnvelopePool;
+extern Pool_t g_DynamicsPool;
+extern Pool_t g_BiquadPool;
+extern Pool_t g_DelayLinePool;
+extern Pool_t g_ShaperPool;
+extern Pool_t g_ReverbPool;
+extern Pool_t g_PlanPool;
+extern Pool_t g_RetiredPool;
+extern const Pool_t *g_pLastFullPool;
+
+
+void *pool_alloc(Pool_t *pPool);
+void pool_free(Pool_t *pPool, void *pBlock);
+bool pool_reserve(Pool_t *pPool, uint16_t nBlocks);
+void pool_report_full(Pool_t *pPool);
+void pool_check_filters(void);
+void pool_debug(void);
+
+#endif
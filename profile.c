@@ -0,0 +1,180 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * profile.c - Cycle accurate profiling
+ *
+ * Uses the DWT cycle counter to record min/avg/max cycles spent per sample in
+ * the sampling interrupt, the filter chain, and each stage and branch of the
+ * compiled chain.
+ */
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "config.h"
+#include "dbg.h"
+#include "packets.h"
+#include "filters.h"
+#include "chainplan.h"
+#include "audio.h"
+#include "profile.h"
+
+
+// Current statistics window, see profile_reset
+volatile uint32_t g_ulProfileEpoch = 1;
+
+// Running total of cycles spent in audio_tick. Lets code preempted by it
+// exclude the time from its own measurement.
+volatile uint32_t g_ulTickCycles = 0;
+
+// Cycles in one sample period
+uint32_t g_ulPeriodCycles = 0;
+
+// Sample input/output in audio_tick, excluding the filter chain
+ProfileStat_t g_ProfileTick;
+
+// Filter chain (chain_process), excluding audio_tick
+ProfileStat_t g_ProfileChain;
+
+// Telemetry interval (msec, 0 = disabled) and when it was last sent
+static uint32_t s_ulTelemetryInterval = PROFILE_TELEMETRY_MSEC;
+static uint32_t s_ulLastTelemetryTick = 0;
+
+
+/*
+ * profile_init
+ *
+ * Starts the cycle counter.
+ */
+void profile_init(void)
+{
+	hal_cycles_init();
+
+	g_ulPeriodCycles = hal_core_clock() / SAMPLE_RATE;
+}
+
+
+/*
+ * profile_summarise
+ *
+ * Takes a snapshot of the current window of `pStat`. Statistics which haven't
+ * been updated since profile_reset read as zero.
+ */
+void profile_summarise(const ProfileStat_t *pStat, ProfileSummary_t *pSummary)
+{
+	pSummary->nMin = 0;
+	pSummary->nAvg = 0;
+	pSummary->nMax = 0;
+
+	if(pStat->ulEpoch != g_ulProfileEpoch || !pStat->nCount)
+		return;
+
+	uint32_t ulAvg = pStat->ullTotal / pStat->nCount;
+
+	pSummary->nMin = pStat->ulMin > UINT16_MAX ? UINT16_MAX : pStat->ulMin;
+	pSummary->nAvg = ulAvg > UINT16_MAX ? UINT16_MAX : ulAvg;
+	pSummary->nMax = pStat->ulMax > UINT16_MAX ? UINT16_MAX : pStat->ulMax;
+}
+
+
+/*
+ * profile_reset
+ *
+ * Starts a new statistics window.
+ */
+void profile_reset(void)
+{
+	g_ulProfileEpoch++;
+}
+
+
+/*
+ * profile_set_telemetry
+ *
+ * Sets how often (msec) B2U_PROFILE is sent to the UI. 0 disables it.
+ */
+void profile_set_telemetry(uint32_t ulInterval)
+{
+	s_ulTelemetryInterval = ulInterval;
+	s_ulLastTelemetryTick = hal_tickcount();
+}
+
+
+/*
+ * profile_loop
+ *
+ * Called by the main loop. Sends B2U_PROFILE and starts a new window every
+ * telemetry interval.
+ */
+void profile_loop(void)
+{
+	if(!s_ulTelemetryInterval)
+		return;
+
+	uint32_t ulTick = hal_tickcount();
+
+	if(ulTick - s_ulLastTelemetryTick < s_ulTelemetryInterval)
+		return;
+
+	s_ulLastTelemetryTick = ulTick;
+
+	packet_profile_send();
+	profile_reset();
+}
+
+
+/*
+ * profile_debug
+ *
+ * Prints the current window of statistics and the headroom left in the
+ * sample period.
+ */
+void profile_debug(void)
+{
+	ProfileSummary_t tick, chain;
+	profile_summarise(&g_ProfileTick, &tick);
+	profile_summarise(&g_ProfileChain, &chain);
+
+	dbg_printf(" === profile_debug ===\r\n");
+	dbg_printf("period: %lu cycles/sample (%lu Hz core clock)\r\n", g_ulPeriodCycles, hal_core_clock());
+	dbg_printf("sample io: min=%u, avg=%u, max=%u cycles/sample\r\n", tick.nMin, tick.nAvg, tick.nMax);
+	dbg_printf("chain:     min=%u, avg=%u, max=%u cycles/sample\r\n", chain.nMin, chain.nAvg, chain.nMax);
+
+	uint32_t ulAvgLoad = (tick.nAvg + chain.nAvg) * 100UL / g_ulPeriodCycles;
+	uint32_t ulPeakLoad = (tick.nMax + chain.nMax) * 100UL / g_ulPeriodCycles;
+	dbg_printf("load: avg=%lu%%, peak=%lu%%, headroom=%ld%%\r\n", ulAvgLoad, ulPeakLoad, 100L - (int32_t)ulAvgLoad);
+
+	const ChainPlan_t *pPlan = g_AudioContext.pChainPlan;
+
+	if(!pPlan)
+		return;
+
+#if !PROFILE_CHAIN
+	dbg_printf("(per stage/branch profiling disabled, see PROFILE_CHAIN)\r\n");
+#endif
+
+	uint8_t iStageStat = 0;
+
+	for(uint8_t i = 0; i < pPlan->nOps; ++i)
+	{
+		const PlanOp_t *pOp = &pPlan->pOps[i];
+		ProfileSummary_t summary;
+
+		// First op of each stage
+		if(pOp->type == PLANOP_APPLY || pOp->type == PLANOP_MIX_BEGIN)
+		{
+			profile_summarise(&pPlan->pStageStats[iStageStat++], &summary);
+			dbg_printf("  - stage #%u: min=%u, avg=%u, max=%u\r\n", pOp->nStage, summary.nMin, summary.nAvg, summary.nMax);
+		}
+
+		profile_summarise(&pOp->stat, &summary);
+		dbg_printf("    - branch #%u (%s): min=%u, avg=%u, max=%u\r\n", pOp->nBranch, pOp->pFilter->pszName, summary.nMin, summary.nAvg, summary.nMax);
+	}
+
+	dbg_printf("\r\n");
+}
@@ -0,0 +1,105 @@
+/*
+ *	HAPR Project 2014
+ *	Group 6 - Tom Bryant (TB) & Saul Rennison (SR)
+ *
+ *	File created by:	SR
+ *	File modified by:	SR
+ *	File debugged by:	SR
+ *
+ * profile.c - Cycle accurate profiling
+ *
+ * Uses the DWT cycle counter to record min/avg/max cycles spent per sample in
+ * the sampling interrupt, the filter chain, and each stage and branch of the
+ * compiled chain (see PlanOp_t::stat).
+ *
+ * Statistics are windowed: profile_reset starts a new window by bumping
+ * g_ulProfileEpoch, and each statistic restarts the next time it is updated.
+ * This lets the main loop reset them without locking out the sampling path.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "config.h"
+
+
+// Current value of the cycle counter
+#define PROFILE_CYCLES() hal_cycles()
+
+
+/*
+ * ProfileStat_t
+ *
+ * Running cycle statistic, updated from the sampling path.
+ */
+typedef struct
+{
+	uint32_t ulMin;		///< fewest cycles recorded
+	uint32_t ulMax;		///< most cycles recorded
+	uint64_t ullTotal;	///< sum of cycles recorded
+	uint32_t nCount;	///< number of recordings
+	uint32_t ulEpoch;	///< g_ulProfileEpoch when the window started
+} ProfileStat_t;
+
+
+/*
+ * ProfileSummary_t
+ *
+ * Snapshot of a ProfileStat_t, in cycles per sample. Saturates at UINT16_MAX.
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+	uint16_t nMin;
+	uint16_t nAvg;
+	uint16_t nMax;
+} ProfileSummary_t;
+#pragma pack(pop)
+
+
+extern volatile uint32_t g_ulProfileEpoch;
+extern volatile uint32_t g_ulTickCycles;
+extern uint32_t g_ulPeriodCycles;
+extern ProfileStat_t g_ProfileTick;
+extern ProfileStat_t g_ProfileChain;
+
+
+/*
+ * profile_stat_add
+ *
+ * Records `ulCycles` against `pStat`, starting a new window if profile_reset
+ * has been called since it was last updated.
+ */
+static inline void profile_stat_add(ProfileStat_t *pStat, uint32_t ulCycles)
+{
+	if(pStat->ulEpoch != g_ulProfileEpoch)
+	{
+		pStat->ulEpoch = g_ulProfileEpoch;
+		pStat->ulMin = ulCycles;
+		pStat->ulMax = ulCycles;
+		pStat->ullTotal = 0;
+		pStat->nCount = 0;
+	}
+
+	if(ulCycles < pStat->ulMin)
+		pStat->ulMin = ulCycles;
+
+	if(ulCycles > pStat->ulMax)
+		pStat->ulMax = ulCycles;
+
+	pStat->ullTotal += ulCycles;
+	pStat->nCount++;
+}
+
+
+void profile_init(void);
+void profile_summarise(const ProfileStat_t *pStat, ProfileSummary_t *pSummary);
+void profile_reset(void);
+void profile_set_telemetry(uint32_t ulInterval);
+void profile_loop(void);
+void profile_debug(void);
+
+#endif
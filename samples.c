@@ -10,203 +10,208 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <math.h>
 
 #include "config.h"
 #include "dbg.h"
+#include "fixed.h"
+#include "profile.h"
 #include "samples.h"
-#include "filters/vibrato.h"
-
-
-SamplePair_t g_pSampleBuffer[BUFFER_SAMPLES / 2];
-volatile uint16_t g_iSampleCursor = 0;
-volatile uint16_t g_iWaveCursor = 0;
-volatile float g_flVibratoSampleCursor = 0;
-static SampleAverage_t s_SampleAverage;
 
 
 /*
- *	Returns the sample in the sample buffer at the requested index
- *	If 'bAffectedByVibrato' is true, 'g_bVibratoActive' is checked
- *	and if true, 'sample_get_interpolated' is called instead.
+ *	Returns the RMS amplitude of the previous 'nSamples'
+ *	input samples in 'pHistory' (including the current one).
+ *	Only used by the `average` command, so it is summed from
+ *	the history when asked for rather than kept up to date
+ *	by the sampling path.
  *
  *	inputs:
- *		index				the index of the sample to be obtained
- *							[0-'MAX_BUFFER_SIZE']
- *		bAffectedByVibrato	bool, whether to take vibrato into account
+ *		pHistory	sample history to average
+ *		nSamples	number of samples to take an average over
+ *					[1 - SAMPLE_AVERAGE_MAX]
  *
  *	output:
- *		signed 12 bit sample
+ *		unsigned value [0-2047]
  */
-static int32_t sample_get_raw(int16_t index, bool bAffectedByVibrato)
+uint16_t sample_get_average(const SampleHistory_t *pHistory, uint16_t nSamples)
 {
-	// let sample_get_interpolated deal with vibrato being active
-	if(g_bVibratoActive && bAffectedByVibrato)
-		return sample_get_interpolated(index);
+	dbg_assert(nSamples > 0 && nSamples <= SAMPLE_AVERAGE_MAX, "invalid average length");
 
-	// Unpack a or b from the sample buffer, depending on index
-	if(index & 1)
-		return g_pSampleBuffer[(index-1)/2].b;
+	const uint16_t iCursor = pHistory->iCursor;
+
+	// 2048^2 * SAMPLE_AVERAGE_MAX still fits
+	uint32_t sum = 0;
+	for(uint16_t i = 0; i < nSamples; ++i)
+	{
+		const int32_t iSample = sample_read(pHistory, iCursor - i);
+		sum += iSample * iSample;
+	}
 
-	return g_pSampleBuffer[index/2].a;
+	return isqrt(sum / nSamples);
 }
 
 
+// Taps read per run of each sample_benchmark variant (as many as the longest
+// FIR), and runs per variant. Only the fastest run counts, so runs interrupted
+// by the sampling path are ignored.
+#define BENCH_TAPS		50
+#define BENCH_RUNS		32
+
+// The legacy layout held 10000 packed samples, more than fit in the packed
+// layout, so it is benchmarked over a length that does (8000 of 8192 when
+// the history was that long). Division takes the same time for any length.
+#define BENCH_LEGACY_SAMPLES	(BUFFER_SAMPLES * 125 / 128)
+#define BENCH_LEGACY_BYTES		(10000 / 2 * sizeof(SamplePair_t))
+#define BENCH_PACKED_BYTES		(BUFFER_SAMPLES / 2 * sizeof(SamplePair_t))
+#define BENCH_UNPACKED_BYTES	(BUFFER_SAMPLES * sizeof(int16_t))
+
+// Masks which keep each variant inside the history buffer, whichever layout it has
+#define BENCH_PACKED_MASK		BUFFER_MASK
+#if SAMPLE_HISTORY_PACKED
+#	define BENCH_UNPACKED_MASK	(BUFFER_MASK >> 1)
+#else
+#	define BENCH_UNPACKED_MASK	BUFFER_MASK
+#endif
+
+static const void *s_pBenchBuffer;	///< history buffer being read
+static uint16_t s_iBenchCursor;
+
+// Stands in for the vibrato flag sample_get used to test on every read, which
+// the legacy and mask variants are timed with
+static volatile bool s_bBenchVibrato = false;
+static volatile int32_t s_iBenchSink;	///< keeps the compiler from dropping the reads
+
+
 /*
- *	Returns a sample from the sample buffer.
- *	If 'index' is positive, return the sample at
- *	that position in the sample buffer array.
- *	If 'index' is negative, return the sample which
- *	is that many in the "past" from the current position.
- *
- *	inputs:
- *		index	the index of the sample to be obtained
- * 				[-9999 - 9999]
+ * bench_legacy_get
  *
- *	output:
- *		signed 12 bit sample
+ * The sample_get this replaced: recursion for negative indices, % by the
+ * buffer length and packed pairs.
  */
-int16_t sample_get(int16_t index)
+static int16_t __attribute__((noinline)) bench_legacy_get(int16_t index)
 {
-	// return sample from past
+	const SamplePair_t *pBuffer = (const SamplePair_t *) s_pBenchBuffer;
+
 	if(index < 0)
 	{
-		dbg_assert(index > -BUFFER_SAMPLES, "invalid sample index");
-		// recall function with the corresponding positive integer
-		return sample_get((BUFFER_SAMPLES + g_iSampleCursor + index) % BUFFER_SAMPLES);
+		dbg_assert(index > -BENCH_LEGACY_SAMPLES, "invalid sample index");
+		return bench_legacy_get((BENCH_LEGACY_SAMPLES + s_iBenchCursor + index) % BENCH_LEGACY_SAMPLES);
 	}
 
-	dbg_assert(index < BUFFER_SAMPLES, "invalid sample index");
+	dbg_assert(index < BENCH_LEGACY_SAMPLES, "invalid sample index");
+
+	if(s_bBenchVibrato)
+		return 0;
 
-	// use sample_get_raw to take vibrato into account
-	return sample_get_raw(index, true);
+	if(index & 1)
+		return pBuffer[(index-1)/2].b;
+
+	return pBuffer[index/2].a;
 }
 
 
-/*
- *	Sets a sample in the sample buffer.
- *	If 'index' is positive, set the sample at
- *	that position in the sample buffer array.
- *	If 'index' is negative, set the sample which
- *	is that many in the "past" from the current position.
- *
- *	inputs:
- *		index	the index of the sample to be obtained
- *				[-9999 - 9999]
- *		value	signed 12 bit sample to be placed into
- *				the buffer
- *
- */
-void sample_set(int16_t index, int16_t value)
+// Cycles for BENCH_TAPS reads with the legacy sample_get
+static uint32_t __attribute__((noinline)) bench_legacy(void)
 {
-	// set sample from past
-	if(index < 0)
-	{
-		dbg_assert(index > -BUFFER_SAMPLES, "invalid sample index");
-		sample_set((BUFFER_SAMPLES + g_iSampleCursor + index) % BUFFER_SAMPLES, value);
-		return;
-	}
+	int32_t sum = 0;
+	const uint32_t ulStartCycles = PROFILE_CYCLES();
 
-	dbg_assert(index < BUFFER_SAMPLES, "invalid sample index");
+	for(int16_t i = 1; i <= BENCH_TAPS; ++i)
+		sum += bench_legacy_get(-i);
 
-	if(index & 1)
-		g_pSampleBuffer[(index-1)/2].b = value;
-	else
-		g_pSampleBuffer[index/2].a = value;
+	const uint32_t ulCycles = PROFILE_CYCLES() - ulStartCycles;
+	s_iBenchSink = sum;
+	return ulCycles;
 }
 
 
-/*
- *	Returns an interpolated sample from the sample buffer.
- *	If 'index' is positive, return the sample at
- *	that position in the sample buffer array.
- *	If 'index' is negative, return the sample which
- *	is that many in the "past" from the current position.
- *	The interpolated sample is calculated by taking the
- *	integer samples before and after the float indexed
- *	sample, and linearly interpolating between them.
- *
- *	inputs:
- *		index	the index of the sample to be obtained
- * 				(float)[-10000 - 10000]
- *
- *	output:
- *		signed 12 bit sample
- */
-int16_t sample_get_interpolated(float index)
+// Cycles for BENCH_TAPS reads from packed pairs, wrapped with a mask
+static uint32_t __attribute__((noinline)) bench_packed(void)
 {
-	// If vibrato active, use vibrato pointer as base
-	if(g_bVibratoActive)
+	const SamplePair_t *pBuffer = (const SamplePair_t *) s_pBenchBuffer;
+	int32_t sum = 0;
+	const uint32_t ulStartCycles = PROFILE_CYCLES();
+
+	for(int16_t i = 1; i <= BENCH_TAPS; ++i)
 	{
-		if(index < 0)
-			index = (g_flVibratoSampleCursor + index);
-		else
-			index = index + (g_flVibratoSampleCursor - g_iSampleCursor);
-			// index = (g_iSampleCursor - g_flVibratoSampleCursor) + index;
-		index += BUFFER_SAMPLES;
-		while(index > BUFFER_SAMPLES)
-			index -= BUFFER_SAMPLES;
+		if(s_bBenchVibrato)
+			continue;
+
+		const uint16_t index = (s_iBenchCursor - i) & BENCH_PACKED_MASK;
+		const SamplePair_t *pPair = &pBuffer[index >> 1];
+		sum += (index & 1) ? pPair->b : pPair->a;
 	}
 
-	// Get previous and next sample
-	int16_t i;
-	if(index < 0)
-		i = (int)(index - 1);
-	else
-		i = (int) index;
+	const uint32_t ulCycles = PROFILE_CYCLES() - ulStartCycles;
+	s_iBenchSink = sum;
+	return ulCycles;
+}
+
 
-	int16_t si = sample_get_raw(i, false);
-	int16_t sj = sample_get_raw(i+1, false);
+// Cycles for BENCH_TAPS reads from int16_t samples, wrapped with a mask
+static uint32_t __attribute__((noinline)) bench_unpacked(void)
+{
+	const int16_t *pBuffer = (const int16_t *) s_pBenchBuffer;
+	int32_t sum = 0;
+	const uint32_t ulStartCycles = PROFILE_CYCLES();
+
+	for(int16_t i = 1; i <= BENCH_TAPS; ++i)
+	{
+		if(s_bBenchVibrato)
+			continue;
 
-	// Interpolate
-	return (int16_t) (si + ((index - i) * (sj - si)));
+		sum += pBuffer[(s_iBenchCursor - i) & BENCH_UNPACKED_MASK];
+	}
+
+	const uint32_t ulCycles = PROFILE_CYCLES() - ulStartCycles;
+	s_iBenchSink = sum;
+	return ulCycles;
 }
 
 
 /*
- *	Returns the average peak amplitude of the previous 'nSamples'
- *	samples.
- *	As averaging lots of samples takes time, the first average
- *	collected is stored to allow multiple effects to use the
- *	same calculation, if their 'nSamples' is the same.
- *
- *	inputs:
- *		nSamples	number of samples to take an average over
+ * bench_run
  *
- *	output:
- *		unsigned value [0-2047]
+ * @returns the fewest cycles taken by BENCH_RUNS runs of `pfnBench`
  */
-uint16_t sample_get_average(uint16_t nSamples)
+static uint32_t bench_run(const SampleHistory_t *pHistory, uint32_t (*pfnBench)(void))
 {
-	// Returns the average of the most recent 'nSamples' samples.
-	// Result is the average distance from baseline to peak (result <= ADC_MAX_VALUE / 2).
-	dbg_assert(nSamples <= BUFFER_SAMPLES, "requested average larger than buffer size");
+	s_pBenchBuffer = pHistory->pBuffer;
 
-	// Enable reuse of calculations by storing the first average calculated each sample
-	// and returning it if the parameters match.
-	if(s_SampleAverage.nSamples == nSamples)
-		return s_SampleAverage.average;
+	uint32_t ulBest = UINT32_MAX;
 
-	int32_t sum = 0;
-	for(uint16_t i = 0; i < nSamples; ++i)
+	for(uint8_t i = 0; i < BENCH_RUNS; ++i)
 	{
-		int32_t intermediate = (i == 0) ? sample_get(g_iSampleCursor) : sample_get(-i);
-		sum += intermediate * intermediate;
-	}
+		s_iBenchCursor = pHistory->iCursor % BENCH_LEGACY_SAMPLES;
 
-	// Set the sample average
-	sum = ((int)sqrt(sum / nSamples));
-	if(s_SampleAverage.nSamples == 0)
-	{
-		s_SampleAverage.nSamples = nSamples;
-		s_SampleAverage.average = sum;
+		uint32_t ulCycles = pfnBench();
+		if(ulCycles < ulBest)
+			ulBest = ulCycles;
 	}
-	return sum;
+
+	return ulBest;
 }
 
 
-// Clear the sample average
-void sample_clear_average()
+/*
+ * sample_benchmark
+ *
+ * Times reading FIR-like runs of history samples with the legacy layout and
+ * both power-of-two layouts, and prints the cycles per read and the memory
+ * each layout needs. Reads whatever `pHistory` holds, so can run while the
+ * chain is.
+ */
+void sample_benchmark(const SampleHistory_t *pHistory)
 {
-	s_SampleAverage.nSamples = 0;
+	const uint32_t ulLegacy = bench_run(pHistory, bench_legacy);
+	const uint32_t ulPacked = bench_run(pHistory, bench_packed);
+	const uint32_t ulUnpacked = bench_run(pHistory, bench_unpacked);
+
+	dbg_printf(" === sample_benchmark ===\r\n");
+	dbg_printf("history: %u samples, %s (%u bytes)\r\n", BUFFER_SAMPLES, SAMPLE_HISTORY_PACKED ? "packed" : "unpacked", (unsigned) SAMPLE_HISTORY_BYTES);
+	dbg_printf("cycles per read, best of %u runs of %u reads:\r\n", BENCH_RUNS, BENCH_TAPS);
+	dbg_printf("  - legacy (10000 packed, %% + recursion): %lu.%02lu cycles, %u bytes\r\n", ulLegacy / BENCH_TAPS, ulLegacy * 100 / BENCH_TAPS % 100, (unsigned) BENCH_LEGACY_BYTES);
+	dbg_printf("  - packed (mask): %lu.%02lu cycles, %u bytes\r\n", ulPacked / BENCH_TAPS, ulPacked * 100 / BENCH_TAPS % 100, (unsigned) BENCH_PACKED_BYTES);
+	dbg_printf("  - unpacked (mask): %lu.%02lu cycles, %u bytes\r\n", ulUnpacked / BENCH_TAPS, ulUnpacked * 100 / BENCH_TAPS % 100, (unsigned) BENCH_UNPACKED_BYTES);
+	dbg_printf("\r\n");
 }
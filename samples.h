@@ -12,11 +12,11 @@
 #define _SAMPLES_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
-
-extern volatile uint16_t g_iSampleCursor;
-extern volatile uint16_t g_iWaveCursor;
-extern volatile float g_flVibratoSampleCursor;
+#include "config.h"
+#include "dbg.h"
+#include "fixed.h"
 
 
 /*
@@ -40,17 +40,122 @@ typedef struct
 #pragma GCC diagnostic pop
 
 
+// Longest window sample_get_average can average over. The chain can be up to
+// a block behind the latest input sample, which may have overwritten the
+// oldest.
+#define SAMPLE_AVERAGE_MAX		(BUFFER_SAMPLES - BLOCK_SAMPLES)
+
+
+/*
+ * SampleHistory_t
+ *
+ * Input samples of an audio context (see context.h), BUFFER_SAMPLES long. Use
+ * the accessors below rather than indexing pBuffer, so the storage layout can
+ * change with SAMPLE_HISTORY_PACKED.
+ */
 typedef struct
 {
-	uint16_t nSamples;
-	uint32_t average;
-} SampleAverage_t;
+#if SAMPLE_HISTORY_PACKED
+	SamplePair_t pBuffer[BUFFER_SAMPLES / 2];
+#else
+	int16_t pBuffer[BUFFER_SAMPLES];
+#endif
+	volatile uint16_t iCursor;	///< index of the sample being filtered, past samples are before it
+} SampleHistory_t;
+
+#define SAMPLE_HISTORY_BYTES	(sizeof(((SampleHistory_t *)0)->pBuffer))
+
+
+uint16_t sample_get_average(const SampleHistory_t *pHistory, uint16_t nSamples);
+void sample_benchmark(const SampleHistory_t *pHistory);
+
+
+/*
+ * sample_read
+ *
+ * Returns the sample at `index` in `pHistory`, ignoring vibrato. Any index is
+ * wrapped into the buffer.
+ */
+static inline int16_t sample_read(const SampleHistory_t *pHistory, uint16_t index)
+{
+	index &= BUFFER_MASK;
+
+#if SAMPLE_HISTORY_PACKED
+	const SamplePair_t *pPair = &pHistory->pBuffer[index >> 1];
+	return (index & 1) ? pPair->b : pPair->a;
+#else
+	return pHistory->pBuffer[index];
+#endif
+}
+
+
+/*
+ * sample_write
+ *
+ * Sets the sample at `index` in `pHistory`. Any index is wrapped into the
+ * buffer.
+ */
+static inline void sample_write(SampleHistory_t *pHistory, uint16_t index, int16_t value)
+{
+	index &= BUFFER_MASK;
+
+#if SAMPLE_HISTORY_PACKED
+	SamplePair_t *pPair = &pHistory->pBuffer[index >> 1];
+	if(index & 1)
+		pPair->b = value;
+	else
+		pPair->a = value;
+#else
+	pHistory->pBuffer[index] = value;
+#endif
+}
+
+
+/*
+ *	Returns a sample from the sample history.
+ *	If 'index' is positive, return the sample at
+ *	that position in the sample buffer array.
+ *	If 'index' is negative, return the sample which
+ *	is that many in the "past" from the current position.
+ *
+ *	inputs:
+ *		index	the index of the sample to be obtained
+ * 				[-(BUFFER_SAMPLES-1) - (BUFFER_SAMPLES-1)]
+ *
+ *	output:
+ *		signed 12 bit sample
+ */
+static inline int16_t sample_get(const SampleHistory_t *pHistory, int16_t index)
+{
+	dbg_assert(index > -BUFFER_SAMPLES && index < BUFFER_SAMPLES, "invalid sample index");
+
+	// sample from past
+	if(index < 0)
+		index += pHistory->iCursor;
+
+	return sample_read(pHistory, index);
+}
 
 
-int16_t sample_get(int16_t index);
-void sample_set(int16_t index, int16_t value);
-int16_t sample_get_interpolated(float index);
-uint16_t sample_get_average(uint16_t nSamples);
-void sample_clear_average(void);
+/*
+ *	Sets a sample in the sample history.
+ *	If 'index' is positive, set the sample at
+ *	that position in the sample buffer array.
+ *	If 'index' is negative, set the sample which
+ *	is that many in the "past" from the current position.
+ *
+ *	inputs:
+ *		index	the index of the sample to be set
+ *				[-(BUFFER_SAMPLES-1) - (BUFFER_SAMPLES-1)]
+ *		value	signed 12 bit sample to be placed into
+ *				the buffer
+ */
+static inline void sample_set(SampleHistory_t *pHistory, int16_t index, int16_t value)
+{
+	if(index < 0)
+		index += pHistory->iCursor;
+
+	sample_write(pHistory, index, value);
+}
 
 #endif
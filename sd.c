@@ -277,21 +277,102 @@ DWORD get_fattime(void)
 
 
 /*
- * fs_init
+ * sd_read_block
  *
- * Mount the FAT filesystem.
+ * Reads SD_BLOCK_SIZE bytes from block `ulBlock` of the card into `pBuf`.
+ *
+ * @returns false on error
  */
-void fs_init(void)
+bool sd_read_block(uint8_t *pBuf, uint32_t ulBlock)
 {
-	FRESULT res = f_mount(&g_fs, "", 1);
+	uint32_t addr = ulBlock;
+
+	// If we're byte addressing, multiply by blocksize
+	if(!(g_fSDStatus & SD_STATUS_BLOCKADDR))
+		addr *= SD_BLOCK_SIZE;
 
-	dbg_printf("Mounting file system... ");
+	// Send read block command
+	uint8_t r1;
+	sd_command(SDCMD_READ_SINGLE_BLOCK, addr, SD_RESP_R1, &r1, SD_TIMEOUT_INDEFINITE);
 
-	if(res)
+	if(r1 != 0)
 	{
-		dbg_printf(ANSI_COLOR_RED "failed (%d)\r\n" ANSI_COLOR_RESET, res);
-		return;
+		dbg_warning("READ_SINGLE_BLOCK failed (%x)\r\n", r1);
+		return false;
 	}
 
-	dbg_printf(ANSI_COLOR_GREEN "OK!\r\n" ANSI_COLOR_RESET);
+	// Wait for data packet
+	uint8_t token;
+	while((token = ssp_read()) == 0xFF);
+
+	// Check for error token
+	if(!(token & (1<<5)))
+	{
+		dbg_warning("READ_SINGLE_BLOCK returned error token (%x)\r\n", token);
+		return false;
+	}
+
+	// Read data block
+	for(int i = 0; i < SD_BLOCK_SIZE; ++i)
+		pBuf[i] = ssp_read();
+
+	// Read CRC
+	ssp_read();
+	ssp_read();
+
+	return true;
+}
+
+
+/*
+ * sd_write_block
+ *
+ * Writes SD_BLOCK_SIZE bytes from `pBuf` to block `ulBlock` of the card.
+ *
+ * @returns false on error
+ */
+bool sd_write_block(const uint8_t *pBuf, uint32_t ulBlock)
+{
+	uint32_t addr = ulBlock;
+
+	// If we're byte addressing, multiply by blocksize
+	if(!(g_fSDStatus & SD_STATUS_BLOCKADDR))
+		addr *= SD_BLOCK_SIZE;
+
+	// Send write block command
+	uint8_t r1;
+	sd_command(SDCMD_WRITE_BLOCK, addr, SD_RESP_R1, &r1, SD_TIMEOUT_INDEFINITE);
+
+	if(r1 != 0)
+	{
+		dbg_warning("WRITE_BLOCK failed (%x)\r\n", r1);
+		return false;
+	}
+
+	// Write a byte before the data packet
+	ssp_read();
+
+	// Write data packet token for CMD24
+	ssp_readwrite(~0x1);
+
+	for(uint16_t i = 0; i < SD_BLOCK_SIZE; ++i)
+		ssp_readwrite(pBuf[i]);
+
+	// Write empty CRC
+	ssp_readwrite(0x0);
+	ssp_readwrite(0x0);
+
+	// Read data response
+	uint8_t iDataResponse = ssp_read() & 0x1F;
+
+	if(iDataResponse != 0x5)
+	{
+		dbg_warning("unexpected data response (%x)", iDataResponse);
+		return false;
+	}
+
+	// Wait until card not busy
+	while(ssp_read() != 0xFF);
+
+	return true;
 }
@@ -100,6 +100,8 @@ typedef SDR3Response_t SDR7Response_t; // same format
 // Function declarations
 // ----------------------------------------------------------------------------
 void sd_init(void);
+bool sd_read_block(uint8_t *pBuf, uint32_t ulBlock);
+bool sd_write_block(const uint8_t *pBuf, uint32_t ulBlock);
 void sd_cs(bool high);
 void sd_send_command(uint8_t index, uint32_t argument);
 bool sd_command(uint8_t index, uint32_t argument, SDResponseType_e respType, void *pRespData, uint32_t ulTimeoutMsec);
@@ -8,11 +8,14 @@
  *	File debugged by:	SR
  *
  * sdio.c - Interface between FatFS and the SD card.
+ *
+ * The card is reached through the HAL (see hal.h), so FatFS runs on a disk
+ * image on the host.
  */
 
 #include "dbg.h"
+#include "hal.h"
 #include "sd.h"
-#include "ssp.h"
 #include "fatfs/ff.h"
 #include "fatfs/diskio.h"
 
@@ -25,8 +28,8 @@ DSTATUS disk_initialize(BYTE pdrv)
 {
 	dbg_assert(pdrv == 0, "invalid drive number");
 
-	if(!(g_fSDStatus & SD_STATUS_READY))
-		sd_init();
+	if(!hal_sd_ready())
+		hal_sd_init();
 
 	return disk_status(pdrv);
 }
@@ -38,7 +41,7 @@ DSTATUS disk_status(BYTE pdrv)
 	DSTATUS status = 0;
 
 	// If the SD card is not ready define STA_NOINIT
-	if(!(g_fSDStatus & SD_STATUS_READY))
+	if(!hal_sd_ready())
 		status |= STA_NOINIT;
 
 	return status;
@@ -50,42 +53,7 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
 	dbg_assert(pdrv == 0, "invalid drive number");
 	dbg_assert(count == 1, "multiple block read not supported");
 
-	uint32_t addr = sector;
-
-	// If we're byte addressing, multiply by blocksize
-	if(!(g_fSDStatus & SD_STATUS_BLOCKADDR))
-		addr *= SD_BLOCK_SIZE;
-
-	// Send read block command
-	uint8_t r1;
-	sd_command(SDCMD_READ_SINGLE_BLOCK, addr, SD_RESP_R1, &r1, SD_TIMEOUT_INDEFINITE);
-
-	if(r1 != 0)
-	{
-		dbg_warning("READ_SINGLE_BLOCK failed (%x)\r\n", r1);
-		return RES_ERROR;
-	}
-
-	// Wait for data packet
-	uint8_t token;
-	while((token = ssp_read()) == 0xFF);
-
-	// Check for error token
-	if(!(token & (1<<5)))
-	{
-		dbg_warning("READ_SINGLE_BLOCK returned error token (%x)\r\n", token);
-		return RES_ERROR;
-	}
-
-	// Read data block
-	for(int i = 0; i < SD_BLOCK_SIZE; ++i)
-		buff[i] = ssp_read();
-
-	// Read CRC
-	ssp_read();
-	ssp_read();
-
-	return RES_OK;
+	return hal_sd_read(buff, sector) ? RES_OK : RES_ERROR;
 }
 
 
@@ -94,48 +62,7 @@ DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
 	dbg_assert(pdrv == 0, "invalid drive number");
 	dbg_assert(count == 1, "multiple block write not supported");
 
-	uint32_t addr = sector;
-
-	// If we're byte addressing, multiply by blocksize
-	if(!(g_fSDStatus & SD_STATUS_BLOCKADDR))
-		addr *= SD_BLOCK_SIZE;
-
-	// Send write block command
-	uint8_t r1;
-	sd_command(SDCMD_WRITE_BLOCK, addr, SD_RESP_R1, &r1, SD_TIMEOUT_INDEFINITE);
-
-	if(r1 != 0)
-	{
-		dbg_warning("WRITE_BLOCK failed (%x)\r\n", r1);
-		return RES_ERROR;
-	}
-
-	// Write a byte before the data packet
-	ssp_read();
-
-	// Write data packet token for CMD24
-	ssp_readwrite(~0x1);
-
-	for(uint16_t i = 0; i < SD_BLOCK_SIZE; ++i)
-		ssp_readwrite(buff[i]);
-
-	// Write empty CRC
-	ssp_readwrite(0x0);
-	ssp_readwrite(0x0);
-
-	// Read data response
-	uint8_t iDataResponse = ssp_read() & 0x1F;
-
-	if(iDataResponse != 0x5)
-	{
-		dbg_warning("unexpected data response (%x)", iDataResponse);
-		return RES_ERROR;
-	}
-
-	// Wait until card not busy
-	while(ssp_read() != 0xFF);
-
-	return RES_OK;
+	return hal_sd_write(buff, sector) ? RES_OK : RES_ERROR;
 }
 
 
@@ -165,3 +92,24 @@ DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
 	dbg_warning("unknown command (%d)\r\n", cmd);
 	return RES_PARERR;
 }
+
+
+/*
+ * fs_init
+ *
+ * Mount the FAT filesystem.
+ */
+void fs_init(void)
+{
+	FRESULT res = f_mount(&g_fs, "", 1);
+
+	dbg_printf("Mounting file system... ");
+
+	if(res)
+	{
+		dbg_printf(ANSI_COLOR_RED "failed (%d)\r\n" ANSI_COLOR_RESET, res);
+		return;
+	}
+
+	dbg_printf(ANSI_COLOR_GREEN "OK!\r\n" ANSI_COLOR_RESET);
+}
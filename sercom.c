@@ -16,12 +16,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-pedantic"
-#	include "lpc17xx_uart.h"
-#	include "lpc17xx_pinsel.h"
-#pragma GCC diagnostic pop
-
+#include "hal.h"
 #include "sercom.h"
 #include "dbg.h"
 
@@ -54,7 +49,7 @@ static void startup_probe_wait(void)
 
 		if(hdr.type == U2B_RESET)
 		{
-			NVIC_SystemReset();
+			hal_reset();
 			return;
 		}
 	}
@@ -64,54 +59,11 @@ static void startup_probe_wait(void)
 /*
  * sercom_init
  *
- * Initialises the USB pins and UART config.
+ * Initialises the UART (see hal_uart_init) and waits for the UI.
  */
 void sercom_init(void)
 {
-	UART_CFG_Type UARTConfigStruct;
-	UART_FIFO_CFG_Type UARTFIFOConfigStruct;
-	PINSEL_CFG_Type PinCfg;
-
-	/*
-	 * Initialize UART pin connect
-	 */
-	PinCfg.Funcnum = 1;
-	PinCfg.OpenDrain = 0;
-	PinCfg.Pinmode = 0;
-
-	// USB serial first
-	PinCfg.Portnum = 0;
-	PinCfg.Pinnum = 2;
-	PINSEL_ConfigPin(&PinCfg);
-
-	PinCfg.Pinnum = 3;
-	PINSEL_ConfigPin(&PinCfg);
-
-	/* Initialize UART Configuration parameter structure to default state:
-	 * - baud rate = 9600bps
-	 * - 8 data bit
-	 * - 1 stop bit
-	 * - None parity
-	 */
-	UART_ConfigStructInit(&UARTConfigStruct);
-
-	/* Initialize FIFOConfigStruct to default state:
-	 * - FIFO_DMAMode = DISABLE
-	 * - FIFO_Level = UART_FIFO_TRGLEV0
-	 * - FIFO_ResetRxBuf = ENABLE
-	 * - FIFO_ResetTxBuf = ENABLE
-	 * - FIFO_State = ENABLE
-	 */
-	UART_FIFOConfigStructInit(&UARTFIFOConfigStruct);
-
-	// Initialize UART0 peripheral with given to corresponding parameter
-	UART_Init((LPC_UART_TypeDef *)LPC_UART0, &UARTConfigStruct);
-
-	// Initialize FIFO for UART0 peripheral
-	UART_FIFOConfig((LPC_UART_TypeDef *)LPC_UART0, &UARTFIFOConfigStruct);
-
-	// Enable UART Transmit
-	UART_TxCmd((LPC_UART_TypeDef *)LPC_UART0, ENABLE);
+	hal_uart_init();
 
 	// Send a probe packet. If a machine is connected, it will send a probe back
 	packet_probe_send();
@@ -144,7 +96,7 @@ void sercom_send(PacketType_e packet_type, const uint8_t *pBuf, uint16_t size)
 	while(g_bUARTLock);
 	g_bUARTLock = true;
 
-	UART_Send((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)&hdr, sizeof(hdr), BLOCKING);
+	hal_uart_send(&hdr, sizeof(hdr));
 
 	if(!size)
 	{
@@ -155,7 +107,7 @@ void sercom_send(PacketType_e packet_type, const uint8_t *pBuf, uint16_t size)
 	dbg_assert(pBuf, "packet size > 0 but no payload supplied");
 
 	// Send packet data
-	UART_Send((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)pBuf, size, BLOCKING);
+	hal_uart_send(pBuf, size);
 
 	// Release UART lock
 	g_bUARTLock = false;
@@ -181,7 +133,7 @@ PacketHeader_t *sercom_receive_nonblock(uint8_t **ppPayload)
 		while(g_bUARTLock);
 
 		g_bUARTLock = true;
-		nHeaderReceived += UART_Receive((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)&pHdr[nHeaderReceived], sizeof(hdr) - nHeaderReceived, NONE_BLOCKING);
+		nHeaderReceived += hal_uart_receive(&pHdr[nHeaderReceived], sizeof(hdr) - nHeaderReceived, false);
 		g_bUARTLock = false;
 
 		if(nHeaderReceived != sizeof(hdr))
@@ -219,7 +171,7 @@ PacketHeader_t *sercom_receive_nonblock(uint8_t **ppPayload)
 		dbg_assert(*ppPayload, "unable to allocate enough space for packet");
 
 		// Read the payload from the serial
-		uint32_t nBytes = UART_Receive((LPC_UART_TypeDef *)LPC_UART0, *ppPayload, hdr.size, BLOCKING);
+		uint32_t nBytes = hal_uart_receive(*ppPayload, hdr.size, true);
 
 		dbg_assert(nBytes == hdr.size, "failed to read payload (%lu of %u) from serial", nBytes, hdr.size);
 	}
@@ -239,7 +191,7 @@ bool sercom_receive(PacketHeader_t *pHdr, uint8_t **ppPayload)
 	dbg_assert(pHdr, "header must not be NULL");
 
 	// Read a packet header from serial
-	uint32_t nBytes = UART_Receive((LPC_UART_TypeDef *)LPC_UART0, (uint8_t *)pHdr, sizeof(*pHdr), BLOCKING);
+	uint32_t nBytes = hal_uart_receive(pHdr, sizeof(*pHdr), true);
 
 	if(nBytes != sizeof(*pHdr))
 	{
@@ -273,7 +225,7 @@ bool sercom_receive(PacketHeader_t *pHdr, uint8_t **ppPayload)
 		dbg_assert(*ppPayload, "unable to allocate enough space for packet");
 
 		// Read the payload
-		nBytes = UART_Receive((LPC_UART_TypeDef *)LPC_UART0, *ppPayload, pHdr->size, BLOCKING);
+		nBytes = hal_uart_receive(*ppPayload, pHdr->size, true);
 
 		dbg_assert(nBytes == pHdr->size, "failed to read payload (%lu of %u) from serial", nBytes, pHdr->size);
 	}
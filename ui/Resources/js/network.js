@@ -197,3 +197,105 @@ packetHandlers[PacketTypes.B2U_CHAIN_BLOB] = function(packet) {
 		appendStage();
 	});
 }
+
+
+// B2U_PROFILE
+// ============================================================================
+packetHandlers[PacketTypes.B2U_PROFILE] = function(packet) {
+	var load = (packet.tick.avg + packet.chain.avg) * 100 / packet.period;
+	var peak = (packet.tick.max + packet.chain.max) * 100 / packet.period;
+	var text = 'Load: ' + load.toFixed(1) + '% (peak ' + peak.toFixed(1) + '%)';
+
+	// Point out the most expensive branch, so we know what to cut
+	var branches = _.toArray(packet.branches);
+
+	if(branches.length && filters) {
+		var slowest = _.max(branches, function(branch) { return branch.avg; });
+		text += ', slowest: ' + filters[slowest.filter].name + ' (stage ' + slowest.stage + ', ' + slowest.avg + ' cycles/sample)';
+	}
+
+	$('#profile-status').text(text);
+};
+
+
+// B2U_ADMISSION
+// ============================================================================
+packetHandlers[PacketTypes.B2U_ADMISSION] = function(packet) {
+	var $filter = $('.stage-row:nth-child(' + (packet.stage + 1) + ') .filter').eq(packet.branch);
+	var refused = packet.result === AdmissionResults.REFUSED;
+
+	if(packet.edit_type === PacketTypes.U2B_FILTER_MOD || packet.edit_type === PacketTypes.U2B_FILTER_MIX)
+		settleFilterParameter($filter, !refused);
+
+	if(packet.result === AdmissionResults.OK) {
+		$('#chain-alert').hide();
+		return;
+	}
+
+	// Refused branches are left disabled on the board
+	if(refused && (packet.edit_type === PacketTypes.U2B_FILTER_CREATE || packet.edit_type === PacketTypes.U2B_FILTER_FLAG)) {
+		$filter.find('input[name="filter-enabled"]').prop('checked', false);
+		$filter.removeClass('panel-success').addClass('panel-danger');
+	}
+
+	var text = (refused ? 'Refused: ' : 'Warning: ') + 'stage ' + packet.stage + ', branch ' + packet.branch;
+	text += ' would need ' + packet.predicted + ' cycles/sample (budget ' + packet.budget + ')';
+
+	$('#chain-alert')
+		.toggleClass('alert-danger', refused)
+		.toggleClass('alert-warning', !refused)
+		.text(text)
+		.show();
+};
+
+
+// B2U_ERROR
+// ============================================================================
+packetHandlers[PacketTypes.B2U_ERROR] = function(packet) {
+	var $stage = $('.stage-row:nth-child(' + (packet.stage + 1) + ')');
+	var text = 'Error: ';
+
+	// The edit went through, but with different values to the ones we sent
+	if(packet.error === PacketErrors.PARAM_CLAMPED) {
+		syncFilterParameters($stage.find('.filter').eq(packet.branch), packet);
+
+		$('#chain-alert')
+			.removeClass('alert-danger')
+			.addClass('alert-warning')
+			.text('Warning: stage ' + packet.stage + ', branch ' + packet.branch + ' parameter out of range, set to the nearest allowed value')
+			.show();
+		return;
+	}
+
+	if(packet.error === PacketErrors.OUT_OF_MEMORY)
+		text += 'out of memory (' + packet.detail + ' pool is full)';
+	else if(packet.error === PacketErrors.RESTORE_FAILED)
+		text += 'unable to restore chain "' + packet.detail + '", the current chain is kept';
+	else if(packet.error === PacketErrors.RESTORE_CLEARED)
+		text += 'unable to restore chain "' + packet.detail + '", the chain has been cleared';
+	else
+		text += 'error ' + packet.error;
+
+	// The board is left with an empty chain
+	if(packet.error === PacketErrors.RESTORE_CLEARED) {
+		$('#filter-container').children().remove();
+		appendStage();
+	}
+
+	// Undo our side of the change
+	if(packet.failed_type === PacketTypes.U2B_FILTER_CREATE) {
+		$stage.find('.filter').last().remove();
+
+		// Remove the stage we added for the filter
+		if($stage.find('.filter').length === 0)
+			$stage.next('.stage-row').remove();
+	} else if(packet.failed_type === PacketTypes.U2B_FILTER_MOD || packet.failed_type === PacketTypes.U2B_FILTER_MIX) {
+		settleFilterParameter($stage.find('.filter').eq(packet.branch), false);
+	}
+
+	$('#chain-alert')
+		.removeClass('alert-warning')
+		.addClass('alert-danger')
+		.text(text)
+		.show();
+};
@@ -255,6 +255,13 @@ function updateFilterParameter($this) {
 	var newVal = $this.val();
 	var textVal = newVal;
 
+	// Remember what to go back to if the board refuses the change (see
+	// settleFilterParameter)
+	if($this.data('accepted-value') === undefined)
+		$this.data('accepted-value', $this.is('select') ? $this.children('[selected]').val() : $this.attr('value'));
+
+	$filter.data('pending-param', $this);
+
 	if(paramName === 'mix') {
 		textVal = parseFloat(textVal).toFixed(3);
 
@@ -279,6 +286,57 @@ function updateFilterParameter($this) {
 }
 
 
+// Called when the board has checked the last parameter change on a filter
+// against its cycle budget. Refused changes are put back.
+function settleFilterParameter($filter, accepted) {
+	var $this = $filter.data('pending-param');
+
+	if(!$this)
+		return;
+
+	$filter.removeData('pending-param');
+
+	if(accepted) {
+		$this.data('accepted-value', $this.val());
+		return;
+	}
+
+	var filter = filters[$filter.data('filter-index')];
+	var paramName = $this.parent().data('param-name');
+	var textVal = $this.data('accepted-value');
+
+	if(paramName === 'mix' || filter.params[paramName]['f'] == 'f')
+		textVal = parseFloat(textVal).toFixed(3);
+
+	$this.val($this.data('accepted-value'));
+	$this.siblings('label').children('.value').text(textVal);
+}
+
+
+
+// Moves the parameter widgets of `$filter` to the values the board kept after
+// clamping them (see PacketErrors.PARAM_CLAMPED)
+function syncFilterParameters($filter, packet) {
+	var filter = filters[$filter.data('filter-index')];
+
+	$filter.find('.form-group[data-param-name]').each(function() {
+		var param = filter.params[$(this).data('param-name')];
+
+		// Mix isn't part of the filter data
+		if(!param)
+			return;
+
+		var val = packet.param_value(param['o'], param['f']);
+		if(val === null || val === undefined)
+			return;
+
+		var textVal = param['f'] == 'f' ? parseFloat(val).toFixed(3) : val;
+
+		$(this).find('select, input[type="range"]').val(val).data('accepted-value', val);
+		$(this).children('label').children('.value').text(textVal);
+	});
+}
+
 /* Tom individual */
 // Called when a user changes any of the analog control checkboxes
 $(document).on('change', '.ac-checkbox', $.debounce(250, function() {
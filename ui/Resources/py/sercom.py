@@ -24,14 +24,14 @@ import unicodedata
 from ordereddict import OrderedDict
 
 
-__all__ = ['ProbePacket', 'ResetPacket', 'PrintPacket', 'FilterListPacket', 'FilterCreatePacket', 'FilterDeletePacket', 'FilterFlagPacket', 'FilterModPacket', 'FilterMixPacket', 'CommandPacket', 'AnalogControlPacket', 'StoredListPacket', 'ChainBlobPacket', 'SerialStream', 'PacketTypes', 'PACKET_MAP']
+__all__ = ['ProbePacket', 'ResetPacket', 'PrintPacket', 'FilterListPacket', 'FilterCreatePacket', 'FilterDeletePacket', 'FilterFlagPacket', 'FilterModPacket', 'FilterMixPacket', 'CommandPacket', 'AnalogControlPacket', 'StoredListPacket', 'ChainBlobPacket', 'ProfilePacket', 'AdmissionPacket', 'ErrorPacket', 'SerialStream', 'PacketTypes', 'AdmissionResults', 'PacketErrors', 'PACKET_MAP']
 
 # little-endian "MBED" encoded into a 32-bit integer
 PACKET_IDENT = ord('M') | ord('B') << 8 | ord('E') << 16 | ord('D') << 24
 
 # little-endian "CHST" encoded into a 32-bit integer
 CHAIN_STORE_IDENT = ord('C') | ord('H') << 8 | ord('S') << 16 | ord('T') << 24
-CHAIN_STORE_VERSION = 1
+CHAIN_STORE_VERSION = 3
 
 global_filters = []
 
@@ -102,6 +102,22 @@ class PacketTypes(object):
 	B2U_STORED_LIST = 11
 	B2U_CHAIN_BLOB = 12
 	# End Saul individual
+	B2U_PROFILE = 13
+	B2U_ADMISSION = 14
+	B2U_ERROR = 15
+
+
+class AdmissionResults(object):
+	OK = 0
+	WARNED = 1
+	REFUSED = 2
+
+
+class PacketErrors(object):
+	OUT_OF_MEMORY = 0
+	PARAM_CLAMPED = 1
+	RESTORE_FAILED = 2
+	RESTORE_CLEARED = 3
 
 
 class Packet(object):
@@ -292,6 +308,11 @@ class ChainBlobPacket(Packet):
 			print 'Invalid chain store ident!'
 			return
 
+		# Parameters of older chains are at offsets that have since changed
+		if version < CHAIN_STORE_VERSION:
+			print 'Chain store version %d is from older firmware (expected %d), recreate the chain!' % (version, CHAIN_STORE_VERSION)
+			return
+
 		if version != CHAIN_STORE_VERSION:
 			print 'Invalid chain store version!'
 			return
@@ -347,6 +368,75 @@ class ChainBlobPacket(Packet):
 # End Saul individual
 
 
+class ProfilePacket(Packet):
+	type_ = PacketTypes.B2U_PROFILE
+
+	def receive(self, data):
+		# All cycle counts are cycles per sample
+		SUMMARY_FORMAT = 'HHH'
+
+		def read_summary(values):
+			return {'min': values[0], 'avg': values[1], 'max': values[2]}
+
+		HEADER_FORMAT = '<H' + SUMMARY_FORMAT * 2 + 'BB'
+		header = struct.unpack_from(HEADER_FORMAT, data)
+		data = data[struct.calcsize(HEADER_FORMAT):]
+
+		self.period = header[0]
+		self.tick = read_summary(header[1:4])
+		self.chain = read_summary(header[4:7])
+		num_stages, num_branches = header[7:9]
+
+		self.stages = []
+		self.branches = []
+
+		STAGE_FORMAT = '<B' + SUMMARY_FORMAT
+		for i in range(num_stages):
+			values = struct.unpack_from(STAGE_FORMAT, data)
+			data = data[struct.calcsize(STAGE_FORMAT):]
+
+			stage = read_summary(values[1:])
+			stage['stage'] = values[0]
+			self.stages.append(stage)
+
+		BRANCH_FORMAT = '<BBB' + SUMMARY_FORMAT
+		for i in range(num_branches):
+			values = struct.unpack_from(BRANCH_FORMAT, data)
+			data = data[struct.calcsize(BRANCH_FORMAT):]
+
+			branch = read_summary(values[3:])
+			branch['stage'], branch['branch'], branch['filter'] = values[:3]
+			self.branches.append(branch)
+
+
+class AdmissionPacket(Packet):
+	type_ = PacketTypes.B2U_ADMISSION
+
+	def receive(self, data):
+		# Cycle counts are cycles per sample
+		self.edit_type, self.stage, self.branch, self.result, self.predicted, self.budget = struct.unpack_from('<BBBBHH', data)
+
+
+
+class ErrorPacket(Packet):
+	type_ = PacketTypes.B2U_ERROR
+
+	def receive(self, data):
+		HEADER_FORMAT = '<BBBB'
+		self.failed_type, self.error, self.stage, self.branch = struct.unpack_from(HEADER_FORMAT, data)
+		self.detail = data[struct.calcsize(HEADER_FORMAT):]
+
+	def param_value(self, offset, format):
+		"""Unpacks a parameter value from the public filter data sent with
+		PARAM_CLAMPED. Returns None if the parameter isn't in the detail.
+		"""
+		offset = int(offset)
+		if offset + struct.calcsize('<' + format) > len(self.detail):
+			return None
+
+		return struct.unpack_from('<' + format, self.detail, offset)[0]
+
+
 PACKET_MAP = [
 	ProbePacket, # B2U_PROBE
 	ResetPacket, # U2B_RESET
@@ -365,6 +455,9 @@ PACKET_MAP = [
 	StoredListPacket, # B2U_STORED_LIST
 	ChainBlobPacket, # B2U_CHAIN_BLOB
 	# End Saul individual
+	ProfilePacket, # B2U_PROFILE
+	AdmissionPacket, # B2U_ADMISSION
+	ErrorPacket, # B2U_ERROR
 ]
 
 